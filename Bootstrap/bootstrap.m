@@ -7,6 +7,11 @@
 #include "bootstrap.h"
 #include "NSUserDefaults+appDefaults.h"
 #include "AppList.h"
+#include "include/choma/AdhocSign.h"
+#include "include/choma/CoreTrustBypass.h"
+#include "include/choma/SignatureCache.h"
+
+#define SIGNATURE_CACHE_MAX_SIZE (256 * 1024 * 1024)
 
 extern int decompress_tar_zstd(const char* src_file_path, const char* dst_file_path);
 
@@ -27,6 +32,11 @@ void rebuildSignature(NSString *directoryPath)
     NSString* fastSignPath = [NSBundle.mainBundle.bundlePath stringByAppendingPathComponent:@"basebin/fastPathSign"];
     NSString* entitlementsPath = [NSBundle.mainBundle.bundlePath stringByAppendingPathComponent:@"basebin/nickchan.entitlements"];
     NSString* ldidEntitlements = [NSString stringWithFormat:@"-S%@", entitlementsPath];
+    NSData* entitlements = [NSData dataWithContentsOfFile:entitlementsPath];
+    ASSERT(entitlements != nil);
+    
+    NSMutableArray<NSString*>* machoPaths = [NSMutableArray new];
+    NSMutableArray<NSNumber*>* machoIsLib = [NSMutableArray new];
     
     for (NSURL *enumURL in directoryEnumerator) {
         @autoreleasepool {
@@ -41,17 +51,11 @@ void rebuildSignature(NSString *directoryPath)
                 machoGetInfo(fp, &ismacho, &islib);
                 
                 if(ismacho) {
-                    
-                    SYSLOG("rebuild %@", enumURL.path);
-                    
                     machoCount++;
+                    if(!islib) libCount++;
                     
-                    if(!islib) {
-                        libCount++;
-                        ASSERT(spawnRoot(ldidPath, @[@"-M", ldidEntitlements, enumURL.path], nil, nil) == 0);
-                    }
-                    
-                    ASSERT(spawnRoot(fastSignPath, @[enumURL.path], nil, nil) == 0);
+                    [machoPaths addObject:enumURL.path];
+                    [machoIsLib addObject:@(islib)];
                 }
                 
                 fclose(fp);
@@ -60,6 +64,66 @@ void rebuildSignature(NSString *directoryPath)
         }
     }
     
+    // Signed results are cached across installs, keyed by the unsigned file and everything else that goes into signing it
+    NSString* appVersion = [NSBundle.mainBundle objectForInfoDictionaryKey:@"CFBundleVersion"];
+    NSMutableData* cacheParameters = [NSMutableData dataWithData:entitlements];
+    [cacheParameters appendData:[appVersion dataUsingEncoding:NSUTF8StringEncoding]];
+    NSMutableData* libCacheParameters = [cacheParameters mutableCopy];
+    [libCacheParameters appendBytes:"lib" length:3];
+    
+    NSString* cachePath = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES).firstObject stringByAppendingPathComponent:@"SignatureCache"];
+    SignatureCache* signatureCache = signature_cache_open(cachePath.fileSystemRepresentation, SIGNATURE_CACHE_MAX_SIZE);
+    if(!signatureCache) SYSLOG("failed to open signature cache at %@", cachePath);
+    
+    // Sign and apply the CoreTrust bypass on all cores, ldid and fastPathSign are only spawned for files choma can't handle in-process (e.g. FAT binaries)
+    // Exceptions can't leave the dispatch_apply block, so failures are collected and asserted afterwards
+    __block int failedCount = 0;
+    dispatch_apply(machoPaths.count, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t i) {
+        @autoreleasepool {
+            NSString* path = machoPaths[i];
+            SYSLOG("rebuild %@", path);
+            
+            // Unsigned files get their identifier from the file name, so identical files at different paths must not share an entry
+            NSMutableData* parameters = [([machoIsLib[i] boolValue] ? libCacheParameters : cacheParameters) mutableCopy];
+            [parameters appendData:[path.lastPathComponent dataUsingEncoding:NSUTF8StringEncoding]];
+            uint8_t cacheKey[SIGNATURE_CACHE_KEY_SIZE];
+            bool cacheable = signatureCache && signature_cache_calculate_key(path.fileSystemRepresentation, parameters.bytes, parameters.length, cacheKey) == 0;
+            if(cacheable && signature_cache_apply(signatureCache, cacheKey, path.fileSystemRepresentation) == 0) {
+                return;
+            }
+            
+            bool failed = false;
+            if(![machoIsLib[i] boolValue]) {
+                if(adhoc_sign_file(path.fileSystemRepresentation, NULL, entitlements.bytes, entitlements.length, ADHOC_SIGN_FLAG_MERGE_ENTITLEMENTS) != 0) {
+                    SYSLOG("in-process signing failed, falling back to ldid: %@", path);
+                    failed = spawnRoot(ldidPath, @[@"-M", ldidEntitlements, path], nil, nil) != 0;
+                }
+            }
+            
+            if(!failed && coretrust_bypass_file(path.fileSystemRepresentation, NULL) != 0) {
+                SYSLOG("in-process CoreTrust bypass failed, falling back to fastPathSign: %@", path);
+                failed = spawnRoot(fastSignPath, @[path], nil, nil) != 0;
+            }
+            
+            if(failed) {
+                SYSLOG("rebuild failed: %@", path);
+                __sync_fetch_and_add(&failedCount, 1);
+            }
+            else if(cacheable) {
+                signature_cache_store(signatureCache, cacheKey, path.fileSystemRepresentation);
+            }
+        }
+    });
+    
+    if(signatureCache) {
+        SignatureCacheStats stats;
+        signature_cache_get_stats(signatureCache, &stats);
+        STRAPLOG("signature cache: hits=%llu, misses=%llu, evictions=%llu, entries=%u, size=%lluKB", stats.hits, stats.misses, stats.evictions, stats.entryCount, stats.totalSize / 1024);
+        signature_cache_close(signatureCache);
+    }
+    
+    ASSERT(failedCount == 0);
+    
     STRAPLOG("rebuild finished! machoCount=%d, libCount=%d", machoCount, libCount);
 
 }
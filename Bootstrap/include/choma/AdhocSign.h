@@ -0,0 +1,25 @@
+#ifndef ADHOC_SIGN_H
+#define ADHOC_SIGN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "MachO.h"
+
+enum {
+    // Merge the passed entitlements into the ones that are already embedded instead of replacing them (like ldid -M)
+    ADHOC_SIGN_FLAG_MERGE_ENTITLEMENTS = 1 << 0,
+};
+
+// Ad-hoc sign a MachO that was opened via macho_init_for_writing, this is an in-process replacement for ldid -S
+// A SHA-256 code directory is generated together with an empty requirements blob and the XML and DER entitlements
+// LC_CODE_SIGNATURE and __LINKEDIT are resized (LC_CODE_SIGNATURE is added if the binary has no signature yet)
+// identifier may be NULL to keep the identifier of the existing signature
+// entitlements is an XML property list, pass NULL to keep the existing entitlements
+int macho_adhoc_sign(MachO *macho, const char *identifier, const void *entitlements, size_t entitlementsSize, uint32_t flags);
+
+// Same as macho_adhoc_sign for a thin MachO at path, if identifier is NULL and the file is not signed yet the file name is used
+int adhoc_sign_file(const char *path, const char *identifier, const void *entitlements, size_t entitlementsSize, uint32_t flags);
+
+#endif // ADHOC_SIGN_H
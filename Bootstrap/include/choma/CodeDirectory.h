@@ -52,7 +52,42 @@ uint8_t csd_code_directory_get_hash_type(CS_DecodedBlob *codeDirBlob);
 void csd_code_directory_set_hash_type(CS_DecodedBlob *codeDirBlob, uint8_t hashType);
 unsigned csd_code_directory_calculate_rank(CS_DecodedBlob *codeDirBlob);
 int csd_code_directory_calculate_hash(CS_DecodedBlob *codeDirBlob, void *cdhashOut);
+void csd_code_directory_read_slot_hash(CS_DecodedBlob *codeDirBlob, MachO *macho, int slot, uint8_t *slotHashOut);
+bool csd_code_directory_calculate_page_hash(CS_DecodedBlob *codeDirBlob, MachO *macho, int slot, uint8_t *pageHashOut);
+
+// Hash pageCount pages of pageSize bytes starting at page firstPage, data ends at dataEnd so the final page can be shorter
+// Hashes are written back to back to hashesOut, pages are spread over all cores and hashed straight from the MachO's mapping if it has one
+int csd_code_directory_hash_pages(MachO *macho, uint8_t hashType, uint8_t hashSize, uint32_t pageSize, uint64_t dataEnd, uint32_t firstPage, uint32_t pageCount, uint8_t *hashesOut);
+// Same as csd_code_directory_hash_pages for several hash types at once, every page is only read once
+// The hashes of hashTypes[i] (hashSizes[i] bytes each) are written to hashesOut[i]
+int csd_code_directory_hash_pages_multi(MachO *macho, uint32_t hashTypeCount, const uint8_t *hashTypes, const uint8_t *hashSizes, uint32_t pageSize, uint64_t dataEnd, uint32_t firstPage, uint32_t pageCount, uint8_t **hashesOut);
+bool csd_code_directory_verify_code_slot(CS_DecodedBlob *codeDirBlob, MachO *macho, int slot);
+bool csd_code_directory_verify_code_slots(CS_DecodedBlob *codeDirBlob, MachO *macho, int slot);
+
+enum {
+    CS_CODE_SLOT_VALID = 0,
+    CS_CODE_SLOT_INVALID = 1,
+    CS_CODE_SLOT_UNREADABLE = 2,
+};
+
+typedef struct s_CS_CodeSlotVerification {
+    uint32_t slotCount;
+    uint32_t hashSize;
+    uint32_t invalidCount; // Slots that are invalid or unreadable
+    uint64_t bytesHashed;
+    uint8_t *statuses; // CS_CODE_SLOT_* for every code slot
+    uint8_t *computedHashes; // slotCount hashes of hashSize bytes, only meaningful for readable slots
+} CS_CodeSlotVerification;
+
+// Verify every code slot of a code directory, the header and code signature bounds are only parsed once and pages are hashed in parallel
+CS_CodeSlotVerification *csd_code_directory_verify_all_code_slots(CS_DecodedBlob *codeDirBlob, MachO *macho);
+void csd_code_slot_verification_free(CS_CodeSlotVerification *verification);
 int csd_code_directory_print_content(CS_DecodedBlob *codeDirBlob, MachO *macho, bool printSlots, bool verifySlots);
 void csd_code_directory_update(CS_DecodedBlob *codeDirBlob, MachO *macho);
+// Update several code directories (e.g. a SHA-1 and a SHA-256 one) from a single pass over the pages
+int csd_code_directory_update_multiple(CS_DecodedBlob **codeDirBlobs, uint32_t codeDirCount, MachO *macho);
+// Only rehash the pages that were written since dirty tracking was enabled on the MachO's stream, plus the final page before the code signature
+// Falls back to csd_code_directory_update if the stream isn't tracking, dirty ranges are kept so alternate code directories can be updated from them too
+int csd_code_directory_update_incremental(CS_DecodedBlob *codeDirBlob, MachO *macho);
 
 #endif // CODE_DIRECTORY_H
\ No newline at end of file
@@ -197,4 +197,34 @@
     LOAD_COMMAND_APPLY_BYTE_ORDER(rpcmd, applier); \
     applier(rpcmd, path.offset);
 
+#define DYLD_INFO_COMMAND_APPLY_BYTE_ORDER(dyldinfo, applier) \
+    LOAD_COMMAND_APPLY_BYTE_ORDER(dyldinfo, applier); \
+    applier(dyldinfo, rebase_off); \
+    applier(dyldinfo, rebase_size); \
+    applier(dyldinfo, bind_off); \
+    applier(dyldinfo, bind_size); \
+    applier(dyldinfo, weak_bind_off); \
+    applier(dyldinfo, weak_bind_size); \
+    applier(dyldinfo, lazy_bind_off); \
+    applier(dyldinfo, lazy_bind_size); \
+    applier(dyldinfo, export_off); \
+    applier(dyldinfo, export_size);
+
+#define DYLD_CHAINED_FIXUPS_HEADER_APPLY_BYTE_ORDER(fh, applier) \
+    applier(fh, fixups_version); \
+    applier(fh, starts_offset); \
+    applier(fh, imports_offset); \
+    applier(fh, symbols_offset); \
+    applier(fh, imports_count); \
+    applier(fh, imports_format); \
+    applier(fh, symbols_format);
+
+#define DYLD_CHAINED_STARTS_IN_SEGMENT_APPLY_BYTE_ORDER(sis, applier) \
+    applier(sis, size); \
+    applier(sis, page_size); \
+    applier(sis, pointer_format); \
+    applier(sis, segment_offset); \
+    applier(sis, max_valid_pointer); \
+    applier(sis, page_count);
+
 #endif // MACHO_BYTE_ORDER_H
\ No newline at end of file
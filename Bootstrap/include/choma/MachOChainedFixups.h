@@ -0,0 +1,61 @@
+#ifndef MACHO_CHAINED_FIXUPS_H
+#define MACHO_CHAINED_FIXUPS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "MachO.h"
+
+typedef struct MachOChainedImport {
+    int32_t libOrdinal; // Can be one of the negative BIND_SPECIAL_DYLIB_* values
+    bool weakImport;
+    int64_t addend;
+    const char *name; // Points into the fixups data
+} MachOChainedImport;
+
+typedef struct MachOChainedFixup {
+    uint64_t fileoff;
+    uint64_t vmaddr;
+    uint16_t pointerFormat; // DYLD_CHAINED_PTR_*
+    uint64_t rawValue;
+
+    bool isBind;
+    uint32_t importOrdinal; // Only for binds, index for macho_chained_fixups_get_import
+    int64_t addend; // Only for binds, added on top of the addend of the import
+    uint64_t targetVmaddr; // Only for rebases, includes the high8 bits for formats that have them
+
+    bool isAuth;
+    uint8_t key;
+    bool addressDiversity;
+    uint16_t diversity;
+} MachOChainedFixup;
+
+typedef struct MachOChainedFixups {
+    MachO *macho;
+
+    // The whole LC_DYLD_CHAINED_FIXUPS payload, NUL terminated so symbol names can't run off the end
+    uint8_t *data;
+    uint32_t dataSize;
+
+    uint32_t startsOffset;
+    uint32_t importsOffset;
+    uint32_t symbolsOffset;
+    uint32_t importsCount;
+    uint32_t importsFormat;
+
+    uint64_t imageBase; // vmaddr of the segment that maps the mach header
+} MachOChainedFixups;
+
+// Read the LC_DYLD_CHAINED_FIXUPS payload, the chains themselves are only read when enumerating
+// Returns NULL if the MachO has no chained fixups
+MachOChainedFixups *macho_chained_fixups_init(MachO *macho);
+
+int macho_chained_fixups_get_import(MachOChainedFixups *fixups, uint32_t importOrdinal, MachOChainedImport *importOut);
+
+// Walk the fixup chains of all segments, one page is read at a time
+// The 32-bit pointer formats are not supported
+int macho_chained_fixups_enumerate(MachOChainedFixups *fixups, void (^enumeratorBlock)(MachOChainedFixup *fixup, bool *stop));
+
+void macho_chained_fixups_free(MachOChainedFixups *fixups);
+
+#endif // MACHO_CHAINED_FIXUPS_H
@@ -0,0 +1,38 @@
+#ifndef MACHO_EXPORTS_TRIE_H
+#define MACHO_EXPORTS_TRIE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "MachO.h"
+
+typedef struct MachOExport {
+    uint64_t flags; // EXPORT_SYMBOL_FLAGS_*
+    uint64_t vmaddr; // 0 for re-exports
+    uint64_t resolverVmaddr; // Only set for EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER
+    uint64_t reexportOrdinal; // Only set for EXPORT_SYMBOL_FLAGS_REEXPORT
+    char *importName; // Only set for re-exports under a different name, freed by macho_export_free
+} MachOExport;
+
+typedef struct MachOExportsTrie {
+    MachO *macho;
+    uint64_t offset; // File offset of the trie inside the MachO
+    uint32_t size;
+    uint64_t imageBase; // vmaddr of the segment that maps the mach header
+} MachOExportsTrie;
+
+// Locate the exports trie through LC_DYLD_EXPORTS_TRIE or LC_DYLD_INFO(_ONLY), nothing of the trie itself is read yet
+// Returns NULL if the MachO has no exports trie
+MachOExportsTrie *macho_exports_trie_init(MachO *macho);
+
+// Resolve a single name, only the nodes on the path to it are read
+// Returns 0 if the name was found, 1 if it is not exported and -1 if the trie is malformed
+int macho_exports_trie_find(MachOExportsTrie *trie, const char *name, MachOExport *exportOut);
+
+// Walk the whole trie, name and export are only valid for the duration of the block
+int macho_exports_trie_enumerate(MachOExportsTrie *trie, void (^enumeratorBlock)(const char *name, MachOExport *export, bool *stop));
+
+void macho_export_free(MachOExport *export);
+void macho_exports_trie_free(MachOExportsTrie *trie);
+
+#endif // MACHO_EXPORTS_TRIE_H
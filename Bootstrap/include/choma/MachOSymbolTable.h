@@ -0,0 +1,53 @@
+#ifndef MACHO_SYMBOL_TABLE_H
+#define MACHO_SYMBOL_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "MachO.h"
+
+typedef struct MachOSymbol {
+    const char *name; // Points into the string table of the symbol table
+    uint8_t type;
+    uint8_t sect;
+    uint16_t desc;
+    uint64_t vmaddr;
+} MachOSymbol;
+
+typedef struct MachOSymbolTable {
+    MachO *macho;
+
+    char *stringTable;
+    uint32_t stringTableSize;
+
+    // In the order of the nlist entries
+    uint32_t symbolCount;
+    MachOSymbol *symbols;
+
+    // Open addressing hash table from name to symbol, entries are symbol index + 1 (0 is empty)
+    uint32_t hashTableSize;
+    uint32_t *hashTable;
+
+    // N_SECT symbols sorted by address for reverse lookups
+    uint32_t symbolsByAddressCount;
+    MachOSymbol **symbolsByAddress;
+} MachOSymbolTable;
+
+// Load LC_SYMTAB of macho, the symbols and the string table are each read with a single read
+// Returns NULL if the MachO has no symbol table
+MachOSymbolTable *macho_symbol_table_init(MachO *macho);
+
+// Same as macho_symbol_table_init, but without building the name and address indexes
+// Only good for enumerating, the find functions always return NULL on it
+MachOSymbolTable *macho_symbol_table_init_unindexed(MachO *macho);
+
+// Look up a symbol by name, defined symbols take precedence over undefined ones with the same name
+MachOSymbol *macho_symbol_table_find_symbol(MachOSymbolTable *symbolTable, const char *name);
+
+// Find the symbol that contains vmaddr (the closest N_SECT symbol at or below it)
+MachOSymbol *macho_symbol_table_find_symbol_for_address(MachOSymbolTable *symbolTable, uint64_t vmaddr);
+
+void macho_symbol_table_enumerate(MachOSymbolTable *symbolTable, void (^enumeratorBlock)(MachOSymbol *symbol, bool *stop));
+void macho_symbol_table_free(MachOSymbolTable *symbolTable);
+
+#endif // MACHO_SYMBOL_TABLE_H
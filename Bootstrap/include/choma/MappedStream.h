@@ -0,0 +1,23 @@
+#ifndef MAPPED_STREAM_H
+#define MAPPED_STREAM_H
+
+#include "MemoryStream.h"
+
+#define MAPPED_STREAM_SIZE_AUTO 0
+#define MAPPED_STREAM_FLAG_COPY_ON_WRITE (1 << 0)
+#define MAPPED_STREAM_FLAG_AUTO_EXPAND (1 << 1)
+
+typedef struct MappedStreamContext {
+    uint8_t *mapping;
+    size_t mappingSize;
+    uint32_t subBufferStart;
+    size_t subBufferSize;
+} MappedStreamContext;
+
+// Map (a part of) a file into memory, reads are plain memory accesses and a raw pointer is available
+// By default the stream is read only, with MAPPED_STREAM_FLAG_COPY_ON_WRITE it becomes writable,
+// but all changes stay private to the stream and are never written back to the file
+MemoryStream *mapped_stream_init_from_file_descriptor(int fd, uint32_t bufferStart, size_t bufferSize, uint32_t flags);
+MemoryStream *mapped_stream_init_from_path(const char *path, uint32_t bufferStart, size_t bufferSize, uint32_t flags);
+
+#endif // MAPPED_STREAM_H
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef MULTI_BUFFER_HASH_H
+#define MULTI_BUFFER_HASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+typedef enum {
+    MULTI_BUFFER_HASH_SHA1,
+    MULTI_BUFFER_HASH_SHA256,
+} MultiBufferHashAlgorithm;
+
+// Hash count buffers that all have the same length, several of them are processed at once where the CPU allows it
+// The first hashStride bytes of every digest (or the whole digest if it is shorter) are written to hashesOut + (i * hashStride)
+// Returns -1 if the algorithm is not supported
+int multi_buffer_hash(MultiBufferHashAlgorithm algorithm, const uint8_t *const *buffers, size_t length, uint32_t count, uint8_t *hashesOut, size_t hashStride);
+
+// Name of the kernel selected for this CPU
+const char *multi_buffer_hash_get_kernel_name(void);
+
+#endif // MULTI_BUFFER_HASH_H
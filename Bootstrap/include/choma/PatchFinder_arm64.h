@@ -30,4 +30,30 @@ uint64_t pfsec_arm64_resolve_adrp_ldr_str_add_reference(PFSection *section, uint
 uint64_t pfsec_arm64_resolve_adrp_ldr_str_add_reference_auto(PFSection *section, uint64_t ldrStrAddAddr);
 uint64_t pfsec_arm64_resolve_stub(PFSection *section, uint64_t stubAddr);
 void pfsec_arm64_enumerate_xrefs(PFSection *section, Arm64XrefTypeMask types, void (^xrefBlock)(Arm64XrefType type, uint64_t source, uint64_t target, bool *stop));
+
+// Every xref in a section, sorted by target (then source) so all references to an address can be found with a binary search
+typedef struct s_PFXrefIndex {
+    uint8_t uuid[16];
+    uint64_t vmaddr;
+    uint64_t size;
+
+    uint64_t count;
+    uint64_t *targets;
+    uint64_t *sources;
+    uint8_t *types;
+} PFXrefIndex;
+
+// Build the index with a single pass over the section
+PFXrefIndex *pfxref_index_build(PFSection *section);
+
+// Indexes are keyed by the LC_UUID of the section's MachO, loading fails if the file was created for a different binary or section
+PFXrefIndex *pfxref_index_load(PFSection *section, const char *path);
+int pfxref_index_save(PFXrefIndex *index, const char *path);
+
+void pfxref_index_enumerate_target(PFXrefIndex *index, uint64_t target, Arm64XrefTypeMask types, void (^xrefBlock)(Arm64XrefType type, uint64_t source, uint64_t target, bool *stop));
+void pfxref_index_free(PFXrefIndex *index);
+
+// Attach an xref index to the section, xref metrics run on it will use it instead of decoding the section again
+// If cachePath is set, the index is loaded from there when possible and saved there after building it otherwise
+int pfsec_arm64_index_xrefs(PFSection *section, const char *cachePath);
 #endif
\ No newline at end of file
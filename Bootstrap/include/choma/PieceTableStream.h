@@ -0,0 +1,52 @@
+#ifndef PIECE_TABLE_STREAM_H
+#define PIECE_TABLE_STREAM_H
+
+#include "MemoryStream.h"
+
+#define PIECE_TABLE_STREAM_FLAG_AUTO_EXPAND (1 << 0)
+
+typedef enum {
+    PIECE_SOURCE_BASE,
+    PIECE_SOURCE_ADDED,
+    PIECE_SOURCE_ZERO,
+} PieceSource;
+
+// A span of the stream, either taken from the base stream, the append-only buffer of added data or zero fill
+typedef struct PieceTablePiece {
+    PieceSource source;
+    uint64_t start;
+    size_t size;
+} PieceTablePiece;
+
+typedef struct PieceTableStreamContext {
+    MemoryStream *baseStream;
+
+    uint8_t *addedData;
+    size_t addedDataSize;
+    size_t addedDataCapacity;
+
+    PieceTablePiece *pieces;
+    uint32_t pieceCount;
+    uint32_t pieceCapacity;
+
+    size_t size;
+
+    // Start of the piece that was accessed last, sequential reads don't have to walk the whole table again
+    uint32_t cursorPiece;
+    uint64_t cursorOffset;
+} PieceTableStreamContext;
+
+// Create a stream that records writes, inserts and deletes as spans over the base stream, the base stream itself is never modified
+// This makes any number of structural edits cheap, piece_table_stream_serialize then produces the final data in a single pass
+// On success, the piece table stream takes ownership of the base stream
+MemoryStream *piece_table_stream_init(MemoryStream *baseStream, uint32_t flags);
+
+// Write the entire contents of the stream to targetStream, sequentially starting at offset 0
+// targetStream is trimmed to the size of the stream and must not share its data with the base stream
+int piece_table_stream_serialize(MemoryStream *stream, MemoryStream *targetStream);
+
+// Apply the edits to targetStream, which has to hold the base data at the same offsets (e.g. the stream the base was cloned from)
+// Only the changed ranges are written, fails without writing anything if base data was moved by an insert or delete
+int piece_table_stream_commit(MemoryStream *stream, MemoryStream *targetStream);
+
+#endif // PIECE_TABLE_STREAM_H
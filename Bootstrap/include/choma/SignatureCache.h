@@ -0,0 +1,39 @@
+#ifndef SIGNATURE_CACHE_H
+#define SIGNATURE_CACHE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define SIGNATURE_CACHE_KEY_SIZE 32
+
+typedef struct s_SignatureCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+    uint32_t entryCount;
+    uint64_t totalSize;
+} SignatureCacheStats;
+
+typedef struct s_SignatureCache SignatureCache;
+
+// Open (or create) a persistent signature cache in directoryPath
+// Once the entries take up more than maxSize bytes, the least recently used ones are evicted
+SignatureCache *signature_cache_open(const char *directoryPath, uint64_t maxSize);
+void signature_cache_close(SignatureCache *cache);
+
+// Calculate the cache key of the file at path, the content is hashed in 1 MiB chunks spread over all cores
+// parameters should contain everything else that affects the result of signing (entitlements, flags, ...)
+int signature_cache_calculate_key(const char *path, const void *parameters, size_t parametersSize, uint8_t keyOut[SIGNATURE_CACHE_KEY_SIZE]);
+
+// Store the signature of the signed MachO at signedPath, together with the header and load commands that point at it
+// This is only valid if signing did not change anything between the load commands and the code signature
+int signature_cache_store(SignatureCache *cache, const uint8_t key[SIGNATURE_CACHE_KEY_SIZE], const char *signedPath);
+
+// Splice a cached signature into the unsigned file at path, returns -1 if there is no entry for key
+int signature_cache_apply(SignatureCache *cache, const uint8_t key[SIGNATURE_CACHE_KEY_SIZE], const char *path);
+
+void signature_cache_get_stats(SignatureCache *cache, SignatureCacheStats *statsOut);
+
+#endif // SIGNATURE_CACHE_H
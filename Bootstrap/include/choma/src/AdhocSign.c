@@ -0,0 +1,603 @@
+#include "AdhocSign.h"
+#include "CSBlob.h"
+#include "CodeDirectory.h"
+#include "MachOByteOrder.h"
+#include "MachOLoadCommand.h"
+#include "MemoryStream.h"
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <CommonCrypto/CommonDigest.h>
+#include <string.h>
+
+// Same page size and hash type ldid uses
+#define ADHOC_SIGN_PAGE_SIZE 0x1000
+#define ADHOC_SIGN_PAGE_SIZE_LOG2 12
+#define ADHOC_SIGN_HASH_SIZE CC_SHA256_DIGEST_LENGTH
+
+// Code directory flags and execSeg flags, see cs_blobs.h
+#ifndef CS_ADHOC
+#define CS_ADHOC 0x00000002
+#endif
+#ifndef CS_LINKER_SIGNED
+#define CS_LINKER_SIGNED 0x00020000
+#endif
+#define CS_SUPPORTSEXECSEG 0x20400
+
+#define CS_EXECSEG_MAIN_BINARY 0x1
+#define CS_EXECSEG_ALLOW_UNSIGNED 0x10
+#define CS_EXECSEG_DEBUGGER 0x20
+#define CS_EXECSEG_JIT 0x40
+#define CS_EXECSEG_SKIP_LV 0x80
+#define CS_EXECSEG_CAN_LOAD_CDHASH 0x100
+#define CS_EXECSEG_CAN_EXEC_CDHASH 0x200
+
+// Version 0x20400 fields that follow CS_CodeDirectory, it only covers the fields up to teamOffset
+typedef struct {
+    uint32_t spare3;
+    uint64_t codeLimit64;
+    uint64_t execSegBase;
+    uint64_t execSegLimit;
+    uint64_t execSegFlags;
+} __attribute__((packed)) CS_CodeDirectoryExecSeg;
+
+typedef struct s_DERBuffer {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} DERBuffer;
+
+typedef struct s_EntitlementEntry {
+    char *key;
+    CFTypeRef value;
+} EntitlementEntry;
+
+static int _der_buffer_append(DERBuffer *buffer, const void *data, size_t size)
+{
+    if (buffer->size + size > buffer->capacity) {
+        size_t newCapacity = buffer->capacity ? buffer->capacity : 0x100;
+        while (newCapacity < buffer->size + size) newCapacity *= 2;
+        uint8_t *newData = realloc(buffer->data, newCapacity);
+        if (!newData) return -1;
+        buffer->data = newData;
+        buffer->capacity = newCapacity;
+    }
+    if (size) memcpy(&buffer->data[buffer->size], data, size);
+    buffer->size += size;
+    return 0;
+}
+
+static int _der_buffer_append_element(DERBuffer *buffer, uint8_t tag, const void *content, size_t contentSize)
+{
+    uint8_t header[2 + sizeof(size_t)];
+    size_t headerSize = 0;
+    header[headerSize++] = tag;
+    if (contentSize < 0x80) {
+        header[headerSize++] = contentSize;
+    }
+    else {
+        uint8_t lengthSize = 0;
+        for (size_t s = contentSize; s; s >>= 8) lengthSize++;
+        header[headerSize++] = 0x80 | lengthSize;
+        for (int i = lengthSize - 1; i >= 0; i--) {
+            header[headerSize++] = (contentSize >> (i * 8)) & 0xff;
+        }
+    }
+    if (_der_buffer_append(buffer, header, headerSize) != 0) return -1;
+    return _der_buffer_append(buffer, content, contentSize);
+}
+
+static char *_cf_string_copy_utf8(CFStringRef string)
+{
+    CFIndex maxSize = CFStringGetMaximumSizeForEncoding(CFStringGetLength(string), kCFStringEncodingUTF8) + 1;
+    char *utf8 = malloc(maxSize);
+    if (!utf8) return NULL;
+    if (!CFStringGetCString(string, utf8, maxSize, kCFStringEncodingUTF8)) {
+        free(utf8);
+        return NULL;
+    }
+    return utf8;
+}
+
+static int _entitlement_entry_compare(const void *a, const void *b)
+{
+    return strcmp(((const EntitlementEntry *)a)->key, ((const EntitlementEntry *)b)->key);
+}
+
+static int _der_encode_value(DERBuffer *buffer, CFTypeRef value);
+
+// Every key value pair becomes a SEQUENCE { UTF8String, value }, sorted by key like ldid does it
+static int _der_encode_dictionary_entries(DERBuffer *buffer, CFDictionaryRef dictionary)
+{
+    CFIndex count = CFDictionaryGetCount(dictionary);
+    if (count == 0) return 0;
+
+    int r = -1;
+    const void **keys = malloc(count * sizeof(*keys));
+    const void **values = malloc(count * sizeof(*values));
+    EntitlementEntry *entries = calloc(count, sizeof(*entries));
+    if (!keys || !values || !entries) goto out;
+
+    CFDictionaryGetKeysAndValues(dictionary, keys, values);
+    for (CFIndex i = 0; i < count; i++) {
+        if (CFGetTypeID(keys[i]) != CFStringGetTypeID()) {
+            printf("Error: entitlements contain a key that is not a string\n");
+            goto out;
+        }
+        entries[i].key = _cf_string_copy_utf8(keys[i]);
+        if (!entries[i].key) goto out;
+        entries[i].value = values[i];
+    }
+    qsort(entries, count, sizeof(*entries), _entitlement_entry_compare);
+
+    for (CFIndex i = 0; i < count; i++) {
+        DERBuffer pair = { 0 };
+        int pairR = _der_buffer_append_element(&pair, 0x0c, entries[i].key, strlen(entries[i].key));
+        if (pairR == 0) pairR = _der_encode_value(&pair, entries[i].value);
+        if (pairR == 0) pairR = _der_buffer_append_element(buffer, 0x30, pair.data, pair.size);
+        free(pair.data);
+        if (pairR != 0) goto out;
+    }
+    r = 0;
+
+out:
+    if (entries) {
+        for (CFIndex i = 0; i < count; i++) {
+            free(entries[i].key);
+        }
+    }
+    free(entries);
+    free(values);
+    free(keys);
+    return r;
+}
+
+static int _der_encode_value(DERBuffer *buffer, CFTypeRef value)
+{
+    CFTypeID type = CFGetTypeID(value);
+    if (type == CFBooleanGetTypeID()) {
+        uint8_t boolean = CFBooleanGetValue(value) ? 0xff : 0x00;
+        return _der_buffer_append_element(buffer, 0x01, &boolean, sizeof(boolean));
+    }
+    else if (type == CFNumberGetTypeID()) {
+        if (CFNumberIsFloatType(value)) {
+            printf("Error: floating point numbers are not supported in DER entitlements\n");
+            return -1;
+        }
+        int64_t number = 0;
+        CFNumberGetValue(value, kCFNumberSInt64Type, &number);
+        uint8_t bytes[sizeof(number)];
+        for (int i = 0; i < sizeof(bytes); i++) {
+            bytes[i] = (number >> (56 - (i * 8))) & 0xff;
+        }
+        // Shortest two's complement representation
+        int start = 0;
+        while (start < (sizeof(bytes) - 1) &&
+               ((bytes[start] == 0x00 && !(bytes[start + 1] & 0x80)) || (bytes[start] == 0xff && (bytes[start + 1] & 0x80)))) {
+            start++;
+        }
+        return _der_buffer_append_element(buffer, 0x02, &bytes[start], sizeof(bytes) - start);
+    }
+    else if (type == CFStringGetTypeID()) {
+        char *string = _cf_string_copy_utf8(value);
+        if (!string) return -1;
+        int r = _der_buffer_append_element(buffer, 0x0c, string, strlen(string));
+        free(string);
+        return r;
+    }
+    else if (type == CFDataGetTypeID()) {
+        return _der_buffer_append_element(buffer, 0x04, CFDataGetBytePtr(value), CFDataGetLength(value));
+    }
+    else if (type == CFArrayGetTypeID()) {
+        DERBuffer content = { 0 };
+        int r = 0;
+        for (CFIndex i = 0; i < CFArrayGetCount(value) && r == 0; i++) {
+            r = _der_encode_value(&content, CFArrayGetValueAtIndex(value, i));
+        }
+        if (r == 0) r = _der_buffer_append_element(buffer, 0x30, content.data, content.size);
+        free(content.data);
+        return r;
+    }
+    else if (type == CFDictionaryGetTypeID()) {
+        DERBuffer content = { 0 };
+        int r = _der_encode_dictionary_entries(&content, value);
+        if (r == 0) r = _der_buffer_append_element(buffer, 0x31, content.data, content.size);
+        free(content.data);
+        return r;
+    }
+
+    printf("Error: unsupported value type in entitlements\n");
+    return -1;
+}
+
+// [APPLICATION 16] { INTEGER 1, [CONTEXT 16] { entries } }
+static int _entitlements_encode_der(CFDictionaryRef entitlements, DERBuffer *derOut)
+{
+    DERBuffer dictionary = { 0 }, content = { 0 };
+    uint8_t version = 1;
+    int r = _der_encode_dictionary_entries(&dictionary, entitlements);
+    if (r == 0) r = _der_buffer_append_element(&content, 0x02, &version, sizeof(version));
+    if (r == 0) r = _der_buffer_append_element(&content, 0xb0, dictionary.data, dictionary.size);
+    if (r == 0) r = _der_buffer_append_element(derOut, 0x70, content.data, content.size);
+    free(dictionary.data);
+    free(content.data);
+    return r;
+}
+
+static CFDictionaryRef _entitlements_create_from_xml(const void *xml, size_t size)
+{
+    CFDataRef data = CFDataCreate(kCFAllocatorDefault, xml, size);
+    if (!data) return NULL;
+    CFPropertyListRef plist = CFPropertyListCreateWithData(kCFAllocatorDefault, data, kCFPropertyListImmutable, NULL, NULL);
+    CFRelease(data);
+    if (!plist) return NULL;
+    if (CFGetTypeID(plist) != CFDictionaryGetTypeID()) {
+        CFRelease(plist);
+        return NULL;
+    }
+    return plist;
+}
+
+static void _entitlements_merge_applier(const void *key, const void *value, void *context)
+{
+    CFDictionarySetValue((CFMutableDictionaryRef)context, key, value);
+}
+
+static bool _entitlements_get_bool(CFDictionaryRef entitlements, const char *key)
+{
+    CFStringRef keyString = CFStringCreateWithCString(kCFAllocatorDefault, key, kCFStringEncodingUTF8);
+    if (!keyString) return false;
+    CFTypeRef value = CFDictionaryGetValue(entitlements, keyString);
+    CFRelease(keyString);
+    return value && CFGetTypeID(value) == CFBooleanGetTypeID() && CFBooleanGetValue(value);
+}
+
+// Same entitlement to execSeg flag mapping that ldid uses
+static uint64_t _entitlements_get_exec_seg_flags(CFDictionaryRef entitlements)
+{
+    uint64_t execSegFlags = 0;
+    if (_entitlements_get_bool(entitlements, "get-task-allow")) execSegFlags |= CS_EXECSEG_ALLOW_UNSIGNED;
+    if (_entitlements_get_bool(entitlements, "run-unsigned-code")) execSegFlags |= CS_EXECSEG_ALLOW_UNSIGNED;
+    if (_entitlements_get_bool(entitlements, "com.apple.private.cs.debugger")) execSegFlags |= CS_EXECSEG_DEBUGGER;
+    if (_entitlements_get_bool(entitlements, "dynamic-codesigning")) execSegFlags |= CS_EXECSEG_JIT;
+    if (_entitlements_get_bool(entitlements, "com.apple.private.skip-library-validation")) execSegFlags |= CS_EXECSEG_SKIP_LV;
+    if (_entitlements_get_bool(entitlements, "com.apple.private.amfi.can-load-cdhash")) execSegFlags |= CS_EXECSEG_CAN_LOAD_CDHASH;
+    if (_entitlements_get_bool(entitlements, "com.apple.private.amfi.can-execute-cdhash")) execSegFlags |= CS_EXECSEG_CAN_EXEC_CDHASH;
+    return execSegFlags;
+}
+
+static CS_GenericBlob *_cs_generic_blob_create(uint32_t magic, const void *data, size_t size)
+{
+    CS_GenericBlob *blob = malloc(sizeof(CS_GenericBlob) + size);
+    if (!blob) return NULL;
+    blob->magic = HOST_TO_BIG(magic);
+    blob->length = HOST_TO_BIG((uint32_t)(sizeof(CS_GenericBlob) + size));
+    if (size) memcpy(blob->data, data, size);
+    return blob;
+}
+
+static MachOSegment *_macho_find_segment(MachO *macho, const char *segmentName)
+{
+    for (uint32_t i = 0; i < macho->segmentCount; i++) {
+        if (strncmp(macho->segments[i]->command.segname, segmentName, sizeof(macho->segments[i]->command.segname)) == 0) {
+            return macho->segments[i];
+        }
+    }
+    return NULL;
+}
+
+// Point LC_CODE_SIGNATURE at the new signature, the command is appended after the existing ones if there is none yet
+static int _macho_update_code_signature_command(MachO *macho, bool addCommand, uint32_t dataoff, uint32_t datasize)
+{
+    if (addCommand) {
+        // The new command has to fit between the load commands and the first section
+        uint64_t firstDataOffset = UINT64_MAX;
+        for (uint32_t i = 0; i < macho->segmentCount; i++) {
+            MachOSegment *segment = macho->segments[i];
+            if (segment->command.fileoff != 0 && segment->command.filesize != 0 && segment->command.fileoff < firstDataOffset) {
+                firstDataOffset = segment->command.fileoff;
+            }
+            for (uint32_t j = 0; j < segment->command.nsects; j++) {
+                if (segment->sections[j].offset != 0 && segment->sections[j].offset < firstDataOffset) {
+                    firstDataOffset = segment->sections[j].offset;
+                }
+            }
+        }
+
+        uint64_t loadCommandsEnd = sizeof(struct mach_header_64) + macho->machHeader.sizeofcmds;
+        if (loadCommandsEnd + sizeof(struct linkedit_data_command) > firstDataOffset) {
+            printf("Error: not enough space to add LC_CODE_SIGNATURE load command\n");
+            return -1;
+        }
+
+        struct linkedit_data_command csLoadCommand = { LC_CODE_SIGNATURE, sizeof(struct linkedit_data_command), dataoff, datasize };
+        LINKEDIT_DATA_COMMAND_APPLY_BYTE_ORDER(&csLoadCommand, HOST_TO_LITTLE_APPLIER);
+        if (macho_write_at_offset(macho, loadCommandsEnd, sizeof(csLoadCommand), &csLoadCommand) != 0) return -1;
+
+        macho->machHeader.ncmds++;
+        macho->machHeader.sizeofcmds += sizeof(struct linkedit_data_command);
+        struct mach_header_64 machHeader = macho->machHeader;
+        MACH_HEADER_APPLY_BYTE_ORDER(&machHeader, HOST_TO_LITTLE_APPLIER);
+        return macho_write_at_offset(macho, 0, sizeof(machHeader), &machHeader);
+    }
+
+    __block int r = -1;
+    macho_enumerate_load_commands_of_type(macho, LC_CODE_SIGNATURE, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        struct linkedit_data_command csLoadCommand;
+        memcpy(&csLoadCommand, cmd, sizeof(csLoadCommand));
+        LINKEDIT_DATA_COMMAND_APPLY_BYTE_ORDER(&csLoadCommand, LITTLE_TO_HOST_APPLIER);
+        csLoadCommand.dataoff = dataoff;
+        csLoadCommand.datasize = datasize;
+        LINKEDIT_DATA_COMMAND_APPLY_BYTE_ORDER(&csLoadCommand, HOST_TO_LITTLE_APPLIER);
+        r = macho_write_at_offset(macho, offset, sizeof(struct linkedit_data_command), &csLoadCommand);
+        *stop = true;
+    });
+    return r;
+}
+
+static int _macho_adhoc_sign(MachO *macho, const char *identifier, const char *fallbackIdentifier, const void *entitlements, size_t entitlementsSize, uint32_t flags)
+{
+    int r = -1;
+    char *existingIdentifier = NULL;
+    uint32_t existingFlags = 0;
+    uint8_t *existingEntitlements = NULL;
+    size_t existingEntitlementsSize = 0;
+    CFDictionaryRef existingDictionary = NULL, newDictionary = NULL;
+    CFMutableDictionaryRef mergedDictionary = NULL;
+    CFDataRef mergedXML = NULL;
+    DERBuffer der = { 0 };
+    CS_GenericBlob *blobs[4] = { 0 };
+    uint32_t blobTypes[4] = { 0 };
+    uint32_t blobCount = 0;
+    uint8_t *codeDir = NULL;
+    CS_DecodedSuperBlob *decodedSuperblob = NULL;
+
+    if (!macho->isSupported) {
+        printf("Error: unsupported MachO\n");
+        goto out;
+    }
+
+    // Keep identifier, flags and entitlements of the existing signature
+    uint32_t csOffset = 0, csSize = 0;
+    bool hasCodeSignature = macho_find_code_signature_bounds(macho, &csOffset, &csSize) == 0;
+    if (hasCodeSignature && csSize >= sizeof(CS_SuperBlob)) {
+        CS_SuperBlob *superblob = macho_read_code_signature(macho);
+        if (superblob && BIG_TO_HOST(superblob->magic) == CSMAGIC_EMBEDDED_SIGNATURE && BIG_TO_HOST(superblob->length) <= csSize) {
+            // Only a few fields are read, so decode without copying, the superblob is owned by existingSuperblob from here on
+            CS_DecodedSuperBlob *existingSuperblob = csd_superblob_decode_lazy(superblob);
+            if (existingSuperblob) {
+                superblob = NULL;
+                CS_DecodedBlob *bestCodeDirBlob = csd_superblob_find_best_code_directory(existingSuperblob);
+                if (bestCodeDirBlob) {
+                    existingIdentifier = csd_code_directory_copy_identifier(bestCodeDirBlob, NULL);
+                    existingFlags = csd_code_directory_get_flags(bestCodeDirBlob);
+                }
+                CS_DecodedBlob *entitlementsBlob = csd_superblob_find_blob(existingSuperblob, CSSLOT_ENTITLEMENTS, NULL);
+                if (entitlementsBlob && csd_blob_get_size(entitlementsBlob) > sizeof(CS_GenericBlob)) {
+                    existingEntitlementsSize = csd_blob_get_size(entitlementsBlob) - sizeof(CS_GenericBlob);
+                    existingEntitlements = malloc(existingEntitlementsSize);
+                    if (existingEntitlements) {
+                        csd_blob_read(entitlementsBlob, sizeof(CS_GenericBlob), existingEntitlementsSize, existingEntitlements);
+                        existingDictionary = _entitlements_create_from_xml(existingEntitlements, existingEntitlementsSize);
+                    }
+                }
+                csd_superblob_free(existingSuperblob);
+            }
+        }
+        free(superblob);
+    }
+
+    const char *finalIdentifier = identifier ? identifier : (existingIdentifier ? existingIdentifier : fallbackIdentifier);
+    if (!finalIdentifier) {
+        printf("Error: no identifier to sign with\n");
+        goto out;
+    }
+
+    // Decide which entitlements end up in the signature
+    if (entitlements) {
+        newDictionary = _entitlements_create_from_xml(entitlements, entitlementsSize);
+        if (!newDictionary) {
+            printf("Error: entitlements are not a valid property list\n");
+            goto out;
+        }
+    }
+
+    CFDictionaryRef finalDictionary = NULL;
+    const void *xml = NULL;
+    size_t xmlSize = 0;
+    if (newDictionary && existingDictionary && (flags & ADHOC_SIGN_FLAG_MERGE_ENTITLEMENTS)) {
+        mergedDictionary = CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0, existingDictionary);
+        if (!mergedDictionary) goto out;
+        CFDictionaryApplyFunction(newDictionary, _entitlements_merge_applier, mergedDictionary);
+        mergedXML = CFPropertyListCreateData(kCFAllocatorDefault, mergedDictionary, kCFPropertyListXMLFormat_v1_0, 0, NULL);
+        if (!mergedXML) {
+            printf("Error: failed to serialize merged entitlements\n");
+            goto out;
+        }
+        finalDictionary = mergedDictionary;
+        xml = CFDataGetBytePtr(mergedXML);
+        xmlSize = CFDataGetLength(mergedXML);
+    }
+    else if (newDictionary) {
+        finalDictionary = newDictionary;
+        xml = entitlements;
+        xmlSize = entitlementsSize;
+    }
+    else if (existingDictionary) {
+        finalDictionary = existingDictionary;
+        xml = existingEntitlements;
+        xmlSize = existingEntitlementsSize;
+    }
+
+    if (finalDictionary && _entitlements_encode_der(finalDictionary, &der) != 0) {
+        printf("Error: failed to encode DER entitlements\n");
+        goto out;
+    }
+
+    // Requirements, entitlements and DER entitlements go into special slots, the empty signature blob does not
+    uint32_t emptyRequirementsCount = 0;
+    blobTypes[blobCount] = CSSLOT_REQUIREMENTS;
+    blobs[blobCount++] = _cs_generic_blob_create(CSMAGIC_REQUIREMENTS, &emptyRequirementsCount, sizeof(emptyRequirementsCount));
+    if (finalDictionary) {
+        blobTypes[blobCount] = CSSLOT_ENTITLEMENTS;
+        blobs[blobCount++] = _cs_generic_blob_create(CSMAGIC_EMBEDDED_ENTITLEMENTS, xml, xmlSize);
+        blobTypes[blobCount] = CSSLOT_DER_ENTITLEMENTS;
+        blobs[blobCount++] = _cs_generic_blob_create(CSMAGIC_EMBEDDED_DER_ENTITLEMENTS, der.data, der.size);
+    }
+    blobTypes[blobCount] = CSSLOT_SIGNATURESLOT;
+    blobs[blobCount++] = _cs_generic_blob_create(CSMAGIC_BLOBWRAPPER, NULL, 0);
+    for (uint32_t i = 0; i < blobCount; i++) {
+        if (!blobs[i]) goto out;
+    }
+
+    // The signature goes to the end of __LINKEDIT, everything before it is covered by the code directory
+    MachOSegment *textSegment = _macho_find_segment(macho, "__TEXT");
+    MachOSegment *linkeditSegment = _macho_find_segment(macho, "__LINKEDIT");
+    if (!linkeditSegment) {
+        printf("Error: MachO has no __LINKEDIT segment\n");
+        goto out;
+    }
+    uint64_t codeLimit = hasCodeSignature ? csOffset : ((linkeditSegment->command.fileoff + linkeditSegment->command.filesize + 0xf) & ~0xfULL);
+    if (codeLimit < linkeditSegment->command.fileoff || codeLimit > UINT32_MAX) {
+        printf("Error: unexpected code signature location 0x%llx\n", codeLimit);
+        goto out;
+    }
+
+    size_t identifierSize = strlen(finalIdentifier) + 1;
+    uint32_t nSpecialSlots = finalDictionary ? CSSLOT_DER_ENTITLEMENTS : CSSLOT_REQUIREMENTS;
+    uint32_t nCodeSlots = (uint32_t)((codeLimit + ADHOC_SIGN_PAGE_SIZE - 1) / ADHOC_SIGN_PAGE_SIZE);
+    uint32_t identOffset = sizeof(CS_CodeDirectory) + sizeof(CS_CodeDirectoryExecSeg);
+    uint32_t hashOffset = (uint32_t)(identOffset + identifierSize + (nSpecialSlots * ADHOC_SIGN_HASH_SIZE));
+    uint32_t codeDirSize = hashOffset + (nCodeSlots * ADHOC_SIGN_HASH_SIZE);
+
+    uint64_t superblobSize = sizeof(CS_SuperBlob) + ((blobCount + 1) * sizeof(CS_BlobIndex)) + codeDirSize;
+    for (uint32_t i = 0; i < blobCount; i++) {
+        superblobSize += BIG_TO_HOST(blobs[i]->length);
+    }
+    uint64_t signatureSize = (superblobSize + 0xf) & ~0xfULL;
+
+    // Load commands are part of the first page, so they have to be final before anything is hashed
+    if (_macho_update_code_signature_command(macho, !hasCodeSignature, (uint32_t)codeLimit, (uint32_t)signatureSize) != 0) {
+        printf("Error: failed to update LC_CODE_SIGNATURE\n");
+        goto out;
+    }
+    linkeditSegment->command.filesize = codeLimit + signatureSize - linkeditSegment->command.fileoff;
+    linkeditSegment->command.vmsize = (linkeditSegment->command.filesize + 0x3fff) & ~0x3fffULL;
+    update_segment_command_64(macho, "__LINKEDIT", linkeditSegment->command.vmaddr, linkeditSegment->command.vmsize, linkeditSegment->command.fileoff, linkeditSegment->command.filesize);
+
+    size_t fileSize = memory_stream_get_size(macho_get_stream(macho));
+    if (fileSize < codeLimit) {
+        uint8_t *gap = calloc(1, codeLimit - fileSize);
+        if (!gap) goto out;
+        int gapR = macho_write_at_offset(macho, fileSize, codeLimit - fileSize, gap);
+        free(gap);
+        if (gapR != 0) goto out;
+    }
+
+    // Build the code directory
+    codeDir = calloc(1, codeDirSize);
+    if (!codeDir) goto out;
+
+    uint64_t execSegFlags = finalDictionary ? _entitlements_get_exec_seg_flags(finalDictionary) : 0;
+    if (macho->machHeader.filetype == MH_EXECUTE) execSegFlags |= CS_EXECSEG_MAIN_BINARY;
+
+    CS_CodeDirectory codeDirHeader = { 0 };
+    codeDirHeader.magic = CSMAGIC_CODEDIRECTORY;
+    codeDirHeader.length = codeDirSize;
+    codeDirHeader.version = CS_SUPPORTSEXECSEG;
+    codeDirHeader.flags = (existingFlags & ~CS_LINKER_SIGNED) | CS_ADHOC;
+    codeDirHeader.hashOffset = hashOffset;
+    codeDirHeader.identOffset = identOffset;
+    codeDirHeader.nSpecialSlots = nSpecialSlots;
+    codeDirHeader.nCodeSlots = nCodeSlots;
+    codeDirHeader.codeLimit = (uint32_t)codeLimit;
+    codeDirHeader.hashSize = ADHOC_SIGN_HASH_SIZE;
+    codeDirHeader.hashType = CS_HASHTYPE_SHA256_256;
+    codeDirHeader.pageSize = ADHOC_SIGN_PAGE_SIZE_LOG2;
+    CODE_DIRECTORY_APPLY_BYTE_ORDER(&codeDirHeader, HOST_TO_BIG_APPLIER);
+    CS_CodeDirectoryExecSeg execSeg = { 0 };
+    execSeg.execSegBase = HOST_TO_BIG((uint64_t)(textSegment ? textSegment->command.fileoff : 0));
+    execSeg.execSegLimit = HOST_TO_BIG((uint64_t)(textSegment ? textSegment->command.filesize : 0));
+    execSeg.execSegFlags = HOST_TO_BIG(execSegFlags);
+    memcpy(codeDir, &codeDirHeader, sizeof(codeDirHeader));
+    memcpy(&codeDir[sizeof(CS_CodeDirectory)], &execSeg, sizeof(execSeg));
+    memcpy(&codeDir[identOffset], finalIdentifier, identifierSize);
+
+    for (uint32_t i = 0; i < blobCount; i++) {
+        if (blobTypes[i] <= nSpecialSlots) {
+            CC_SHA256(blobs[i], BIG_TO_HOST(blobs[i]->length), &codeDir[hashOffset - (blobTypes[i] * ADHOC_SIGN_HASH_SIZE)]);
+        }
+    }
+
+    if (csd_code_directory_hash_pages(macho, CS_HASHTYPE_SHA256_256, ADHOC_SIGN_HASH_SIZE, ADHOC_SIGN_PAGE_SIZE, codeLimit, 0, nCodeSlots, &codeDir[hashOffset]) != 0) {
+        printf("Error: failed to hash code pages\n");
+        goto out;
+    }
+
+    // Assemble and write the superblob
+    decodedSuperblob = csd_superblob_init();
+    if (!decodedSuperblob) goto out;
+    decodedSuperblob->magic = CSMAGIC_EMBEDDED_SIGNATURE;
+
+    CS_DecodedBlob *codeDirBlob = csd_blob_init(CSSLOT_CODEDIRECTORY, (CS_GenericBlob *)codeDir);
+    if (!codeDirBlob) goto out;
+    csd_superblob_append_blob(decodedSuperblob, codeDirBlob);
+    for (uint32_t i = 0; i < blobCount; i++) {
+        CS_DecodedBlob *blob = csd_blob_init(blobTypes[i], blobs[i]);
+        if (!blob) goto out;
+        csd_superblob_append_blob(decodedSuperblob, blob);
+    }
+
+    uint32_t encodedSize = 0;
+    if (csd_superblob_encode_to_stream(decodedSuperblob, macho_get_stream(macho), codeLimit, &encodedSize) != 0 || encodedSize != superblobSize) {
+        printf("Error: failed to write code signature\n");
+        goto out;
+    }
+    if (signatureSize > superblobSize) {
+        uint8_t padding[0x10] = { 0 };
+        if (macho_write_at_offset(macho, codeLimit + superblobSize, signatureSize - superblobSize, padding) != 0) goto out;
+    }
+
+    // Drop whatever was left behind by a bigger signature
+    fileSize = memory_stream_get_size(macho_get_stream(macho));
+    if (fileSize > codeLimit + signatureSize) {
+        if (memory_stream_trim(macho_get_stream(macho), 0, fileSize - (codeLimit + signatureSize)) != 0) {
+            printf("Error: failed to trim MachO\n");
+            goto out;
+        }
+    }
+
+    r = 0;
+
+out:
+    if (decodedSuperblob) csd_superblob_free(decodedSuperblob);
+    free(codeDir);
+    for (uint32_t i = 0; i < blobCount; i++) {
+        free(blobs[i]);
+    }
+    free(der.data);
+    if (mergedXML) CFRelease(mergedXML);
+    if (mergedDictionary) CFRelease(mergedDictionary);
+    if (newDictionary) CFRelease(newDictionary);
+    if (existingDictionary) CFRelease(existingDictionary);
+    free(existingEntitlements);
+    free(existingIdentifier);
+    return r;
+}
+
+int macho_adhoc_sign(MachO *macho, const char *identifier, const void *entitlements, size_t entitlementsSize, uint32_t flags)
+{
+    return _macho_adhoc_sign(macho, identifier, NULL, entitlements, entitlementsSize, flags);
+}
+
+int adhoc_sign_file(const char *path, const char *identifier, const void *entitlements, size_t entitlementsSize, uint32_t flags)
+{
+    MachO *macho = macho_init_for_writing(path);
+    if (!macho) return -1;
+
+    const char *fileName = strrchr(path, '/');
+    fileName = fileName ? fileName + 1 : path;
+
+    int r = _macho_adhoc_sign(macho, identifier, fileName, entitlements, entitlementsSize, flags);
+    macho_free(macho);
+    return r;
+}
@@ -9,9 +9,12 @@ static int _buffered_stream_make_own_data(MemoryStream *stream)
 {
     BufferedStreamContext *context = stream->context;
     if ((stream->flags & MEMORY_STREAM_FLAG_OWNS_DATA) == 0) {
-        void *newBuffer = malloc(context->subBufferSize);
+        void *newBuffer = malloc(context->subBufferSize ? context->subBufferSize : 1);
+        if (!newBuffer) return -1;
         memcpy(newBuffer, context->buffer + context->subBufferStart, context->subBufferSize);
         context->buffer = newBuffer;
+        context->bufferSize = context->subBufferSize;
+        context->subBufferStart = 0;
         stream->flags |= MEMORY_STREAM_FLAG_OWNS_DATA;
     }
     return 0;
@@ -47,7 +50,8 @@ static int buffered_stream_write(MemoryStream *stream, uint64_t offset, size_t s
     }
 
     if (needsExpand) {
-        buffered_stream_expand(stream, 0, (offset + size) - context->subBufferSize);
+        int r = buffered_stream_expand(stream, 0, (offset + size) - context->subBufferSize);
+        if (r != 0) return r;
     }
 
     memcpy(context->buffer + context->subBufferStart + offset, inBuf, size);
@@ -71,7 +75,11 @@ static int buffered_stream_trim(MemoryStream *stream, size_t trimAtStart, size_t
 {
     BufferedStreamContext *context = stream->context;
 
-    // TODO: bound checks
+    if ((trimAtStart + trimAtEnd) > context->subBufferSize) {
+        return -1;
+    }
+
+    // The trimmed space stays allocated, so that growing again later doesn't need a new allocation
     context->subBufferStart += trimAtStart;
     context->subBufferSize -= (trimAtEnd + trimAtStart);
 
@@ -83,15 +91,37 @@ static int buffered_stream_expand(MemoryStream *stream, size_t expandAtStart, si
     BufferedStreamContext *context = stream->context;
 
     size_t newSize = context->subBufferSize + expandAtStart + expandAtEnd;
-    uint8_t *newBuffer = malloc(newSize);
-    memset(newBuffer, 0, newSize);
-    memcpy(&newBuffer[expandAtStart], &context->buffer[context->subBufferStart], context->subBufferSize);
+
+    // If the buffer is ours and has enough room around the current data, expand in place
+    if (stream->flags & MEMORY_STREAM_FLAG_OWNS_DATA) {
+        if (context->subBufferStart >= expandAtStart && (context->subBufferStart + context->subBufferSize + expandAtEnd) <= context->bufferSize) {
+            memset(&context->buffer[context->subBufferStart - expandAtStart], 0, expandAtStart);
+            memset(&context->buffer[context->subBufferStart + context->subBufferSize], 0, expandAtEnd);
+            context->subBufferStart -= expandAtStart;
+            context->subBufferSize = newSize;
+            return 0;
+        }
+    }
+
+    // Otherwise grow geometrically, so that repeated expansions (e.g. inserting load commands one by one) stay amortised linear
+    // Space is reserved on the side(s) that are being expanded
+    size_t newBufferSize = newSize + (newSize >> 1);
+    size_t reserveAtStart = 0;
+    if (expandAtStart) {
+        reserveAtStart = expandAtEnd ? (newBufferSize - newSize) / 2 : (newBufferSize - newSize);
+    }
+
+    uint8_t *newBuffer = malloc(newBufferSize ? newBufferSize : 1);
+    if (!newBuffer) return -1;
+    memset(&newBuffer[reserveAtStart], 0, expandAtStart);
+    memcpy(&newBuffer[reserveAtStart + expandAtStart], &context->buffer[context->subBufferStart], context->subBufferSize);
+    memset(&newBuffer[reserveAtStart + expandAtStart + context->subBufferSize], 0, expandAtEnd);
     if (stream->flags & MEMORY_STREAM_FLAG_OWNS_DATA) {
         free(context->buffer);
     }
     context->buffer = newBuffer;
-    context->bufferSize = newSize;
-    context->subBufferStart = 0;
+    context->bufferSize = newBufferSize;
+    context->subBufferStart = reserveAtStart;
     context->subBufferSize = newSize;
     stream->flags |= MEMORY_STREAM_FLAG_OWNS_DATA;
 
@@ -5,6 +5,7 @@
 #include "MachOByteOrder.h"
 #include "BufferedStream.h"
 #include "MemoryStream.h"
+#include "PieceTableStream.h"
 #include "Util.h"
 #include <mach-o/loader.h>
 #include <stddef.h>
@@ -99,15 +100,14 @@ int macho_parse_signature_blob_to_der_encoded_data(MachO *macho, uint32_t signat
 int macho_find_code_signature_bounds(MachO *macho, uint32_t *offsetOut, uint32_t *sizeOut)
 {
     __block int r = -1;
-    macho_enumerate_load_commands(macho, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
-        if (loadCommand.cmd == LC_CODE_SIGNATURE) {
-            struct linkedit_data_command *csLoadCommand = ((struct linkedit_data_command *)cmd);
-            LINKEDIT_DATA_COMMAND_APPLY_BYTE_ORDER(csLoadCommand, LITTLE_TO_HOST_APPLIER);
-            if (offsetOut) *offsetOut = csLoadCommand->dataoff;
-            if (sizeOut) *sizeOut = csLoadCommand->datasize;
-            *stop = true;
-            r = 0;
-        }
+    macho_enumerate_load_commands_of_type(macho, LC_CODE_SIGNATURE, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        struct linkedit_data_command csLoadCommand;
+        memcpy(&csLoadCommand, cmd, sizeof(csLoadCommand));
+        LINKEDIT_DATA_COMMAND_APPLY_BYTE_ORDER(&csLoadCommand, LITTLE_TO_HOST_APPLIER);
+        if (offsetOut) *offsetOut = csLoadCommand.dataoff;
+        if (sizeOut) *sizeOut = csLoadCommand.datasize;
+        *stop = true;
+        r = 0;
     });
     return r;
 }
@@ -126,7 +126,7 @@ CS_SuperBlob *macho_read_code_signature(MachO *macho)
 int macho_replace_code_signature(MachO *macho, CS_SuperBlob *superblob)
 {
     uint32_t csSegmentOffset = 0, csSegmentSize = 0;
-    macho_find_code_signature_bounds(macho, &csSegmentOffset, &csSegmentSize);
+    if (macho_find_code_signature_bounds(macho, &csSegmentOffset, &csSegmentSize) != 0) return -1;
 
     uint32_t sizeOfCodeSignature = 0;
     memory_stream_read(macho->stream, csSegmentOffset + offsetof(CS_SuperBlob, length), sizeof(sizeOfCodeSignature), &sizeOfCodeSignature);
@@ -136,23 +136,66 @@ int macho_replace_code_signature(MachO *macho, CS_SuperBlob *superblob)
 
     // See how much space we have to write the new code signature
     uint64_t entireFileSize = memory_stream_get_size(macho->stream);
+    if (entireFileSize == MEMORY_STREAM_SIZE_INVALID || csSegmentOffset > entireFileSize) return -1;
     uint64_t freeSpace = entireFileSize - csSegmentOffset;
-    uint64_t paddingSize = freeSpace - sizeOfCodeSignature;
-
-    if (newCodeSignatureSize >= freeSpace) {
-        macho_write_at_offset(macho, csSegmentOffset, newCodeSignatureSize, superblob);
-        uint8_t padding[paddingSize];
-        memset(padding, 0, paddingSize);
-        macho_write_at_offset(macho, csSegmentOffset + newCodeSignatureSize, paddingSize, padding);
-    } else if (newCodeSignatureSize < freeSpace) {
-        memory_stream_trim(macho_get_stream(macho), 0, entireFileSize-csSegmentOffset);
-        macho_write_at_offset(macho, csSegmentOffset, newCodeSignatureSize, superblob);
-        uint8_t padding[paddingSize];
-        memset(padding, 0, paddingSize);
-        macho_write_at_offset(macho, csSegmentOffset + newCodeSignatureSize, paddingSize, padding);
+    uint64_t paddingSize = freeSpace > sizeOfCodeSignature ? freeSpace - sizeOfCodeSignature : 0;
+
+    // Record the edits in a piece table, so the padding takes no memory and the MachO is only written to and resized once
+    MemoryStream *baseStream = memory_stream_softclone(macho->stream);
+    if (!baseStream) return -1;
+    MemoryStream *editStream = piece_table_stream_init(baseStream, PIECE_TABLE_STREAM_FLAG_AUTO_EXPAND);
+    if (!editStream) {
+        memory_stream_free(baseStream);
+        return -1;
     }
 
-    return 0;
+    // Everything from the old signature on is replaced by the new signature, followed by the same amount of padding as before
+    int r = memory_stream_delete(editStream, csSegmentOffset, freeSpace);
+    if (r == 0) r = memory_stream_write(editStream, csSegmentOffset, newCodeSignatureSize, superblob);
+    if (r == 0) r = memory_stream_expand(editStream, 0, paddingSize);
+    if (r == 0) r = piece_table_stream_commit(editStream, macho->stream);
+
+    memory_stream_free(editStream);
+    return r;
+}
+
+int macho_replace_code_signature_decoded(MachO *macho, CS_DecodedSuperBlob *decodedSuperblob)
+{
+    MemoryStream *stream = macho_get_stream(macho);
+
+    uint32_t csSegmentOffset = 0;
+    if (macho_find_code_signature_bounds(macho, &csSegmentOffset, NULL) != 0) return -1;
+
+    uint32_t sizeOfCodeSignature = 0;
+    memory_stream_read(stream, csSegmentOffset + offsetof(CS_SuperBlob, length), sizeof(sizeOfCodeSignature), &sizeOfCodeSignature);
+    sizeOfCodeSignature = BIG_TO_HOST(sizeOfCodeSignature);
+
+    // Keep the same amount of padding after the signature that macho_replace_code_signature keeps
+    uint64_t entireFileSize = memory_stream_get_size(stream);
+    uint64_t freeSpace = entireFileSize - csSegmentOffset;
+    uint64_t paddingSize = freeSpace > sizeOfCodeSignature ? freeSpace - sizeOfCodeSignature : 0;
+
+    uint32_t newCodeSignatureSize = 0;
+    int r = csd_superblob_encode_to_stream(decodedSuperblob, stream, csSegmentOffset, &newCodeSignatureSize);
+    if (r != 0) return r;
+
+    uint64_t paddingOffset = csSegmentOffset + newCodeSignatureSize;
+    uint8_t padding[0x1000];
+    memset(padding, 0, sizeof(padding));
+    while (paddingSize) {
+        size_t curSize = paddingSize < sizeof(padding) ? paddingSize : sizeof(padding);
+        r = macho_write_at_offset(macho, paddingOffset, curSize, padding);
+        if (r != 0) return r;
+        paddingOffset += curSize;
+        paddingSize -= curSize;
+    }
+
+    // Drop what is left of a bigger signature
+    uint64_t newFileSize = memory_stream_get_size(stream);
+    if (newFileSize > paddingOffset) {
+        r = memory_stream_trim(stream, 0, newFileSize - paddingOffset);
+    }
+    return r;
 }
 
 int macho_extract_cs_to_file(MachO *macho, CS_SuperBlob *superblob)
@@ -175,6 +218,23 @@ CS_DecodedBlob *csd_blob_init(uint32_t type, CS_GenericBlob *blobData)
     return blob;
 }
 
+CS_DecodedBlob *csd_blob_init_nocopy(uint32_t type, CS_GenericBlob *blobData)
+{
+    CS_DecodedBlob *blob = malloc(sizeof(CS_DecodedBlob));
+    if (!blob) return NULL;
+    memset(blob, 0, sizeof(CS_DecodedBlob));
+
+    blob->type = type;
+    // The stream does not own blobData, the first write makes it copy the data (see _buffered_stream_make_own_data)
+    blob->stream = buffered_stream_init_from_buffer_nocopy(blobData, BIG_TO_HOST(blobData->length), BUFFERED_STREAM_FLAG_AUTO_EXPAND);
+    if (!blob->stream) {
+        free(blob);
+        return NULL;
+    }
+
+    return blob;
+}
+
 int csd_blob_read(CS_DecodedBlob *blob, uint64_t offset, size_t size, void *outBuf)
 {
     return memory_stream_read(blob->stream, offset, size, outBuf);
@@ -250,72 +310,150 @@ CS_DecodedSuperBlob *csd_superblob_init(void)
     return decodedSuperblob;
 }
 
-CS_DecodedSuperBlob *csd_superblob_decode(CS_SuperBlob *superblob)
+static CS_DecodedSuperBlob *_csd_superblob_decode(CS_SuperBlob *superblob, bool lazy)
 {
     CS_DecodedSuperBlob *decodedSuperblob = csd_superblob_init();
     if (!decodedSuperblob) return NULL;
 
     CS_DecodedBlob **nextBlob = &decodedSuperblob->firstBlob;
     decodedSuperblob->magic = BIG_TO_HOST(superblob->magic);
+    uint64_t superblobLength = BIG_TO_HOST(superblob->length);
+    uint32_t blobCount = BIG_TO_HOST(superblob->count);
+
+    if (sizeof(CS_SuperBlob) + ((uint64_t)blobCount * sizeof(CS_BlobIndex)) > superblobLength) {
+        printf("Error: superblob index (%u entries) does not fit into superblob of size 0x%llx\n", blobCount, superblobLength);
+        goto fail;
+    }
 
-    for (uint32_t i = 0; i < BIG_TO_HOST(superblob->count); i++) {
+    for (uint32_t i = 0; i < blobCount; i++) {
         CS_BlobIndex curIndex = superblob->index[i];
         BLOB_INDEX_APPLY_BYTE_ORDER(&curIndex, BIG_TO_HOST_APPLIER);
         //printf("decoding %u (type: %x, offset: 0x%x)\n", i, curIndex.type, curIndex.offset);
 
+        if ((uint64_t)curIndex.offset + sizeof(CS_GenericBlob) > superblobLength) {
+            printf("Error: blob %u (type 0x%x) starts outside of the superblob\n", i, curIndex.type);
+            goto fail;
+        }
         CS_GenericBlob *curBlobData = (CS_GenericBlob *)(((uint8_t*)superblob) + curIndex.offset);
+        if ((uint64_t)curIndex.offset + BIG_TO_HOST(curBlobData->length) > superblobLength) {
+            printf("Error: blob %u (type 0x%x) ends outside of the superblob\n", i, curIndex.type);
+            goto fail;
+        }
 
-        *nextBlob = csd_blob_init(curIndex.type, curBlobData);
+        *nextBlob = lazy ? csd_blob_init_nocopy(curIndex.type, curBlobData) : csd_blob_init(curIndex.type, curBlobData);
+        if (!*nextBlob) goto fail;
         nextBlob = &(*nextBlob)->next;
     }
     return decodedSuperblob;
+
+fail:
+    csd_superblob_free(decodedSuperblob);
+    return NULL;
 }
 
-CS_SuperBlob *csd_superblob_encode(CS_DecodedSuperBlob *decodedSuperblob)
+CS_DecodedSuperBlob *csd_superblob_decode(CS_SuperBlob *superblob)
 {
-    uint32_t blobCount = 0, blobSize = 0;
+    return _csd_superblob_decode(superblob, false);
+}
 
-    // Determine amount and size of contained blobs
+CS_DecodedSuperBlob *csd_superblob_decode_lazy(CS_SuperBlob *superblob)
+{
+    CS_DecodedSuperBlob *decodedSuperblob = _csd_superblob_decode(superblob, true);
+    if (decodedSuperblob) {
+        decodedSuperblob->backingSuperblob = superblob;
+    }
+    return decodedSuperblob;
+}
+
+// Build the superblob header and index in one pass over the blob list, the blob data itself is not touched
+// Blobs are laid out back to back after the index in list order
+static CS_SuperBlob *_csd_superblob_create_header(CS_DecodedSuperBlob *decodedSuperblob, uint32_t *headerSizeOut)
+{
+    uint32_t blobCount = 0;
     CS_DecodedBlob *nextBlob = decodedSuperblob->firstBlob;
     while (nextBlob) {
         blobCount++;
-        blobSize += csd_blob_get_size(nextBlob);
         nextBlob = nextBlob->next;
     }
 
-    uint32_t superblobLength = sizeof(CS_SuperBlob) + (sizeof(CS_BlobIndex) * blobCount) + blobSize;
-    CS_SuperBlob *superblob = malloc(superblobLength);
-
-    // Populate superblob fields
-    superblob->count = blobCount;
-    superblob->length = superblobLength;
-    superblob->magic = decodedSuperblob->magic;
-    SUPERBLOB_APPLY_BYTE_ORDER(superblob, HOST_TO_BIG_APPLIER)
+    uint32_t headerSize = sizeof(CS_SuperBlob) + (sizeof(CS_BlobIndex) * blobCount);
+    CS_SuperBlob *header = malloc(headerSize);
+    if (!header) return NULL;
 
-    // Populate indexes and write actual backing data
     uint32_t idx = 0;
-    uint32_t dataStartOffset = sizeof(CS_SuperBlob) + (sizeof(CS_BlobIndex) * blobCount);
-    uint8_t *superblobData = ((uint8_t*)superblob) + dataStartOffset;
-    uint8_t *superblobDataCur = superblobData;
+    uint32_t curOffset = headerSize;
     nextBlob = decodedSuperblob->firstBlob;
     while (nextBlob) {
-        // Populate blob data
-        uint32_t curSize = csd_blob_get_size(nextBlob);
-        csd_blob_read(nextBlob, 0, curSize, superblobDataCur);
-
-        // Populate index
-        CS_BlobIndex *curIndex = &superblob->index[idx];
-        curIndex->offset = dataStartOffset + (superblobDataCur - superblobData);
+        CS_BlobIndex *curIndex = &header->index[idx];
+        curIndex->offset = curOffset;
         curIndex->type = nextBlob->type;
         BLOB_INDEX_APPLY_BYTE_ORDER(curIndex, HOST_TO_BIG_APPLIER);
 
-        superblobDataCur += curSize;
+        curOffset += csd_blob_get_size(nextBlob);
         idx++;
         nextBlob = nextBlob->next;
     }
+
+    header->count = blobCount;
+    header->length = curOffset;
+    header->magic = decodedSuperblob->magic;
+    SUPERBLOB_APPLY_BYTE_ORDER(header, HOST_TO_BIG_APPLIER)
+
+    if (headerSizeOut) *headerSizeOut = headerSize;
+    return header;
+}
+
+CS_SuperBlob *csd_superblob_encode(CS_DecodedSuperBlob *decodedSuperblob)
+{
+    uint32_t headerSize = 0;
+    CS_SuperBlob *header = _csd_superblob_create_header(decodedSuperblob, &headerSize);
+    if (!header) return NULL;
+
+    uint32_t superblobLength = BIG_TO_HOST(header->length);
+    CS_SuperBlob *superblob = realloc(header, superblobLength);
+    if (!superblob) {
+        free(header);
+        return NULL;
+    }
+
+    // Populate actual backing data
+    uint8_t *superblobDataCur = ((uint8_t*)superblob) + headerSize;
+    CS_DecodedBlob *nextBlob = decodedSuperblob->firstBlob;
+    while (nextBlob) {
+        uint32_t curSize = csd_blob_get_size(nextBlob);
+        csd_blob_read(nextBlob, 0, curSize, superblobDataCur);
+        superblobDataCur += curSize;
+        nextBlob = nextBlob->next;
+    }
     return superblob;
 }
 
+int csd_superblob_encode_to_stream(CS_DecodedSuperBlob *decodedSuperblob, MemoryStream *stream, uint64_t offset, uint32_t *lengthOut)
+{
+    uint32_t headerSize = 0;
+    CS_SuperBlob *header = _csd_superblob_create_header(decodedSuperblob, &headerSize);
+    if (!header) return -1;
+    uint32_t superblobLength = BIG_TO_HOST(header->length);
+
+    int r = memory_stream_write(stream, offset, headerSize, header);
+    free(header);
+    if (r != 0) return r;
+
+    // Every blob is copied straight from its own stream into the target
+    uint64_t curOffset = offset + headerSize;
+    CS_DecodedBlob *nextBlob = decodedSuperblob->firstBlob;
+    while (nextBlob) {
+        size_t curSize = csd_blob_get_size(nextBlob);
+        r = memory_stream_copy_data(nextBlob->stream, 0, stream, curOffset, curSize);
+        if (r != 0) return r;
+        curOffset += curSize;
+        nextBlob = nextBlob->next;
+    }
+
+    if (lengthOut) *lengthOut = superblobLength;
+    return 0;
+}
+
 CS_DecodedBlob *csd_superblob_find_blob(CS_DecodedSuperBlob *superblob, uint32_t type, uint32_t *indexOut)
 {
     CS_DecodedBlob *blob = superblob->firstBlob;
@@ -432,6 +570,24 @@ CS_DecodedBlob *csd_superblob_find_best_code_directory(CS_DecodedSuperBlob *deco
     return bestCDBlob;
 }
 
+int csd_superblob_update_code_directories(CS_DecodedSuperBlob *decodedSuperblob, MachO *macho)
+{
+    CS_DecodedBlob *codeDirBlobs[1 + CSSLOT_ALTERNATE_CODEDIRECTORY_MAX];
+    uint32_t codeDirCount = 0;
+
+    CS_DecodedBlob *blob = decodedSuperblob->firstBlob;
+    while (blob) {
+        if (blob->type == CSSLOT_CODEDIRECTORY || ((CSSLOT_ALTERNATE_CODEDIRECTORIES <= blob->type && blob->type < CSSLOT_ALTERNATE_CODEDIRECTORY_LIMIT))) {
+            if (codeDirCount < (sizeof(codeDirBlobs) / sizeof(codeDirBlobs[0]))) {
+                codeDirBlobs[codeDirCount++] = blob;
+            }
+        }
+        blob = blob->next;
+    }
+
+    return csd_code_directory_update_multiple(codeDirBlobs, codeDirCount, macho);
+}
+
 int csd_superblob_calculate_best_cdhash(CS_DecodedSuperBlob *decodedSuperblob, void *cdhashOut)
 {
     if (!cdhashOut) return -1;
@@ -451,19 +607,12 @@ int csd_superblob_print_content(CS_DecodedSuperBlob *decodedSuperblob, MachO *ma
         if (blobType == CSSLOT_CODEDIRECTORY || blobType == CSSLOT_ALTERNATE_CODEDIRECTORIES) {
             csd_code_directory_print_content(currentBlob, macho, printAllSlots, verifySlots);
         }
-        else if (blobType == CSSLOT_SIGNATURESLOT) {
-            CS_GenericBlob *cms_blob = malloc(sizeof(CS_GenericBlob));
-            memset(cms_blob, 0, sizeof(CS_GenericBlob));
-            memory_stream_read(currentBlob->stream, 0, sizeof(CS_GenericBlob), cms_blob);
-            GENERIC_BLOB_APPLY_BYTE_ORDER(cms_blob, BIG_TO_HOST_APPLIER);
-            printf("This is the %s, magic %#x.\n", cs_blob_magic_to_string(cms_blob->magic), cms_blob->magic);
-        }
         else {
-            CS_GenericBlob *generic_blob = malloc(sizeof(CS_GenericBlob));
-            memset(generic_blob, 0, sizeof(CS_GenericBlob));
-            memory_stream_read(currentBlob->stream, 0, sizeof(CS_GenericBlob), generic_blob);
-            GENERIC_BLOB_APPLY_BYTE_ORDER(generic_blob, BIG_TO_HOST_APPLIER);
-            printf("This is the %s, magic %#x.\n", cs_blob_magic_to_string(generic_blob->magic), generic_blob->magic);
+            CS_GenericBlob genericBlob;
+            memset(&genericBlob, 0, sizeof(genericBlob));
+            memory_stream_read(currentBlob->stream, 0, sizeof(genericBlob), &genericBlob);
+            GENERIC_BLOB_APPLY_BYTE_ORDER(&genericBlob, BIG_TO_HOST_APPLIER);
+            printf("This is the %s, magic %#x.\n", cs_blob_magic_to_string(genericBlob.magic), genericBlob.magic);
         }
 
         offset += csd_blob_get_size(currentBlob);
@@ -480,5 +629,8 @@ void csd_superblob_free(CS_DecodedSuperBlob *decodedSuperblob)
         nextBlob = nextBlob->next;
         csd_blob_free(prevBlob);
     }
+    if (decodedSuperblob->backingSuperblob) {
+        free(decodedSuperblob->backingSuperblob);
+    }
     free(decodedSuperblob);
 }
@@ -75,6 +75,8 @@ typedef struct s_CS_DecodedBlob {
 typedef struct s_CS_DecodedSuperBlob {
     uint32_t magic;
     struct s_CS_DecodedBlob *firstBlob;
+    // Raw superblob the blobs of a lazily decoded superblob point into, freed together with it
+    CS_SuperBlob *backingSuperblob;
 } CS_DecodedSuperBlob;
 
 // Convert blob magic to readable blob type string
@@ -89,8 +91,13 @@ int macho_find_code_signature_bounds(MachO *macho, uint32_t *offsetOut, uint32_t
 CS_SuperBlob *macho_read_code_signature(MachO *macho);
 
 int macho_replace_code_signature(MachO *macho, CS_SuperBlob *superblob);
+// Same as macho_replace_code_signature, but the superblob is encoded straight into the MachO without building it in memory first
+int macho_replace_code_signature_decoded(MachO *macho, CS_DecodedSuperBlob *decodedSuperblob);
 
 CS_DecodedBlob *csd_blob_init(uint32_t type, CS_GenericBlob *blobData);
+// Same as csd_blob_init, but the blob is a view into blobData that is only copied when it is first modified
+// blobData has to stay valid until the blob has been written to or freed
+CS_DecodedBlob *csd_blob_init_nocopy(uint32_t type, CS_GenericBlob *blobData);
 int csd_blob_read(CS_DecodedBlob *blob, uint64_t offset, size_t size, void *outBuf);
 int csd_blob_write(CS_DecodedBlob *blob, uint64_t offset, size_t size, const void *inBuf);
 int csd_blob_insert(CS_DecodedBlob *blob, uint64_t offset, size_t size, const void *inBuf);
@@ -104,13 +111,22 @@ void csd_blob_free(CS_DecodedBlob *blob);
 
 CS_DecodedSuperBlob *csd_superblob_init(void);
 CS_DecodedSuperBlob *csd_superblob_decode(CS_SuperBlob *superblob);
+// Decode without copying any blob data, every blob is a view into superblob until it is first modified
+// On success the decoded superblob takes ownership of superblob (which must come from malloc, e.g. macho_read_code_signature) and frees it in csd_superblob_free
+// Blobs removed from it must not be read after csd_superblob_free unless they have been written to
+CS_DecodedSuperBlob *csd_superblob_decode_lazy(CS_SuperBlob *superblob);
 CS_SuperBlob *csd_superblob_encode(CS_DecodedSuperBlob *decodedSuperblob);
+// Encode the superblob into stream at offset in one sequential pass, every blob is copied directly from its own stream
+int csd_superblob_encode_to_stream(CS_DecodedSuperBlob *decodedSuperblob, MemoryStream *stream, uint64_t offset, uint32_t *lengthOut);
 CS_DecodedBlob *csd_superblob_find_blob(CS_DecodedSuperBlob *superblob, uint32_t type, uint32_t *indexOut);
 int csd_superblob_insert_blob_after_blob(CS_DecodedSuperBlob *superblob, CS_DecodedBlob *blobToInsert, CS_DecodedBlob *afterBlob);
 int csd_superblob_insert_blob_at_index(CS_DecodedSuperBlob *superblob, CS_DecodedBlob *blobToInsert, uint32_t atIndex);
 int csd_superblob_append_blob(CS_DecodedSuperBlob *superblob, CS_DecodedBlob *blobToAppend);
 int csd_superblob_remove_blob(CS_DecodedSuperBlob *superblob, CS_DecodedBlob *blobToRemove); // <- Important: When calling this, caller is responsible for freeing blobToRemove
 int csd_superblob_remove_blob_at_index(CS_DecodedSuperBlob *superblob, uint32_t atIndex);
+CS_DecodedBlob *csd_superblob_find_best_code_directory(CS_DecodedSuperBlob *decodedSuperblob);
+// Rehash the code slots of every code directory in the superblob, reading each page only once
+int csd_superblob_update_code_directories(CS_DecodedSuperBlob *decodedSuperblob, MachO *macho);
 int csd_superblob_calculate_best_cdhash(CS_DecodedSuperBlob *decodedSuperblob, void *cdhashOut);
 int csd_superblob_print_content(CS_DecodedSuperBlob *decodedSuperblob, MachO *macho, bool printAllSlots, bool verifySlots);
 void csd_superblob_free(CS_DecodedSuperBlob *decodedSuperblob);
@@ -0,0 +1,419 @@
+#include "CachedStream.h"
+
+static int cached_stream_read(MemoryStream *stream, uint64_t offset, size_t size, void *outBuf);
+
+static void _cached_stream_update_flags(MemoryStream *stream)
+{
+    // The data is owned by the underlying stream, never advertise it so nobody writes through the raw pointer behind the cache
+    CachedStreamContext *context = stream->context;
+    stream->flags = context->underlyingStream->flags & ~(MEMORY_STREAM_FLAG_OWNS_DATA);
+}
+
+static uint32_t _cached_stream_bucket_for_block(CachedStreamContext *context, uint64_t blockIndex)
+{
+    // Fibonacci hashing, bucketCount is always a power of two
+    return (uint32_t)((blockIndex * 0x9E3779B97F4A7C15ULL) >> 32) & (context->bucketCount - 1);
+}
+
+static void _cached_stream_lru_unlink(CachedStreamContext *context, uint32_t entry)
+{
+    CachedStreamBlock *block = &context->blocks[entry];
+    if (block->lruPrev != CACHED_STREAM_INDEX_NONE) context->blocks[block->lruPrev].lruNext = block->lruNext;
+    else context->lruHead = block->lruNext;
+    if (block->lruNext != CACHED_STREAM_INDEX_NONE) context->blocks[block->lruNext].lruPrev = block->lruPrev;
+    else context->lruTail = block->lruPrev;
+    block->lruPrev = CACHED_STREAM_INDEX_NONE;
+    block->lruNext = CACHED_STREAM_INDEX_NONE;
+}
+
+static void _cached_stream_lru_push_front(CachedStreamContext *context, uint32_t entry)
+{
+    CachedStreamBlock *block = &context->blocks[entry];
+    block->lruPrev = CACHED_STREAM_INDEX_NONE;
+    block->lruNext = context->lruHead;
+    if (context->lruHead != CACHED_STREAM_INDEX_NONE) context->blocks[context->lruHead].lruPrev = entry;
+    context->lruHead = entry;
+    if (context->lruTail == CACHED_STREAM_INDEX_NONE) context->lruTail = entry;
+}
+
+static void _cached_stream_lru_push_back(CachedStreamContext *context, uint32_t entry)
+{
+    CachedStreamBlock *block = &context->blocks[entry];
+    block->lruNext = CACHED_STREAM_INDEX_NONE;
+    block->lruPrev = context->lruTail;
+    if (context->lruTail != CACHED_STREAM_INDEX_NONE) context->blocks[context->lruTail].lruNext = entry;
+    context->lruTail = entry;
+    if (context->lruHead == CACHED_STREAM_INDEX_NONE) context->lruHead = entry;
+}
+
+static uint32_t _cached_stream_lookup(CachedStreamContext *context, uint64_t blockIndex)
+{
+    uint32_t entry = context->buckets[_cached_stream_bucket_for_block(context, blockIndex)];
+    while (entry != CACHED_STREAM_INDEX_NONE) {
+        if (context->blocks[entry].blockIndex == blockIndex) return entry;
+        entry = context->blocks[entry].hashNext;
+    }
+    return CACHED_STREAM_INDEX_NONE;
+}
+
+static void _cached_stream_drop(CachedStreamContext *context, uint32_t entry)
+{
+    CachedStreamBlock *block = &context->blocks[entry];
+    if (!block->inUse) return;
+
+    uint32_t *link = &context->buckets[_cached_stream_bucket_for_block(context, block->blockIndex)];
+    while (*link != CACHED_STREAM_INDEX_NONE) {
+        if (*link == entry) {
+            *link = block->hashNext;
+            break;
+        }
+        link = &context->blocks[*link].hashNext;
+    }
+    block->hashNext = CACHED_STREAM_INDEX_NONE;
+
+    // Unused entries live at the end of the LRU list, so they get reused first
+    _cached_stream_lru_unlink(context, entry);
+    _cached_stream_lru_push_back(context, entry);
+    block->inUse = false;
+}
+
+static void _cached_stream_drop_all(CachedStreamContext *context)
+{
+    for (uint32_t i = 0; i < context->capacity; i++) {
+        CachedStreamBlock *block = &context->blocks[i];
+        block->inUse = false;
+        block->hashNext = CACHED_STREAM_INDEX_NONE;
+        block->lruPrev = i > 0 ? i - 1 : CACHED_STREAM_INDEX_NONE;
+        block->lruNext = i + 1 < context->capacity ? i + 1 : CACHED_STREAM_INDEX_NONE;
+    }
+    for (uint32_t i = 0; i < context->bucketCount; i++) {
+        context->buckets[i] = CACHED_STREAM_INDEX_NONE;
+    }
+    context->lruHead = 0;
+    context->lruTail = context->capacity - 1;
+}
+
+static void _cached_stream_drop_range(CachedStreamContext *context, uint64_t start, uint64_t end)
+{
+    if (end <= start) return;
+    uint64_t firstBlock = start / context->blockSize;
+    uint64_t lastBlock = (end - 1) / context->blockSize;
+
+    // For large ranges it's cheaper to go over the cache than over the range
+    if ((lastBlock - firstBlock) >= context->capacity) {
+        for (uint32_t i = 0; i < context->capacity; i++) {
+            CachedStreamBlock *block = &context->blocks[i];
+            if (block->inUse && block->blockIndex >= firstBlock && block->blockIndex <= lastBlock) {
+                _cached_stream_drop(context, i);
+            }
+        }
+        return;
+    }
+
+    for (uint64_t blockIndex = firstBlock; blockIndex <= lastBlock; blockIndex++) {
+        uint32_t entry = _cached_stream_lookup(context, blockIndex);
+        if (entry != CACHED_STREAM_INDEX_NONE) {
+            _cached_stream_drop(context, entry);
+        }
+    }
+}
+
+// Returns the cache entry for a block, reading it from the underlying stream if needed
+// Must be called with the lock held
+static CachedStreamBlock *_cached_stream_get_block(CachedStreamContext *context, uint64_t blockIndex, size_t streamSize)
+{
+    uint32_t entry = _cached_stream_lookup(context, blockIndex);
+    if (entry != CACHED_STREAM_INDEX_NONE) {
+        context->stats.hits++;
+        if (context->lruHead != entry) {
+            _cached_stream_lru_unlink(context, entry);
+            _cached_stream_lru_push_front(context, entry);
+        }
+        return &context->blocks[entry];
+    }
+    context->stats.misses++;
+
+    // The block storage is only allocated once it's needed, soft clones that are never read from stay cheap
+    if (!context->blockStorage) {
+        context->blockStorage = malloc(context->blockSize * context->capacity);
+        if (!context->blockStorage) return NULL;
+        for (uint32_t i = 0; i < context->capacity; i++) {
+            context->blocks[i].data = &context->blockStorage[context->blockSize * i];
+        }
+    }
+
+    entry = context->lruTail;
+    if (context->blocks[entry].inUse) {
+        _cached_stream_drop(context, entry);
+        context->stats.evictions++;
+    }
+
+    CachedStreamBlock *block = &context->blocks[entry];
+    uint64_t blockStart = blockIndex * context->blockSize;
+    size_t blockSize = context->blockSize;
+    if (blockStart + blockSize > streamSize) {
+        blockSize = streamSize - blockStart;
+    }
+    if (memory_stream_read(context->underlyingStream, blockStart, blockSize, block->data) != 0) {
+        return NULL;
+    }
+
+    block->blockIndex = blockIndex;
+    block->size = blockSize;
+    block->inUse = true;
+
+    uint32_t bucket = _cached_stream_bucket_for_block(context, blockIndex);
+    block->hashNext = context->buckets[bucket];
+    context->buckets[bucket] = entry;
+    _cached_stream_lru_unlink(context, entry);
+    _cached_stream_lru_push_front(context, entry);
+
+    return block;
+}
+
+static int cached_stream_read(MemoryStream *stream, uint64_t offset, size_t size, void *outBuf)
+{
+    CachedStreamContext *context = stream->context;
+    size_t streamSize = memory_stream_get_size(context->underlyingStream);
+    if (streamSize == MEMORY_STREAM_SIZE_INVALID || (offset + size) > streamSize) {
+        printf("Error: cannot read %zx bytes at %llx, maximum is %zx.\n", size, offset, streamSize);
+        return -1;
+    }
+
+    pthread_mutex_lock(&context->lock);
+
+    // Reads that span whole blocks wouldn't benefit from the cache, but would evict everything else from it
+    if (size >= context->blockSize) {
+        context->stats.bypassedReads++;
+        pthread_mutex_unlock(&context->lock);
+        if (memory_stream_read(context->underlyingStream, offset, size, outBuf) != 0) return -1;
+        return size;
+    }
+
+    size_t readSize = 0;
+    while (readSize < size) {
+        uint64_t curOffset = offset + readSize;
+        CachedStreamBlock *block = _cached_stream_get_block(context, curOffset / context->blockSize, streamSize);
+        if (!block) break;
+
+        size_t offsetInBlock = curOffset % context->blockSize;
+        size_t sizeToCopy = block->size - offsetInBlock;
+        if (sizeToCopy > (size - readSize)) {
+            sizeToCopy = size - readSize;
+        }
+        memcpy((uint8_t *)outBuf + readSize, &block->data[offsetInBlock], sizeToCopy);
+        readSize += sizeToCopy;
+    }
+
+    pthread_mutex_unlock(&context->lock);
+    return readSize;
+}
+
+static int cached_stream_write(MemoryStream *stream, uint64_t offset, size_t size, const void *inBuf)
+{
+    CachedStreamContext *context = stream->context;
+
+    pthread_mutex_lock(&context->lock);
+
+    size_t oldSize = memory_stream_get_size(context->underlyingStream);
+    if (memory_stream_write(context->underlyingStream, offset, size, inBuf) != 0) {
+        pthread_mutex_unlock(&context->lock);
+        return -1;
+    }
+
+    // Update cached blocks in place, blocks that changed size are dropped instead
+    uint64_t firstBlock = offset / context->blockSize;
+    uint64_t lastBlock = (offset + size - 1) / context->blockSize;
+    if (size != 0 && (lastBlock - firstBlock) < context->capacity) {
+        for (uint64_t blockIndex = firstBlock; blockIndex <= lastBlock; blockIndex++) {
+            uint32_t entry = _cached_stream_lookup(context, blockIndex);
+            if (entry == CACHED_STREAM_INDEX_NONE) continue;
+
+            CachedStreamBlock *block = &context->blocks[entry];
+            uint64_t blockStart = blockIndex * context->blockSize;
+            uint64_t copyStart = offset > blockStart ? offset : blockStart;
+            uint64_t copyEnd = (offset + size) < (blockStart + context->blockSize) ? (offset + size) : (blockStart + context->blockSize);
+            if (copyEnd > blockStart + block->size) {
+                _cached_stream_drop(context, entry);
+                continue;
+            }
+            memcpy(&block->data[copyStart - blockStart], (const uint8_t *)inBuf + (copyStart - offset), copyEnd - copyStart);
+        }
+    }
+    else {
+        _cached_stream_drop_range(context, offset, offset + size);
+    }
+
+    // If the write grew the stream, the previously last block is now incomplete
+    size_t newSize = memory_stream_get_size(context->underlyingStream);
+    if (newSize != oldSize) {
+        _cached_stream_drop_range(context, oldSize < newSize ? oldSize : newSize, newSize > oldSize ? newSize : oldSize);
+    }
+
+    pthread_mutex_unlock(&context->lock);
+    return size;
+}
+
+static int cached_stream_get_size(MemoryStream *stream, size_t *sizeOut)
+{
+    CachedStreamContext *context = stream->context;
+    size_t size = memory_stream_get_size(context->underlyingStream);
+    if (size == MEMORY_STREAM_SIZE_INVALID) return -1;
+    *sizeOut = size;
+    return 0;
+}
+
+static uint8_t *cached_stream_get_raw_pointer(MemoryStream *stream)
+{
+    CachedStreamContext *context = stream->context;
+    return memory_stream_get_raw_pointer(context->underlyingStream);
+}
+
+static int cached_stream_trim(MemoryStream *stream, size_t trimAtStart, size_t trimAtEnd)
+{
+    CachedStreamContext *context = stream->context;
+    pthread_mutex_lock(&context->lock);
+    int r = memory_stream_trim(context->underlyingStream, trimAtStart, trimAtEnd);
+    // All offsets change, so nothing in the cache is valid anymore
+    _cached_stream_drop_all(context);
+    _cached_stream_update_flags(stream);
+    pthread_mutex_unlock(&context->lock);
+    return r;
+}
+
+static int cached_stream_expand(MemoryStream *stream, size_t expandAtStart, size_t expandAtEnd)
+{
+    CachedStreamContext *context = stream->context;
+    pthread_mutex_lock(&context->lock);
+    int r = memory_stream_expand(context->underlyingStream, expandAtStart, expandAtEnd);
+    _cached_stream_drop_all(context);
+    _cached_stream_update_flags(stream);
+    pthread_mutex_unlock(&context->lock);
+    return r;
+}
+
+static MemoryStream *_cached_stream_init_context(MemoryStream *stream, MemoryStream *underlyingStream, size_t blockSize, uint32_t capacity)
+{
+    CachedStreamContext *context = malloc(sizeof(CachedStreamContext));
+    if (!context) return NULL;
+    memset(context, 0, sizeof(CachedStreamContext));
+
+    context->blockSize = blockSize;
+    context->capacity = capacity;
+    context->blocks = malloc(sizeof(CachedStreamBlock) * capacity);
+    context->bucketCount = 1;
+    while (context->bucketCount < capacity * 2) context->bucketCount <<= 1;
+    context->buckets = malloc(sizeof(uint32_t) * context->bucketCount);
+    if (!context->blocks || !context->buckets) goto fail;
+    if (pthread_mutex_init(&context->lock, NULL) != 0) goto fail;
+
+    _cached_stream_drop_all(context);
+    context->underlyingStream = underlyingStream;
+    stream->context = context;
+    _cached_stream_update_flags(stream);
+    return stream;
+
+fail:
+    if (context->blocks) free(context->blocks);
+    if (context->buckets) free(context->buckets);
+    free(context);
+    return NULL;
+}
+
+static MemoryStream *_cached_stream_clone(MemoryStream *stream, bool hard)
+{
+    CachedStreamContext *context = stream->context;
+
+    MemoryStream *clone = malloc(sizeof(MemoryStream));
+    if (!clone) return NULL;
+    memset(clone, 0, sizeof(MemoryStream));
+
+    // The clone gets its own (empty) cache, so that clones can be used from different threads without contention
+    MemoryStream *underlyingClone = hard ? memory_stream_hardclone(context->underlyingStream) : memory_stream_softclone(context->underlyingStream);
+    if (!underlyingClone) {
+        free(clone);
+        return NULL;
+    }
+
+    if (!_cached_stream_init_context(clone, underlyingClone, context->blockSize, context->capacity)) {
+        memory_stream_free(underlyingClone);
+        free(clone);
+        return NULL;
+    }
+    return clone;
+}
+
+static MemoryStream *cached_stream_softclone(MemoryStream *stream)
+{
+    return _cached_stream_clone(stream, false);
+}
+
+static MemoryStream *cached_stream_hardclone(MemoryStream *stream)
+{
+    return _cached_stream_clone(stream, true);
+}
+
+static void cached_stream_free(MemoryStream *stream)
+{
+    CachedStreamContext *context = stream->context;
+    memory_stream_free(context->underlyingStream);
+    pthread_mutex_destroy(&context->lock);
+    if (context->blockStorage) free(context->blockStorage);
+    free(context->blocks);
+    free(context->buckets);
+    free(context);
+}
+
+MemoryStream *cached_stream_init(MemoryStream *underlyingStream, size_t blockSize, uint32_t capacity)
+{
+    if (!underlyingStream) return NULL;
+    if (blockSize == 0) blockSize = CACHED_STREAM_BLOCK_SIZE_DEFAULT;
+    if (capacity == 0) capacity = CACHED_STREAM_CAPACITY_DEFAULT;
+    if ((blockSize & (blockSize - 1)) != 0) {
+        printf("Error: cached stream block size 0x%zx is not a power of two.\n", blockSize);
+        return NULL;
+    }
+
+    MemoryStream *stream = malloc(sizeof(MemoryStream));
+    if (!stream) return NULL;
+    memset(stream, 0, sizeof(MemoryStream));
+
+    if (!_cached_stream_init_context(stream, underlyingStream, blockSize, capacity)) {
+        free(stream);
+        return NULL;
+    }
+
+    stream->read = cached_stream_read;
+    stream->write = cached_stream_write;
+    stream->getSize = cached_stream_get_size;
+    stream->getRawPtr = cached_stream_get_raw_pointer;
+
+    stream->trim = cached_stream_trim;
+    stream->expand = cached_stream_expand;
+
+    stream->softclone = cached_stream_softclone;
+    stream->hardclone = cached_stream_hardclone;
+    stream->free = cached_stream_free;
+
+    return stream;
+}
+
+int cached_stream_get_stats(MemoryStream *stream, CachedStreamStats *statsOut)
+{
+    if (stream->read != cached_stream_read) return -1;
+    CachedStreamContext *context = stream->context;
+    pthread_mutex_lock(&context->lock);
+    *statsOut = context->stats;
+    pthread_mutex_unlock(&context->lock);
+    return 0;
+}
+
+int cached_stream_invalidate(MemoryStream *stream)
+{
+    if (stream->read != cached_stream_read) return -1;
+    CachedStreamContext *context = stream->context;
+    pthread_mutex_lock(&context->lock);
+    _cached_stream_drop_all(context);
+    pthread_mutex_unlock(&context->lock);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef CACHED_STREAM_H
+#define CACHED_STREAM_H
+
+#include "MemoryStream.h"
+#include <pthread.h>
+
+#define CACHED_STREAM_BLOCK_SIZE_DEFAULT 0x4000
+#define CACHED_STREAM_CAPACITY_DEFAULT 128
+
+#define CACHED_STREAM_INDEX_NONE UINT32_MAX
+
+typedef struct CachedStreamBlock {
+    uint64_t blockIndex;
+    size_t size;
+    uint8_t *data;
+
+    // Links in the LRU list and in the hash bucket chain
+    uint32_t lruPrev;
+    uint32_t lruNext;
+    uint32_t hashNext;
+    bool inUse;
+} CachedStreamBlock;
+
+typedef struct CachedStreamStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t bypassedReads;
+} CachedStreamStats;
+
+typedef struct CachedStreamContext {
+    MemoryStream *underlyingStream;
+    pthread_mutex_t lock;
+
+    size_t blockSize;
+    uint32_t capacity;
+    uint8_t *blockStorage;
+    CachedStreamBlock *blocks;
+
+    uint32_t bucketCount;
+    uint32_t *buckets;
+
+    // Most recently used block is at the head, the next block to be evicted at the tail
+    uint32_t lruHead;
+    uint32_t lruTail;
+
+    CachedStreamStats stats;
+} CachedStreamContext;
+
+// Wrap a stream into an LRU cache of aligned blocks, so that many small reads at nearby offsets only cost one read of the underlying stream
+// Writes go through to the underlying stream immediately, the cache never holds data that the underlying stream doesn't
+// blockSize has to be a power of two, pass 0 for blockSize or capacity to use the defaults
+// On success, the cached stream takes ownership of the underlying stream
+MemoryStream *cached_stream_init(MemoryStream *underlyingStream, size_t blockSize, uint32_t capacity);
+
+int cached_stream_get_stats(MemoryStream *stream, CachedStreamStats *statsOut);
+int cached_stream_invalidate(MemoryStream *stream);
+
+#endif // CACHED_STREAM_H
@@ -1,7 +1,47 @@
 #include "CodeDirectory.h"
 #include "CSBlob.h"
 #include "Util.h"
+#include "MultiBufferHash.h"
 #include <stddef.h>
+#include <dispatch/dispatch.h>
+
+// Hash data with the algorithm of a code directory, the first hashSize bytes of the digest are written to hashOut
+// SHA-1 and SHA-256 go through the multi buffer hasher, so single pages take the same path as batches of them
+static bool _csd_code_directory_hash(uint8_t hashType, const void *data, size_t size, uint8_t *hashOut, size_t hashSize)
+{
+    uint8_t fullHash[CC_SHA384_DIGEST_LENGTH];
+    size_t fullHashSize = 0;
+    switch (hashType) {
+        case CS_HASHTYPE_SHA160_160: {
+            const uint8_t *buffer = data;
+            multi_buffer_hash(MULTI_BUFFER_HASH_SHA1, &buffer, size, 1, fullHash, CC_SHA1_DIGEST_LENGTH);
+            fullHashSize = CC_SHA1_DIGEST_LENGTH;
+            break;
+        }
+
+        case CS_HASHTYPE_SHA256_256:
+        case CS_HASHTYPE_SHA256_160: {
+            const uint8_t *buffer = data;
+            multi_buffer_hash(MULTI_BUFFER_HASH_SHA256, &buffer, size, 1, fullHash, CC_SHA256_DIGEST_LENGTH);
+            fullHashSize = CC_SHA256_DIGEST_LENGTH;
+            break;
+        }
+
+        case CS_HASHTYPE_SHA384_384: {
+            CC_SHA384(data, (CC_LONG)size, fullHash);
+            fullHashSize = CC_SHA384_DIGEST_LENGTH;
+            break;
+        }
+
+        default: {
+            return false;
+        }
+    }
+
+    if (hashSize > fullHashSize) return false;
+    memcpy(hashOut, fullHash, hashSize);
+    return true;
+}
 
 void csd_code_directory_read_slot_hash(CS_DecodedBlob *codeDirBlob, MachO *macho, int slot, uint8_t *slotHashOut)
 {
@@ -34,35 +74,120 @@ bool csd_code_directory_calculate_page_hash(CS_DecodedBlob *codeDirBlob, MachO *
 
     uint8_t page[pageToReadSize];
     if (macho_read_at_offset(macho, pageToReadOffset, pageToReadSize, page) != 0) return false;
-    switch (codeDir.hashType) {
-        case CS_HASHTYPE_SHA160_160: {
-            CC_SHA1(page, (CC_LONG)pageToReadSize, pageHashOut);
-            break;
-        }
+    return _csd_code_directory_hash(codeDir.hashType, page, pageToReadSize, pageHashOut, codeDir.hashSize);
+}
 
-        case CS_HASHTYPE_SHA256_256:
-        case CS_HASHTYPE_SHA256_160: {
-            uint8_t fullHash[CC_SHA256_DIGEST_LENGTH];
-            CC_SHA256(page, (CC_LONG)pageToReadSize, fullHash);
-            memcpy(pageHashOut, fullHash, codeDir.hashSize);
-            break;
-        }
+#define PAGE_HASH_BATCH_SIZE 64
 
-        case CS_HASHTYPE_SHA384_384: {
-            uint8_t fullHash[CC_SHA384_DIGEST_LENGTH];
-            CC_SHA256(page, (CC_LONG)pageToReadSize, fullHash);
-            memcpy(pageHashOut, fullHash, codeDir.hashSize);
-            break;
+// Hash pageCount consecutive pages that start at data, only the last one can be shorter than pageSize
+static bool _csd_code_directory_hash_batch(uint8_t hashType, uint8_t hashSize, uint32_t pageSize, const uint8_t *data, uint64_t dataSize, uint32_t pageCount, uint8_t *hashesOut)
+{
+    // All full pages of the batch are hashed together, only a short last page is hashed on its own
+    uint32_t i = 0;
+    uint32_t fullPageCount = (uint32_t)(dataSize / pageSize);
+    if (fullPageCount > pageCount) fullPageCount = pageCount;
+    if (fullPageCount > 0 && (hashType == CS_HASHTYPE_SHA160_160 || hashType == CS_HASHTYPE_SHA256_256 || hashType == CS_HASHTYPE_SHA256_160)) {
+        MultiBufferHashAlgorithm algorithm = (hashType == CS_HASHTYPE_SHA160_160) ? MULTI_BUFFER_HASH_SHA1 : MULTI_BUFFER_HASH_SHA256;
+        size_t digestSize = (hashType == CS_HASHTYPE_SHA160_160) ? CC_SHA1_DIGEST_LENGTH : CC_SHA256_DIGEST_LENGTH;
+        if (hashSize > digestSize) return false;
+
+        const uint8_t *pages[PAGE_HASH_BATCH_SIZE];
+        for (; i < fullPageCount; i++) {
+            pages[i] = &data[(uint64_t)i * pageSize];
         }
+        multi_buffer_hash(algorithm, pages, pageSize, fullPageCount, hashesOut, hashSize);
+    }
 
-        default: {
+    for (; i < pageCount; i++) {
+        uint64_t pageStart = (uint64_t)i * pageSize;
+        uint64_t pageLength = dataSize - pageStart;
+        if (pageLength > pageSize) pageLength = pageSize;
+        if (!_csd_code_directory_hash(hashType, &data[pageStart], pageLength, &hashesOut[(size_t)i * hashSize], hashSize)) {
             return false;
         }
     }
-
     return true;
 }
 
+// SHA256-160 is a truncated SHA256, so both can share the hashing work
+static bool _csd_code_directory_hash_types_share_digest(uint8_t hashType, uint8_t otherHashType)
+{
+    if (hashType == otherHashType) return true;
+    bool isSHA256 = (hashType == CS_HASHTYPE_SHA256_256 || hashType == CS_HASHTYPE_SHA256_160);
+    bool otherIsSHA256 = (otherHashType == CS_HASHTYPE_SHA256_256 || otherHashType == CS_HASHTYPE_SHA256_160);
+    return isSHA256 && otherIsSHA256;
+}
+
+int csd_code_directory_hash_pages_multi(MachO *macho, uint32_t hashTypeCount, const uint8_t *hashTypes, const uint8_t *hashSizes, uint32_t pageSize, uint64_t dataEnd, uint32_t firstPage, uint32_t pageCount, uint8_t **hashesOut)
+{
+    if (pageCount == 0 || hashTypeCount == 0) return 0;
+    if (pageSize == 0) return -1;
+    if (((uint64_t)firstPage + pageCount - 1) * pageSize >= dataEnd) return -1;
+    if (dataEnd > memory_stream_get_size(macho_get_stream(macho))) return -1;
+
+    uint8_t *mapping = memory_stream_get_raw_pointer(macho_get_stream(macho));
+    size_t batchCount = (pageCount + PAGE_HASH_BATCH_SIZE - 1) / PAGE_HASH_BATCH_SIZE;
+    __block bool failed = false;
+
+    // Every batch of pages is read once and hashed with every hash type by one worker, which writes the hashes straight into the right spot of hashesOut
+    dispatch_apply(batchCount, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t batch) {
+        uint32_t batchFirstPage = firstPage + (uint32_t)(batch * PAGE_HASH_BATCH_SIZE);
+        uint32_t batchPageCount = PAGE_HASH_BATCH_SIZE;
+        if (batchPageCount > (firstPage + pageCount) - batchFirstPage) {
+            batchPageCount = (firstPage + pageCount) - batchFirstPage;
+        }
+        uint64_t batchStart = (uint64_t)batchFirstPage * pageSize;
+        uint64_t batchEnd = batchStart + ((uint64_t)batchPageCount * pageSize);
+        if (batchEnd > dataEnd) batchEnd = dataEnd;
+
+        const uint8_t *data = NULL;
+        uint8_t *buffer = NULL;
+        if (mapping) {
+            data = &mapping[batchStart];
+        }
+        else {
+            buffer = malloc(batchEnd - batchStart);
+            if (!buffer || macho_read_at_offset(macho, batchStart, batchEnd - batchStart, buffer) != 0) {
+                if (buffer) free(buffer);
+                __atomic_store_n(&failed, true, __ATOMIC_RELAXED);
+                return;
+            }
+            data = buffer;
+        }
+
+        size_t batchIndex = batchFirstPage - firstPage;
+        for (uint32_t t = 0; t < hashTypeCount; t++) {
+            uint8_t *batchHashes = &hashesOut[t][batchIndex * hashSizes[t]];
+
+            // Reuse the hashes of an earlier type with the same digest if there is one
+            uint32_t u = 0;
+            for (; u < t; u++) {
+                if (_csd_code_directory_hash_types_share_digest(hashTypes[t], hashTypes[u]) && hashSizes[u] >= hashSizes[t]) break;
+            }
+            if (u < t) {
+                for (uint32_t i = 0; i < batchPageCount; i++) {
+                    memcpy(&batchHashes[(size_t)i * hashSizes[t]], &hashesOut[u][(batchIndex + i) * hashSizes[u]], hashSizes[t]);
+                }
+                continue;
+            }
+
+            if (!_csd_code_directory_hash_batch(hashTypes[t], hashSizes[t], pageSize, data, batchEnd - batchStart, batchPageCount, batchHashes)) {
+                __atomic_store_n(&failed, true, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+
+        if (buffer) free(buffer);
+    });
+
+    return failed ? -1 : 0;
+}
+
+int csd_code_directory_hash_pages(MachO *macho, uint8_t hashType, uint8_t hashSize, uint32_t pageSize, uint64_t dataEnd, uint32_t firstPage, uint32_t pageCount, uint8_t *hashesOut)
+{
+    return csd_code_directory_hash_pages_multi(macho, 1, &hashType, &hashSize, pageSize, dataEnd, firstPage, pageCount, &hashesOut);
+}
+
 bool csd_code_directory_verify_code_slot(CS_DecodedBlob *codeDirBlob, MachO *macho, int slot)
 {
     CS_CodeDirectory codeDir;
@@ -73,23 +198,96 @@ bool csd_code_directory_verify_code_slot(CS_DecodedBlob *codeDirBlob, MachO *mac
     csd_code_directory_read_slot_hash(codeDirBlob, macho, slot, slotHash);
 
     uint8_t pageHash[codeDir.hashSize];
-    if (!csd_code_directory_calculate_page_hash(codeDirBlob, macho, slot, slotHash)) return false;
+    if (!csd_code_directory_calculate_page_hash(codeDirBlob, macho, slot, pageHash)) return false;
 
     return (memcmp(slotHash, pageHash, codeDir.hashSize) == 0);
 }
 
-bool csd_code_directory_verify_code_slots(CS_DecodedBlob *codeDirBlob, MachO *macho, int slot)
+CS_CodeSlotVerification *csd_code_directory_verify_all_code_slots(CS_DecodedBlob *codeDirBlob, MachO *macho)
 {
     CS_CodeDirectory codeDir;
     csd_blob_read(codeDirBlob, 0, sizeof(codeDir), &codeDir);
-    CODE_DIRECTORY_APPLY_BYTE_ORDER(&codeDir, HOST_TO_BIG_APPLIER);
+    CODE_DIRECTORY_APPLY_BYTE_ORDER(&codeDir, BIG_TO_HOST_APPLIER);
+    if (codeDir.pageSize >= 32) return NULL;
+
+    uint32_t slotCount = codeDir.nCodeSlots;
+    uint32_t hashSize = codeDir.hashSize;
+    uint8_t *slotHashes = malloc(slotCount ? ((size_t)slotCount * hashSize) : 1);
+    CS_CodeSlotVerification *verification = calloc(1, sizeof(CS_CodeSlotVerification));
+    if (!slotHashes || !verification) goto fail;
+    verification->slotCount = slotCount;
+    verification->hashSize = hashSize;
+    verification->statuses = malloc(slotCount ? slotCount : 1);
+    verification->computedHashes = calloc(slotCount ? slotCount : 1, hashSize ? hashSize : 1);
+    if (!verification->statuses || !verification->computedHashes) goto fail;
+    if (slotCount == 0) {
+        free(slotHashes);
+        return verification;
+    }
+    if (csd_blob_read(codeDirBlob, codeDir.hashOffset, (size_t)slotCount * hashSize, slotHashes) != 0) goto fail;
+    memset(verification->statuses, CS_CODE_SLOT_UNREADABLE, slotCount);
+
+    uint32_t pageSize = (uint32_t)1 << codeDir.pageSize;
+    uint32_t csOffset = 0, csSize = 0;
+    macho_find_code_signature_bounds(macho, &csOffset, &csSize);
+    uint64_t fileSize = memory_stream_get_size(macho_get_stream(macho));
+
+    // All slots but the last one cover a full page, those are hashed in parallel as far as the file goes
+    uint32_t fullPageCount = slotCount - 1;
+    if (fullPageCount > fileSize / pageSize) fullPageCount = fileSize / pageSize;
+    if (fullPageCount > 0 && csd_code_directory_hash_pages(macho, codeDir.hashType, hashSize, pageSize, (uint64_t)fullPageCount * pageSize, 0, fullPageCount, verification->computedHashes) == 0) {
+        for (uint32_t i = 0; i < fullPageCount; i++) {
+            verification->statuses[i] = CS_CODE_SLOT_VALID;
+        }
+        verification->bytesHashed += (uint64_t)fullPageCount * pageSize;
+    }
 
-    for (int i = 0; i < codeDir.nCodeSlots; i++) {
-        if (!csd_code_directory_verify_code_slot(codeDirBlob, macho, i)) {
-            return false;
+    // The last slot ends where the code signature starts
+    uint64_t finalPageOffset = (uint64_t)(slotCount - 1) * pageSize;
+    if (finalPageOffset <= csOffset && csOffset <= fileSize) {
+        size_t finalPageSize = csOffset - finalPageOffset;
+        uint8_t *finalPage = malloc(finalPageSize ? finalPageSize : 1);
+        if (finalPage && macho_read_at_offset(macho, finalPageOffset, finalPageSize, finalPage) == 0) {
+            if (_csd_code_directory_hash(codeDir.hashType, finalPage, finalPageSize, &verification->computedHashes[(size_t)(slotCount - 1) * hashSize], hashSize)) {
+                verification->statuses[slotCount - 1] = CS_CODE_SLOT_VALID;
+                verification->bytesHashed += finalPageSize;
+            }
         }
+        if (finalPage) free(finalPage);
     }
-    return true;
+
+    for (uint32_t i = 0; i < slotCount; i++) {
+        if (verification->statuses[i] == CS_CODE_SLOT_VALID && memcmp(&slotHashes[(size_t)i * hashSize], &verification->computedHashes[(size_t)i * hashSize], hashSize) != 0) {
+            verification->statuses[i] = CS_CODE_SLOT_INVALID;
+        }
+        if (verification->statuses[i] != CS_CODE_SLOT_VALID) {
+            verification->invalidCount++;
+        }
+    }
+
+    free(slotHashes);
+    return verification;
+
+fail:
+    if (slotHashes) free(slotHashes);
+    if (verification) csd_code_slot_verification_free(verification);
+    return NULL;
+}
+
+void csd_code_slot_verification_free(CS_CodeSlotVerification *verification)
+{
+    if (verification->statuses) free(verification->statuses);
+    if (verification->computedHashes) free(verification->computedHashes);
+    free(verification);
+}
+
+bool csd_code_directory_verify_code_slots(CS_DecodedBlob *codeDirBlob, MachO *macho, int slot)
+{
+    CS_CodeSlotVerification *verification = csd_code_directory_verify_all_code_slots(codeDirBlob, macho);
+    if (!verification) return false;
+    bool valid = (verification->invalidCount == 0);
+    csd_code_slot_verification_free(verification);
+    return valid;
 }
 
 const char *cs_hash_type_to_string(int hashType)
@@ -342,6 +540,7 @@ int csd_code_directory_print_content(CS_DecodedBlob *codeDirBlob, MachO *macho,
     int maxdigits = count_digits(codeDir.nCodeSlots);
     bool codeSlotsCorrect = true;
     bool needsNewline = false;
+    CS_CodeSlotVerification *verification = verifySlots ? csd_code_directory_verify_all_code_slots(codeDirBlob, macho) : NULL;
 
     for (int64_t i = -((int64_t)codeDir.nSpecialSlots); i < (int64_t)codeDir.nCodeSlots; i++) {
         // Read slot
@@ -374,13 +573,10 @@ int csd_code_directory_print_content(CS_DecodedBlob *codeDirBlob, MachO *macho,
         }
 
         if (verifySlots && i >= 0) {
-            uint8_t pageHash[codeDir.hashSize];
             needsNewline = true;
-            bool correct = false;
-            bool calcWorked = csd_code_directory_calculate_page_hash(codeDirBlob, macho, i, pageHash);
-            if (calcWorked) {
-                correct = (memcmp(slotHash, pageHash, codeDir.hashSize) == 0);
-            }
+            bool calcWorked = verification && verification->statuses[i] != CS_CODE_SLOT_UNREADABLE;
+            bool correct = verification && verification->statuses[i] == CS_CODE_SLOT_VALID;
+            uint8_t *pageHash = verification ? &verification->computedHashes[i * codeDir.hashSize] : NULL;
 
             if (correct) {
                 printf(" ✅");
@@ -402,6 +598,7 @@ int csd_code_directory_print_content(CS_DecodedBlob *codeDirBlob, MachO *macho,
         if (needsNewline) printf("\n\n");
         needsNewline = false;
     }
+    if (verification) csd_code_slot_verification_free(verification);
     if (verifySlots) {
         if (codeSlotsCorrect) {
             printf("All page hashes are valid!\n");
@@ -414,6 +611,24 @@ int csd_code_directory_print_content(CS_DecodedBlob *codeDirBlob, MachO *macho,
     return 0;
 }
 
+// Rehash pageCount pages starting at firstPage and write the hashes to their slots in one go
+static int _csd_code_directory_rehash_pages(CS_DecodedBlob *codeDirBlob, MachO *macho, CS_CodeDirectory *codeDir, uint64_t dataEnd, uint32_t firstPage, uint32_t pageCount)
+{
+    uint8_t *pageHashes = malloc((size_t)pageCount * codeDir->hashSize);
+    if (!pageHashes) {
+        printf("Error: failed to allocate memory for page hashes\n");
+        return -1;
+    }
+    if (csd_code_directory_hash_pages(macho, codeDir->hashType, codeDir->hashSize, 0x1000, dataEnd, firstPage, pageCount, pageHashes) != 0) {
+        printf("Error: failed to hash pages\n");
+        free(pageHashes);
+        return -1;
+    }
+    csd_blob_write(codeDirBlob, codeDir->hashOffset + ((uint64_t)firstPage * codeDir->hashSize), (size_t)pageCount * codeDir->hashSize, pageHashes);
+    free(pageHashes);
+    return 0;
+}
+
 void csd_code_directory_update(CS_DecodedBlob *codeDirBlob, MachO *macho)
 {
     CS_CodeDirectory codeDir;
@@ -425,26 +640,119 @@ void csd_code_directory_update(CS_DecodedBlob *codeDirBlob, MachO *macho)
     macho_find_code_signature_bounds(macho, &codeSignatureOffset, NULL);
     uint64_t finalPageBoundary = align_to_size(codeSignatureOffset, 0x1000);
     int numberOfPagesToHash = (finalPageBoundary / 0x1000) - 1;
+    if (numberOfPagesToHash <= 0) return;
+
+    _csd_code_directory_rehash_pages(codeDirBlob, macho, &codeDir, finalPageBoundary, 0, numberOfPagesToHash);
+}
+
+int csd_code_directory_update_multiple(CS_DecodedBlob **codeDirBlobs, uint32_t codeDirCount, MachO *macho)
+{
+    if (codeDirCount == 0) return 0;
+
+    uint32_t codeSignatureOffset = 0;
+    // Same as csd_code_directory_update, every page except the final one is rehashed
+    macho_find_code_signature_bounds(macho, &codeSignatureOffset, NULL);
+    uint64_t finalPageBoundary = align_to_size(codeSignatureOffset, 0x1000);
+    int numberOfPagesToHash = (finalPageBoundary / 0x1000) - 1;
+    if (numberOfPagesToHash <= 0) return 0;
+
+    int r = -1;
+    CS_CodeDirectory *codeDirs = malloc(codeDirCount * sizeof(CS_CodeDirectory));
+    uint8_t *hashTypes = malloc(codeDirCount);
+    uint8_t *hashSizes = malloc(codeDirCount);
+    uint8_t **pageHashes = calloc(codeDirCount, sizeof(uint8_t *));
+    if (!codeDirs || !hashTypes || !hashSizes || !pageHashes) {
+        printf("Error: failed to allocate memory for page hashes\n");
+        goto out;
+    }
+
+    for (uint32_t i = 0; i < codeDirCount; i++) {
+        csd_blob_read(codeDirBlobs[i], 0, sizeof(CS_CodeDirectory), &codeDirs[i]);
+        CODE_DIRECTORY_APPLY_BYTE_ORDER(&codeDirs[i], BIG_TO_HOST_APPLIER);
+        hashTypes[i] = codeDirs[i].hashType;
+        hashSizes[i] = codeDirs[i].hashSize;
+        pageHashes[i] = malloc((size_t)numberOfPagesToHash * codeDirs[i].hashSize);
+        if (!pageHashes[i]) {
+            printf("Error: failed to allocate memory for page hashes\n");
+            goto out;
+        }
+    }
+
+    // Every page is only read once, no matter how many code directories there are
+    if (csd_code_directory_hash_pages_multi(macho, codeDirCount, hashTypes, hashSizes, 0x1000, finalPageBoundary, 0, numberOfPagesToHash, pageHashes) != 0) {
+        printf("Error: failed to hash pages\n");
+        goto out;
+    }
+
+    for (uint32_t i = 0; i < codeDirCount; i++) {
+        csd_blob_write(codeDirBlobs[i], codeDirs[i].hashOffset, (size_t)numberOfPagesToHash * codeDirs[i].hashSize, pageHashes[i]);
+    }
+    r = 0;
+
+out:
+    if (pageHashes) {
+        for (uint32_t i = 0; i < codeDirCount; i++) {
+            if (pageHashes[i]) free(pageHashes[i]);
+        }
+        free(pageHashes);
+    }
+    if (hashSizes) free(hashSizes);
+    if (hashTypes) free(hashTypes);
+    if (codeDirs) free(codeDirs);
+    return r;
+}
+
+int csd_code_directory_update_incremental(CS_DecodedBlob *codeDirBlob, MachO *macho)
+{
+    MemoryStream *stream = macho_get_stream(macho);
+    if (!memory_stream_is_tracking_dirty_ranges(stream)) {
+        csd_code_directory_update(codeDirBlob, macho);
+        return 0;
+    }
+
+    CS_CodeDirectory codeDir;
+    csd_blob_read(codeDirBlob, 0, sizeof(CS_CodeDirectory), &codeDir);
+    CODE_DIRECTORY_APPLY_BYTE_ORDER(&codeDir, BIG_TO_HOST_APPLIER);
 
-    for (int pageNumber = 0; pageNumber < numberOfPagesToHash; pageNumber++) {
-        uint64_t pageOffset = pageNumber * 0x1000;
-        uint64_t pageEndOffset = pageOffset + 0x1000;
-        uint64_t pageLength = 0x1000;
-        if (pageEndOffset > finalPageBoundary) {
-            pageLength = finalPageBoundary - pageOffset;
+    uint32_t codeSignatureOffset = 0;
+    macho_find_code_signature_bounds(macho, &codeSignatureOffset, NULL);
+    uint32_t pageCount = align_to_size(codeSignatureOffset, 0x1000) / 0x1000;
+    if (pageCount > codeDir.nCodeSlots) pageCount = codeDir.nCodeSlots;
+    if (pageCount == 0) return 0;
+    uint32_t finalPage = pageCount - 1;
+
+    // Turn the dirty ranges into runs of pages, ranges are sorted so a run only ever needs to be merged with the previous one
+    uint32_t dirtyRangeCount = 0;
+    const MemoryStreamRange *dirtyRanges = memory_stream_get_dirty_ranges(stream, &dirtyRangeCount);
+    uint32_t runStart = 0, runEnd = 0;
+    for (uint32_t i = 0; i < dirtyRangeCount; i++) {
+        if (dirtyRanges[i].start >= codeSignatureOffset) break;
+        uint32_t firstPage = dirtyRanges[i].start / 0x1000;
+        uint32_t endPage = (dirtyRanges[i].end >= codeSignatureOffset) ? pageCount : (uint32_t)((dirtyRanges[i].end + 0xFFF) / 0x1000);
+        if (endPage > pageCount) endPage = pageCount;
+        if (firstPage >= endPage) continue;
+
+        if (runEnd > runStart && firstPage <= runEnd) {
+            if (endPage > runEnd) runEnd = endPage;
+            continue;
         }
+        if (runEnd > runStart) {
+            if (_csd_code_directory_rehash_pages(codeDirBlob, macho, &codeDir, codeSignatureOffset, runStart, runEnd - runStart) != 0) return -1;
+        }
+        runStart = firstPage;
+        runEnd = endPage;
+    }
 
-        // Read page
-        uint8_t pageData[pageLength];
-        memset(pageData, 0, pageLength);
-        macho_read_at_offset(macho, pageOffset, pageLength, pageData);
-
-        // Calculate hash
-        uint8_t pageHash[CC_SHA256_DIGEST_LENGTH];
-        CC_SHA256(pageData, (CC_LONG)pageLength, pageHash);
-    
-        // Write hash to CodeDirectory
-        uint32_t offsetOfBlobToReplace = codeDir.hashOffset + (pageNumber * codeDir.hashSize);
-        csd_blob_write(codeDirBlob, offsetOfBlobToReplace, codeDir.hashSize, pageHash);
+    // The final page ends where the code signature starts, so it is always rehashed
+    if (runEnd > runStart && runEnd >= finalPage) {
+        runEnd = pageCount;
     }
-}
\ No newline at end of file
+    else {
+        if (runEnd > runStart) {
+            if (_csd_code_directory_rehash_pages(codeDirBlob, macho, &codeDir, codeSignatureOffset, runStart, runEnd - runStart) != 0) return -1;
+        }
+        runStart = finalPage;
+        runEnd = pageCount;
+    }
+    return _csd_code_directory_rehash_pages(codeDirBlob, macho, &codeDir, codeSignatureOffset, runStart, runEnd - runStart);
+}
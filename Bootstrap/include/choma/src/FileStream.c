@@ -8,11 +8,22 @@ static int _file_stream_context_is_trimmed(FileStreamContext *context)
     return (context->bufferStart != 0 || context->bufferSize != context->fileSize);
 }
 
+// Positional IO is used for all accesses, so that streams sharing a file descriptor
+// (soft clones, FAT slices, fileset entries) can be used from multiple threads at once
 static int file_stream_read(MemoryStream *stream, uint64_t offset, size_t size, void *outBuf)
 {
     FileStreamContext *context = stream->context;
-    lseek(context->fd, context->bufferStart + offset, SEEK_SET);
-    return read(context->fd, outBuf, size);
+    size_t readSize = 0;
+    while (readSize < size) {
+        ssize_t r = pread(context->fd, (uint8_t *)outBuf + readSize, size - readSize, context->bufferStart + offset + readSize);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (r == 0) break;
+        readSize += r;
+    }
+    return readSize;
 }
 
 static int file_stream_write(MemoryStream *stream, uint64_t offset, size_t size, const void *inBuf)
@@ -28,7 +39,7 @@ static int file_stream_write(MemoryStream *stream, uint64_t offset, size_t size,
     size_t sizeToExpand = 0;
     // only expand when possible
     if ((context->bufferStart + offset + size) > context->fileSize) {
-        if (((stream->flags | MEMORY_STREAM_FLAG_AUTO_EXPAND) == 0) || _file_stream_context_is_trimmed(context)) {
+        if (((stream->flags & MEMORY_STREAM_FLAG_AUTO_EXPAND) == 0) || _file_stream_context_is_trimmed(context)) {
             printf("Error: file_stream_write failed, file is not auto expandable.\n");
             return -1;
         }
@@ -41,8 +52,16 @@ static int file_stream_write(MemoryStream *stream, uint64_t offset, size_t size,
     context->fileSize += sizeToExpand;
     context->bufferSize += sizeToExpand;
 
-    lseek(context->fd, context->bufferStart + offset, SEEK_SET);
-    return write(context->fd, inBuf, size);
+    size_t writtenSize = 0;
+    while (writtenSize < size) {
+        ssize_t r = pwrite(context->fd, (const uint8_t *)inBuf + writtenSize, size - writtenSize, context->bufferStart + offset + writtenSize);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        writtenSize += r;
+    }
+    return writtenSize;
 }
 
 static int file_stream_get_size(MemoryStream *stream, size_t *sizeOut)
@@ -81,8 +100,10 @@ static int file_stream_trim(MemoryStream *stream, size_t trimAtStart, size_t tri
     if ((stream->flags & MEMORY_STREAM_FLAG_MUTABLE) && !_file_stream_context_is_trimmed(context)) {
         // If this stream is mutable, we want to actually trim the file itself
         uint32_t newSize = context->bufferSize - trimAtStart - trimAtEnd;
-        memory_stream_copy_data(stream, trimAtStart, stream, 0, newSize);
-        ftruncate(context->fd, newSize);
+        if (trimAtStart) memory_stream_copy_data(stream, trimAtStart, stream, 0, newSize);
+        if (ftruncate(context->fd, newSize) != 0) return -1;
+        context->fileSize = newSize;
+        context->bufferSize = newSize;
     }
     else {
         // Else just trim the part of the file that this buffer represents
@@ -103,11 +124,10 @@ static int file_stream_expand(MemoryStream *stream, size_t expandAtStart, size_t
     // If this buffer is trimmed, expanding is also not supported
     if (_file_stream_context_is_trimmed(context)) return -1;
 
-    lseek(context->fd, 0, SEEK_END);
-    for (size_t i = expandAtEnd; i < 0; i--) {
-        char buf = 0;
-        write(context->fd, &buf, 1);
-    }
+    // Growing the file zero fills the new space without touching the shared file offset
+    if (ftruncate(context->fd, context->fileSize + expandAtEnd) != 0) return -1;
+    context->fileSize += expandAtEnd;
+    context->bufferSize += expandAtEnd;
     return 0;
 }
 
@@ -138,6 +158,7 @@ MemoryStream *file_stream_init_from_file_descriptor_nodup(int fd, uint32_t buffe
     }
 
     FileStreamContext *context = malloc(sizeof(FileStreamContext));
+    if (!context) goto fail;
     context->fd = fd;
     context->fileSize = s.st_size;
 
@@ -172,7 +193,7 @@ MemoryStream *file_stream_init_from_file_descriptor_nodup(int fd, uint32_t buffe
     return stream;
 
 fail:
-    file_stream_free(stream);
+    free(stream);
     return NULL;
 }
 
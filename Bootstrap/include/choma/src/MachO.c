@@ -1,10 +1,13 @@
 #include "FAT.h"
 #include "FileStream.h"
+#include "CachedStream.h"
 #include "MachO.h"
 #include "MachOByteOrder.h"
 #include "MachOLoadCommand.h"
+#include "MachOSymbolTable.h"
 #include "CSBlob.h"
 #include "MemoryStream.h"
+#include "Util.h"
 
 #include <mach-o/loader.h>
 #import <mach-o/nlist.h>
@@ -15,9 +18,29 @@ int macho_read_at_offset(MachO *macho, uint64_t offset, size_t size, void *outBu
     return memory_stream_read(macho->stream, offset, size, outBuf);
 }
 
+// Mirror a write into the cached load commands, the index is rebuilt before the next enumeration
+static void _macho_sync_load_commands(MachO *macho, uint64_t offset, size_t size, const void *inBuf)
+{
+    if (!macho->loadCommands) return;
+
+    uint64_t loadCommandsStart = sizeof(struct mach_header_64);
+    uint64_t loadCommandsEnd = loadCommandsStart + macho->loadCommandsSize;
+    if (offset >= loadCommandsEnd) return;
+
+    uint64_t copyStart = offset > loadCommandsStart ? offset : loadCommandsStart;
+    uint64_t copyEnd = (offset + size) < loadCommandsEnd ? (offset + size) : loadCommandsEnd;
+    if (copyStart < copyEnd) {
+        // inBuf can be a command that was handed out by macho_enumerate_load_commands
+        memmove(&macho->loadCommands[copyStart - loadCommandsStart], (const uint8_t *)inBuf + (copyStart - offset), copyEnd - copyStart);
+    }
+    macho->loadCommandsStale = true;
+}
+
 int macho_write_at_offset(MachO *macho, uint64_t offset, size_t size, const void *inBuf)
 {
-    return memory_stream_write(macho->stream, offset, size, inBuf);
+    int r = memory_stream_write(macho->stream, offset, size, inBuf);
+    if (r == 0) _macho_sync_load_commands(macho, offset, size, inBuf);
+    return r;
 }
 
 MemoryStream *macho_get_stream(MachO *macho)
@@ -30,35 +53,162 @@ uint32_t macho_get_filetype(MachO *macho)
     return macho->machHeader.filetype;
 }
 
-int macho_translate_fileoff_to_vmaddr(MachO *macho, uint64_t fileoff, uint64_t *vmaddrOut, MachOSegment **segmentOut)
+static uint64_t _macho_address_map_entry_start(MachOAddressMapEntry *entry, bool byFileoff)
 {
+    if (entry->section) return byFileoff ? entry->section->offset : entry->section->addr;
+    return byFileoff ? entry->segment->command.fileoff : entry->segment->command.vmaddr;
+}
+
+static uint64_t _macho_address_map_entry_size(MachOAddressMapEntry *entry, bool byFileoff)
+{
+    if (entry->section) return entry->section->size;
+    return byFileoff ? entry->segment->command.filesize : entry->segment->command.vmsize;
+}
+
+static bool _macho_address_map_entry_contains(MachOAddressMapEntry *entry, uint64_t address, bool byFileoff)
+{
+    uint64_t start = _macho_address_map_entry_start(entry, byFileoff);
+    return address >= start && (address - start) < _macho_address_map_entry_size(entry, byFileoff);
+}
+
+static int _macho_address_map_compare_vmaddr(const void *a, const void *b)
+{
+    uint64_t startA = _macho_address_map_entry_start((MachOAddressMapEntry *)a, false);
+    uint64_t startB = _macho_address_map_entry_start((MachOAddressMapEntry *)b, false);
+    if (startA != startB) return (startA > startB) - (startA < startB);
+    return (int)((MachOAddressMapEntry *)a)->order - (int)((MachOAddressMapEntry *)b)->order;
+}
+
+static int _macho_address_map_compare_fileoff(const void *a, const void *b)
+{
+    uint64_t startA = _macho_address_map_entry_start((MachOAddressMapEntry *)a, true);
+    uint64_t startB = _macho_address_map_entry_start((MachOAddressMapEntry *)b, true);
+    if (startA != startB) return (startA > startB) - (startA < startB);
+    return (int)((MachOAddressMapEntry *)a)->order - (int)((MachOAddressMapEntry *)b)->order;
+}
+
+static bool _macho_section_is_zerofill(struct section_64 *section)
+{
+    uint32_t type = section->flags & SECTION_TYPE;
+    return type == S_ZEROFILL || type == S_GB_ZEROFILL || type == S_THREAD_LOCAL_ZEROFILL;
+}
+
+static int _macho_address_map_build(MachO *macho, MachOAddressMap *map, bool sections, bool byFileoff)
+{
+    free(map->entries);
+    memset(map, 0, sizeof(MachOAddressMap));
+
+    uint32_t capacity = 0;
+    for (uint32_t i = 0; i < macho->segmentCount; i++) {
+        capacity += sections ? macho->segments[i]->command.nsects : 1;
+    }
+    if (!capacity) return 0;
+    map->entries = malloc(capacity * sizeof(MachOAddressMapEntry));
+    if (!map->entries) return -1;
+
     for (uint32_t i = 0; i < macho->segmentCount; i++) {
         MachOSegment *segment = macho->segments[i];
-        uint64_t segmentStartOff = segment->command.fileoff;
-        uint64_t segmentEndOff = segment->command.fileoff + segment->command.filesize;
-        if (fileoff >= segmentStartOff && fileoff < segmentEndOff) {
-            uint64_t relativeFileoff = fileoff - segmentStartOff;
-            *vmaddrOut = segment->command.vmaddr + relativeFileoff;
-            return 0;
+        uint32_t entryCount = sections ? segment->command.nsects : 1;
+        for (uint32_t j = 0; j < entryCount; j++) {
+            MachOAddressMapEntry entry = { segment, sections ? &segment->sections[j] : NULL, map->count };
+            if (!_macho_address_map_entry_size(&entry, byFileoff)) continue;
+            if (byFileoff && entry.section && (_macho_section_is_zerofill(entry.section) || !entry.section->offset)) continue;
+            map->entries[map->count++] = entry;
         }
     }
-    return -1;
+    qsort(map->entries, map->count, sizeof(MachOAddressMapEntry), byFileoff ? _macho_address_map_compare_fileoff : _macho_address_map_compare_vmaddr);
+
+    uint64_t highestEnd = 0;
+    for (uint32_t i = 0; i < map->count; i++) {
+        uint64_t start = _macho_address_map_entry_start(&map->entries[i], byFileoff);
+        if (i > 0 && start < highestEnd) map->overlapping = true;
+        uint64_t end = start + _macho_address_map_entry_size(&map->entries[i], byFileoff);
+        if (end > highestEnd) highestEnd = end;
+    }
+    return 0;
 }
 
-int macho_translate_vmaddr_to_fileoff(MachO *macho, uint64_t vmaddr, uint64_t *fileoffOut, MachOSegment **segmentOut)
+static MachOAddressMapEntry *_macho_address_map_lookup(MachOAddressMap *map, uint64_t address, bool byFileoff)
 {
-    for (uint32_t i = 0; i < macho->segmentCount; i++) {
-        MachOSegment *segment = macho->segments[i];
-        uint64_t segmentVmAddr = segment->command.vmaddr;
-        uint64_t segmentVmEnd = segment->command.vmaddr + segment->command.vmsize;
-        if (vmaddr >= segmentVmAddr && vmaddr < segmentVmEnd) {
-            uint64_t relativeVmAddr = vmaddr - segmentVmAddr;
-            *fileoffOut = segment->command.fileoff + relativeVmAddr;
-            if (segmentOut) *segmentOut = segment;
-            return 0;
+    if (map->overlapping) {
+        MachOAddressMapEntry *firstMatch = NULL;
+        for (uint32_t i = 0; i < map->count; i++) {
+            MachOAddressMapEntry *entry = &map->entries[i];
+            if (_macho_address_map_entry_contains(entry, address, byFileoff) && (!firstMatch || entry->order < firstMatch->order)) {
+                firstMatch = entry;
+            }
         }
+        return firstMatch;
+    }
+
+    // Reads tend to hit the same segment over and over again
+    uint32_t lastHit = __atomic_load_n(&map->lastHit, __ATOMIC_RELAXED);
+    if (lastHit && lastHit <= map->count && _macho_address_map_entry_contains(&map->entries[lastHit - 1], address, byFileoff)) {
+        return &map->entries[lastHit - 1];
+    }
+
+    // Find the first entry above the address, the one before it is the only candidate
+    uint32_t low = 0, high = map->count;
+    while (low < high) {
+        uint32_t mid = low + ((high - low) / 2);
+        if (_macho_address_map_entry_start(&map->entries[mid], byFileoff) <= address) low = mid + 1;
+        else high = mid;
     }
-    return -1;
+    if (!low || !_macho_address_map_entry_contains(&map->entries[low - 1], address, byFileoff)) return NULL;
+
+    __atomic_store_n(&map->lastHit, low, __ATOMIC_RELAXED);
+    return &map->entries[low - 1];
+}
+
+static int _macho_build_address_maps(MachO *macho)
+{
+    if (_macho_address_map_build(macho, &macho->segmentsByVmaddr, false, false) != 0) return -1;
+    if (_macho_address_map_build(macho, &macho->segmentsByFileoff, false, true) != 0) return -1;
+    if (_macho_address_map_build(macho, &macho->sectionsByVmaddr, true, false) != 0) return -1;
+    if (_macho_address_map_build(macho, &macho->sectionsByFileoff, true, true) != 0) return -1;
+    return 0;
+}
+
+int macho_translate_fileoff_to_vmaddr(MachO *macho, uint64_t fileoff, uint64_t *vmaddrOut, MachOSegment **segmentOut)
+{
+    MachOAddressMapEntry *entry = _macho_address_map_lookup(&macho->segmentsByFileoff, fileoff, true);
+    if (!entry) return -1;
+
+    MachOSegment *segment = entry->segment;
+    *vmaddrOut = segment->command.vmaddr + (fileoff - segment->command.fileoff);
+    if (segmentOut) *segmentOut = segment;
+    return 0;
+}
+
+int macho_translate_vmaddr_to_fileoff(MachO *macho, uint64_t vmaddr, uint64_t *fileoffOut, MachOSegment **segmentOut)
+{
+    MachOAddressMapEntry *entry = _macho_address_map_lookup(&macho->segmentsByVmaddr, vmaddr, false);
+    if (!entry) return -1;
+
+    MachOSegment *segment = entry->segment;
+    *fileoffOut = segment->command.fileoff + (vmaddr - segment->command.vmaddr);
+    if (segmentOut) *segmentOut = segment;
+    return 0;
+}
+
+int macho_translate_vmaddr_to_section(MachO *macho, uint64_t vmaddr, MachOSegment **segmentOut, struct section_64 **sectionOut)
+{
+    MachOAddressMapEntry *entry = _macho_address_map_lookup(&macho->sectionsByVmaddr, vmaddr, false);
+    if (!entry) return -1;
+
+    if (segmentOut) *segmentOut = entry->segment;
+    if (sectionOut) *sectionOut = entry->section;
+    return 0;
+}
+
+int macho_translate_fileoff_to_section(MachO *macho, uint64_t fileoff, MachOSegment **segmentOut, struct section_64 **sectionOut)
+{
+    MachOAddressMapEntry *entry = _macho_address_map_lookup(&macho->sectionsByFileoff, fileoff, true);
+    if (!entry) return -1;
+
+    if (segmentOut) *segmentOut = entry->segment;
+    if (sectionOut) *sectionOut = entry->section;
+    return 0;
 }
 
 int macho_read_at_vmaddr(MachO *macho, uint64_t vmaddr, size_t size, void *outBuf)
@@ -68,8 +218,7 @@ int macho_read_at_vmaddr(MachO *macho, uint64_t vmaddr, size_t size, void *outBu
     int r = macho_translate_vmaddr_to_fileoff(macho, vmaddr, &fileoff, &segment);
     if (r != 0) return r;
 
-    uint64_t readEnd = vmaddr + size;
-    if (readEnd >= (segment->command.vmaddr + segment->command.vmsize)) {
+    if (size > ((segment->command.vmaddr + segment->command.vmsize) - vmaddr)) {
         // prevent OOB
         return -1;
     }
@@ -84,8 +233,7 @@ int macho_write_at_vmaddr(MachO *macho, uint64_t vmaddr, size_t size, const void
     int r = macho_translate_vmaddr_to_fileoff(macho, vmaddr, &fileoff, &segment);
     if (r != 0) return r;
 
-    uint64_t readEnd = vmaddr + size;
-    if (readEnd >= (segment->command.vmaddr + segment->command.vmsize)) {
+    if (size > ((segment->command.vmaddr + segment->command.vmsize) - vmaddr)) {
         // prevent OOB
         return -1;
     }
@@ -93,66 +241,147 @@ int macho_write_at_vmaddr(MachO *macho, uint64_t vmaddr, size_t size, const void
     return macho_write_at_offset(macho, fileoff, size, inBuf);
 }
 
-int macho_enumerate_load_commands(MachO *macho, void (^enumeratorBlock)(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop))
+static int _macho_load_command_type_compare(const void *a, const void *b)
 {
+    uint64_t keyA = *(const uint64_t *)a, keyB = *(const uint64_t *)b;
+    return (keyA > keyB) - (keyA < keyB);
+}
+
+// Build the entry table and the index by type from the cached load commands
+static int _macho_index_load_commands(MachO *macho)
+{
+    free(macho->loadCommandEntries);
+    free(macho->loadCommandsByType);
+    macho->loadCommandEntries = NULL;
+    macho->loadCommandsByType = NULL;
+    macho->loadCommandCount = 0;
+
+    uint32_t ncmds = macho->machHeader.ncmds;
+    macho->loadCommandEntries = malloc(ncmds * sizeof(MachOLoadCommandEntry));
+    macho->loadCommandsByType = malloc(ncmds * sizeof(uint64_t));
+    if (!macho->loadCommandEntries || !macho->loadCommandsByType) return -1;
+
+    uint32_t position = 0;
+    for (uint32_t i = 0; i < ncmds; i++) {
+        if (position + sizeof(struct load_command) > macho->loadCommandsSize) {
+            printf("Error: load command %u starts outside of sizeofcmds.\n", i);
+            break;
+        }
+        struct load_command loadCommand;
+        memcpy(&loadCommand, &macho->loadCommands[position], sizeof(loadCommand));
+        LOAD_COMMAND_APPLY_BYTE_ORDER(&loadCommand, LITTLE_TO_HOST_APPLIER);
+        if (loadCommand.cmdsize < sizeof(loadCommand) || position + loadCommand.cmdsize > macho->loadCommandsSize) {
+            printf("Error: load command %u has an invalid size (0x%x).\n", i, loadCommand.cmdsize);
+            break;
+        }
+
+        if (strcmp(load_command_to_string(loadCommand.cmd), "LC_UNKNOWN") == 0) {
+            printf("Ignoring unknown command: 0x%x.\n", loadCommand.cmd);
+        }
+        else {
+            uint32_t idx = macho->loadCommandCount++;
+            macho->loadCommandEntries[idx] = (MachOLoadCommandEntry){
+                .cmd = loadCommand.cmd,
+                .cmdsize = loadCommand.cmdsize,
+                .offset = sizeof(struct mach_header_64) + position,
+            };
+            macho->loadCommandsByType[idx] = ((uint64_t)loadCommand.cmd << 32) | idx;
+        }
+        position += loadCommand.cmdsize;
+    }
+
+    // Keys contain the entry index, so commands of the same type stay in file order
+    qsort(macho->loadCommandsByType, macho->loadCommandCount, sizeof(uint64_t), _macho_load_command_type_compare);
+    macho->loadCommandsStale = false;
+    return 0;
+}
+
+// Read all load commands with one read and index them
+static int _macho_load_load_commands(MachO *macho)
+{
+    uint32_t sizeofcmds = macho->machHeader.sizeofcmds;
+    uint8_t *loadCommands = malloc(sizeofcmds ? sizeofcmds : 1);
+    if (!loadCommands) return -1;
+    if (macho_read_at_offset(macho, sizeof(struct mach_header_64), sizeofcmds, loadCommands) != 0) {
+        printf("Error: failed to read load commands (size 0x%x).\n", sizeofcmds);
+        free(loadCommands);
+        return -1;
+    }
+
+    free(macho->loadCommands);
+    macho->loadCommands = loadCommands;
+    macho->loadCommandsSize = sizeofcmds;
+    return _macho_index_load_commands(macho);
+}
+
+static int _macho_ensure_load_commands(MachO *macho)
+{
+    if (macho->loadCommands && !macho->loadCommandsStale) return 0;
     if (macho->machHeader.ncmds < 1 || macho->machHeader.ncmds > 1000) {
         printf("Error: invalid number of load commands (%d).\n", macho->machHeader.ncmds);
         return -1;
     }
 
-    // First load command starts after mach header
-    uint64_t offset = sizeof(struct mach_header_64);
+    // Writes inside the load commands have already been mirrored into the copy, only a new size requires reading them again
+    if (macho->loadCommands && macho->loadCommandsSize == macho->machHeader.sizeofcmds) {
+        return _macho_index_load_commands(macho);
+    }
+    return _macho_load_load_commands(macho);
+}
 
-    for (int j = 0; j < macho->machHeader.ncmds; j++) {
-        struct load_command loadCommand;
-        macho_read_at_offset(macho, offset, sizeof(loadCommand), &loadCommand);
-        LOAD_COMMAND_APPLY_BYTE_ORDER(&loadCommand, LITTLE_TO_HOST_APPLIER);
+static bool _macho_enumerate_load_command_entry(MachO *macho, MachOLoadCommandEntry *entry, void (^enumeratorBlock)(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop))
+{
+    struct load_command loadCommand = { .cmd = entry->cmd, .cmdsize = entry->cmdsize };
+    bool stop = false;
+    enumeratorBlock(loadCommand, entry->offset, &macho->loadCommands[entry->offset - sizeof(struct mach_header_64)], &stop);
+    return stop;
+}
 
-        if (strcmp(load_command_to_string(loadCommand.cmd), "LC_UNKNOWN") == 0)
-		{
-			printf("Ignoring unknown command: 0x%x.\n", loadCommand.cmd);
-		}
-        else {
-            // TODO: Check if cmdsize matches expected size for cmd
-            uint8_t cmd[loadCommand.cmdsize];
-            macho_read_at_offset(macho, offset, loadCommand.cmdsize, cmd);
-            bool stop = false;
-            enumeratorBlock(loadCommand, offset, (void *)cmd, &stop);
-            if (stop) break;
-        }
-        offset += loadCommand.cmdsize;
+int macho_enumerate_load_commands(MachO *macho, void (^enumeratorBlock)(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop))
+{
+    if (_macho_ensure_load_commands(macho) != 0) return -1;
+
+    // The count is taken up front, a block that writes to the load commands only marks the index as stale
+    uint32_t loadCommandCount = macho->loadCommandCount;
+    MachOLoadCommandEntry *entries = macho->loadCommandEntries;
+    for (uint32_t i = 0; i < loadCommandCount; i++) {
+        if (_macho_enumerate_load_command_entry(macho, &entries[i], enumeratorBlock)) break;
+    }
+    return 0;
+}
+
+int macho_enumerate_load_commands_of_type(MachO *macho, uint32_t cmdType, void (^enumeratorBlock)(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop))
+{
+    if (_macho_ensure_load_commands(macho) != 0) return -1;
+
+    // Find the first key of this type
+    uint64_t firstKey = (uint64_t)cmdType << 32;
+    uint32_t low = 0, high = macho->loadCommandCount;
+    while (low < high) {
+        uint32_t mid = low + ((high - low) / 2);
+        if (macho->loadCommandsByType[mid] < firstKey) low = mid + 1;
+        else high = mid;
+    }
+
+    uint32_t loadCommandCount = macho->loadCommandCount;
+    uint64_t *byType = macho->loadCommandsByType;
+    MachOLoadCommandEntry *entries = macho->loadCommandEntries;
+    for (uint32_t i = low; i < loadCommandCount && (byType[i] >> 32) == cmdType; i++) {
+        if (_macho_enumerate_load_command_entry(macho, &entries[(uint32_t)byType[i]], enumeratorBlock)) break;
     }
     return 0;
 }
 
 int macho_enumerate_symbols(MachO *macho, void (^enumeratorBlock)(const char *name, uint8_t type, uint64_t vmaddr, bool *stop))
 {
-    macho_enumerate_load_commands(macho, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
-        if (loadCommand.cmd == LC_SYMTAB) {
-            struct symtab_command *symtabCommand = (struct symtab_command *)cmd;
-            SYMTAB_COMMAND_APPLY_BYTE_ORDER(symtabCommand, LITTLE_TO_HOST_APPLIER);
-            char strtbl[symtabCommand->strsize];
-            macho_read_at_offset(macho, symtabCommand->stroff, symtabCommand->strsize, strtbl);
-
-            for (int i = 0; i < symtabCommand->nsyms; i++) {
-                struct nlist_64 entry = { 0 };
-                macho_read_at_offset(macho, symtabCommand->symoff + (i * sizeof(entry)), sizeof(entry), &entry);
-                NLIST_64_APPLY_BYTE_ORDER(&entry, LITTLE_TO_HOST_APPLIER);
-                if (entry.n_un.n_strx >= symtabCommand->strsize || entry.n_un.n_strx == 0) continue;
-
-                const char *symbolName = &strtbl[entry.n_un.n_strx];
-                if (symbolName[0] == 0) continue;
-
-                bool stopSym = false;
-                enumeratorBlock(symbolName, entry.n_type, entry.n_value, &stopSym);
-                if (stopSym) {
-                    *stop = true;
-                    break;   
-                }
-            }
-        }
-    });
+    // Lookups aren't needed for enumerating, so skip building the indexes
+    MachOSymbolTable *symbolTable = macho_symbol_table_init_unindexed(macho);
+    if (!symbolTable) return 0;
 
+    macho_symbol_table_enumerate(symbolTable, ^(MachOSymbol *symbol, bool *stop) {
+        enumeratorBlock(symbol->name, symbol->type, symbol->vmaddr, stop);
+    });
+    macho_symbol_table_free(symbolTable);
     return 0;
 }
 
@@ -164,19 +393,23 @@ int macho_enumerate_dependencies(MachO *macho, void (^enumeratorBlock)(const cha
             loadCommand.cmd == LC_REEXPORT_DYLIB || 
             loadCommand.cmd == LC_LAZY_LOAD_DYLIB ||
             loadCommand.cmd == LC_LOAD_UPWARD_DYLIB) {
-            struct dylib_command *dylibCommand = (struct dylib_command *)cmd;
+            struct dylib_command dylibCommandCopy;
+            memcpy(&dylibCommandCopy, cmd, sizeof(dylibCommandCopy));
+            struct dylib_command *dylibCommand = &dylibCommandCopy;
             DYLIB_COMMAND_APPLY_BYTE_ORDER(dylibCommand, LITTLE_TO_HOST_APPLIER);
             if (dylibCommand->dylib.name.offset >= loadCommand.cmdsize || dylibCommand->dylib.name.offset < sizeof(struct dylib_command)) {
                 printf("WARNING: Malformed dependency at 0x%llx (Name offset out of bounds)\n", offset);
                 return;
             }
             char *dependencyPath = ((char *)cmd + dylibCommand->dylib.name.offset);
-            size_t dependencyLength = strnlen(dependencyPath, loadCommand.cmdsize - dylibCommand->dylib.name.offset);
+            size_t dependencyMaxLength = loadCommand.cmdsize - dylibCommand->dylib.name.offset;
+            size_t dependencyLength = strnlen(dependencyPath, dependencyMaxLength);
             if (!dependencyLength) {
                 printf("WARNING: Malformed dependency at 0x%llx (Name has zero length)\n", offset);
                 return;
             }
-            if (dependencyPath[dependencyLength] != 0) {
+            // cmd points into the cached load commands, so don't look past the end of the command
+            if (dependencyLength == dependencyMaxLength) {
                 printf("WARNING: Malformed dependency at 0x%llx (Name has non NULL end byte)\n", offset);
                 return;
             }
@@ -194,32 +427,33 @@ int macho_enumerate_dependencies(MachO *macho, void (^enumeratorBlock)(const cha
 
 int macho_enumerate_rpaths(MachO *macho, void (^enumeratorBlock)(const char *rpath, bool *stop))
 {
-    macho_enumerate_load_commands(macho, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
-        if (loadCommand.cmd == LC_RPATH) {
-            struct rpath_command *rpathCommand = (struct rpath_command *)cmd;
-            RPATH_COMMAND_APPLY_BYTE_ORDER(rpathCommand, LITTLE_TO_HOST_APPLIER);
-
-            if (rpathCommand->path.offset >= loadCommand.cmdsize || rpathCommand->path.offset < sizeof(struct rpath_command)) {
-                printf("WARNING: Malformed rpath at 0x%llx (Path offset out of bounds)\n", offset);
-                return;
-            }
+    macho_enumerate_load_commands_of_type(macho, LC_RPATH, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        struct rpath_command rpathCommand;
+        memcpy(&rpathCommand, cmd, sizeof(rpathCommand));
+        RPATH_COMMAND_APPLY_BYTE_ORDER(&rpathCommand, LITTLE_TO_HOST_APPLIER);
+
+        if (rpathCommand.path.offset >= loadCommand.cmdsize || rpathCommand.path.offset < sizeof(struct rpath_command)) {
+            printf("WARNING: Malformed rpath at 0x%llx (Path offset out of bounds)\n", offset);
+            return;
+        }
 
-            char *rpath = ((char *)cmd) + rpathCommand->path.offset;
-            size_t rpathLength = strnlen(rpath, rpathCommand->cmdsize - rpathCommand->path.offset);
-            if (!rpathLength) {
-                printf("WARNING: Malformed rpath at 0x%llx (Path has zero length)\n", offset);
-                return;
-            }
-            if (rpath[rpathLength] != 0) {
-                printf("WARNING: Malformed rpath at 0x%llx (Name has non NULL end byte)\n", offset);
-                return;
-            }
+        char *rpath = ((char *)cmd) + rpathCommand.path.offset;
+        size_t rpathMaxLength = loadCommand.cmdsize - rpathCommand.path.offset;
+        size_t rpathLength = strnlen(rpath, rpathMaxLength);
+        if (!rpathLength) {
+            printf("WARNING: Malformed rpath at 0x%llx (Path has zero length)\n", offset);
+            return;
+        }
+        // cmd points into the cached load commands, so don't look past the end of the command
+        if (rpathLength == rpathMaxLength) {
+            printf("WARNING: Malformed rpath at 0x%llx (Name has non NULL end byte)\n", offset);
+            return;
+        }
 
-            bool stopRpath = false;
-            enumeratorBlock(rpath, &stopRpath);
-            if (stopRpath) {
-                *stop = true;
-            }
+        bool stopRpath = false;
+        enumeratorBlock(rpath, &stopRpath);
+        if (stopRpath) {
+            *stop = true;
         }
     });
     return 0;
@@ -227,47 +461,124 @@ int macho_enumerate_rpaths(MachO *macho, void (^enumeratorBlock)(const char *rpa
 
 int macho_parse_segments(MachO *macho)
 {
-    return macho_enumerate_load_commands(macho, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
-        if (loadCommand.cmd == LC_SEGMENT_64) {
-            macho->segmentCount++;
-            if (macho->segments == NULL) { macho->segments = malloc(macho->segmentCount * sizeof(MachOSegment*)); }
-            else { macho->segments = realloc(macho->segments, macho->segmentCount * sizeof(MachOSegment*)); }
-            macho->segments[macho->segmentCount-1] = malloc(loadCommand.cmdsize);
-            memcpy(macho->segments[macho->segmentCount-1], cmd, loadCommand.cmdsize);
-            SEGMENT_COMMAND_64_APPLY_BYTE_ORDER(&macho->segments[macho->segmentCount-1]->command, LITTLE_TO_HOST_APPLIER);
-            for (uint32_t i = 0; i < macho->segments[macho->segmentCount-1]->command.nsects; i++) {
-                SECTION_64_APPLY_BYTE_ORDER(&macho->segments[macho->segmentCount-1]->sections[i], LITTLE_TO_HOST_APPLIER);
-            }
+    return macho_enumerate_load_commands_of_type(macho, LC_SEGMENT_64, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        macho->segmentCount++;
+        if (macho->segments == NULL) { macho->segments = malloc(macho->segmentCount * sizeof(MachOSegment*)); }
+        else { macho->segments = realloc(macho->segments, macho->segmentCount * sizeof(MachOSegment*)); }
+        macho->segments[macho->segmentCount-1] = malloc(loadCommand.cmdsize);
+        memcpy(macho->segments[macho->segmentCount-1], cmd, loadCommand.cmdsize);
+        SEGMENT_COMMAND_64_APPLY_BYTE_ORDER(&macho->segments[macho->segmentCount-1]->command, LITTLE_TO_HOST_APPLIER);
+        for (uint32_t i = 0; i < macho->segments[macho->segmentCount-1]->command.nsects; i++) {
+            SECTION_64_APPLY_BYTE_ORDER(&macho->segments[macho->segmentCount-1]->sections[i], LITTLE_TO_HOST_APPLIER);
         }
     });
 }
 
+static uint32_t _macho_fileset_hash(const char *entryId)
+{
+    return (uint32_t)fnv1a_hash(entryId, strlen(entryId));
+}
+
+// Only records the entries, the sub-MachOs are parsed by macho_fileset_entry_get_fat
 int macho_parse_fileset_machos(MachO *macho)
 {
     if (macho_get_filetype(macho) != MH_FILESET) return -1;
-    return macho_enumerate_load_commands(macho, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
-        if (loadCommand.cmd == LC_FILESET_ENTRY) {
-            uint32_t i = macho->filesetCount;
-            macho->filesetCount++;
-
-            struct fileset_entry_command *filesetCommand = cmd;
-            FILESET_ENTRY_COMMAND_APPLY_BYTE_ORDER(filesetCommand, LITTLE_TO_HOST_APPLIER);
-
-            if (macho->filesetMachos == NULL) { macho->filesetMachos = malloc(macho->filesetCount * sizeof(FilesetMachO)); }
-            else { macho->filesetMachos = realloc(macho->filesetMachos, macho->filesetCount * sizeof(FilesetMachO)); }
-
-            FilesetMachO *filesetMacho = &macho->filesetMachos[i];
-            filesetMacho->entry_id = strdup((char *)cmd + filesetCommand->entry_id.offset);
-            filesetMacho->vmaddr = filesetCommand->vmaddr;
-            filesetMacho->fileoff = filesetCommand->fileoff;
-            
-            MemoryStream *subStream = memory_stream_softclone(macho->stream);
-            
-            // TODO: Also cut trim to the end of the macho, but for that we would need to determine it's size
-            memory_stream_trim(subStream, filesetCommand->fileoff, 0);
-            filesetMacho->underlyingMachO = fat_init_from_memory_stream(subStream);
+
+    // The entries hold dispatch_once_t's, so the array can't be reallocated once they are filled in
+    __block uint32_t entryCount = 0;
+    macho_enumerate_load_commands_of_type(macho, LC_FILESET_ENTRY, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        entryCount++;
+    });
+    if (!entryCount) return 0;
+
+    macho->filesetMachos = calloc(entryCount, sizeof(FilesetMachO));
+    if (!macho->filesetMachos) return -1;
+
+    macho_enumerate_load_commands_of_type(macho, LC_FILESET_ENTRY, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        if (loadCommand.cmdsize < sizeof(struct fileset_entry_command)) return;
+
+        struct fileset_entry_command filesetCommand;
+        memcpy(&filesetCommand, cmd, sizeof(filesetCommand));
+        FILESET_ENTRY_COMMAND_APPLY_BYTE_ORDER(&filesetCommand, LITTLE_TO_HOST_APPLIER);
+
+        uint32_t entryIdOffset = filesetCommand.entry_id.offset;
+        if (entryIdOffset < sizeof(struct fileset_entry_command) || entryIdOffset >= loadCommand.cmdsize) {
+            printf("WARNING: Malformed fileset entry at 0x%llx (entry_id out of bounds)\n", offset);
+            return;
+        }
+
+        FilesetMachO *filesetMacho = &macho->filesetMachos[macho->filesetCount];
+        // cmd points into the cached load commands, so don't look past the end of the command
+        filesetMacho->entry_id = strndup((char *)cmd + entryIdOffset, loadCommand.cmdsize - entryIdOffset);
+        if (!filesetMacho->entry_id) return;
+        filesetMacho->vmaddr = filesetCommand.vmaddr;
+        filesetMacho->fileoff = filesetCommand.fileoff;
+        macho->filesetCount++;
+    });
+
+    // Keep the load factor at or below 50%
+    macho->filesetHashTableSize = 16;
+    while (macho->filesetHashTableSize < (macho->filesetCount * 2)) {
+        macho->filesetHashTableSize <<= 1;
+    }
+    macho->filesetHashTable = calloc(macho->filesetHashTableSize, sizeof(uint32_t));
+    if (!macho->filesetHashTable) return -1;
+
+    uint32_t mask = macho->filesetHashTableSize - 1;
+    for (uint32_t i = 0; i < macho->filesetCount; i++) {
+        uint32_t slot = _macho_fileset_hash(macho->filesetMachos[i].entry_id) & mask;
+        bool duplicate = false;
+        while (macho->filesetHashTable[slot]) {
+            // Like the linear search this replaces, the first entry with an id wins
+            if (!strcmp(macho->filesetMachos[macho->filesetHashTable[slot] - 1].entry_id, macho->filesetMachos[i].entry_id)) {
+                duplicate = true;
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        if (!duplicate) macho->filesetHashTable[slot] = i + 1;
+    }
+    return 0;
+}
+
+FilesetMachO *macho_find_fileset_entry(MachO *macho, const char *entryId)
+{
+    if (!macho->filesetHashTable) return NULL;
+
+    uint32_t mask = macho->filesetHashTableSize - 1;
+    uint32_t slot = _macho_fileset_hash(entryId) & mask;
+    while (macho->filesetHashTable[slot]) {
+        FilesetMachO *filesetMacho = &macho->filesetMachos[macho->filesetHashTable[slot] - 1];
+        if (!strcmp(filesetMacho->entry_id, entryId)) return filesetMacho;
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+FAT *macho_fileset_entry_get_fat(MachO *macho, FilesetMachO *filesetMacho)
+{
+    dispatch_once(&filesetMacho->underlyingMachOOnce, ^{
+        MemoryStream *subStream = memory_stream_softclone(macho->stream);
+        if (!subStream) return;
+
+        // TODO: Also cut trim to the end of the macho, but for that we would need to determine it's size
+        if (memory_stream_trim(subStream, filesetMacho->fileoff, 0) != 0) {
+            memory_stream_free(subStream);
+            return;
         }
+        filesetMacho->underlyingMachO = fat_init_from_memory_stream(subStream);
     });
+    return filesetMacho->underlyingMachO;
+}
+
+MachO *macho_get_fileset_macho(MachO *macho, const char *entryId)
+{
+    FilesetMachO *filesetMacho = macho_find_fileset_entry(macho, entryId);
+    if (!filesetMacho) return NULL;
+
+    FAT *fat = macho_fileset_entry_get_fat(macho, filesetMacho);
+    if (!fat || fat->slicesCount != 1) return NULL;
+    return fat->slices[0];
 }
 
 int _macho_parse(MachO *macho)
@@ -282,7 +593,10 @@ int _macho_parse(MachO *macho)
             return -1;
         }
 
+        // Everything below only walks the load commands read here
+        _macho_ensure_load_commands(macho);
         macho_parse_segments(macho);
+        if (_macho_build_address_maps(macho) != 0) return -1;
         macho_parse_fileset_machos(macho);
     }
     return 0;
@@ -319,8 +633,12 @@ MachO *macho_init_for_writing(const char *filePath)
     if (!macho) return NULL;
     memset(macho, 0, sizeof(MachO));
 
-    macho->stream = file_stream_init_from_path(filePath, 0, FILE_STREAM_SIZE_AUTO, FILE_STREAM_FLAG_WRITABLE | FILE_STREAM_FLAG_AUTO_EXPAND);
-    if (!macho->stream) goto fail;
+    MemoryStream *fileStream = file_stream_init_from_path(filePath, 0, FILE_STREAM_SIZE_AUTO, FILE_STREAM_FLAG_WRITABLE | FILE_STREAM_FLAG_AUTO_EXPAND);
+    if (!fileStream) goto fail;
+
+    // Writes go straight through the cache, so the file is always up to date
+    macho->stream = cached_stream_init(fileStream, 0, 0);
+    if (!macho->stream) macho->stream = fileStream;
 
     size_t fileSize = memory_stream_get_size(macho->stream);
     memory_stream_read(macho->stream, 0, sizeof(struct mach_header_64), &macho->machHeader);
@@ -369,9 +687,10 @@ bool macho_is_encrypted(MachO *macho)
     __block bool isEncrypted = false;
     macho_enumerate_load_commands(macho, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
         if (loadCommand.cmd == LC_ENCRYPTION_INFO_64 || loadCommand.cmd == LC_ENCRYPTION_INFO) {
-            struct encryption_info_command *encryptionInfoCommand = cmd;
-            ENCRYPTION_INFO_COMMAND_APPLY_BYTE_ORDER(encryptionInfoCommand, LITTLE_TO_HOST_APPLIER);
-            if (encryptionInfoCommand->cryptid == 1) {
+            struct encryption_info_command encryptionInfoCommand;
+            memcpy(&encryptionInfoCommand, cmd, sizeof(encryptionInfoCommand));
+            ENCRYPTION_INFO_COMMAND_APPLY_BYTE_ORDER(&encryptionInfoCommand, LITTLE_TO_HOST_APPLIER);
+            if (encryptionInfoCommand.cryptid == 1) {
                 *stop = true;
                 isEncrypted = true;
             }
@@ -380,21 +699,43 @@ bool macho_is_encrypted(MachO *macho)
     return isEncrypted;
 }
 
+int macho_get_uuid(MachO *macho, uint8_t uuidOut[16])
+{
+    __block int r = -1;
+    macho_enumerate_load_commands_of_type(macho, LC_UUID, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        if (loadCommand.cmdsize >= sizeof(struct uuid_command)) {
+            struct uuid_command *uuidCommand = cmd;
+            memcpy(uuidOut, uuidCommand->uuid, sizeof(uuidCommand->uuid));
+            r = 0;
+            *stop = true;
+        }
+    });
+    return r;
+}
+
 void macho_free(MachO *macho)
 {
-    if (macho->filesetCount != 0 && macho->filesetMachos) {
+    if (macho->filesetMachos) {
         for (uint32_t i = 0; i < macho->filesetCount; i++) {
-            fat_free(macho->filesetMachos[i].underlyingMachO);
+            if (macho->filesetMachos[i].underlyingMachO) fat_free(macho->filesetMachos[i].underlyingMachO);
             free(macho->filesetMachos[i].entry_id);
         }
         free(macho->filesetMachos);
     }
+    free(macho->filesetHashTable);
     if (macho->segmentCount != 0 && macho->segments) {
         for (uint32_t i = 0; i < macho->segmentCount; i++) {
             free(macho->segments[i]);
         }
         free(macho->segments);
     }
+    free(macho->segmentsByVmaddr.entries);
+    free(macho->segmentsByFileoff.entries);
+    free(macho->sectionsByVmaddr.entries);
+    free(macho->sectionsByFileoff.entries);
+    free(macho->loadCommands);
+    free(macho->loadCommandEntries);
+    free(macho->loadCommandsByType);
     if (macho->stream) {
         memory_stream_free(macho->stream);
     }
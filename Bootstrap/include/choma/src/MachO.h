@@ -2,6 +2,7 @@
 #define MACHO_SLICE_H
 
 #include <stdbool.h>
+#include <dispatch/dispatch.h>
 #include <mach-o/fat.h>
 #include <mach-o/loader.h>
 #include "MemoryStream.h"
@@ -17,9 +18,31 @@ typedef struct FilesetMachO {
     char *entry_id;
     uint64_t vmaddr;
     uint64_t fileoff;
+    // Only parsed on first use, access it through macho_fileset_entry_get_fat
+    dispatch_once_t underlyingMachOOnce;
 	FAT *underlyingMachO;
 } FilesetMachO;
 
+typedef struct MachOLoadCommandEntry {
+    uint32_t cmd;
+    uint32_t cmdsize;
+    uint64_t offset;
+} MachOLoadCommandEntry;
+
+typedef struct MachOAddressMapEntry {
+    MachOSegment *segment;
+    struct section_64 *section; // NULL in the segment maps
+    uint32_t order; // Position in load command order, decides between overlapping entries
+} MachOAddressMapEntry;
+
+// Entries sorted by start address, bounds are read from the segment / section so they follow in-place updates
+typedef struct MachOAddressMap {
+    uint32_t count;
+    MachOAddressMapEntry *entries;
+    bool overlapping; // Lookups fall back to a linear scan to return the first match in load command order
+    uint32_t lastHit; // Index + 1 of the entry that matched last, 0 if there is none
+} MachOAddressMap;
+
 typedef struct MachO {
     MemoryStream *stream;
     bool isSupported;
@@ -28,9 +51,27 @@ typedef struct MachO {
 
     uint32_t filesetCount;
     FilesetMachO *filesetMachos;
+    // Open addressing hash table from entry_id to fileset entry, entries are index + 1 (0 is empty)
+    uint32_t filesetHashTableSize;
+    uint32_t *filesetHashTable;
 
     uint32_t segmentCount;
     MachOSegment **segments;
+
+    // Built once by macho_init, used by the translation functions
+    MachOAddressMap segmentsByVmaddr;
+    MachOAddressMap segmentsByFileoff;
+    MachOAddressMap sectionsByVmaddr;
+    MachOAddressMap sectionsByFileoff;
+
+    // Load commands as read by macho_init, in file byte order
+    uint8_t *loadCommands;
+    uint32_t loadCommandsSize;
+    uint32_t loadCommandCount;
+    MachOLoadCommandEntry *loadCommandEntries;
+    // (cmd << 32) | entry index, sorted, so that all commands of one type can be found with a binary search
+    uint64_t *loadCommandsByType;
+    bool loadCommandsStale;
 } MachO;
 
 // Read data from a MachO at a specified offset
@@ -46,15 +87,31 @@ uint32_t macho_get_filetype(MachO *macho);
 int macho_translate_fileoff_to_vmaddr(MachO *macho, uint64_t fileoff, uint64_t *vmaddrOut, MachOSegment **segmentOut);
 int macho_translate_vmaddr_to_fileoff(MachO *macho, uint64_t vmaddr, uint64_t *fileoffOut, MachOSegment **segmentOut);
 
+// Find the section that contains an address, zerofill sections are only found by vmaddr
+int macho_translate_vmaddr_to_section(MachO *macho, uint64_t vmaddr, MachOSegment **segmentOut, struct section_64 **sectionOut);
+int macho_translate_fileoff_to_section(MachO *macho, uint64_t fileoff, MachOSegment **segmentOut, struct section_64 **sectionOut);
+
 // Wrappers to deal with virtual addresses
 int macho_read_at_vmaddr(MachO *macho, uint64_t vmaddr, size_t size, void *outBuf);
 int macho_write_at_vmaddr(MachO *macho, uint64_t vmaddr, size_t size, const void *inBuf);
 
+// Load commands are enumerated from the copy read by macho_init, no I/O is done
+// cmd points into that copy and must not be modified, changes have to be written with macho_write_at_offset (which keeps the copy in sync)
 int macho_enumerate_load_commands(MachO *macho, void (^enumeratorBlock)(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop));
+// Same as macho_enumerate_load_commands, but only commands of type cmdType are visited (in file order)
+int macho_enumerate_load_commands_of_type(MachO *macho, uint32_t cmdType, void (^enumeratorBlock)(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop));
+// Symbols are read through a MachOSymbolTable, use one directly to look up more than one symbol
 int macho_enumerate_symbols(MachO *macho, void (^enumeratorBlock)(const char *name, uint8_t type, uint64_t vmaddr, bool *stop));
 int macho_enumerate_dependencies(MachO *macho, void (^enumeratorBlock)(const char *dylibPath, uint32_t cmd, struct dylib* dylib, bool *stop));
 int macho_enumerate_rpaths(MachO *macho, void (^enumeratorBlock)(const char *rpath, bool *stop));
 
+// Look up an entry of an MH_FILESET MachO by its entry_id (e.g. com.apple.kernel)
+FilesetMachO *macho_find_fileset_entry(MachO *macho, const char *entryId);
+// Parse the sub-MachO of a fileset entry the first time it is requested, safe to call from multiple threads
+FAT *macho_fileset_entry_get_fat(MachO *macho, FilesetMachO *filesetMacho);
+// Shortcut for both of the above, returns NULL unless the entry exists and has exactly one slice
+MachO *macho_get_fileset_macho(MachO *macho, const char *entryId);
+
 // Initialise a MachO object from a MemoryStream and it's corresponding FAT arch descriptor
 MachO *macho_init(MemoryStream *stream, struct fat_arch_64 archDescriptor);
 
@@ -67,6 +124,9 @@ MachO **macho_array_create_for_paths(char **inputPaths, int inputPathsCount);
 // Check if a MachO is encrypted
 bool macho_is_encrypted(MachO *macho);
 
+// Get the UUID from LC_UUID, returns -1 if the MachO doesn't have one
+int macho_get_uuid(MachO *macho, uint8_t uuidOut[16]);
+
 void macho_free(MachO *macho);
 
 #endif // MACHO_SLICE_H
\ No newline at end of file
@@ -0,0 +1,333 @@
+#include "MachOChainedFixups.h"
+
+#include "MachO.h"
+#include "MachOByteOrder.h"
+
+#include <mach-o/loader.h>
+#include <mach-o/fixup-chains.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t _chained_fixups_read_uint32(MachOChainedFixups *fixups, uint32_t offset)
+{
+    uint32_t value;
+    memcpy(&value, &fixups->data[offset], sizeof(value));
+    return LITTLE_TO_HOST(value);
+}
+
+static uint64_t _chained_fixups_read_uint64(MachOChainedFixups *fixups, uint32_t offset)
+{
+    uint64_t value;
+    memcpy(&value, &fixups->data[offset], sizeof(value));
+    return LITTLE_TO_HOST(value);
+}
+
+static int64_t _sign_extend(uint64_t value, uint32_t bits)
+{
+    uint64_t signBit = 1ULL << (bits - 1);
+    return (int64_t)((value ^ signBit) - signBit);
+}
+
+MachOChainedFixups *macho_chained_fixups_init(MachO *macho)
+{
+    __block struct linkedit_data_command fixupsCommand;
+    __block bool foundFixups = false;
+    macho_enumerate_load_commands_of_type(macho, LC_DYLD_CHAINED_FIXUPS, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        if (loadCommand.cmdsize < sizeof(fixupsCommand)) return;
+        memcpy(&fixupsCommand, cmd, sizeof(fixupsCommand));
+        LINKEDIT_DATA_COMMAND_APPLY_BYTE_ORDER(&fixupsCommand, LITTLE_TO_HOST_APPLIER);
+        foundFixups = true;
+        *stop = true;
+    });
+    if (!foundFixups || fixupsCommand.datasize < sizeof(struct dyld_chained_fixups_header)) return NULL;
+
+    MachOChainedFixups *fixups = malloc(sizeof(MachOChainedFixups));
+    if (!fixups) return NULL;
+    memset(fixups, 0, sizeof(MachOChainedFixups));
+    fixups->macho = macho;
+    fixups->dataSize = fixupsCommand.datasize;
+    fixups->data = malloc((size_t)fixupsCommand.datasize + 1);
+    if (!fixups->data) goto fail;
+    if (macho_read_at_offset(macho, fixupsCommand.dataoff, fixupsCommand.datasize, fixups->data) != 0) {
+        printf("Error: failed to read chained fixups (0x%x bytes at 0x%x)\n", fixupsCommand.datasize, fixupsCommand.dataoff);
+        goto fail;
+    }
+    fixups->data[fixupsCommand.datasize] = 0;
+
+    struct dyld_chained_fixups_header header;
+    memcpy(&header, fixups->data, sizeof(header));
+    DYLD_CHAINED_FIXUPS_HEADER_APPLY_BYTE_ORDER(&header, LITTLE_TO_HOST_APPLIER);
+    if (header.fixups_version != 0) {
+        printf("Error: unsupported chained fixups version %u\n", header.fixups_version);
+        goto fail;
+    }
+    if (header.symbols_format != 0) {
+        printf("Error: compressed chained fixups symbols are not supported\n");
+        goto fail;
+    }
+
+    uint64_t importSize = 0;
+    switch (header.imports_format) {
+        case DYLD_CHAINED_IMPORT:
+            importSize = sizeof(uint32_t);
+            break;
+        case DYLD_CHAINED_IMPORT_ADDEND:
+            importSize = sizeof(uint32_t) * 2;
+            break;
+        case DYLD_CHAINED_IMPORT_ADDEND64:
+            importSize = sizeof(uint64_t) * 2;
+            break;
+        default:
+            printf("Error: unsupported chained fixups imports format %u\n", header.imports_format);
+            goto fail;
+    }
+    if ((header.starts_offset + sizeof(uint32_t)) > fixups->dataSize ||
+        (header.imports_offset + (importSize * header.imports_count)) > fixups->dataSize ||
+        header.symbols_offset > fixups->dataSize) {
+        printf("Error: chained fixups header is out of bounds\n");
+        goto fail;
+    }
+
+    fixups->startsOffset = header.starts_offset;
+    fixups->importsOffset = header.imports_offset;
+    fixups->symbolsOffset = header.symbols_offset;
+    fixups->importsCount = header.imports_count;
+    fixups->importsFormat = header.imports_format;
+    macho_translate_fileoff_to_vmaddr(macho, 0, &fixups->imageBase, NULL);
+    return fixups;
+
+fail:
+    macho_chained_fixups_free(fixups);
+    return NULL;
+}
+
+int macho_chained_fixups_get_import(MachOChainedFixups *fixups, uint32_t importOrdinal, MachOChainedImport *importOut)
+{
+    if (importOrdinal >= fixups->importsCount) return -1;
+
+    uint32_t nameOffset = 0;
+    memset(importOut, 0, sizeof(MachOChainedImport));
+    if (fixups->importsFormat == DYLD_CHAINED_IMPORT_ADDEND64) {
+        uint32_t importOffset = fixups->importsOffset + (importOrdinal * sizeof(uint64_t) * 2);
+        uint64_t import = _chained_fixups_read_uint64(fixups, importOffset);
+        uint16_t libOrdinal = import & 0xffff;
+        importOut->libOrdinal = libOrdinal > 0xfff0 ? (int16_t)libOrdinal : libOrdinal;
+        importOut->weakImport = (import >> 16) & 1;
+        nameOffset = (uint32_t)(import >> 32);
+        importOut->addend = (int64_t)_chained_fixups_read_uint64(fixups, importOffset + sizeof(uint64_t));
+    }
+    else {
+        uint32_t importSize = fixups->importsFormat == DYLD_CHAINED_IMPORT_ADDEND ? (sizeof(uint32_t) * 2) : sizeof(uint32_t);
+        uint32_t importOffset = fixups->importsOffset + (importOrdinal * importSize);
+        uint32_t import = _chained_fixups_read_uint32(fixups, importOffset);
+        uint8_t libOrdinal = import & 0xff;
+        importOut->libOrdinal = libOrdinal > 0xf0 ? (int8_t)libOrdinal : libOrdinal;
+        importOut->weakImport = (import >> 8) & 1;
+        nameOffset = import >> 9;
+        if (fixups->importsFormat == DYLD_CHAINED_IMPORT_ADDEND) {
+            importOut->addend = (int32_t)_chained_fixups_read_uint32(fixups, importOffset + sizeof(uint32_t));
+        }
+    }
+
+    if (((uint64_t)fixups->symbolsOffset + nameOffset) >= fixups->dataSize) return -1;
+    importOut->name = (const char *)&fixups->data[fixups->symbolsOffset + nameOffset];
+    return 0;
+}
+
+// Decode a single pointer of a chain, returns the distance to the next one in units of the stride (0 ends the chain)
+static int _chained_fixup_decode(MachOChainedFixups *fixups, MachOChainedFixup *fixup, uint32_t *nextOut, uint32_t *strideOut)
+{
+    uint64_t raw = fixup->rawValue;
+    switch (fixup->pointerFormat) {
+        case DYLD_CHAINED_PTR_ARM64E:
+        case DYLD_CHAINED_PTR_ARM64E_KERNEL:
+        case DYLD_CHAINED_PTR_ARM64E_USERLAND:
+        case DYLD_CHAINED_PTR_ARM64E_FIRMWARE:
+        case DYLD_CHAINED_PTR_ARM64E_USERLAND24: {
+            *nextOut = (raw >> 51) & 0x7ff;
+            *strideOut = (fixup->pointerFormat == DYLD_CHAINED_PTR_ARM64E_KERNEL || fixup->pointerFormat == DYLD_CHAINED_PTR_ARM64E_FIRMWARE) ? 4 : 8;
+            fixup->isAuth = (raw >> 63) & 1;
+            fixup->isBind = (raw >> 62) & 1;
+            if (fixup->isAuth) {
+                fixup->diversity = (raw >> 32) & 0xffff;
+                fixup->addressDiversity = (raw >> 48) & 1;
+                fixup->key = (raw >> 49) & 3;
+            }
+            if (fixup->isBind) {
+                fixup->importOrdinal = fixup->pointerFormat == DYLD_CHAINED_PTR_ARM64E_USERLAND24 ? (raw & 0xffffff) : (raw & 0xffff);
+                if (!fixup->isAuth) fixup->addend = _sign_extend((raw >> 32) & 0x7ffff, 19);
+            }
+            else if (fixup->isAuth) {
+                // Authenticated rebases always hold an offset from the image base
+                fixup->targetVmaddr = fixups->imageBase + (raw & 0xffffffff);
+            }
+            else {
+                uint64_t target = raw & 0x7ffffffffffULL;
+                uint64_t high8 = (raw >> 43) & 0xff;
+                // DYLD_CHAINED_PTR_ARM64E and DYLD_CHAINED_PTR_ARM64E_FIRMWARE already hold a vmaddr, the others hold an offset
+                if (fixup->pointerFormat == DYLD_CHAINED_PTR_ARM64E_KERNEL ||
+                    fixup->pointerFormat == DYLD_CHAINED_PTR_ARM64E_USERLAND ||
+                    fixup->pointerFormat == DYLD_CHAINED_PTR_ARM64E_USERLAND24) {
+                    target += fixups->imageBase;
+                }
+                fixup->targetVmaddr = (high8 << 56) | target;
+            }
+            return 0;
+        }
+        case DYLD_CHAINED_PTR_64:
+        case DYLD_CHAINED_PTR_64_OFFSET: {
+            *nextOut = (raw >> 51) & 0xfff;
+            *strideOut = 4;
+            fixup->isBind = (raw >> 63) & 1;
+            if (fixup->isBind) {
+                fixup->importOrdinal = raw & 0xffffff;
+                fixup->addend = (raw >> 24) & 0xff;
+            }
+            else {
+                uint64_t target = raw & 0xfffffffffULL;
+                uint64_t high8 = (raw >> 36) & 0xff;
+                if (fixup->pointerFormat == DYLD_CHAINED_PTR_64_OFFSET) target += fixups->imageBase;
+                fixup->targetVmaddr = (high8 << 56) | target;
+            }
+            return 0;
+        }
+        case DYLD_CHAINED_PTR_64_KERNEL_CACHE:
+        case DYLD_CHAINED_PTR_X86_64_KERNEL_CACHE: {
+            *nextOut = (raw >> 51) & 0xfff;
+            *strideOut = fixup->pointerFormat == DYLD_CHAINED_PTR_X86_64_KERNEL_CACHE ? 1 : 4;
+            fixup->isAuth = (raw >> 63) & 1;
+            if (fixup->isAuth) {
+                fixup->diversity = (raw >> 32) & 0xffff;
+                fixup->addressDiversity = (raw >> 48) & 1;
+                fixup->key = (raw >> 49) & 3;
+            }
+            fixup->targetVmaddr = fixups->imageBase + (raw & 0x3fffffff);
+            return 0;
+        }
+        default:
+            printf("Error: unsupported chained pointer format %u\n", fixup->pointerFormat);
+            return -1;
+    }
+}
+
+int macho_chained_fixups_enumerate(MachOChainedFixups *fixups, void (^enumeratorBlock)(MachOChainedFixup *fixup, bool *stop))
+{
+    MachO *macho = fixups->macho;
+    uint32_t segmentCount = _chained_fixups_read_uint32(fixups, fixups->startsOffset);
+    if ((fixups->startsOffset + sizeof(uint32_t) + ((uint64_t)segmentCount * sizeof(uint32_t))) > fixups->dataSize) {
+        printf("Error: chained fixups starts are out of bounds\n");
+        return -1;
+    }
+
+    int r = 0;
+    uint8_t *page = NULL;
+    uint32_t pageBufferSize = 0;
+    bool stop = false;
+    for (uint32_t segmentIndex = 0; segmentIndex < segmentCount && !stop; segmentIndex++) {
+        uint32_t segmentInfoOffset = _chained_fixups_read_uint32(fixups, fixups->startsOffset + sizeof(uint32_t) + (segmentIndex * sizeof(uint32_t)));
+        if (!segmentInfoOffset) continue;
+
+        uint64_t startsInSegmentOffset = (uint64_t)fixups->startsOffset + segmentInfoOffset;
+        if ((startsInSegmentOffset + offsetof(struct dyld_chained_starts_in_segment, page_start)) > fixups->dataSize) {
+            r = -1;
+            break;
+        }
+        struct dyld_chained_starts_in_segment startsInSegment;
+        memcpy(&startsInSegment, &fixups->data[startsInSegmentOffset], offsetof(struct dyld_chained_starts_in_segment, page_start));
+        DYLD_CHAINED_STARTS_IN_SEGMENT_APPLY_BYTE_ORDER(&startsInSegment, LITTLE_TO_HOST_APPLIER);
+        uint64_t pageStartsOffset = startsInSegmentOffset + offsetof(struct dyld_chained_starts_in_segment, page_start);
+        if ((pageStartsOffset + ((uint64_t)startsInSegment.page_count * sizeof(uint16_t))) > fixups->dataSize ||
+            segmentIndex >= macho->segmentCount || !startsInSegment.page_size) {
+            r = -1;
+            break;
+        }
+
+        if (startsInSegment.pointer_format == DYLD_CHAINED_PTR_32 ||
+            startsInSegment.pointer_format == DYLD_CHAINED_PTR_32_CACHE ||
+            startsInSegment.pointer_format == DYLD_CHAINED_PTR_32_FIRMWARE) {
+            printf("Error: 32-bit chained pointer formats are not supported\n");
+            r = -1;
+            break;
+        }
+
+        MachOSegment *segment = macho->segments[segmentIndex];
+        if (startsInSegment.page_size > pageBufferSize) {
+            uint8_t *newPage = realloc(page, startsInSegment.page_size);
+            if (!newPage) {
+                r = -1;
+                break;
+            }
+            page = newPage;
+            pageBufferSize = startsInSegment.page_size;
+        }
+
+        for (uint16_t pageIndex = 0; pageIndex < startsInSegment.page_count && !stop; pageIndex++) {
+            uint16_t pageStart;
+            memcpy(&pageStart, &fixups->data[pageStartsOffset + (pageIndex * sizeof(uint16_t))], sizeof(pageStart));
+            pageStart = LITTLE_TO_HOST(pageStart);
+            if (pageStart == DYLD_CHAINED_PTR_START_NONE) continue;
+            if (pageStart & DYLD_CHAINED_PTR_START_MULTI) {
+                // Only used by the 32-bit formats
+                r = -1;
+                break;
+            }
+
+            uint64_t pageSegmentOffset = (uint64_t)pageIndex * startsInSegment.page_size;
+            if (pageSegmentOffset >= segment->command.filesize) {
+                r = -1;
+                break;
+            }
+            uint64_t pageSize = segment->command.filesize - pageSegmentOffset;
+            if (pageSize > startsInSegment.page_size) pageSize = startsInSegment.page_size;
+            uint64_t pageFileoff = segment->command.fileoff + pageSegmentOffset;
+            if (macho_read_at_offset(macho, pageFileoff, pageSize, page) != 0) {
+                r = -1;
+                break;
+            }
+
+            uint64_t offsetInPage = pageStart;
+            while (true) {
+                if ((offsetInPage + sizeof(uint64_t)) > pageSize) {
+                    printf("Error: chained fixup at 0x%llx is out of bounds\n", pageFileoff + offsetInPage);
+                    r = -1;
+                    break;
+                }
+
+                MachOChainedFixup fixup;
+                memset(&fixup, 0, sizeof(fixup));
+                memcpy(&fixup.rawValue, &page[offsetInPage], sizeof(fixup.rawValue));
+                fixup.rawValue = LITTLE_TO_HOST(fixup.rawValue);
+                fixup.pointerFormat = startsInSegment.pointer_format;
+                fixup.fileoff = pageFileoff + offsetInPage;
+                fixup.vmaddr = fixups->imageBase + startsInSegment.segment_offset + pageSegmentOffset + offsetInPage;
+
+                uint32_t next = 0, stride = 0;
+                if (_chained_fixup_decode(fixups, &fixup, &next, &stride) != 0) {
+                    r = -1;
+                    break;
+                }
+                if (fixup.isBind && fixup.importOrdinal >= fixups->importsCount) {
+                    printf("Error: chained fixup at 0x%llx binds to invalid import %u\n", fixup.fileoff, fixup.importOrdinal);
+                    r = -1;
+                    break;
+                }
+
+                enumeratorBlock(&fixup, &stop);
+                if (stop || !next) break;
+                offsetInPage += (uint64_t)next * stride;
+            }
+            if (r != 0) break;
+        }
+        if (r != 0) break;
+    }
+
+    if (page) free(page);
+    return r;
+}
+
+void macho_chained_fixups_free(MachOChainedFixups *fixups)
+{
+    if (fixups->data) free(fixups->data);
+    free(fixups);
+}
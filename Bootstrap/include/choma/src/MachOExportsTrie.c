@@ -0,0 +1,312 @@
+#include "MachOExportsTrie.h"
+
+#include "MachO.h"
+#include "MachOByteOrder.h"
+
+#include <mach-o/loader.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Nodes are small, so reading the trie through a small window means most nodes take a single read
+#define EXPORTS_TRIE_WINDOW_SIZE 256
+
+typedef struct _MachOExportsTrieCursor {
+    MachOExportsTrie *trie;
+    uint8_t window[EXPORTS_TRIE_WINDOW_SIZE];
+    uint32_t windowStart;
+    uint32_t windowSize;
+    uint32_t position;
+} _MachOExportsTrieCursor;
+
+static void _exports_trie_cursor_init(_MachOExportsTrieCursor *cursor, MachOExportsTrie *trie)
+{
+    cursor->trie = trie;
+    cursor->windowStart = 0;
+    cursor->windowSize = 0;
+    cursor->position = 0;
+}
+
+static int _exports_trie_read_byte(_MachOExportsTrieCursor *cursor, uint8_t *byteOut)
+{
+    if (cursor->position >= cursor->trie->size) return -1;
+    if (cursor->position < cursor->windowStart || cursor->position >= (cursor->windowStart + cursor->windowSize)) {
+        uint32_t windowSize = cursor->trie->size - cursor->position;
+        if (windowSize > EXPORTS_TRIE_WINDOW_SIZE) windowSize = EXPORTS_TRIE_WINDOW_SIZE;
+        if (macho_read_at_offset(cursor->trie->macho, cursor->trie->offset + cursor->position, windowSize, cursor->window) != 0) return -1;
+        cursor->windowStart = cursor->position;
+        cursor->windowSize = windowSize;
+    }
+    *byteOut = cursor->window[cursor->position - cursor->windowStart];
+    cursor->position++;
+    return 0;
+}
+
+static int _exports_trie_read_uleb128(_MachOExportsTrieCursor *cursor, uint64_t *valueOut)
+{
+    uint64_t value = 0;
+    uint32_t shift = 0;
+    uint8_t byte = 0;
+    do {
+        if (_exports_trie_read_byte(cursor, &byte) != 0) return -1;
+        if (shift >= 64) return -1;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    *valueOut = value;
+    return 0;
+}
+
+// Parse the terminal info at the cursor, the cursor has to be positioned right after the terminal size
+static int _exports_trie_read_export(_MachOExportsTrieCursor *cursor, const char *name, MachOExport *exportOut)
+{
+    memset(exportOut, 0, sizeof(MachOExport));
+    if (_exports_trie_read_uleb128(cursor, &exportOut->flags) != 0) return -1;
+
+    if (exportOut->flags & EXPORT_SYMBOL_FLAGS_REEXPORT) {
+        if (_exports_trie_read_uleb128(cursor, &exportOut->reexportOrdinal) != 0) return -1;
+
+        size_t importNameSize = 32, importNameLength = 0;
+        char *importName = malloc(importNameSize);
+        if (!importName) return -1;
+        uint8_t c = 0;
+        do {
+            if (_exports_trie_read_byte(cursor, &c) != 0) {
+                free(importName);
+                return -1;
+            }
+            if (importNameLength == importNameSize) {
+                importNameSize *= 2;
+                char *newImportName = realloc(importName, importNameSize);
+                if (!newImportName) {
+                    free(importName);
+                    return -1;
+                }
+                importName = newImportName;
+            }
+            importName[importNameLength++] = c;
+        } while (c != 0);
+
+        // An empty import name means the symbol is re-exported under the same name
+        if (importName[0] == 0 || (name && strcmp(importName, name) == 0)) {
+            free(importName);
+            importName = NULL;
+        }
+        exportOut->importName = importName;
+        return 0;
+    }
+
+    uint64_t address = 0;
+    if (_exports_trie_read_uleb128(cursor, &address) != 0) return -1;
+    bool isAbsolute = (exportOut->flags & EXPORT_SYMBOL_FLAGS_KIND_MASK) == EXPORT_SYMBOL_FLAGS_KIND_ABSOLUTE;
+    exportOut->vmaddr = isAbsolute ? address : (cursor->trie->imageBase + address);
+
+    if (exportOut->flags & EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER) {
+        uint64_t resolver = 0;
+        if (_exports_trie_read_uleb128(cursor, &resolver) != 0) return -1;
+        exportOut->resolverVmaddr = cursor->trie->imageBase + resolver;
+    }
+    return 0;
+}
+
+MachOExportsTrie *macho_exports_trie_init(MachO *macho)
+{
+    __block uint64_t trieOffset = 0;
+    __block uint32_t trieSize = 0;
+    macho_enumerate_load_commands_of_type(macho, LC_DYLD_EXPORTS_TRIE, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        if (loadCommand.cmdsize < sizeof(struct linkedit_data_command)) return;
+        struct linkedit_data_command exportsTrieCommand;
+        memcpy(&exportsTrieCommand, cmd, sizeof(exportsTrieCommand));
+        LINKEDIT_DATA_COMMAND_APPLY_BYTE_ORDER(&exportsTrieCommand, LITTLE_TO_HOST_APPLIER);
+        trieOffset = exportsTrieCommand.dataoff;
+        trieSize = exportsTrieCommand.datasize;
+        *stop = true;
+    });
+    if (!trieSize) {
+        // Older binaries keep the trie in the dyld info
+        void (^dyldInfoHandler)(struct load_command, uint64_t, void *, bool *) = ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+            if (loadCommand.cmdsize < sizeof(struct dyld_info_command)) return;
+            struct dyld_info_command dyldInfoCommand;
+            memcpy(&dyldInfoCommand, cmd, sizeof(dyldInfoCommand));
+            DYLD_INFO_COMMAND_APPLY_BYTE_ORDER(&dyldInfoCommand, LITTLE_TO_HOST_APPLIER);
+            trieOffset = dyldInfoCommand.export_off;
+            trieSize = dyldInfoCommand.export_size;
+            *stop = true;
+        };
+        macho_enumerate_load_commands_of_type(macho, LC_DYLD_INFO_ONLY, dyldInfoHandler);
+        if (!trieSize) macho_enumerate_load_commands_of_type(macho, LC_DYLD_INFO, dyldInfoHandler);
+    }
+    if (!trieSize) return NULL;
+
+    if ((trieOffset + trieSize) > macho->archDescriptor.size) {
+        printf("Error: exports trie (0x%x bytes at 0x%llx) is out of bounds\n", trieSize, trieOffset);
+        return NULL;
+    }
+
+    MachOExportsTrie *trie = malloc(sizeof(MachOExportsTrie));
+    if (!trie) return NULL;
+    trie->macho = macho;
+    trie->offset = trieOffset;
+    trie->size = trieSize;
+    trie->imageBase = 0;
+    macho_translate_fileoff_to_vmaddr(macho, 0, &trie->imageBase, NULL);
+    return trie;
+}
+
+int macho_exports_trie_find(MachOExportsTrie *trie, const char *name, MachOExport *exportOut)
+{
+    _MachOExportsTrieCursor cursor;
+    _exports_trie_cursor_init(&cursor, trie);
+
+    const char *remainingName = name;
+    uint32_t visitedNodes = 0;
+    while (true) {
+        // Every node takes at least two bytes, anything beyond that is a loop
+        if (++visitedNodes > trie->size) return -1;
+
+        uint64_t terminalSize = 0;
+        if (_exports_trie_read_uleb128(&cursor, &terminalSize) != 0) return -1;
+        if (*remainingName == 0) {
+            if (!terminalSize) return 1;
+            return _exports_trie_read_export(&cursor, name, exportOut);
+        }
+
+        if (terminalSize > (trie->size - cursor.position)) return -1;
+        cursor.position += (uint32_t)terminalSize;
+
+        uint8_t childCount = 0;
+        if (_exports_trie_read_byte(&cursor, &childCount) != 0) return -1;
+
+        bool foundChild = false;
+        for (uint8_t i = 0; i < childCount && !foundChild; i++) {
+            // Compare the edge with the rest of the name while reading it
+            const char *edgeName = remainingName;
+            bool matches = true;
+            uint8_t c = 0;
+            while (true) {
+                if (_exports_trie_read_byte(&cursor, &c) != 0) return -1;
+                if (c == 0) break;
+                if (matches && *edgeName == (char)c) edgeName++;
+                else matches = false;
+            }
+
+            uint64_t childOffset = 0;
+            if (_exports_trie_read_uleb128(&cursor, &childOffset) != 0) return -1;
+            if (matches) {
+                if (childOffset >= trie->size) return -1;
+                remainingName = edgeName;
+                cursor.position = (uint32_t)childOffset;
+                foundChild = true;
+            }
+        }
+        if (!foundChild) return 1;
+    }
+}
+
+// Everything visited between a node and its next sibling is below their parent,
+// so the parent's name is still in the buffer once a sibling is popped and only the edge has to be appended
+typedef struct _MachOExportsTrieStackEntry {
+    uint32_t nodeOffset;
+    uint32_t edgeOffset;
+    uint32_t parentNameLength;
+} _MachOExportsTrieStackEntry;
+
+int macho_exports_trie_enumerate(MachOExportsTrie *trie, void (^enumeratorBlock)(const char *name, MachOExport *export, bool *stop))
+{
+    _MachOExportsTrieCursor cursor;
+    _exports_trie_cursor_init(&cursor, trie);
+
+    int r = -1;
+    uint32_t visitedNodes = 0;
+    uint32_t stackSize = 64, stackCount = 0;
+    _MachOExportsTrieStackEntry *stack = malloc(stackSize * sizeof(_MachOExportsTrieStackEntry));
+    uint32_t nameSize = 256;
+    char *name = malloc(nameSize);
+    if (!stack || !name) goto out;
+
+    stack[stackCount++] = (_MachOExportsTrieStackEntry){ 0, UINT32_MAX, 0 };
+    while (stackCount) {
+        _MachOExportsTrieStackEntry node = stack[--stackCount];
+        if (++visitedNodes > trie->size) {
+            printf("Error: exports trie contains a loop\n");
+            goto out;
+        }
+
+        uint32_t nameLength = node.parentNameLength;
+        if (node.edgeOffset != UINT32_MAX) {
+            cursor.position = node.edgeOffset;
+            uint8_t c = 0;
+            while (true) {
+                if (_exports_trie_read_byte(&cursor, &c) != 0) goto out;
+                if (c == 0) break;
+                if ((nameLength + 1) >= nameSize) {
+                    char *newName = realloc(name, nameSize * 2);
+                    if (!newName) goto out;
+                    name = newName;
+                    nameSize *= 2;
+                }
+                name[nameLength++] = c;
+            }
+        }
+        name[nameLength] = 0;
+
+        cursor.position = node.nodeOffset;
+        uint64_t terminalSize = 0;
+        if (_exports_trie_read_uleb128(&cursor, &terminalSize) != 0) goto out;
+        if (terminalSize > (trie->size - cursor.position)) goto out;
+        uint32_t childrenOffset = cursor.position + (uint32_t)terminalSize;
+
+        if (terminalSize) {
+            MachOExport export;
+            if (_exports_trie_read_export(&cursor, name, &export) != 0) goto out;
+            bool stop = false;
+            enumeratorBlock(name, &export, &stop);
+            macho_export_free(&export);
+            if (stop) break;
+        }
+
+        cursor.position = childrenOffset;
+        uint8_t childCount = 0;
+        if (_exports_trie_read_byte(&cursor, &childCount) != 0) goto out;
+
+        if ((stackCount + childCount) > stackSize) {
+            while ((stackCount + childCount) > stackSize) stackSize *= 2;
+            _MachOExportsTrieStackEntry *newStack = realloc(stack, stackSize * sizeof(_MachOExportsTrieStackEntry));
+            if (!newStack) goto out;
+            stack = newStack;
+        }
+
+        // Children are pushed in reverse, so they are visited in trie order
+        for (uint8_t i = 0; i < childCount; i++) {
+            uint32_t edgeOffset = cursor.position;
+            uint8_t c = 0;
+            do {
+                if (_exports_trie_read_byte(&cursor, &c) != 0) goto out;
+            } while (c != 0);
+            uint64_t childOffset = 0;
+            if (_exports_trie_read_uleb128(&cursor, &childOffset) != 0) goto out;
+            if (childOffset >= trie->size) goto out;
+            stack[stackCount + (childCount - 1 - i)] = (_MachOExportsTrieStackEntry){ (uint32_t)childOffset, edgeOffset, nameLength };
+        }
+        stackCount += childCount;
+    }
+    r = 0;
+
+out:
+    if (r != 0 && visitedNodes <= trie->size) printf("Error: malformed exports trie\n");
+    if (stack) free(stack);
+    if (name) free(name);
+    return r;
+}
+
+void macho_export_free(MachOExport *export)
+{
+    if (export->importName) {
+        free(export->importName);
+        export->importName = NULL;
+    }
+}
+
+void macho_exports_trie_free(MachOExportsTrie *trie)
+{
+    free(trie);
+}
@@ -118,33 +118,31 @@ char *load_command_to_string(int loadCommand) {
 }
 
 void update_segment_command_64(MachO *macho, const char *segmentName, uint64_t vmaddr, uint64_t vmsize, uint64_t fileoff, uint64_t filesize) {
-    macho_enumerate_load_commands(macho, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
-        if (loadCommand.cmd == LC_SEGMENT_64) {
-            struct segment_command_64 *segmentCommand = (struct segment_command_64 *)cmd;
-            SEGMENT_COMMAND_64_APPLY_BYTE_ORDER(segmentCommand, LITTLE_TO_HOST_APPLIER);
-            if (strcmp(segmentCommand->segname, segmentName) == 0) {
-                segmentCommand->vmaddr = vmaddr;
-                segmentCommand->vmsize = vmsize;
-                segmentCommand->fileoff = fileoff;
-                segmentCommand->filesize = filesize;
-                SEGMENT_COMMAND_64_APPLY_BYTE_ORDER(segmentCommand, HOST_TO_LITTLE_APPLIER);
-                memory_stream_write(macho->stream, offset, sizeof(struct segment_command_64), segmentCommand);
-                *stop = true;
-            }
+    macho_enumerate_load_commands_of_type(macho, LC_SEGMENT_64, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        struct segment_command_64 segmentCommand;
+        memcpy(&segmentCommand, cmd, sizeof(segmentCommand));
+        SEGMENT_COMMAND_64_APPLY_BYTE_ORDER(&segmentCommand, LITTLE_TO_HOST_APPLIER);
+        if (strcmp(segmentCommand.segname, segmentName) == 0) {
+            segmentCommand.vmaddr = vmaddr;
+            segmentCommand.vmsize = vmsize;
+            segmentCommand.fileoff = fileoff;
+            segmentCommand.filesize = filesize;
+            SEGMENT_COMMAND_64_APPLY_BYTE_ORDER(&segmentCommand, HOST_TO_LITTLE_APPLIER);
+            macho_write_at_offset(macho, offset, sizeof(struct segment_command_64), &segmentCommand);
+            *stop = true;
         }
     });
 }
 
 void update_lc_code_signature(MachO *macho, uint64_t size) {
-    macho_enumerate_load_commands(macho, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
-        if (loadCommand.cmd == LC_CODE_SIGNATURE) {
-            struct linkedit_data_command *csLoadCommand = (struct linkedit_data_command *)cmd;
-            LINKEDIT_DATA_COMMAND_APPLY_BYTE_ORDER(csLoadCommand, LITTLE_TO_HOST_APPLIER);
-            csLoadCommand->datasize = size;
-            LINKEDIT_DATA_COMMAND_APPLY_BYTE_ORDER(csLoadCommand, HOST_TO_LITTLE_APPLIER);
-            memory_stream_write(macho->stream, offset, sizeof(struct linkedit_data_command), csLoadCommand);
-            *stop = true;
-        }
+    macho_enumerate_load_commands_of_type(macho, LC_CODE_SIGNATURE, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        struct linkedit_data_command csLoadCommand;
+        memcpy(&csLoadCommand, cmd, sizeof(csLoadCommand));
+        LINKEDIT_DATA_COMMAND_APPLY_BYTE_ORDER(&csLoadCommand, LITTLE_TO_HOST_APPLIER);
+        csLoadCommand.datasize = size;
+        LINKEDIT_DATA_COMMAND_APPLY_BYTE_ORDER(&csLoadCommand, HOST_TO_LITTLE_APPLIER);
+        macho_write_at_offset(macho, offset, sizeof(struct linkedit_data_command), &csLoadCommand);
+        *stop = true;
     });
 }
 
@@ -156,16 +154,15 @@ int update_load_commands_for_coretrust_bypass(MachO *macho, CS_SuperBlob *superb
     __block uint64_t blockPaddingSize = 0;
     __block uint64_t vmAddress = 0;
     __block uint64_t fileOffset = 0;
-    macho_enumerate_load_commands(macho, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
-        if (loadCommand.cmd == LC_SEGMENT_64) {
-            struct segment_command_64 *segmentCommand = (struct segment_command_64 *)cmd;
-            SEGMENT_COMMAND_64_APPLY_BYTE_ORDER(segmentCommand, LITTLE_TO_HOST_APPLIER);
-            if (strcmp(segmentCommand->segname, "__LINKEDIT") == 0) {
-                blockPaddingSize = segmentCommand->filesize - originalCodeSignatureSize;
-                vmAddress = segmentCommand->vmaddr;
-                fileOffset = segmentCommand->fileoff;
-                *stop = true;
-            }
+    macho_enumerate_load_commands_of_type(macho, LC_SEGMENT_64, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        struct segment_command_64 segmentCommand;
+        memcpy(&segmentCommand, cmd, sizeof(segmentCommand));
+        SEGMENT_COMMAND_64_APPLY_BYTE_ORDER(&segmentCommand, LITTLE_TO_HOST_APPLIER);
+        if (strcmp(segmentCommand.segname, "__LINKEDIT") == 0) {
+            blockPaddingSize = segmentCommand.filesize - originalCodeSignatureSize;
+            vmAddress = segmentCommand.vmaddr;
+            fileOffset = segmentCommand.fileoff;
+            *stop = true;
         }
     });
 
@@ -0,0 +1,200 @@
+#include "MachOSymbolTable.h"
+
+#include "MachO.h"
+#include "MachOByteOrder.h"
+#include "Util.h"
+
+#include <mach-o/loader.h>
+#include <mach-o/nlist.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t _macho_symbol_name_hash(const char *name)
+{
+    return fnv1a_hash(name, strlen(name));
+}
+
+static bool _macho_symbol_is_defined(MachOSymbol *symbol)
+{
+    return (symbol->type & N_TYPE) != N_UNDF;
+}
+
+static void _macho_symbol_table_insert(MachOSymbolTable *symbolTable, uint32_t symbolIndex)
+{
+    MachOSymbol *symbol = &symbolTable->symbols[symbolIndex];
+    uint32_t mask = symbolTable->hashTableSize - 1;
+    uint32_t slot = (uint32_t)_macho_symbol_name_hash(symbol->name) & mask;
+    while (symbolTable->hashTable[slot]) {
+        MachOSymbol *existing = &symbolTable->symbols[symbolTable->hashTable[slot] - 1];
+        if (strcmp(existing->name, symbol->name) == 0) {
+            // Keep the first definition, but let it replace an undefined reference
+            if (!_macho_symbol_is_defined(existing) && _macho_symbol_is_defined(symbol)) {
+                symbolTable->hashTable[slot] = symbolIndex + 1;
+            }
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+    symbolTable->hashTable[slot] = symbolIndex + 1;
+}
+
+static int _macho_symbol_address_compare(const void *a, const void *b)
+{
+    uint64_t addressA = (*(MachOSymbol **)a)->vmaddr;
+    uint64_t addressB = (*(MachOSymbol **)b)->vmaddr;
+    return (addressA > addressB) - (addressA < addressB);
+}
+
+static MachOSymbolTable *_macho_symbol_table_load(MachO *macho)
+{
+    __block struct symtab_command symtabCommand;
+    __block bool foundSymtab = false;
+    macho_enumerate_load_commands_of_type(macho, LC_SYMTAB, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        if (loadCommand.cmdsize < sizeof(symtabCommand)) return;
+        memcpy(&symtabCommand, cmd, sizeof(symtabCommand));
+        SYMTAB_COMMAND_APPLY_BYTE_ORDER(&symtabCommand, LITTLE_TO_HOST_APPLIER);
+        foundSymtab = true;
+        *stop = true;
+    });
+    if (!foundSymtab) return NULL;
+
+    MachOSymbolTable *symbolTable = malloc(sizeof(MachOSymbolTable));
+    if (!symbolTable) return NULL;
+    memset(symbolTable, 0, sizeof(MachOSymbolTable));
+    symbolTable->macho = macho;
+
+    struct nlist_64 *nlists = NULL;
+
+    // The string table is terminated by us, so names can never run off the end
+    symbolTable->stringTableSize = symtabCommand.strsize;
+    symbolTable->stringTable = malloc((size_t)symtabCommand.strsize + 1);
+    if (!symbolTable->stringTable) goto fail;
+    if (macho_read_at_offset(macho, symtabCommand.stroff, symtabCommand.strsize, symbolTable->stringTable) != 0) {
+        printf("Error: failed to read string table (0x%x bytes at 0x%x)\n", symtabCommand.strsize, symtabCommand.stroff);
+        goto fail;
+    }
+    symbolTable->stringTable[symtabCommand.strsize] = '\0';
+
+    size_t nlistsSize = (size_t)symtabCommand.nsyms * sizeof(struct nlist_64);
+    nlists = malloc(nlistsSize ? nlistsSize : 1);
+    symbolTable->symbols = malloc((symtabCommand.nsyms ? symtabCommand.nsyms : 1) * sizeof(MachOSymbol));
+    if (!nlists || !symbolTable->symbols) goto fail;
+    if (macho_read_at_offset(macho, symtabCommand.symoff, nlistsSize, nlists) != 0) {
+        printf("Error: failed to read %u symbols at 0x%x\n", symtabCommand.nsyms, symtabCommand.symoff);
+        goto fail;
+    }
+
+    for (uint32_t i = 0; i < symtabCommand.nsyms; i++) {
+        struct nlist_64 entry = nlists[i];
+        NLIST_64_APPLY_BYTE_ORDER(&entry, LITTLE_TO_HOST_APPLIER);
+        if (entry.n_un.n_strx >= symtabCommand.strsize || entry.n_un.n_strx == 0) continue;
+
+        const char *symbolName = &symbolTable->stringTable[entry.n_un.n_strx];
+        if (symbolName[0] == 0) continue;
+
+        MachOSymbol *symbol = &symbolTable->symbols[symbolTable->symbolCount++];
+        symbol->name = symbolName;
+        symbol->type = entry.n_type;
+        symbol->sect = entry.n_sect;
+        symbol->desc = entry.n_desc;
+        symbol->vmaddr = entry.n_value;
+    }
+    free(nlists);
+    return symbolTable;
+
+fail:
+    if (nlists) free(nlists);
+    macho_symbol_table_free(symbolTable);
+    return NULL;
+}
+
+static bool _macho_symbol_is_sect(MachOSymbol *symbol)
+{
+    return (symbol->type & N_STAB) == 0 && (symbol->type & N_TYPE) == N_SECT;
+}
+
+static int _macho_symbol_table_build_index(MachOSymbolTable *symbolTable)
+{
+    uint32_t sectSymbolCount = 0;
+    for (uint32_t i = 0; i < symbolTable->symbolCount; i++) {
+        if (_macho_symbol_is_sect(&symbolTable->symbols[i])) sectSymbolCount++;
+    }
+
+    // Keep the load factor at or below 50%
+    symbolTable->hashTableSize = 16;
+    while (symbolTable->hashTableSize < ((uint64_t)symbolTable->symbolCount * 2)) {
+        symbolTable->hashTableSize <<= 1;
+    }
+    symbolTable->hashTable = calloc(symbolTable->hashTableSize, sizeof(uint32_t));
+    symbolTable->symbolsByAddress = malloc((sectSymbolCount ? sectSymbolCount : 1) * sizeof(MachOSymbol *));
+    if (!symbolTable->hashTable || !symbolTable->symbolsByAddress) return -1;
+
+    for (uint32_t i = 0; i < symbolTable->symbolCount; i++) {
+        MachOSymbol *symbol = &symbolTable->symbols[i];
+        _macho_symbol_table_insert(symbolTable, i);
+        if (_macho_symbol_is_sect(symbol)) {
+            symbolTable->symbolsByAddress[symbolTable->symbolsByAddressCount++] = symbol;
+        }
+    }
+    qsort(symbolTable->symbolsByAddress, symbolTable->symbolsByAddressCount, sizeof(MachOSymbol *), _macho_symbol_address_compare);
+    return 0;
+}
+
+MachOSymbolTable *macho_symbol_table_init(MachO *macho)
+{
+    MachOSymbolTable *symbolTable = _macho_symbol_table_load(macho);
+    if (!symbolTable) return NULL;
+    if (_macho_symbol_table_build_index(symbolTable) != 0) {
+        macho_symbol_table_free(symbolTable);
+        return NULL;
+    }
+    return symbolTable;
+}
+
+MachOSymbolTable *macho_symbol_table_init_unindexed(MachO *macho)
+{
+    return _macho_symbol_table_load(macho);
+}
+
+MachOSymbol *macho_symbol_table_find_symbol(MachOSymbolTable *symbolTable, const char *name)
+{
+    if (!symbolTable->hashTable) return NULL;
+    uint32_t mask = symbolTable->hashTableSize - 1;
+    uint32_t slot = (uint32_t)_macho_symbol_name_hash(name) & mask;
+    while (symbolTable->hashTable[slot]) {
+        MachOSymbol *symbol = &symbolTable->symbols[symbolTable->hashTable[slot] - 1];
+        if (strcmp(symbol->name, name) == 0) return symbol;
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+MachOSymbol *macho_symbol_table_find_symbol_for_address(MachOSymbolTable *symbolTable, uint64_t vmaddr)
+{
+    // Find the first symbol above vmaddr, the one before it is the result
+    uint32_t low = 0, high = symbolTable->symbolsByAddressCount;
+    while (low < high) {
+        uint32_t mid = low + ((high - low) / 2);
+        if (symbolTable->symbolsByAddress[mid]->vmaddr <= vmaddr) low = mid + 1;
+        else high = mid;
+    }
+    return low ? symbolTable->symbolsByAddress[low - 1] : NULL;
+}
+
+void macho_symbol_table_enumerate(MachOSymbolTable *symbolTable, void (^enumeratorBlock)(MachOSymbol *symbol, bool *stop))
+{
+    for (uint32_t i = 0; i < symbolTable->symbolCount; i++) {
+        bool stop = false;
+        enumeratorBlock(&symbolTable->symbols[i], &stop);
+        if (stop) break;
+    }
+}
+
+void macho_symbol_table_free(MachOSymbolTable *symbolTable)
+{
+    if (symbolTable->stringTable) free(symbolTable->stringTable);
+    if (symbolTable->symbols) free(symbolTable->symbols);
+    if (symbolTable->hashTable) free(symbolTable->hashTable);
+    if (symbolTable->symbolsByAddress) free(symbolTable->symbolsByAddress);
+    free(symbolTable);
+}
@@ -0,0 +1,265 @@
+#include "MappedStream.h"
+#include "MemoryStream.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+
+static int mapped_stream_expand(MemoryStream *stream, size_t expandAtStart, size_t expandAtEnd);
+static void mapped_stream_free(MemoryStream *stream);
+
+static uint8_t *_mapped_stream_map_anonymous(size_t size)
+{
+    // mmap does not accept zero sized mappings
+    if (size == 0) size = 1;
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (mapping == MAP_FAILED) return NULL;
+    return mapping;
+}
+
+static int _mapped_stream_make_own_data(MemoryStream *stream)
+{
+    MappedStreamContext *context = stream->context;
+    if ((stream->flags & MEMORY_STREAM_FLAG_OWNS_DATA) == 0) {
+        uint8_t *newMapping = _mapped_stream_map_anonymous(context->subBufferSize);
+        if (!newMapping) {
+            printf("Error: failed to allocate memory for mapped stream copy: %s\n", strerror(errno));
+            return -1;
+        }
+        memcpy(newMapping, context->mapping + context->subBufferStart, context->subBufferSize);
+        context->mapping = newMapping;
+        context->mappingSize = context->subBufferSize ? context->subBufferSize : 1;
+        context->subBufferStart = 0;
+        stream->flags |= MEMORY_STREAM_FLAG_OWNS_DATA;
+    }
+    return 0;
+}
+
+static int mapped_stream_read(MemoryStream *stream, uint64_t offset, size_t size, void *outBuf)
+{
+    MappedStreamContext *context = stream->context;
+    if ((offset + size) > context->subBufferSize) {
+        printf("Error: cannot read %zx bytes at %llx, maximum is %zx.\n", size, offset, context->subBufferSize);
+        return -1;
+    }
+
+    memcpy(outBuf, context->mapping + context->subBufferStart + offset, size);
+    return size;
+}
+
+static int mapped_stream_write(MemoryStream *stream, uint64_t offset, size_t size, const void *inBuf)
+{
+    MappedStreamContext *context = stream->context;
+
+    // Read only mappings can't be written to
+    if ((stream->flags & MEMORY_STREAM_FLAG_MUTABLE) == 0) return -1;
+
+    bool expandAllowed = (stream->flags & MEMORY_STREAM_FLAG_AUTO_EXPAND);
+    bool needsExpand = (offset + size) > context->subBufferSize;
+
+    if (needsExpand && !expandAllowed) {
+        printf("Error: cannot write %zx bytes at %llx, maximum is %zx.\n", size, offset, context->subBufferSize);
+        return -1;
+    }
+
+    // Soft clones share the mapping of their parent, so they need their own copy before writing
+    if ((stream->flags & MEMORY_STREAM_FLAG_OWNS_DATA) == 0) {
+        int r = _mapped_stream_make_own_data(stream);
+        if (r != 0) return r;
+    }
+
+    if (needsExpand) {
+        int r = mapped_stream_expand(stream, 0, (offset + size) - context->subBufferSize);
+        if (r != 0) return r;
+    }
+
+    memcpy(context->mapping + context->subBufferStart + offset, inBuf, size);
+    return size;
+}
+
+static int mapped_stream_get_size(MemoryStream *stream, size_t *sizeOut)
+{
+    MappedStreamContext *context = stream->context;
+    *sizeOut = context->subBufferSize;
+    return 0;
+}
+
+static uint8_t *mapped_stream_get_raw_pointer(MemoryStream *stream)
+{
+    MappedStreamContext *context = stream->context;
+    return &context->mapping[context->subBufferStart];
+}
+
+static int mapped_stream_trim(MemoryStream *stream, size_t trimAtStart, size_t trimAtEnd)
+{
+    MappedStreamContext *context = stream->context;
+    if ((trimAtStart + trimAtEnd) > context->subBufferSize) {
+        return -1;
+    }
+
+    context->subBufferStart += trimAtStart;
+    context->subBufferSize -= (trimAtStart + trimAtEnd);
+    return 0;
+}
+
+static int mapped_stream_expand(MemoryStream *stream, size_t expandAtStart, size_t expandAtEnd)
+{
+    MappedStreamContext *context = stream->context;
+
+    // Expanding would change the contents, which is only allowed for copy-on-write streams
+    if ((stream->flags & MEMORY_STREAM_FLAG_MUTABLE) == 0) return -1;
+
+    // The file mapping can't grow, so move the data into an anonymous mapping
+    size_t newSize = context->subBufferSize + expandAtStart + expandAtEnd;
+    uint8_t *newMapping = _mapped_stream_map_anonymous(newSize);
+    if (!newMapping) {
+        printf("Error: failed to expand mapped stream: %s\n", strerror(errno));
+        return -1;
+    }
+    memcpy(&newMapping[expandAtStart], &context->mapping[context->subBufferStart], context->subBufferSize);
+    if (stream->flags & MEMORY_STREAM_FLAG_OWNS_DATA) {
+        munmap(context->mapping, context->mappingSize);
+    }
+    context->mapping = newMapping;
+    context->mappingSize = newSize ? newSize : 1;
+    context->subBufferStart = 0;
+    context->subBufferSize = newSize;
+    stream->flags |= MEMORY_STREAM_FLAG_OWNS_DATA;
+
+    return 0;
+}
+
+static MemoryStream *mapped_stream_softclone(MemoryStream *stream)
+{
+    MemoryStream *clone = malloc(sizeof(MemoryStream));
+    if (!clone) return NULL;
+    memset(clone, 0, sizeof(MemoryStream));
+
+    MappedStreamContext *context = stream->context;
+    MappedStreamContext *contextCopy = malloc(sizeof(MappedStreamContext));
+    if (!contextCopy) {
+        free(clone);
+        return NULL;
+    }
+
+    contextCopy->mapping = context->mapping;
+    contextCopy->mappingSize = context->mappingSize;
+    contextCopy->subBufferStart = context->subBufferStart;
+    contextCopy->subBufferSize = context->subBufferSize;
+    clone->flags = stream->flags & ~(MEMORY_STREAM_FLAG_OWNS_DATA);
+
+    clone->context = contextCopy;
+    return clone;
+}
+
+static MemoryStream *mapped_stream_hardclone(MemoryStream *stream)
+{
+    MemoryStream *clone = mapped_stream_softclone(stream);
+    if (clone) {
+        // A clone that still aliases the mapping must not be handed out as a hard clone
+        if (_mapped_stream_make_own_data(clone) != 0) {
+            mapped_stream_free(clone);
+            free(clone);
+            return NULL;
+        }
+    }
+    return clone;
+}
+
+static void mapped_stream_free(MemoryStream *stream)
+{
+    MappedStreamContext *context = stream->context;
+    if (context->mapping) {
+        if (stream->flags & MEMORY_STREAM_FLAG_OWNS_DATA) {
+            munmap(context->mapping, context->mappingSize);
+        }
+    }
+    free(context);
+}
+
+MemoryStream *mapped_stream_init_from_file_descriptor(int fd, uint32_t bufferStart, size_t bufferSize, uint32_t flags)
+{
+    struct stat s;
+    int statRes = fstat(fd, &s);
+    if (statRes != 0) {
+        printf("Error: stat returned %d for %d.\n", statRes, fd);
+        return NULL;
+    }
+
+    if (bufferSize == MAPPED_STREAM_SIZE_AUTO) {
+        if (bufferStart > s.st_size) return NULL;
+        bufferSize = s.st_size - bufferStart;
+    }
+    if (bufferSize == 0 || (bufferStart + bufferSize) > s.st_size) {
+        printf("Error: cannot map 0x%zx bytes at 0x%x of a file of size 0x%llx.\n", bufferSize, bufferStart, (unsigned long long)s.st_size);
+        return NULL;
+    }
+
+    // mmap needs a page aligned file offset, so map from the start of the page that contains bufferStart
+    uint64_t pageMask = (uint64_t)getpagesize() - 1;
+    uint64_t mapStart = bufferStart & ~pageMask;
+    size_t mapSize = (bufferStart - mapStart) + bufferSize;
+
+    int prot = PROT_READ;
+    if (flags & MAPPED_STREAM_FLAG_COPY_ON_WRITE) {
+        prot |= PROT_WRITE;
+    }
+
+    void *mapping = mmap(NULL, mapSize, prot, MAP_PRIVATE, fd, mapStart);
+    if (mapping == MAP_FAILED) {
+        printf("Error: mmap failed for %d: %s\n", fd, strerror(errno));
+        return NULL;
+    }
+
+    MemoryStream *stream = malloc(sizeof(MemoryStream));
+    if (!stream) goto fail;
+    memset(stream, 0, sizeof(MemoryStream));
+
+    MappedStreamContext *context = malloc(sizeof(MappedStreamContext));
+    if (!context) goto fail;
+    context->mapping = mapping;
+    context->mappingSize = mapSize;
+    context->subBufferStart = bufferStart - mapStart;
+    context->subBufferSize = bufferSize;
+
+    stream->context = context;
+    stream->flags = MEMORY_STREAM_FLAG_OWNS_DATA;
+    if (flags & MAPPED_STREAM_FLAG_COPY_ON_WRITE) {
+        stream->flags |= MEMORY_STREAM_FLAG_MUTABLE;
+    }
+    if (flags & MAPPED_STREAM_FLAG_AUTO_EXPAND) {
+        stream->flags |= MEMORY_STREAM_FLAG_AUTO_EXPAND;
+    }
+
+    stream->read = mapped_stream_read;
+    stream->write = mapped_stream_write;
+    stream->getSize = mapped_stream_get_size;
+    stream->getRawPtr = mapped_stream_get_raw_pointer;
+
+    stream->trim = mapped_stream_trim;
+    stream->expand = mapped_stream_expand;
+
+    stream->softclone = mapped_stream_softclone;
+    stream->hardclone = mapped_stream_hardclone;
+    stream->free = mapped_stream_free;
+
+    return stream;
+
+fail:
+    munmap(mapping, mapSize);
+    if (stream) free(stream);
+    return NULL;
+}
+
+MemoryStream *mapped_stream_init_from_path(const char *path, uint32_t bufferStart, size_t bufferSize, uint32_t flags)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Failed to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    // The mapping stays valid after the file descriptor is closed
+    MemoryStream *stream = mapped_stream_init_from_file_descriptor(fd, bufferStart, bufferSize, flags);
+    close(fd);
+    return stream;
+}
\ No newline at end of file
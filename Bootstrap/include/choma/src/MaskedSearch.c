@@ -0,0 +1,413 @@
+#include "MaskedSearch.h"
+#include "Util.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__arm64__) || defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// A kernel finds the first (or last) position in a buffer where (value & mask) matches
+// Word kernels look at consecutive 32-bit words, byte kernels at consecutive bytes
+// All of them return the index of the match or -1
+typedef struct MaskedSearchKernel {
+    const char *name;
+    int64_t (*findWordForward)(const uint8_t *buf, uint64_t count, uint32_t value, uint32_t mask);
+    int64_t (*findWordBackward)(const uint8_t *buf, uint64_t count, uint32_t value, uint32_t mask);
+    int64_t (*findByteForward)(const uint8_t *buf, uint64_t count, uint8_t value, uint8_t mask);
+    int64_t (*findByteBackward)(const uint8_t *buf, uint64_t count, uint8_t value, uint8_t mask);
+} MaskedSearchKernel;
+
+static inline uint32_t _load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static int64_t _find_word_forward_scalar(const uint8_t *buf, uint64_t count, uint32_t value, uint32_t mask)
+{
+    for (uint64_t i = 0; i < count; i++) {
+        if ((_load32(&buf[i * 4]) & mask) == value) return i;
+    }
+    return -1;
+}
+
+static int64_t _find_word_backward_scalar(const uint8_t *buf, uint64_t count, uint32_t value, uint32_t mask)
+{
+    for (uint64_t i = count; i > 0; i--) {
+        if ((_load32(&buf[(i - 1) * 4]) & mask) == value) return i - 1;
+    }
+    return -1;
+}
+
+static int64_t _find_byte_forward_scalar(const uint8_t *buf, uint64_t count, uint8_t value, uint8_t mask)
+{
+    for (uint64_t i = 0; i < count; i++) {
+        if ((buf[i] & mask) == value) return i;
+    }
+    return -1;
+}
+
+static int64_t _find_byte_backward_scalar(const uint8_t *buf, uint64_t count, uint8_t value, uint8_t mask)
+{
+    for (uint64_t i = count; i > 0; i--) {
+        if ((buf[i - 1] & mask) == value) return i - 1;
+    }
+    return -1;
+}
+
+static const MaskedSearchKernel gScalarKernel = {
+    .name = "scalar",
+    .findWordForward = _find_word_forward_scalar,
+    .findWordBackward = _find_word_backward_scalar,
+    .findByteForward = _find_byte_forward_scalar,
+    .findByteBackward = _find_byte_backward_scalar,
+};
+
+#if defined(__x86_64__)
+
+static int64_t _find_word_forward_sse2(const uint8_t *buf, uint64_t count, uint32_t value, uint32_t mask)
+{
+    __m128i v = _mm_set1_epi32(value);
+    __m128i m = _mm_set1_epi32(mask);
+    uint64_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i w = _mm_loadu_si128((const __m128i *)&buf[i * 4]);
+        int bits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(w, m), v)));
+        if (bits) return i + __builtin_ctz(bits);
+    }
+    int64_t r = _find_word_forward_scalar(&buf[i * 4], count - i, value, mask);
+    return r < 0 ? -1 : i + r;
+}
+
+static int64_t _find_word_backward_sse2(const uint8_t *buf, uint64_t count, uint32_t value, uint32_t mask)
+{
+    __m128i v = _mm_set1_epi32(value);
+    __m128i m = _mm_set1_epi32(mask);
+    uint64_t i = count;
+    for (; i >= 4; i -= 4) {
+        __m128i w = _mm_loadu_si128((const __m128i *)&buf[(i - 4) * 4]);
+        int bits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(w, m), v)));
+        if (bits) return (i - 4) + (31 - __builtin_clz(bits));
+    }
+    return _find_word_backward_scalar(buf, i, value, mask);
+}
+
+static int64_t _find_byte_forward_sse2(const uint8_t *buf, uint64_t count, uint8_t value, uint8_t mask)
+{
+    __m128i v = _mm_set1_epi8((char)value);
+    __m128i m = _mm_set1_epi8((char)mask);
+    uint64_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i *)&buf[i]);
+        int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(b, m), v));
+        if (bits) return i + __builtin_ctz(bits);
+    }
+    int64_t r = _find_byte_forward_scalar(&buf[i], count - i, value, mask);
+    return r < 0 ? -1 : i + r;
+}
+
+static int64_t _find_byte_backward_sse2(const uint8_t *buf, uint64_t count, uint8_t value, uint8_t mask)
+{
+    __m128i v = _mm_set1_epi8((char)value);
+    __m128i m = _mm_set1_epi8((char)mask);
+    uint64_t i = count;
+    for (; i >= 16; i -= 16) {
+        __m128i b = _mm_loadu_si128((const __m128i *)&buf[i - 16]);
+        int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(b, m), v));
+        if (bits) return (i - 16) + (31 - __builtin_clz(bits));
+    }
+    return _find_byte_backward_scalar(buf, i, value, mask);
+}
+
+static const MaskedSearchKernel gSSE2Kernel = {
+    .name = "sse2",
+    .findWordForward = _find_word_forward_sse2,
+    .findWordBackward = _find_word_backward_sse2,
+    .findByteForward = _find_byte_forward_sse2,
+    .findByteBackward = _find_byte_backward_sse2,
+};
+
+__attribute__((target("avx2")))
+static int64_t _find_word_forward_avx2(const uint8_t *buf, uint64_t count, uint32_t value, uint32_t mask)
+{
+    __m256i v = _mm256_set1_epi32(value);
+    __m256i m = _mm256_set1_epi32(mask);
+    uint64_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i w0 = _mm256_loadu_si256((const __m256i *)&buf[i * 4]);
+        __m256i w1 = _mm256_loadu_si256((const __m256i *)&buf[(i + 8) * 4]);
+        __m256i c0 = _mm256_cmpeq_epi32(_mm256_and_si256(w0, m), v);
+        __m256i c1 = _mm256_cmpeq_epi32(_mm256_and_si256(w1, m), v);
+        if (!_mm256_testz_si256(_mm256_or_si256(c0, c1), _mm256_or_si256(c0, c1))) {
+            int bits = _mm256_movemask_ps(_mm256_castsi256_ps(c0)) | (_mm256_movemask_ps(_mm256_castsi256_ps(c1)) << 8);
+            return i + __builtin_ctz(bits);
+        }
+    }
+    int64_t r = _find_word_forward_sse2(&buf[i * 4], count - i, value, mask);
+    return r < 0 ? -1 : i + r;
+}
+
+__attribute__((target("avx2")))
+static int64_t _find_word_backward_avx2(const uint8_t *buf, uint64_t count, uint32_t value, uint32_t mask)
+{
+    __m256i v = _mm256_set1_epi32(value);
+    __m256i m = _mm256_set1_epi32(mask);
+    uint64_t i = count;
+    for (; i >= 16; i -= 16) {
+        __m256i w0 = _mm256_loadu_si256((const __m256i *)&buf[(i - 16) * 4]);
+        __m256i w1 = _mm256_loadu_si256((const __m256i *)&buf[(i - 8) * 4]);
+        __m256i c0 = _mm256_cmpeq_epi32(_mm256_and_si256(w0, m), v);
+        __m256i c1 = _mm256_cmpeq_epi32(_mm256_and_si256(w1, m), v);
+        if (!_mm256_testz_si256(_mm256_or_si256(c0, c1), _mm256_or_si256(c0, c1))) {
+            int bits = _mm256_movemask_ps(_mm256_castsi256_ps(c0)) | (_mm256_movemask_ps(_mm256_castsi256_ps(c1)) << 8);
+            return (i - 16) + (31 - __builtin_clz(bits));
+        }
+    }
+    return _find_word_backward_sse2(buf, i, value, mask);
+}
+
+__attribute__((target("avx2")))
+static int64_t _find_byte_forward_avx2(const uint8_t *buf, uint64_t count, uint8_t value, uint8_t mask)
+{
+    __m256i v = _mm256_set1_epi8((char)value);
+    __m256i m = _mm256_set1_epi8((char)mask);
+    uint64_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i *)&buf[i]);
+        uint32_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(b, m), v));
+        if (bits) return i + __builtin_ctz(bits);
+    }
+    int64_t r = _find_byte_forward_sse2(&buf[i], count - i, value, mask);
+    return r < 0 ? -1 : i + r;
+}
+
+__attribute__((target("avx2")))
+static int64_t _find_byte_backward_avx2(const uint8_t *buf, uint64_t count, uint8_t value, uint8_t mask)
+{
+    __m256i v = _mm256_set1_epi8((char)value);
+    __m256i m = _mm256_set1_epi8((char)mask);
+    uint64_t i = count;
+    for (; i >= 32; i -= 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i *)&buf[i - 32]);
+        uint32_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(b, m), v));
+        if (bits) return (i - 32) + (31 - __builtin_clz(bits));
+    }
+    return _find_byte_backward_sse2(buf, i, value, mask);
+}
+
+static const MaskedSearchKernel gAVX2Kernel = {
+    .name = "avx2",
+    .findWordForward = _find_word_forward_avx2,
+    .findWordBackward = _find_word_backward_avx2,
+    .findByteForward = _find_byte_forward_avx2,
+    .findByteBackward = _find_byte_backward_avx2,
+};
+
+#elif defined(__arm64__) || defined(__aarch64__)
+
+// Narrow a comparison result to 4 bits per byte lane (or 16 bits per word lane), so it fits into a general purpose register
+static inline uint64_t _neon_match_bits_u8(uint8x16_t eq)
+{
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+static inline uint64_t _neon_match_bits_u32(uint32x4_t eq)
+{
+    return vget_lane_u64(vreinterpret_u64_u16(vmovn_u32(eq)), 0);
+}
+
+static int64_t _find_word_forward_neon(const uint8_t *buf, uint64_t count, uint32_t value, uint32_t mask)
+{
+    uint32x4_t v = vdupq_n_u32(value);
+    uint32x4_t m = vdupq_n_u32(mask);
+    uint64_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint32x4_t c0 = vceqq_u32(vandq_u32(vreinterpretq_u32_u8(vld1q_u8(&buf[i * 4])), m), v);
+        uint32x4_t c1 = vceqq_u32(vandq_u32(vreinterpretq_u32_u8(vld1q_u8(&buf[(i + 4) * 4])), m), v);
+        if (vmaxvq_u32(vorrq_u32(c0, c1))) {
+            uint64_t bits = _neon_match_bits_u32(c0);
+            if (bits) return i + (__builtin_ctzll(bits) >> 4);
+            return i + 4 + (__builtin_ctzll(_neon_match_bits_u32(c1)) >> 4);
+        }
+    }
+    int64_t r = _find_word_forward_scalar(&buf[i * 4], count - i, value, mask);
+    return r < 0 ? -1 : i + r;
+}
+
+static int64_t _find_word_backward_neon(const uint8_t *buf, uint64_t count, uint32_t value, uint32_t mask)
+{
+    uint32x4_t v = vdupq_n_u32(value);
+    uint32x4_t m = vdupq_n_u32(mask);
+    uint64_t i = count;
+    for (; i >= 8; i -= 8) {
+        uint32x4_t c0 = vceqq_u32(vandq_u32(vreinterpretq_u32_u8(vld1q_u8(&buf[(i - 8) * 4])), m), v);
+        uint32x4_t c1 = vceqq_u32(vandq_u32(vreinterpretq_u32_u8(vld1q_u8(&buf[(i - 4) * 4])), m), v);
+        if (vmaxvq_u32(vorrq_u32(c0, c1))) {
+            uint64_t bits = _neon_match_bits_u32(c1);
+            if (bits) return (i - 4) + ((63 - __builtin_clzll(bits)) >> 4);
+            return (i - 8) + ((63 - __builtin_clzll(_neon_match_bits_u32(c0))) >> 4);
+        }
+    }
+    return _find_word_backward_scalar(buf, i, value, mask);
+}
+
+static int64_t _find_byte_forward_neon(const uint8_t *buf, uint64_t count, uint8_t value, uint8_t mask)
+{
+    uint8x16_t v = vdupq_n_u8(value);
+    uint8x16_t m = vdupq_n_u8(mask);
+    uint64_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint64_t bits = _neon_match_bits_u8(vceqq_u8(vandq_u8(vld1q_u8(&buf[i]), m), v));
+        if (bits) return i + (__builtin_ctzll(bits) >> 2);
+    }
+    int64_t r = _find_byte_forward_scalar(&buf[i], count - i, value, mask);
+    return r < 0 ? -1 : i + r;
+}
+
+static int64_t _find_byte_backward_neon(const uint8_t *buf, uint64_t count, uint8_t value, uint8_t mask)
+{
+    uint8x16_t v = vdupq_n_u8(value);
+    uint8x16_t m = vdupq_n_u8(mask);
+    uint64_t i = count;
+    for (; i >= 16; i -= 16) {
+        uint64_t bits = _neon_match_bits_u8(vceqq_u8(vandq_u8(vld1q_u8(&buf[i - 16]), m), v));
+        if (bits) return (i - 16) + ((63 - __builtin_clzll(bits)) >> 2);
+    }
+    return _find_byte_backward_scalar(buf, i, value, mask);
+}
+
+static const MaskedSearchKernel gNEONKernel = {
+    .name = "neon",
+    .findWordForward = _find_word_forward_neon,
+    .findWordBackward = _find_word_backward_neon,
+    .findByteForward = _find_byte_forward_neon,
+    .findByteBackward = _find_byte_backward_neon,
+};
+
+#endif
+
+static const MaskedSearchKernel *gKernel = &gScalarKernel;
+static pthread_once_t gKernelOnce = PTHREAD_ONCE_INIT;
+
+static void _masked_search_select_kernel(void)
+{
+#if defined(__x86_64__)
+    gKernel = __builtin_cpu_supports("avx2") ? &gAVX2Kernel : &gSSE2Kernel;
+#elif defined(__arm64__) || defined(__aarch64__)
+    gKernel = &gNEONKernel;
+#endif
+}
+
+static const MaskedSearchKernel *_masked_search_get_kernel(void)
+{
+    pthread_once(&gKernelOnce, _masked_search_select_kernel);
+    return gKernel;
+}
+
+const char *masked_search_get_kernel_name(void)
+{
+    return _masked_search_get_kernel()->name;
+}
+
+int masked_search_get_candidates(uint64_t start, uint64_t end, uint16_t alignment, size_t nbytes, MaskedSearchCandidates *candidatesOut)
+{
+    // Mirrors the checks and the loop condition of enumerate_range
+    if (start == end) return 0;
+    if (alignment == 0) return 0;
+    if (nbytes == 0) return 0;
+    if (nbytes % alignment) return 0;
+
+    if (start < end) {
+        if (end < nbytes) return 0;
+        end -= nbytes;
+        if (start >= end) return 0;
+        if ((end - start) % alignment) return -1;
+        candidatesOut->first = start;
+        candidatesOut->count = ((end - start) / alignment) - 1;
+        candidatesOut->backwards = false;
+    }
+    else {
+        if (start < nbytes) return 0;
+        start -= nbytes;
+        if (start <= end) return 0;
+        if ((start - end) % alignment) return -1;
+        candidatesOut->first = start;
+        candidatesOut->count = ((start - end) / alignment) - 1;
+        candidatesOut->backwards = true;
+    }
+    return candidatesOut->count ? 1 : 0;
+}
+
+int masked_search_buffer(const uint8_t *buf, uint64_t bufStart, MaskedSearchCandidates *candidates, const void *bytes, const void *mask, size_t nbytes, uint16_t alignment, uint64_t *foundOffsetOut)
+{
+    if (candidates->count == 0) return -1;
+
+    const MaskedSearchKernel *kernel = _masked_search_get_kernel();
+    const uint8_t *patternBytes = bytes;
+    const uint8_t *patternMask = mask;
+
+    // Lowest candidate, relative to buf
+    uint64_t lowest = candidates->backwards ? (candidates->first - (candidates->count - 1) * alignment) : candidates->first;
+    const uint8_t *searchStart = &buf[lowest - bufStart];
+
+    // Instructions: compare whole words
+    if (nbytes == sizeof(uint32_t) && alignment == sizeof(uint32_t)) {
+        uint32_t wordMask = patternMask ? _load32(patternMask) : UINT32_MAX;
+        uint32_t wordValue = _load32(patternBytes) & wordMask;
+        int64_t index = candidates->backwards ? kernel->findWordBackward(searchStart, candidates->count, wordValue, wordMask) : kernel->findWordForward(searchStart, candidates->count, wordValue, wordMask);
+        if (index < 0) return -1;
+        *foundOffsetOut = lowest + (index * alignment);
+        return 0;
+    }
+
+    // Anything else: use the byte with the most significant mask bits as a filter, then check the full pattern at every hit
+    size_t anchor = 0;
+    int anchorBits = -1;
+    for (size_t i = 0; i < nbytes; i++) {
+        int bits = __builtin_popcount(patternMask ? patternMask[i] : 0xFF);
+        if (bits > anchorBits) {
+            anchor = i;
+            anchorBits = bits;
+            if (bits == 8) break;
+        }
+    }
+    uint8_t anchorMask = patternMask ? patternMask[anchor] : 0xFF;
+    uint8_t anchorValue = patternBytes[anchor] & anchorMask;
+
+    // Positions of the anchor byte that belong to a candidate are [0, scanCount) relative to scanStart
+    const uint8_t *scanStart = &searchStart[anchor];
+    uint64_t scanCount = (candidates->count - 1) * alignment + 1;
+
+    if (!candidates->backwards) {
+        uint64_t pos = 0;
+        while (pos < scanCount) {
+            int64_t index = kernel->findByteForward(&scanStart[pos], scanCount - pos, anchorValue, anchorMask);
+            if (index < 0) return -1;
+            pos += index;
+            if ((pos % alignment) == 0 && memcmp_masked(&searchStart[pos], patternBytes, (unsigned char *)patternMask, nbytes) == 0) {
+                *foundOffsetOut = lowest + pos;
+                return 0;
+            }
+            pos++;
+        }
+    }
+    else {
+        uint64_t endPos = scanCount;
+        while (endPos > 0) {
+            int64_t index = kernel->findByteBackward(scanStart, endPos, anchorValue, anchorMask);
+            if (index < 0) return -1;
+            uint64_t pos = index;
+            if ((pos % alignment) == 0 && memcmp_masked(&searchStart[pos], patternBytes, (unsigned char *)patternMask, nbytes) == 0) {
+                *foundOffsetOut = lowest + pos;
+                return 0;
+            }
+            endPos = pos;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,25 @@
+#ifndef MASKED_SEARCH_H
+#define MASKED_SEARCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+typedef struct MaskedSearchCandidates {
+    uint64_t first;
+    uint64_t count;
+    bool backwards;
+} MaskedSearchCandidates;
+
+// Work out which offsets enumerate_range would visit for a search from start to end
+// Returns 1 if there are candidates, 0 if there are none and -1 if the range can't be searched in bulk (it's not a multiple of the alignment)
+int masked_search_get_candidates(uint64_t start, uint64_t end, uint16_t alignment, size_t nbytes, MaskedSearchCandidates *candidatesOut);
+
+// Find the first candidate (in search direction) at which bytes match under mask, buf[0] corresponds to offset bufStart
+// buf needs to cover all candidates plus nbytes
+int masked_search_buffer(const uint8_t *buf, uint64_t bufStart, MaskedSearchCandidates *candidates, const void *bytes, const void *mask, size_t nbytes, uint16_t alignment, uint64_t *foundOffsetOut);
+
+// Name of the kernel selected for this CPU
+const char *masked_search_get_kernel_name(void);
+
+#endif // MASKED_SEARCH_H
@@ -1,5 +1,16 @@
 #include "MemoryStream.h"
 #include "Util.h"
+#include "MaskedSearch.h"
+
+typedef struct s_MemoryStreamDirtyRanges {
+    MemoryStreamRange *ranges;
+    uint32_t count;
+    uint32_t capacity;
+    // Set when a range couldn't be recorded, everything counts as dirty then
+    bool overflowed;
+} MemoryStreamDirtyRanges;
+
+static const MemoryStreamRange gEntireStreamRange = { 0, UINT64_MAX };
 
 int memory_stream_read(MemoryStream *stream, uint64_t offset, size_t size, void *outBuf)
 {
@@ -16,6 +27,7 @@ int memory_stream_write(MemoryStream *stream, uint64_t offset, size_t size, cons
     if (stream->write) {
         int ret = stream->write(stream, offset, size, inBuf);
         if (ret != size) { return -1; }
+        memory_stream_mark_dirty(stream, offset, offset + size);
         return 0;
     }
     return -1;
@@ -24,11 +36,25 @@ int memory_stream_write(MemoryStream *stream, uint64_t offset, size_t size, cons
 int memory_stream_insert(MemoryStream *stream, uint64_t offset, size_t size, const void *inBuf)
 {
     if (!(stream->flags & MEMORY_STREAM_FLAG_MUTABLE)) goto fail;
+    if (stream->insert) {
+        if (stream->insert(stream, offset, size, inBuf) != 0) goto fail;
+        memory_stream_mark_dirty(stream, offset, UINT64_MAX);
+        return 0;
+    }
 
     size_t streamSize = memory_stream_get_size(stream);
-    if (memory_stream_expand(stream, 0, size) != 0) goto fail;
-    if (memory_stream_copy_data(stream, offset, stream, offset + size, streamSize-offset) != 0) goto fail;
+    if (offset > streamSize) goto fail;
+
+    // Move whichever side of the insertion point is smaller, streams that can't grow at the start fall back to moving the tail
+    if (offset < (streamSize - offset) && memory_stream_expand(stream, size, 0) == 0) {
+        if (memory_stream_copy_data(stream, size, stream, 0, offset) != 0) goto fail;
+    }
+    else {
+        if (memory_stream_expand(stream, 0, size) != 0) goto fail;
+        if (memory_stream_copy_data(stream, offset, stream, offset + size, streamSize-offset) != 0) goto fail;
+    }
     if (memory_stream_write(stream, offset, size, inBuf) != 0) goto fail;
+    memory_stream_mark_dirty(stream, offset, UINT64_MAX);
     return 0;
 
 fail:
@@ -40,10 +66,25 @@ int memory_stream_delete(MemoryStream *stream, uint64_t offset, size_t size)
 {
     if (size == 0) return 0;
     if (!(stream->flags & MEMORY_STREAM_FLAG_MUTABLE)) goto fail;
+    if (stream->remove) {
+        if (stream->remove(stream, offset, size) != 0) goto fail;
+        memory_stream_mark_dirty(stream, offset, UINT64_MAX);
+        return 0;
+    }
 
     size_t streamSize = memory_stream_get_size(stream);
-    if (memory_stream_copy_data(stream, offset+size, stream, offset, streamSize-(offset+size)) != 0) goto fail;
-    if (memory_stream_trim(stream, 0, size) != 0) goto fail;
+    if (offset + size > streamSize) goto fail;
+
+    // Streams backed by memory can trim at the start without moving anything, so move the head instead if it's smaller
+    if (offset < (streamSize - (offset + size)) && memory_stream_get_raw_pointer(stream)) {
+        if (memory_stream_copy_data(stream, 0, stream, size, offset) != 0) goto fail;
+        if (memory_stream_trim(stream, size, 0) != 0) goto fail;
+    }
+    else {
+        if (memory_stream_copy_data(stream, offset+size, stream, offset, streamSize-(offset+size)) != 0) goto fail;
+        if (memory_stream_trim(stream, 0, size) != 0) goto fail;
+    }
+    memory_stream_mark_dirty(stream, offset, UINT64_MAX);
     return 0;
 
 fail:
@@ -102,6 +143,8 @@ void _memory_stream_clone(MemoryStream *clone, MemoryStream *stream)
 
     clone->trim = stream->trim;
     clone->expand = stream->expand;
+    clone->insert = stream->insert;
+    clone->remove = stream->remove;
 
     clone->softclone = stream->softclone;
     clone->hardclone = stream->hardclone;
@@ -135,7 +178,13 @@ MemoryStream *memory_stream_hardclone(MemoryStream *stream)
 int memory_stream_trim(MemoryStream *stream, size_t trimAtStart, size_t trimAtEnd)
 {
     if (stream->trim) {
-        return stream->trim(stream, trimAtStart, trimAtEnd);
+        size_t oldSize = memory_stream_get_size(stream);
+        int r = stream->trim(stream, trimAtStart, trimAtEnd);
+        if (r == 0) {
+            // Trimming at the start moves everything, trimming at the end only changes the data from the new end on
+            memory_stream_mark_dirty(stream, (trimAtStart || oldSize == MEMORY_STREAM_SIZE_INVALID) ? 0 : (oldSize - trimAtEnd), UINT64_MAX);
+        }
+        return r;
     }
     return -1;
 }
@@ -143,7 +192,12 @@ int memory_stream_trim(MemoryStream *stream, size_t trimAtStart, size_t trimAtEn
 int memory_stream_expand(MemoryStream *stream, size_t expandAtStart, size_t expandAtEnd)
 {
     if (stream->expand) {
-        return stream->expand(stream, expandAtStart, expandAtEnd);
+        size_t oldSize = memory_stream_get_size(stream);
+        int r = stream->expand(stream, expandAtStart, expandAtEnd);
+        if (r == 0) {
+            memory_stream_mark_dirty(stream, (expandAtStart || oldSize == MEMORY_STREAM_SIZE_INVALID) ? 0 : oldSize, UINT64_MAX);
+        }
+        return r;
     }
     return -1;
 }
@@ -153,9 +207,99 @@ void memory_stream_free(MemoryStream *stream)
     if (stream->free) {
         stream->free(stream);
     }
+    memory_stream_set_dirty_tracking(stream, false);
     free(stream);
 }
 
+int memory_stream_set_dirty_tracking(MemoryStream *stream, bool enabled)
+{
+    if (enabled && !stream->dirtyRanges) {
+        stream->dirtyRanges = calloc(1, sizeof(MemoryStreamDirtyRanges));
+        if (!stream->dirtyRanges) return -1;
+    }
+    else if (!enabled && stream->dirtyRanges) {
+        if (stream->dirtyRanges->ranges) free(stream->dirtyRanges->ranges);
+        free(stream->dirtyRanges);
+        stream->dirtyRanges = NULL;
+    }
+    return 0;
+}
+
+bool memory_stream_is_tracking_dirty_ranges(MemoryStream *stream)
+{
+    return stream->dirtyRanges != NULL;
+}
+
+void memory_stream_mark_dirty(MemoryStream *stream, uint64_t start, uint64_t end)
+{
+    MemoryStreamDirtyRanges *dirty = stream->dirtyRanges;
+    if (!dirty || dirty->overflowed || start >= end) return;
+
+    // Find the first range that ends at or after start, every range from there that starts at or before end gets merged into the new one
+    uint32_t first = 0, last = dirty->count;
+    while (first < last) {
+        uint32_t middle = first + (last - first) / 2;
+        if (dirty->ranges[middle].end < start) {
+            first = middle + 1;
+        }
+        else {
+            last = middle;
+        }
+    }
+    last = first;
+    while (last < dirty->count && dirty->ranges[last].start <= end) {
+        if (dirty->ranges[last].start < start) start = dirty->ranges[last].start;
+        if (dirty->ranges[last].end > end) end = dirty->ranges[last].end;
+        last++;
+    }
+
+    if (first == last) {
+        if (dirty->count == dirty->capacity) {
+            uint32_t newCapacity = dirty->capacity ? (dirty->capacity * 2) : 16;
+            MemoryStreamRange *newRanges = realloc(dirty->ranges, newCapacity * sizeof(MemoryStreamRange));
+            if (!newRanges) {
+                // Rather treat everything as dirty than lose a write
+                dirty->overflowed = true;
+                return;
+            }
+            dirty->ranges = newRanges;
+            dirty->capacity = newCapacity;
+        }
+        memmove(&dirty->ranges[first + 1], &dirty->ranges[first], (dirty->count - first) * sizeof(MemoryStreamRange));
+        dirty->count++;
+        last = first + 1;
+    }
+
+    dirty->ranges[first].start = start;
+    dirty->ranges[first].end = end;
+    if (last > first + 1) {
+        memmove(&dirty->ranges[first + 1], &dirty->ranges[last], (dirty->count - last) * sizeof(MemoryStreamRange));
+        dirty->count -= (last - first - 1);
+    }
+}
+
+const MemoryStreamRange *memory_stream_get_dirty_ranges(MemoryStream *stream, uint32_t *countOut)
+{
+    if (!stream->dirtyRanges) {
+        if (countOut) *countOut = 0;
+        return NULL;
+    }
+    if (stream->dirtyRanges->overflowed) {
+        if (countOut) *countOut = 1;
+        return &gEntireStreamRange;
+    }
+    if (countOut) *countOut = stream->dirtyRanges->count;
+    return stream->dirtyRanges->ranges;
+}
+
+void memory_stream_clear_dirty_ranges(MemoryStream *stream)
+{
+    if (stream->dirtyRanges) {
+        stream->dirtyRanges->count = 0;
+        stream->dirtyRanges->overflowed = false;
+    }
+}
+
 #define COPY_DATA_BUFFER_SIZE 0x4000
 int memory_stream_copy_data(MemoryStream *originStream, uint64_t originOffset, MemoryStream *targetStream, uint64_t targetOffset, size_t size)
 {
@@ -170,10 +314,40 @@ int memory_stream_copy_data(MemoryStream *originStream, uint64_t originOffset, M
         printf("Error: memory_stream_copy_data failed, originOffset OOB\n");
         return -1;
     }
-    if (targetOffset + size > targetSize && !(memory_stream_get_flags(targetStream) | MEMORY_STREAM_FLAG_AUTO_EXPAND)) {
+    if (targetOffset + size > targetSize && !(memory_stream_get_flags(targetStream) & MEMORY_STREAM_FLAG_AUTO_EXPAND)) {
         printf("Error: memory_stream_copy_data failed, targetOffset OOB\n");
         return -1;
     }
+    if (size == 0) return 0;
+
+    // Fast paths for streams that are backed by memory
+    // Writing through the raw pointer of the target is only allowed if it owns its data (copy-on-write clones don't)
+    uint8_t *originPtr = memory_stream_get_raw_pointer(originStream);
+    uint8_t *targetPtr = memory_stream_get_raw_pointer(targetStream);
+    uint32_t requiredTargetFlags = MEMORY_STREAM_FLAG_OWNS_DATA | MEMORY_STREAM_FLAG_MUTABLE;
+    bool targetWritableInPlace = targetPtr && ((memory_stream_get_flags(targetStream) & requiredTargetFlags) == requiredTargetFlags) && (targetOffset + size <= targetSize);
+    if (originPtr && targetWritableInPlace) {
+        memmove(&targetPtr[targetOffset], &originPtr[originOffset], size);
+        memory_stream_mark_dirty(targetStream, targetOffset, targetOffset + size);
+        return 0;
+    }
+    if (originPtr && originStream != targetStream) {
+        int wr = memory_stream_write(targetStream, targetOffset, size, &originPtr[originOffset]);
+        if (wr != 0) {
+            printf("Error: memory_stream_copy_data failed on memory_stream_write (%d)\n", wr);
+        }
+        return wr;
+    }
+    if (targetWritableInPlace && originStream != targetStream) {
+        int rr = memory_stream_read(originStream, originOffset, size, &targetPtr[targetOffset]);
+        if (rr != 0) {
+            printf("Error: memory_stream_copy_data failed on memory_stream_read (%d)\n", rr);
+        }
+        else {
+            memory_stream_mark_dirty(targetStream, targetOffset, targetOffset + size);
+        }
+        return rr;
+    }
 
     bool backwards = (originStream == targetStream) && (targetOffset > originOffset);
 
@@ -196,15 +370,49 @@ int memory_stream_copy_data(MemoryStream *originStream, uint64_t originOffset, M
         int wr = memory_stream_write(targetStream, writeOffset, sizeToCopy, buffer);
         if (wr != 0) {
             printf("Error: memory_stream_copy_data failed on memory_stream_write (%d)\n", wr);
-            return rr;
+            return wr;
         }
     }
 
     return 0;
 }
 
+#define FIND_MEMORY_CHUNK_SIZE 0x100000
 int memory_stream_find_memory(MemoryStream *stream, uint64_t searchStartOffset, uint64_t searchEndOffset, void *bytes, void *mask, size_t nbytes, uint16_t alignment, uint64_t *foundOffsetOut)
 {
+    MaskedSearchCandidates candidates;
+    int c = masked_search_get_candidates(searchStartOffset, searchEndOffset, alignment, nbytes, &candidates);
+    if (c == 0) return -1;
+    if (c == 1) {
+        uint64_t highest = candidates.backwards ? candidates.first : (candidates.first + (candidates.count - 1) * alignment);
+        uint8_t *rawPtr = memory_stream_get_raw_pointer(stream);
+        if (rawPtr && (highest + nbytes) <= memory_stream_get_size(stream)) {
+            return masked_search_buffer(rawPtr, 0, &candidates, bytes, mask, nbytes, alignment, foundOffsetOut);
+        }
+
+        // No raw pointer, search the stream in chunks of candidates (in search direction)
+        uint64_t candidatesPerChunk = FIND_MEMORY_CHUNK_SIZE / alignment;
+        uint8_t *chunk = malloc((candidatesPerChunk - 1) * alignment + nbytes);
+        if (!chunk) return -1;
+
+        int r = -1;
+        for (uint64_t done = 0; done < candidates.count && r != 0; done += candidatesPerChunk) {
+            MaskedSearchCandidates chunkCandidates = candidates;
+            chunkCandidates.count = candidates.count - done;
+            if (chunkCandidates.count > candidatesPerChunk) {
+                chunkCandidates.count = candidatesPerChunk;
+            }
+            chunkCandidates.first = candidates.backwards ? (candidates.first - done * alignment) : (candidates.first + done * alignment);
+
+            uint64_t chunkStart = candidates.backwards ? (chunkCandidates.first - (chunkCandidates.count - 1) * alignment) : chunkCandidates.first;
+            size_t chunkSize = (chunkCandidates.count - 1) * alignment + nbytes;
+            if (memory_stream_read(stream, chunkStart, chunkSize, chunk) != 0) break;
+            r = masked_search_buffer(chunk, chunkStart, &chunkCandidates, bytes, mask, nbytes, alignment, foundOffsetOut);
+        }
+        free(chunk);
+        return r;
+    }
+
     __block int r = -1;
     enumerate_range(searchStartOffset, searchEndOffset, alignment, nbytes, ^bool(uint64_t cur) {
         uint8_t buf[nbytes];
@@ -15,6 +15,14 @@
 
 #define MEMORY_STREAM_SIZE_INVALID (size_t)-1
 
+// A byte range [start, end) of a stream, end is UINT64_MAX for ranges that reach until the end of the stream
+typedef struct s_MemoryStreamRange {
+   uint64_t start;
+   uint64_t end;
+} MemoryStreamRange;
+
+struct s_MemoryStreamDirtyRanges;
+
 // A generic memory IO interface that is used throughout this project
 // Can be backed by anything, just the functions have to be implemented
 typedef struct s_MemoryStream {
@@ -29,9 +37,16 @@ typedef struct s_MemoryStream {
    int (*trim)(struct s_MemoryStream *stream, size_t trimAtStart, size_t trimAtEnd);
    int (*expand)(struct s_MemoryStream *stream, size_t expandAtStart, size_t expandAtEnd);
 
+   // Optional, for streams that can insert or remove data without moving everything behind it
+   int (*insert)(struct s_MemoryStream *stream, uint64_t offset, size_t size, const void *inBuf);
+   int (*remove)(struct s_MemoryStream *stream, uint64_t offset, size_t size);
+
    struct s_MemoryStream *(*hardclone)(struct s_MemoryStream *stream);
    struct s_MemoryStream *(*softclone)(struct s_MemoryStream *stream);
    void (*free)(struct s_MemoryStream *stream);
+
+   // Ranges written since dirty tracking was enabled, NULL if it isn't
+   struct s_MemoryStreamDirtyRanges *dirtyRanges;
 } MemoryStream;
 
 int memory_stream_read(MemoryStream *stream, uint64_t offset, size_t size, void *outBuf);
@@ -54,6 +69,15 @@ int memory_stream_expand(MemoryStream *stream, size_t expandAtStart, size_t expa
 
 void memory_stream_free(MemoryStream *stream);
 
+// Dirty tracking records which ranges of a stream were changed through the memory_stream_* functions
+// Writes straight through the raw pointer are not seen, insertions, deletions and trims at the start dirty everything behind them
+int memory_stream_set_dirty_tracking(MemoryStream *stream, bool enabled);
+bool memory_stream_is_tracking_dirty_ranges(MemoryStream *stream);
+void memory_stream_mark_dirty(MemoryStream *stream, uint64_t start, uint64_t end);
+// Sorted, non overlapping ranges, only valid until the stream is changed again
+const MemoryStreamRange *memory_stream_get_dirty_ranges(MemoryStream *stream, uint32_t *countOut);
+void memory_stream_clear_dirty_ranges(MemoryStream *stream);
+
 int memory_stream_copy_data(MemoryStream *originStream, uint64_t originOffset, MemoryStream *targetStream, uint64_t targetOffset, size_t size);
 int memory_stream_find_memory(MemoryStream *stream, uint64_t searchStartOffset, uint64_t searchEndOffset, void *bytes, void *mask, size_t nbytes, uint16_t alignment, uint64_t *foundOffsetOut);
 
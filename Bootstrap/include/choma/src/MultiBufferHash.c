@@ -0,0 +1,698 @@
+#include "MultiBufferHash.h"
+
+#include <CommonCrypto/CommonDigest.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#include <cpuid.h>
+#elif defined(__arm64__) || defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#define MULTI_BUFFER_HASH_MAX_LANES 8
+#define MULTI_BUFFER_HASH_BLOCK_SIZE 64
+
+// Hash state of every lane, stored word by word so that one vector register holds the same word of all lanes
+typedef uint32_t MultiBufferHashState[8][MULTI_BUFFER_HASH_MAX_LANES];
+
+// A kernel runs the compression function over blockCount consecutive 64 byte blocks in each of its lanes
+// Kernels without compression functions hash everything through CommonCrypto
+typedef struct MultiBufferHashKernel {
+    const char *name;
+    uint32_t lanes;
+    void (*sha1Compress)(MultiBufferHashState state, const uint8_t *const *blocks, size_t blockCount);
+    void (*sha256Compress)(MultiBufferHashState state, const uint8_t *const *blocks, size_t blockCount);
+} MultiBufferHashKernel;
+
+static const uint32_t gSHA1InitialState[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+static const uint32_t gSHA1K[4] = {
+    0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6,
+};
+
+static const uint32_t gSHA256InitialState[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint32_t gSHA256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const MultiBufferHashKernel gScalarKernel = {
+    .name = "scalar",
+    .lanes = 1,
+    .sha1Compress = NULL,
+    .sha256Compress = NULL,
+};
+
+#if defined(__x86_64__)
+
+#define AVX2_ROTL(x, n) _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+#define AVX2_ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define AVX2_XOR3(x, y, z) _mm256_xor_si256(_mm256_xor_si256(x, y), z)
+
+// Load 8 big endian words from each lane and transpose them, so that wordsOut[i] holds word i of every lane
+__attribute__((target("avx2")))
+static void _load_words_avx2(const uint8_t *const *blocks, size_t offset, __m256i *wordsOut)
+{
+    const __m256i byteSwap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                             12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    __m256i rows[8], pairs[8], quads[8];
+    for (int l = 0; l < 8; l++) {
+        rows[l] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)&blocks[l][offset]), byteSwap);
+    }
+    for (int l = 0; l < 8; l += 2) {
+        pairs[l] = _mm256_unpacklo_epi32(rows[l], rows[l + 1]);
+        pairs[l + 1] = _mm256_unpackhi_epi32(rows[l], rows[l + 1]);
+    }
+    for (int l = 0; l < 8; l += 4) {
+        quads[l] = _mm256_unpacklo_epi64(pairs[l], pairs[l + 2]);
+        quads[l + 1] = _mm256_unpackhi_epi64(pairs[l], pairs[l + 2]);
+        quads[l + 2] = _mm256_unpacklo_epi64(pairs[l + 1], pairs[l + 3]);
+        quads[l + 3] = _mm256_unpackhi_epi64(pairs[l + 1], pairs[l + 3]);
+    }
+    for (int i = 0; i < 4; i++) {
+        wordsOut[i] = _mm256_permute2x128_si256(quads[i], quads[i + 4], 0x20);
+        wordsOut[i + 4] = _mm256_permute2x128_si256(quads[i], quads[i + 4], 0x31);
+    }
+}
+
+__attribute__((target("avx2")))
+static void _sha1_compress_avx2(MultiBufferHashState state, const uint8_t *const *blocks, size_t blockCount)
+{
+    __m256i s[5];
+    for (int i = 0; i < 5; i++) {
+        s[i] = _mm256_loadu_si256((const __m256i *)state[i]);
+    }
+
+    for (size_t b = 0; b < blockCount; b++) {
+        __m256i w[16];
+        _load_words_avx2(blocks, b * MULTI_BUFFER_HASH_BLOCK_SIZE, &w[0]);
+        _load_words_avx2(blocks, b * MULTI_BUFFER_HASH_BLOCK_SIZE + 32, &w[8]);
+
+        __m256i a = s[0], bb = s[1], c = s[2], d = s[3], e = s[4];
+        for (int t = 0; t < 80; t++) {
+            if (t >= 16) {
+                w[t & 15] = AVX2_ROTL(_mm256_xor_si256(AVX2_XOR3(w[(t - 3) & 15], w[(t - 8) & 15], w[(t - 14) & 15]), w[t & 15]), 1);
+            }
+            __m256i f;
+            if (t < 20) {
+                f = _mm256_xor_si256(_mm256_and_si256(_mm256_xor_si256(c, d), bb), d);
+            }
+            else if (t >= 40 && t < 60) {
+                f = _mm256_or_si256(_mm256_and_si256(bb, c), _mm256_and_si256(d, _mm256_or_si256(bb, c)));
+            }
+            else {
+                f = AVX2_XOR3(bb, c, d);
+            }
+            __m256i temp = _mm256_add_epi32(_mm256_add_epi32(AVX2_ROTL(a, 5), f), _mm256_add_epi32(_mm256_add_epi32(e, w[t & 15]), _mm256_set1_epi32(gSHA1K[t / 20])));
+            e = d;
+            d = c;
+            c = AVX2_ROTL(bb, 30);
+            bb = a;
+            a = temp;
+        }
+
+        s[0] = _mm256_add_epi32(s[0], a);
+        s[1] = _mm256_add_epi32(s[1], bb);
+        s[2] = _mm256_add_epi32(s[2], c);
+        s[3] = _mm256_add_epi32(s[3], d);
+        s[4] = _mm256_add_epi32(s[4], e);
+    }
+
+    for (int i = 0; i < 5; i++) {
+        _mm256_storeu_si256((__m256i *)state[i], s[i]);
+    }
+}
+
+__attribute__((target("avx2")))
+static void _sha256_compress_avx2(MultiBufferHashState state, const uint8_t *const *blocks, size_t blockCount)
+{
+    __m256i s[8];
+    for (int i = 0; i < 8; i++) {
+        s[i] = _mm256_loadu_si256((const __m256i *)state[i]);
+    }
+
+    for (size_t b = 0; b < blockCount; b++) {
+        __m256i w[16];
+        _load_words_avx2(blocks, b * MULTI_BUFFER_HASH_BLOCK_SIZE, &w[0]);
+        _load_words_avx2(blocks, b * MULTI_BUFFER_HASH_BLOCK_SIZE + 32, &w[8]);
+
+        __m256i a = s[0], bb = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int t = 0; t < 64; t++) {
+            if (t >= 16) {
+                __m256i w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];
+                __m256i s0 = AVX2_XOR3(AVX2_ROTR(w15, 7), AVX2_ROTR(w15, 18), _mm256_srli_epi32(w15, 3));
+                __m256i s1 = AVX2_XOR3(AVX2_ROTR(w2, 17), AVX2_ROTR(w2, 19), _mm256_srli_epi32(w2, 10));
+                w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+            }
+            __m256i sum1 = AVX2_XOR3(AVX2_ROTR(e, 6), AVX2_ROTR(e, 11), AVX2_ROTR(e, 25));
+            __m256i ch = _mm256_xor_si256(_mm256_and_si256(_mm256_xor_si256(f, g), e), g);
+            __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sum1), _mm256_add_epi32(_mm256_add_epi32(ch, w[t & 15]), _mm256_set1_epi32(gSHA256K[t])));
+            __m256i sum0 = AVX2_XOR3(AVX2_ROTR(a, 2), AVX2_ROTR(a, 13), AVX2_ROTR(a, 22));
+            __m256i maj = _mm256_or_si256(_mm256_and_si256(a, bb), _mm256_and_si256(c, _mm256_or_si256(a, bb)));
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, t1);
+            d = c;
+            c = bb;
+            bb = a;
+            a = _mm256_add_epi32(t1, _mm256_add_epi32(sum0, maj));
+        }
+
+        s[0] = _mm256_add_epi32(s[0], a);
+        s[1] = _mm256_add_epi32(s[1], bb);
+        s[2] = _mm256_add_epi32(s[2], c);
+        s[3] = _mm256_add_epi32(s[3], d);
+        s[4] = _mm256_add_epi32(s[4], e);
+        s[5] = _mm256_add_epi32(s[5], f);
+        s[6] = _mm256_add_epi32(s[6], g);
+        s[7] = _mm256_add_epi32(s[7], h);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        _mm256_storeu_si256((__m256i *)state[i], s[i]);
+    }
+}
+
+static const MultiBufferHashKernel gAVX2Kernel = {
+    .name = "avx2",
+    .lanes = 8,
+    .sha1Compress = _sha1_compress_avx2,
+    .sha256Compress = _sha256_compress_avx2,
+};
+
+// The SHA extensions work on a single stream, two streams are interleaved to hide the latency of the round instructions
+#define SHANI_LANES 2
+
+__attribute__((target("sha,sse4.1")))
+static void _sha1_compress_shani(MultiBufferHashState state, const uint8_t *const *blocks, size_t blockCount)
+{
+    const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd[SHANI_LANES], e[SHANI_LANES];
+    for (int l = 0; l < SHANI_LANES; l++) {
+        abcd[l] = _mm_set_epi32(state[0][l], state[1][l], state[2][l], state[3][l]);
+        e[l] = _mm_set_epi32(state[4][l], 0, 0, 0);
+    }
+
+    for (size_t b = 0; b < blockCount; b++) {
+        __m128i abcdSaved[SHANI_LANES], eSaved[SHANI_LANES], previous[SHANI_LANES], w[SHANI_LANES][4];
+        for (int l = 0; l < SHANI_LANES; l++) {
+            abcdSaved[l] = abcd[l];
+            eSaved[l] = e[l];
+            for (int i = 0; i < 4; i++) {
+                w[l][i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&blocks[l][b * MULTI_BUFFER_HASH_BLOCK_SIZE + i * 16]), byteSwap);
+            }
+        }
+
+        // Every iteration runs four rounds, the round function changes every five iterations
+        #pragma clang loop unroll(full)
+        for (int i = 0; i < 20; i++) {
+            for (int l = 0; l < SHANI_LANES; l++) {
+                if (i >= 4) {
+                    w[l][i & 3] = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(w[l][i & 3], w[l][(i + 1) & 3]), w[l][(i + 2) & 3]), w[l][(i + 3) & 3]);
+                }
+                __m128i ew = (i == 0) ? _mm_add_epi32(e[l], w[l][0]) : _mm_sha1nexte_epu32(previous[l], w[l][i & 3]);
+                previous[l] = abcd[l];
+                switch (i / 5) {
+                    case 0: abcd[l] = _mm_sha1rnds4_epu32(abcd[l], ew, 0); break;
+                    case 1: abcd[l] = _mm_sha1rnds4_epu32(abcd[l], ew, 1); break;
+                    case 2: abcd[l] = _mm_sha1rnds4_epu32(abcd[l], ew, 2); break;
+                    default: abcd[l] = _mm_sha1rnds4_epu32(abcd[l], ew, 3); break;
+                }
+            }
+        }
+
+        for (int l = 0; l < SHANI_LANES; l++) {
+            e[l] = _mm_sha1nexte_epu32(previous[l], eSaved[l]);
+            abcd[l] = _mm_add_epi32(abcd[l], abcdSaved[l]);
+        }
+    }
+
+    for (int l = 0; l < SHANI_LANES; l++) {
+        state[0][l] = _mm_extract_epi32(abcd[l], 3);
+        state[1][l] = _mm_extract_epi32(abcd[l], 2);
+        state[2][l] = _mm_extract_epi32(abcd[l], 1);
+        state[3][l] = _mm_extract_epi32(abcd[l], 0);
+        state[4][l] = _mm_extract_epi32(e[l], 3);
+    }
+}
+
+__attribute__((target("sha,sse4.1")))
+static void _sha256_compress_shani(MultiBufferHashState state, const uint8_t *const *blocks, size_t blockCount)
+{
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    // The round instruction wants the state as ABEF and CDGH
+    __m128i abef[SHANI_LANES], cdgh[SHANI_LANES];
+    for (int l = 0; l < SHANI_LANES; l++) {
+        abef[l] = _mm_set_epi32(state[0][l], state[1][l], state[4][l], state[5][l]);
+        cdgh[l] = _mm_set_epi32(state[2][l], state[3][l], state[6][l], state[7][l]);
+    }
+
+    for (size_t b = 0; b < blockCount; b++) {
+        __m128i abefSaved[SHANI_LANES], cdghSaved[SHANI_LANES], w[SHANI_LANES][4];
+        for (int l = 0; l < SHANI_LANES; l++) {
+            abefSaved[l] = abef[l];
+            cdghSaved[l] = cdgh[l];
+            for (int i = 0; i < 4; i++) {
+                w[l][i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&blocks[l][b * MULTI_BUFFER_HASH_BLOCK_SIZE + i * 16]), byteSwap);
+            }
+        }
+
+        // Every iteration runs four rounds
+        #pragma clang loop unroll(full)
+        for (int i = 0; i < 16; i++) {
+            __m128i k = _mm_loadu_si128((const __m128i *)&gSHA256K[i * 4]);
+            for (int l = 0; l < SHANI_LANES; l++) {
+                if (i >= 4) {
+                    __m128i x = _mm_add_epi32(_mm_sha256msg1_epu32(w[l][i & 3], w[l][(i + 1) & 3]), _mm_alignr_epi8(w[l][(i + 3) & 3], w[l][(i + 2) & 3], 4));
+                    w[l][i & 3] = _mm_sha256msg2_epu32(x, w[l][(i + 3) & 3]);
+                }
+                __m128i wk = _mm_add_epi32(w[l][i & 3], k);
+                cdgh[l] = _mm_sha256rnds2_epu32(cdgh[l], abef[l], wk);
+                abef[l] = _mm_sha256rnds2_epu32(abef[l], cdgh[l], _mm_shuffle_epi32(wk, 0x0e));
+            }
+        }
+
+        for (int l = 0; l < SHANI_LANES; l++) {
+            abef[l] = _mm_add_epi32(abef[l], abefSaved[l]);
+            cdgh[l] = _mm_add_epi32(cdgh[l], cdghSaved[l]);
+        }
+    }
+
+    for (int l = 0; l < SHANI_LANES; l++) {
+        state[0][l] = _mm_extract_epi32(abef[l], 3);
+        state[1][l] = _mm_extract_epi32(abef[l], 2);
+        state[2][l] = _mm_extract_epi32(cdgh[l], 3);
+        state[3][l] = _mm_extract_epi32(cdgh[l], 2);
+        state[4][l] = _mm_extract_epi32(abef[l], 1);
+        state[5][l] = _mm_extract_epi32(abef[l], 0);
+        state[6][l] = _mm_extract_epi32(cdgh[l], 1);
+        state[7][l] = _mm_extract_epi32(cdgh[l], 0);
+    }
+}
+
+static const MultiBufferHashKernel gSHANIKernel = {
+    .name = "sha-ni",
+    .lanes = SHANI_LANES,
+    .sha1Compress = _sha1_compress_shani,
+    .sha256Compress = _sha256_compress_shani,
+};
+
+static bool _cpu_supports_sha_extensions(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+    return (ebx & (1 << 29)) != 0;
+}
+
+#elif defined(__arm64__) || defined(__aarch64__)
+
+// With the crypto extensions available at compile time the NEON kernel is never selected
+#if !defined(__ARM_FEATURE_SHA2)
+
+#define NEON_ROTL(x, n) vorrq_u32(vshlq_n_u32(x, n), vshrq_n_u32(x, 32 - (n)))
+#define NEON_ROTR(x, n) vorrq_u32(vshrq_n_u32(x, n), vshlq_n_u32(x, 32 - (n)))
+#define NEON_XOR3(x, y, z) veorq_u32(veorq_u32(x, y), z)
+
+// Load 4 big endian words from each lane and transpose them, so that wordsOut[i] holds word i of every lane
+static void _load_words_neon(const uint8_t *const *blocks, size_t offset, uint32x4_t *wordsOut)
+{
+    uint32x4_t rows[4];
+    for (int l = 0; l < 4; l++) {
+        rows[l] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(&blocks[l][offset])));
+    }
+    uint32x4x2_t low = vtrnq_u32(rows[0], rows[1]);
+    uint32x4x2_t high = vtrnq_u32(rows[2], rows[3]);
+    wordsOut[0] = vcombine_u32(vget_low_u32(low.val[0]), vget_low_u32(high.val[0]));
+    wordsOut[1] = vcombine_u32(vget_low_u32(low.val[1]), vget_low_u32(high.val[1]));
+    wordsOut[2] = vcombine_u32(vget_high_u32(low.val[0]), vget_high_u32(high.val[0]));
+    wordsOut[3] = vcombine_u32(vget_high_u32(low.val[1]), vget_high_u32(high.val[1]));
+}
+
+static void _sha1_compress_neon(MultiBufferHashState state, const uint8_t *const *blocks, size_t blockCount)
+{
+    uint32x4_t s[5];
+    for (int i = 0; i < 5; i++) {
+        s[i] = vld1q_u32(state[i]);
+    }
+
+    for (size_t b = 0; b < blockCount; b++) {
+        uint32x4_t w[16];
+        for (int i = 0; i < 4; i++) {
+            _load_words_neon(blocks, b * MULTI_BUFFER_HASH_BLOCK_SIZE + i * 16, &w[i * 4]);
+        }
+
+        uint32x4_t a = s[0], bb = s[1], c = s[2], d = s[3], e = s[4];
+        for (int t = 0; t < 80; t++) {
+            if (t >= 16) {
+                w[t & 15] = NEON_ROTL(veorq_u32(NEON_XOR3(w[(t - 3) & 15], w[(t - 8) & 15], w[(t - 14) & 15]), w[t & 15]), 1);
+            }
+            uint32x4_t f;
+            if (t < 20) {
+                f = vbslq_u32(bb, c, d);
+            }
+            else if (t >= 40 && t < 60) {
+                f = vbslq_u32(veorq_u32(bb, c), d, bb);
+            }
+            else {
+                f = NEON_XOR3(bb, c, d);
+            }
+            uint32x4_t temp = vaddq_u32(vaddq_u32(NEON_ROTL(a, 5), f), vaddq_u32(vaddq_u32(e, w[t & 15]), vdupq_n_u32(gSHA1K[t / 20])));
+            e = d;
+            d = c;
+            c = NEON_ROTL(bb, 30);
+            bb = a;
+            a = temp;
+        }
+
+        s[0] = vaddq_u32(s[0], a);
+        s[1] = vaddq_u32(s[1], bb);
+        s[2] = vaddq_u32(s[2], c);
+        s[3] = vaddq_u32(s[3], d);
+        s[4] = vaddq_u32(s[4], e);
+    }
+
+    for (int i = 0; i < 5; i++) {
+        vst1q_u32(state[i], s[i]);
+    }
+}
+
+static void _sha256_compress_neon(MultiBufferHashState state, const uint8_t *const *blocks, size_t blockCount)
+{
+    uint32x4_t s[8];
+    for (int i = 0; i < 8; i++) {
+        s[i] = vld1q_u32(state[i]);
+    }
+
+    for (size_t b = 0; b < blockCount; b++) {
+        uint32x4_t w[16];
+        for (int i = 0; i < 4; i++) {
+            _load_words_neon(blocks, b * MULTI_BUFFER_HASH_BLOCK_SIZE + i * 16, &w[i * 4]);
+        }
+
+        uint32x4_t a = s[0], bb = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int t = 0; t < 64; t++) {
+            if (t >= 16) {
+                uint32x4_t w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];
+                uint32x4_t s0 = NEON_XOR3(NEON_ROTR(w15, 7), NEON_ROTR(w15, 18), vshrq_n_u32(w15, 3));
+                uint32x4_t s1 = NEON_XOR3(NEON_ROTR(w2, 17), NEON_ROTR(w2, 19), vshrq_n_u32(w2, 10));
+                w[t & 15] = vaddq_u32(vaddq_u32(w[t & 15], s0), vaddq_u32(w[(t - 7) & 15], s1));
+            }
+            uint32x4_t sum1 = NEON_XOR3(NEON_ROTR(e, 6), NEON_ROTR(e, 11), NEON_ROTR(e, 25));
+            uint32x4_t ch = vbslq_u32(e, f, g);
+            uint32x4_t t1 = vaddq_u32(vaddq_u32(h, sum1), vaddq_u32(vaddq_u32(ch, w[t & 15]), vdupq_n_u32(gSHA256K[t])));
+            uint32x4_t sum0 = NEON_XOR3(NEON_ROTR(a, 2), NEON_ROTR(a, 13), NEON_ROTR(a, 22));
+            uint32x4_t maj = vbslq_u32(veorq_u32(a, bb), c, bb);
+            h = g;
+            g = f;
+            f = e;
+            e = vaddq_u32(d, t1);
+            d = c;
+            c = bb;
+            bb = a;
+            a = vaddq_u32(t1, vaddq_u32(sum0, maj));
+        }
+
+        s[0] = vaddq_u32(s[0], a);
+        s[1] = vaddq_u32(s[1], bb);
+        s[2] = vaddq_u32(s[2], c);
+        s[3] = vaddq_u32(s[3], d);
+        s[4] = vaddq_u32(s[4], e);
+        s[5] = vaddq_u32(s[5], f);
+        s[6] = vaddq_u32(s[6], g);
+        s[7] = vaddq_u32(s[7], h);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        vst1q_u32(state[i], s[i]);
+    }
+}
+
+static const MultiBufferHashKernel gNEONKernel = {
+    .name = "neon",
+    .lanes = 4,
+    .sha1Compress = _sha1_compress_neon,
+    .sha256Compress = _sha256_compress_neon,
+};
+
+#else
+
+// The crypto extensions work on a single stream, two streams are interleaved to hide the latency of the round instructions
+#define ARMV8_CRYPTO_LANES 2
+
+static void _sha1_compress_armv8_crypto(MultiBufferHashState state, const uint8_t *const *blocks, size_t blockCount)
+{
+    uint32x4_t abcd[ARMV8_CRYPTO_LANES];
+    uint32_t e[ARMV8_CRYPTO_LANES];
+    for (int l = 0; l < ARMV8_CRYPTO_LANES; l++) {
+        uint32_t words[4] = { state[0][l], state[1][l], state[2][l], state[3][l] };
+        abcd[l] = vld1q_u32(words);
+        e[l] = state[4][l];
+    }
+
+    for (size_t b = 0; b < blockCount; b++) {
+        uint32x4_t abcdSaved[ARMV8_CRYPTO_LANES], w[ARMV8_CRYPTO_LANES][4];
+        uint32_t eSaved[ARMV8_CRYPTO_LANES];
+        for (int l = 0; l < ARMV8_CRYPTO_LANES; l++) {
+            abcdSaved[l] = abcd[l];
+            eSaved[l] = e[l];
+            for (int i = 0; i < 4; i++) {
+                w[l][i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(&blocks[l][b * MULTI_BUFFER_HASH_BLOCK_SIZE + i * 16])));
+            }
+        }
+
+        // Every iteration runs four rounds, the round function changes every five iterations
+        #pragma clang loop unroll(full)
+        for (int i = 0; i < 20; i++) {
+            uint32x4_t k = vdupq_n_u32(gSHA1K[i / 5]);
+            for (int l = 0; l < ARMV8_CRYPTO_LANES; l++) {
+                if (i >= 4) {
+                    w[l][i & 3] = vsha1su1q_u32(vsha1su0q_u32(w[l][i & 3], w[l][(i + 1) & 3], w[l][(i + 2) & 3]), w[l][(i + 3) & 3]);
+                }
+                uint32x4_t wk = vaddq_u32(w[l][i & 3], k);
+                uint32_t nextE = vsha1h_u32(vgetq_lane_u32(abcd[l], 0));
+                switch (i / 5) {
+                    case 0: abcd[l] = vsha1cq_u32(abcd[l], e[l], wk); break;
+                    case 2: abcd[l] = vsha1mq_u32(abcd[l], e[l], wk); break;
+                    default: abcd[l] = vsha1pq_u32(abcd[l], e[l], wk); break;
+                }
+                e[l] = nextE;
+            }
+        }
+
+        for (int l = 0; l < ARMV8_CRYPTO_LANES; l++) {
+            abcd[l] = vaddq_u32(abcd[l], abcdSaved[l]);
+            e[l] += eSaved[l];
+        }
+    }
+
+    for (int l = 0; l < ARMV8_CRYPTO_LANES; l++) {
+        state[0][l] = vgetq_lane_u32(abcd[l], 0);
+        state[1][l] = vgetq_lane_u32(abcd[l], 1);
+        state[2][l] = vgetq_lane_u32(abcd[l], 2);
+        state[3][l] = vgetq_lane_u32(abcd[l], 3);
+        state[4][l] = e[l];
+    }
+}
+
+static void _sha256_compress_armv8_crypto(MultiBufferHashState state, const uint8_t *const *blocks, size_t blockCount)
+{
+    uint32x4_t abcd[ARMV8_CRYPTO_LANES], efgh[ARMV8_CRYPTO_LANES];
+    for (int l = 0; l < ARMV8_CRYPTO_LANES; l++) {
+        uint32_t words[8] = { state[0][l], state[1][l], state[2][l], state[3][l], state[4][l], state[5][l], state[6][l], state[7][l] };
+        abcd[l] = vld1q_u32(&words[0]);
+        efgh[l] = vld1q_u32(&words[4]);
+    }
+
+    for (size_t b = 0; b < blockCount; b++) {
+        uint32x4_t abcdSaved[ARMV8_CRYPTO_LANES], efghSaved[ARMV8_CRYPTO_LANES], w[ARMV8_CRYPTO_LANES][4];
+        for (int l = 0; l < ARMV8_CRYPTO_LANES; l++) {
+            abcdSaved[l] = abcd[l];
+            efghSaved[l] = efgh[l];
+            for (int i = 0; i < 4; i++) {
+                w[l][i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(&blocks[l][b * MULTI_BUFFER_HASH_BLOCK_SIZE + i * 16])));
+            }
+        }
+
+        // Every iteration runs four rounds
+        #pragma clang loop unroll(full)
+        for (int i = 0; i < 16; i++) {
+            uint32x4_t k = vld1q_u32(&gSHA256K[i * 4]);
+            for (int l = 0; l < ARMV8_CRYPTO_LANES; l++) {
+                if (i >= 4) {
+                    w[l][i & 3] = vsha256su1q_u32(vsha256su0q_u32(w[l][i & 3], w[l][(i + 1) & 3]), w[l][(i + 2) & 3], w[l][(i + 3) & 3]);
+                }
+                uint32x4_t wk = vaddq_u32(w[l][i & 3], k);
+                uint32x4_t previous = abcd[l];
+                abcd[l] = vsha256hq_u32(abcd[l], efgh[l], wk);
+                efgh[l] = vsha256h2q_u32(efgh[l], previous, wk);
+            }
+        }
+
+        for (int l = 0; l < ARMV8_CRYPTO_LANES; l++) {
+            abcd[l] = vaddq_u32(abcd[l], abcdSaved[l]);
+            efgh[l] = vaddq_u32(efgh[l], efghSaved[l]);
+        }
+    }
+
+    for (int l = 0; l < ARMV8_CRYPTO_LANES; l++) {
+        uint32_t words[8];
+        vst1q_u32(&words[0], abcd[l]);
+        vst1q_u32(&words[4], efgh[l]);
+        for (int i = 0; i < 8; i++) {
+            state[i][l] = words[i];
+        }
+    }
+}
+
+static const MultiBufferHashKernel gARMv8CryptoKernel = {
+    .name = "armv8-crypto",
+    .lanes = ARMV8_CRYPTO_LANES,
+    .sha1Compress = _sha1_compress_armv8_crypto,
+    .sha256Compress = _sha256_compress_armv8_crypto,
+};
+
+#endif
+
+#endif
+
+static const MultiBufferHashKernel *gKernel = &gScalarKernel;
+static pthread_once_t gKernelOnce = PTHREAD_ONCE_INIT;
+
+static void _multi_buffer_hash_select_kernel(void)
+{
+#if defined(__x86_64__)
+    if (_cpu_supports_sha_extensions() && __builtin_cpu_supports("sse4.1")) {
+        gKernel = &gSHANIKernel;
+    }
+    else if (__builtin_cpu_supports("avx2")) {
+        gKernel = &gAVX2Kernel;
+    }
+#elif defined(__arm64__) || defined(__aarch64__)
+#if defined(__ARM_FEATURE_SHA2)
+    gKernel = &gARMv8CryptoKernel;
+#else
+    gKernel = &gNEONKernel;
+#endif
+#endif
+}
+
+static const MultiBufferHashKernel *_multi_buffer_hash_get_kernel(void)
+{
+    pthread_once(&gKernelOnce, _multi_buffer_hash_select_kernel);
+    return gKernel;
+}
+
+const char *multi_buffer_hash_get_kernel_name(void)
+{
+    return _multi_buffer_hash_get_kernel()->name;
+}
+
+// Hash one buffer per lane, digestsOut receives stateWords big endian words for every lane
+static void _multi_buffer_hash_lanes(void (*compress)(MultiBufferHashState, const uint8_t *const *, size_t), const uint32_t *initialState, uint32_t stateWords, uint32_t lanes, const uint8_t *const *buffers, size_t length, uint8_t *digestsOut)
+{
+    MultiBufferHashState state;
+    for (uint32_t i = 0; i < stateWords; i++) {
+        for (uint32_t l = 0; l < lanes; l++) {
+            state[i][l] = initialState[i];
+        }
+    }
+
+    size_t fullBlockCount = length / MULTI_BUFFER_HASH_BLOCK_SIZE;
+    if (fullBlockCount > 0) {
+        compress(state, buffers, fullBlockCount);
+    }
+
+    // The remaining data is followed by 0x80, zeroes and the big endian bit length, which takes one or two blocks
+    uint8_t tail[MULTI_BUFFER_HASH_MAX_LANES][MULTI_BUFFER_HASH_BLOCK_SIZE * 2];
+    const uint8_t *tailBlocks[MULTI_BUFFER_HASH_MAX_LANES];
+    size_t remaining = length % MULTI_BUFFER_HASH_BLOCK_SIZE;
+    size_t tailSize = (remaining + 9 > MULTI_BUFFER_HASH_BLOCK_SIZE) ? (MULTI_BUFFER_HASH_BLOCK_SIZE * 2) : MULTI_BUFFER_HASH_BLOCK_SIZE;
+    uint64_t bitLength = (uint64_t)length * 8;
+    for (uint32_t l = 0; l < lanes; l++) {
+        memset(tail[l], 0, tailSize);
+        memcpy(tail[l], &buffers[l][fullBlockCount * MULTI_BUFFER_HASH_BLOCK_SIZE], remaining);
+        tail[l][remaining] = 0x80;
+        for (int i = 0; i < 8; i++) {
+            tail[l][tailSize - 1 - i] = (uint8_t)(bitLength >> (i * 8));
+        }
+        tailBlocks[l] = tail[l];
+    }
+    compress(state, tailBlocks, tailSize / MULTI_BUFFER_HASH_BLOCK_SIZE);
+
+    for (uint32_t l = 0; l < lanes; l++) {
+        uint8_t *digest = &digestsOut[l * stateWords * 4];
+        for (uint32_t i = 0; i < stateWords; i++) {
+            digest[i * 4 + 0] = (uint8_t)(state[i][l] >> 24);
+            digest[i * 4 + 1] = (uint8_t)(state[i][l] >> 16);
+            digest[i * 4 + 2] = (uint8_t)(state[i][l] >> 8);
+            digest[i * 4 + 3] = (uint8_t)(state[i][l]);
+        }
+    }
+}
+
+int multi_buffer_hash(MultiBufferHashAlgorithm algorithm, const uint8_t *const *buffers, size_t length, uint32_t count, uint8_t *hashesOut, size_t hashStride)
+{
+    const MultiBufferHashKernel *kernel = _multi_buffer_hash_get_kernel();
+    void (*compress)(MultiBufferHashState, const uint8_t *const *, size_t) = NULL;
+    const uint32_t *initialState = NULL;
+    uint32_t stateWords = 0;
+    switch (algorithm) {
+        case MULTI_BUFFER_HASH_SHA1: {
+            compress = kernel->sha1Compress;
+            initialState = gSHA1InitialState;
+            stateWords = CC_SHA1_DIGEST_LENGTH / 4;
+            break;
+        }
+
+        case MULTI_BUFFER_HASH_SHA256: {
+            compress = kernel->sha256Compress;
+            initialState = gSHA256InitialState;
+            stateWords = CC_SHA256_DIGEST_LENGTH / 4;
+            break;
+        }
+
+        default: {
+            return -1;
+        }
+    }
+
+    size_t copySize = (stateWords * 4) < hashStride ? (stateWords * 4) : hashStride;
+    uint32_t i = 0;
+    if (compress) {
+        uint8_t digests[MULTI_BUFFER_HASH_MAX_LANES * CC_SHA256_DIGEST_LENGTH];
+        for (; count - i >= kernel->lanes; i += kernel->lanes) {
+            _multi_buffer_hash_lanes(compress, initialState, stateWords, kernel->lanes, &buffers[i], length, digests);
+            for (uint32_t l = 0; l < kernel->lanes; l++) {
+                memcpy(&hashesOut[(size_t)(i + l) * hashStride], &digests[l * stateWords * 4], copySize);
+            }
+        }
+    }
+
+    // Whatever is left over doesn't fill all lanes and goes through CommonCrypto
+    for (; i < count; i++) {
+        uint8_t digest[CC_SHA256_DIGEST_LENGTH];
+        if (algorithm == MULTI_BUFFER_HASH_SHA1) {
+            CC_SHA1(buffers[i], (CC_LONG)length, digest);
+        }
+        else {
+            CC_SHA256(buffers[i], (CC_LONG)length, digest);
+        }
+        memcpy(&hashesOut[(size_t)i * hashStride], digest, copySize);
+    }
+
+    return 0;
+}
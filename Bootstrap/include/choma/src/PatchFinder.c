@@ -2,11 +2,19 @@
 #include "MachO.h"
 #include "MemoryStream.h"
 #include "Util.h"
+#include "MaskedSearch.h"
 #include "PatchFinder_arm64.h"
 #include <mach/machine.h>
+#include <pthread.h>
+#include <dispatch/dispatch.h>
 
 int raw_buffer_find_memory(uint8_t *buf, uint64_t searchStartOffset, uint64_t searchEndOffset, void *bytes, void *mask, size_t nbytes, uint16_t alignment, uint64_t *foundOffsetOut)
 {
+    MaskedSearchCandidates candidates;
+    int c = masked_search_get_candidates(searchStartOffset, searchEndOffset, alignment, nbytes, &candidates);
+    if (c == 0) return -1;
+    if (c == 1) return masked_search_buffer(buf, 0, &candidates, bytes, mask, nbytes, alignment, foundOffsetOut);
+
     __block int r = -1;
     enumerate_range(searchStartOffset, searchEndOffset, alignment, nbytes, ^bool(uint64_t cur) {
         if (!memcmp_masked(&buf[cur], bytes, mask, nbytes)) {
@@ -24,16 +32,8 @@ PFSection *pfsec_init_from_macho(MachO *macho, const char *filesetEntryId, const
     PFSection *pfSection = NULL;
     MachO *machoToUse = NULL;
     if (filesetEntryId) {
-        // try to find a fileset macho with this identifier
-        for (uint32_t i = 0; i < macho->filesetCount; i++) {
-            FilesetMachO *filesetMacho = &macho->filesetMachos[i];
-            if (filesetMacho->underlyingMachO->slicesCount == 1) {
-                if (!strcmp(filesetMacho->entry_id, filesetEntryId)) {
-                    machoToUse = filesetMacho->underlyingMachO->slices[0];
-                    break;
-                }
-            }
-        }
+        // try to find a fileset macho with this identifier, only that one gets parsed
+        machoToUse = macho_get_fileset_macho(macho, filesetEntryId);
     }
     else {
         machoToUse = macho;
@@ -76,6 +76,9 @@ PFSection *pfsec_init_from_macho(MachO *macho, const char *filesetEntryId, const
     if (pfSection) {
         pfSection->cache = NULL;
         pfSection->ownsCache = false;
+        pfSection->xrefIndex = NULL;
+        pfSection->stringIndex = NULL;
+        pfSection->parallel = false;
         pfSection->macho = macho;
     }
 
@@ -258,13 +261,165 @@ uint64_t pfsec_find_function_start(PFSection *section, uint64_t midAddr)
 void pfsec_free(PFSection *section)
 {
     pfsec_set_cached(section, false);
+    if (section->xrefIndex) {
+        pfxref_index_free(section->xrefIndex);
+    }
+    if (section->stringIndex) {
+        pfstring_index_free(section->stringIndex);
+    }
     free(section);
 }
 
+void pfsec_set_parallel(PFSection *section, bool parallel)
+{
+    section->parallel = parallel;
+}
+
+int pfparallel_chunk_add_match(PFParallelChunk *chunk, uint64_t vmaddr, uint64_t target, uint32_t type)
+{
+    if (chunk->matchCount == chunk->matchCapacity) {
+        uint64_t newCapacity = chunk->matchCapacity ? (chunk->matchCapacity * 2) : 64;
+        PFParallelMatch *newMatches = realloc(chunk->matches, newCapacity * sizeof(PFParallelMatch));
+        if (!newMatches) {
+            chunk->failed = true;
+            return -1;
+        }
+        chunk->matches = newMatches;
+        chunk->matchCapacity = newCapacity;
+    }
+    chunk->matches[chunk->matchCount++] = (PFParallelMatch){ .vmaddr = vmaddr, .target = target, .type = type };
+    return 0;
+}
+
+#define PF_PARALLEL_CHUNK_SIZE 0x40000
+
+typedef struct s_PFParallelScan {
+    pthread_mutex_t lock;
+    PFParallelChunk *chunks;
+    uint64_t chunkCount;
+    uint64_t nextChunk;
+    bool stopped;
+} PFParallelScan;
+
+void pfsec_scan_parallel(PFSection *section, uint64_t startAddr, uint64_t endAddr, uint16_t alignment, void (^scanBlock)(PFParallelChunk *chunk), void (^deliverBlock)(PFParallelMatch *match, bool *stop))
+{
+    if (endAddr <= startAddr || alignment == 0) return;
+
+    uint64_t chunkSize = PF_PARALLEL_CHUNK_SIZE - (PF_PARALLEL_CHUNK_SIZE % alignment);
+    if (chunkSize == 0) chunkSize = alignment;
+
+    PFParallelScan scan;
+    pthread_mutex_init(&scan.lock, NULL);
+    scan.chunkCount = ((endAddr - startAddr) + chunkSize - 1) / chunkSize;
+    scan.nextChunk = 0;
+    scan.stopped = false;
+    scan.chunks = calloc(scan.chunkCount, sizeof(PFParallelChunk));
+    if (!scan.chunks) {
+        printf("Error: failed to allocate parallel scan chunks\n");
+        pthread_mutex_destroy(&scan.lock);
+        return;
+    }
+    for (uint64_t i = 0; i < scan.chunkCount; i++) {
+        scan.chunks[i].startAddr = startAddr + (i * chunkSize);
+        scan.chunks[i].endAddr = (endAddr - scan.chunks[i].startAddr) > chunkSize ? (scan.chunks[i].startAddr + chunkSize) : endAddr;
+        scan.chunks[i].stopped = &scan.stopped;
+    }
+
+    // Chunks finish in any order, whichever thread completes the next chunk in line delivers everything that's ready
+    PFParallelScan *scanPtr = &scan;
+    dispatch_apply(scan.chunkCount, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t i) {
+        PFParallelChunk *chunk = &scanPtr->chunks[i];
+        if (!__atomic_load_n(&scanPtr->stopped, __ATOMIC_ACQUIRE)) {
+            scanBlock(chunk);
+        }
+
+        pthread_mutex_lock(&scanPtr->lock);
+        chunk->done = true;
+        while (scanPtr->nextChunk < scanPtr->chunkCount && scanPtr->chunks[scanPtr->nextChunk].done) {
+            PFParallelChunk *readyChunk = &scanPtr->chunks[scanPtr->nextChunk];
+            if (readyChunk->failed && !scanPtr->stopped) {
+                printf("Error: failed to scan 0x%llx - 0x%llx\n", readyChunk->startAddr, readyChunk->endAddr);
+                __atomic_store_n(&scanPtr->stopped, true, __ATOMIC_RELEASE);
+            }
+            for (uint64_t j = 0; j < readyChunk->matchCount && !scanPtr->stopped; j++) {
+                bool stop = false;
+                deliverBlock(&readyChunk->matches[j], &stop);
+                if (stop) {
+                    __atomic_store_n(&scanPtr->stopped, true, __ATOMIC_RELEASE);
+                }
+            }
+            free(readyChunk->matches);
+            readyChunk->matches = NULL;
+            scanPtr->nextChunk++;
+        }
+        pthread_mutex_unlock(&scanPtr->lock);
+    });
+
+    free(scan.chunks);
+    pthread_mutex_destroy(&scan.lock);
+}
+
+void _pfsec_scan_pattern_chunk(PFSection *section, PFPatternMetric *patternMetric, PFParallelChunk *chunk)
+{
+    uint16_t alignment = patternMetric->alignment;
+    MaskedSearchCandidates candidates = {
+        .first = chunk->startAddr,
+        .count = (chunk->endAddr - chunk->startAddr) / alignment,
+        .backwards = false,
+    };
+
+    // The last candidate of a chunk overlaps nbytes into the next one
+    uint64_t dataSize = (chunk->endAddr - chunk->startAddr) - alignment + patternMetric->nbytes;
+    uint8_t *data = NULL;
+    if (section->cache) {
+        data = &section->cache[chunk->startAddr - section->vmaddr];
+    }
+    else {
+        data = malloc(dataSize);
+        if (!data) {
+            chunk->failed = true;
+            return;
+        }
+        if (pfsec_read_reloff(section, chunk->startAddr - section->vmaddr, dataSize, data) != 0) {
+            chunk->failed = true;
+            free(data);
+            return;
+        }
+    }
+
+    uint64_t found = 0;
+    while (!__atomic_load_n(chunk->stopped, __ATOMIC_ACQUIRE) && masked_search_buffer(data, chunk->startAddr, &candidates, patternMetric->bytes, patternMetric->mask, patternMetric->nbytes, alignment, &found) == 0) {
+        if (pfparallel_chunk_add_match(chunk, found, 0, 0) != 0) break;
+        uint64_t consumed = ((found - candidates.first) / alignment) + 1;
+        if (consumed >= candidates.count) break;
+        candidates.first = found + alignment;
+        candidates.count -= consumed;
+    }
+
+    if (!section->cache) free(data);
+}
+
 void _pfsec_run_pattern_metric(PFSection *section, uint64_t startAddr, uint64_t endAddr, PFPatternMetric *patternMetric, void (^matchBlock)(uint64_t vmaddr, bool *stop))
 {
     uint16_t alignment = patternMetric->alignment;
 
+    if (section->parallel) {
+        if (startAddr < section->vmaddr || startAddr > (section->vmaddr + section->size)) return;
+        if (endAddr < section->vmaddr   || endAddr > (section->vmaddr + section->size)) return;
+
+        MaskedSearchCandidates candidates;
+        int c = masked_search_get_candidates(startAddr, endAddr, alignment, patternMetric->nbytes, &candidates);
+        if (c == 0) return;
+        if (c == 1 && !candidates.backwards) {
+            pfsec_scan_parallel(section, candidates.first, candidates.first + (candidates.count * alignment), alignment, ^(PFParallelChunk *chunk) {
+                _pfsec_scan_pattern_chunk(section, patternMetric, chunk);
+            }, ^(PFParallelMatch *match, bool *stop) {
+                matchBlock(match->vmaddr, stop);
+            });
+            return;
+        }
+    }
+
     while (pfsec_find_memory(section, startAddr, endAddr, patternMetric->bytes, patternMetric->mask, patternMetric->nbytes, alignment, &startAddr) == 0) {
         bool stop = false;
         matchBlock(startAddr, &stop);
@@ -286,31 +441,266 @@ PFPatternMetric *pfmetric_pattern_init(void *bytes, void *mask, size_t nbytes, u
     return metric;
 }
 
+typedef struct s_PFStringIndexSortEntry {
+    const char *string;
+    uint64_t index;
+} PFStringIndexSortEntry;
+
+static int _pfstring_index_sort_compare(const void *a, const void *b)
+{
+    const PFStringIndexSortEntry *entryA = a;
+    const PFStringIndexSortEntry *entryB = b;
+    int r = strcmp(entryA->string, entryB->string);
+    if (r != 0) return r;
+    return entryA->index < entryB->index ? -1 : (entryA->index > entryB->index);
+}
+
+static int _pfstring_index_compare_index(const void *a, const void *b)
+{
+    uint64_t indexA = *(const uint64_t *)a;
+    uint64_t indexB = *(const uint64_t *)b;
+    return indexA < indexB ? -1 : (indexA > indexB);
+}
+
+PFStringIndex *pfstring_index_build(PFSection *section)
+{
+    PFStringIndex *index = calloc(1, sizeof(PFStringIndex));
+    if (!index) return NULL;
+    index->vmaddr = section->vmaddr;
+    index->size = section->size;
+
+    // Keep a private copy so the index stays valid regardless of the section's cache
+    index->data = malloc(section->size + 1);
+    if (!index->data) goto fail;
+    if (pfsec_read_reloff(section, 0, section->size, index->data) != 0) goto fail;
+    index->data[section->size] = 0;
+
+    // Same walk as reading the strings one by one, a string that isn't terminated inside of the section ends it
+    uint64_t capacity = 0x1000;
+    index->offsets = malloc(capacity * sizeof(uint64_t));
+    index->lengths = malloc(capacity * sizeof(uint32_t));
+    if (!index->offsets || !index->lengths) goto fail;
+    uint64_t offset = 0;
+    while (offset < index->size) {
+        size_t length = strnlen((const char *)&index->data[offset], index->size - offset);
+        if (offset + length >= index->size || length > UINT32_MAX) break;
+        if (index->count == capacity) {
+            capacity *= 2;
+            uint64_t *newOffsets = realloc(index->offsets, capacity * sizeof(uint64_t));
+            if (!newOffsets) goto fail;
+            index->offsets = newOffsets;
+            uint32_t *newLengths = realloc(index->lengths, capacity * sizeof(uint32_t));
+            if (!newLengths) goto fail;
+            index->lengths = newLengths;
+        }
+        index->offsets[index->count] = offset;
+        index->lengths[index->count] = (uint32_t)length;
+        index->count++;
+        offset += length + 1;
+    }
+
+    index->bucketCount = 16;
+    while (index->bucketCount < (index->count * 2)) index->bucketCount <<= 1;
+    index->buckets = calloc(index->bucketCount, sizeof(uint64_t));
+    index->next = malloc((index->count ? index->count : 1) * sizeof(uint64_t));
+    index->sorted = malloc((index->count ? index->count : 1) * sizeof(uint64_t));
+    PFStringIndexSortEntry *sortEntries = malloc((index->count ? index->count : 1) * sizeof(PFStringIndexSortEntry));
+    if (!index->buckets || !index->next || !index->sorted || !sortEntries) {
+        free(sortEntries);
+        goto fail;
+    }
+
+    // Insert back to front so every chain ends up in section order
+    for (uint64_t i = index->count; i > 0; i--) {
+        uint64_t e = i - 1;
+        uint64_t bucket = fnv1a_hash(&index->data[index->offsets[e]], index->lengths[e]) & (index->bucketCount - 1);
+        index->next[e] = index->buckets[bucket];
+        index->buckets[bucket] = e + 1;
+    }
+
+    for (uint64_t i = 0; i < index->count; i++) {
+        sortEntries[i] = (PFStringIndexSortEntry){ .string = (const char *)&index->data[index->offsets[i]], .index = i };
+    }
+    qsort(sortEntries, index->count, sizeof(PFStringIndexSortEntry), _pfstring_index_sort_compare);
+    for (uint64_t i = 0; i < index->count; i++) {
+        index->sorted[i] = sortEntries[i].index;
+    }
+    free(sortEntries);
+
+    return index;
+
+fail:
+    printf("Error: failed to build string index\n");
+    pfstring_index_free(index);
+    return NULL;
+}
+
+static void _pfstring_index_enumerate_exact(PFStringIndex *index, const char *string, void (^matchBlock)(uint64_t vmaddr, bool *stop))
+{
+    size_t length = strlen(string);
+    uint64_t bucket = fnv1a_hash(string, length) & (index->bucketCount - 1);
+    bool stop = false;
+    for (uint64_t e = index->buckets[bucket]; e != 0 && !stop; e = index->next[e - 1]) {
+        if (index->lengths[e - 1] == length && !memcmp(&index->data[index->offsets[e - 1]], string, length)) {
+            matchBlock(index->vmaddr + index->offsets[e - 1], &stop);
+        }
+    }
+}
+
+static void _pfstring_index_enumerate_prefix(PFStringIndex *index, const char *prefix, void (^matchBlock)(uint64_t vmaddr, bool *stop))
+{
+    size_t length = strlen(prefix);
+
+    // Strings sharing a prefix are next to each other in sorted order
+    uint64_t low = 0, high = index->count;
+    while (low < high) {
+        uint64_t mid = low + ((high - low) / 2);
+        if (strcmp((const char *)&index->data[index->offsets[index->sorted[mid]]], prefix) < 0) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    uint64_t end = low;
+    while (end < index->count && !strncmp((const char *)&index->data[index->offsets[index->sorted[end]]], prefix, length)) {
+        end++;
+    }
+    if (end == low) return;
+
+    uint64_t *matches = malloc((end - low) * sizeof(uint64_t));
+    if (!matches) return;
+    memcpy(matches, &index->sorted[low], (end - low) * sizeof(uint64_t));
+    qsort(matches, end - low, sizeof(uint64_t), _pfstring_index_compare_index);
+
+    bool stop = false;
+    for (uint64_t i = 0; i < (end - low) && !stop; i++) {
+        matchBlock(index->vmaddr + index->offsets[matches[i]], &stop);
+    }
+    free(matches);
+}
+
+static void _pfstring_index_enumerate_substring(PFStringIndex *index, const char *substring, void (^matchBlock)(uint64_t vmaddr, bool *stop))
+{
+    size_t length = strlen(substring);
+    bool stop = false;
+    uint64_t e = 0;
+    uint64_t offset = 0;
+    while (e < index->count && !stop) {
+        // Search the raw data for the next hit and work out which string it belongs to
+        uint8_t *hit = memmem(&index->data[offset], index->size - offset, substring, length);
+        if (!hit) break;
+        uint64_t hitOffset = hit - index->data;
+        while (e < index->count && (index->offsets[e] + index->lengths[e]) < hitOffset) e++;
+        if (e == index->count) break;
+
+        if (hitOffset >= index->offsets[e] && (hitOffset + length) <= (index->offsets[e] + index->lengths[e])) {
+            matchBlock(index->vmaddr + index->offsets[e], &stop);
+            offset = index->offsets[e] + index->lengths[e] + 1;
+            e++;
+        }
+        else {
+            offset = hitOffset + 1;
+        }
+    }
+}
+
+void pfstring_index_enumerate(PFStringIndex *index, const char *string, PFStringMatchType matchType, void (^matchBlock)(uint64_t vmaddr, bool *stop))
+{
+    switch (matchType) {
+        case PF_STRING_MATCH_EXACT:
+        _pfstring_index_enumerate_exact(index, string, matchBlock);
+        break;
+        case PF_STRING_MATCH_PREFIX:
+        _pfstring_index_enumerate_prefix(index, string, matchBlock);
+        break;
+        case PF_STRING_MATCH_SUBSTRING:
+        if (string[0] == 0) {
+            // Every string contains the empty string
+            _pfstring_index_enumerate_prefix(index, string, matchBlock);
+        }
+        else {
+            _pfstring_index_enumerate_substring(index, string, matchBlock);
+        }
+        break;
+    }
+}
+
+void pfstring_index_free(PFStringIndex *index)
+{
+    if (index->data) free(index->data);
+    if (index->offsets) free(index->offsets);
+    if (index->lengths) free(index->lengths);
+    if (index->sorted) free(index->sorted);
+    if (index->buckets) free(index->buckets);
+    if (index->next) free(index->next);
+    free(index);
+}
+
+int pfsec_index_strings(PFSection *section)
+{
+    if (section->stringIndex) return 0;
+    section->stringIndex = pfstring_index_build(section);
+    return section->stringIndex ? 0 : -1;
+}
+
+static bool _pfstring_matches(const char *string, const char *pattern, PFStringMatchType matchType)
+{
+    switch (matchType) {
+        case PF_STRING_MATCH_EXACT:
+        return !strcmp(string, pattern);
+        case PF_STRING_MATCH_PREFIX:
+        return !strncmp(string, pattern, strlen(pattern));
+        case PF_STRING_MATCH_SUBSTRING:
+        return strstr(string, pattern) != NULL;
+    }
+    return false;
+}
+
 void _pfsec_run_string_metric(PFSection *section, uint64_t startAddr, uint64_t endAddr, PFStringMetric *stringMetric, void (^matchBlock)(uint64_t vmaddr, bool *stop))
 {
+    if (pfsec_index_strings(section) == 0) {
+        pfstring_index_enumerate(section->stringIndex, stringMetric->string, stringMetric->matchType, ^(uint64_t vmaddr, bool *stop) {
+            if (vmaddr >= startAddr && vmaddr < endAddr) {
+                matchBlock(vmaddr, stop);
+            }
+        });
+        return;
+    }
+
     char *str = NULL;
     uint64_t searchOffset = 0;
     while (pfsec_read_string_reloff(section, searchOffset, &str) == 0) {
-        if (!strcmp(str, stringMetric->string)) {
+        uint64_t vmaddr = section->vmaddr + searchOffset;
+        if (vmaddr >= startAddr && vmaddr < endAddr && _pfstring_matches(str, stringMetric->string, stringMetric->matchType)) {
             bool stop = false;
-            matchBlock(section->vmaddr + searchOffset, &stop);
-            if (stop) break;
+            matchBlock(vmaddr, &stop);
+            if (stop) {
+                free(str);
+                break;
+            }
         }
         searchOffset += strlen(str)+1;
         free(str);
     }
 }
 
-PFStringMetric *pfmetric_string_init(const char *string)
+PFStringMetric *pfmetric_string_init_with_match_type(const char *string, PFStringMatchType matchType)
 {
     PFStringMetric *metric = malloc(sizeof(PFStringMetric));
 
     metric->shared.type = PF_METRIC_TYPE_STRING;
     metric->string = strdup(string);
+    metric->matchType = matchType;
 
     return metric;
 }
 
+PFStringMetric *pfmetric_string_init(const char *string)
+{
+    return pfmetric_string_init_with_match_type(string, PF_STRING_MATCH_EXACT);
+}
+
 void _pfsec_run_arm64_xref_metric(PFSection *section, uint64_t startAddr, uint64_t endAddr, PFXrefMetric *metric, void (^matchBlock)(uint64_t vmaddr, bool *stop))
 {
     Arm64XrefTypeMask arm64Types = 0;
@@ -322,6 +712,13 @@ void _pfsec_run_arm64_xref_metric(PFSection *section, uint64_t startAddr, uint64
         arm64Types |= ARM64_XREF_TYPE_MASK_REFERENCE;
     }
 
+    if (section->xrefIndex) {
+        pfxref_index_enumerate_target(section->xrefIndex, metric->address, arm64Types, ^(Arm64XrefType type, uint64_t source, uint64_t target, bool *stop) {
+            matchBlock(source, stop);
+        });
+        return;
+    }
+
     pfsec_arm64_enumerate_xrefs(section, arm64Types, ^(Arm64XrefType type, uint64_t source, uint64_t target, bool *stop) {
         if (target == metric->address) {
             matchBlock(source, stop);
@@ -386,3 +783,169 @@ void pfmetric_run(PFSection *section, void *metric, void (^matchBlock)(uint64_t
 }
 
 
+#define PF_MULTI_PATTERN_CHUNK_SIZE 0x100000
+
+typedef struct s_PFSweepMetric {
+    uint32_t index;
+    uint32_t value;
+    uint32_t mask;
+    uint64_t endAddr;
+    bool stopped;
+} PFSweepMetric;
+
+// Copy of value and mask per bucket so the inner loop doesn't have to chase the metric
+typedef struct s_PFSweepBucketEntry {
+    uint32_t value;
+    uint32_t mask;
+    uint32_t sweepIndex;
+} PFSweepBucketEntry;
+
+void pfmetric_run_patterns_in_range(PFSection *section, uint64_t startAddr, uint64_t endAddr, PFPatternMetric **metrics, uint32_t metricCount, void (^matchBlock)(uint32_t metricIndex, uint64_t vmaddr, bool *stop))
+{
+    if (startAddr == -1ULL) startAddr = section->vmaddr;
+    if (endAddr == -1ULL) endAddr = section->vmaddr + section->size;
+    if (startAddr < section->vmaddr || startAddr > (section->vmaddr + section->size)) return;
+    if (endAddr < section->vmaddr   || endAddr > (section->vmaddr + section->size)) return;
+    if (!metricCount) return;
+
+    PFSweepMetric *sweepMetrics = malloc(sizeof(PFSweepMetric) * metricCount);
+    PFSweepBucketEntry *bucketEntries = NULL;
+    uint8_t *chunk = NULL;
+    if (!sweepMetrics) return;
+
+    // Word aligned patterns are checked together in one forward pass, everything else is run on its own afterwards
+    uint32_t sweepCount = 0;
+    uint64_t sweepEnd = startAddr;
+    size_t maxNBytes = 0;
+    for (uint32_t i = 0; i < metricCount; i++) {
+        PFPatternMetric *metric = metrics[i];
+        if (metric->alignment != sizeof(uint32_t) || metric->nbytes < sizeof(uint32_t)) continue;
+
+        MaskedSearchCandidates candidates;
+        int c = masked_search_get_candidates(startAddr, endAddr, metric->alignment, metric->nbytes, &candidates);
+        if (c == -1 || candidates.backwards) continue;
+
+        PFSweepMetric *sweepMetric = &sweepMetrics[sweepCount++];
+        sweepMetric->index = i;
+        sweepMetric->mask = 0xFFFFFFFF;
+        if (metric->mask) memcpy(&sweepMetric->mask, metric->mask, sizeof(uint32_t));
+        memcpy(&sweepMetric->value, metric->bytes, sizeof(uint32_t));
+        sweepMetric->value &= sweepMetric->mask;
+        sweepMetric->endAddr = (c == 1) ? (candidates.first + (candidates.count * sizeof(uint32_t))) : startAddr;
+        sweepMetric->stopped = (c == 0);
+
+        if (sweepMetric->endAddr > sweepEnd) sweepEnd = sweepMetric->endAddr;
+        if (metric->nbytes > maxNBytes) maxNBytes = metric->nbytes;
+    }
+
+    // Bucket the metrics on the top byte of the first word, which holds the fixed opcode bits of most instructions
+    // A metric that doesn't fully mask the top byte is added to every bucket it can match
+    uint32_t bucketStart[257] = { 0 };
+    for (uint32_t i = 0; i < sweepCount; i++) {
+        if (sweepMetrics[i].stopped) continue;
+        for (uint32_t b = 0; b < 256; b++) {
+            if ((b & (sweepMetrics[i].mask >> 24)) == (sweepMetrics[i].value >> 24)) bucketStart[b + 1]++;
+        }
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        bucketStart[b + 1] += bucketStart[b];
+    }
+    if (bucketStart[256]) {
+        bucketEntries = malloc(sizeof(PFSweepBucketEntry) * bucketStart[256]);
+        if (!bucketEntries) goto out;
+        uint32_t bucketFill[256];
+        memcpy(bucketFill, bucketStart, sizeof(bucketFill));
+        for (uint32_t i = 0; i < sweepCount; i++) {
+            if (sweepMetrics[i].stopped) continue;
+            for (uint32_t b = 0; b < 256; b++) {
+                if ((b & (sweepMetrics[i].mask >> 24)) == (sweepMetrics[i].value >> 24)) {
+                    bucketEntries[bucketFill[b]++] = (PFSweepBucketEntry){ sweepMetrics[i].value, sweepMetrics[i].mask, i };
+                }
+            }
+        }
+    }
+
+    uint32_t activeCount = 0;
+    for (uint32_t i = 0; i < sweepCount; i++) {
+        if (!sweepMetrics[i].stopped) activeCount++;
+    }
+
+    if (activeCount && !section->cache) {
+        chunk = malloc(PF_MULTI_PATTERN_CHUNK_SIZE + maxNBytes);
+        if (!chunk) goto out;
+    }
+
+    for (uint64_t chunkAddr = startAddr; chunkAddr < sweepEnd && activeCount; chunkAddr += PF_MULTI_PATTERN_CHUNK_SIZE) {
+        uint64_t chunkSize = sweepEnd - chunkAddr;
+        if (chunkSize > PF_MULTI_PATTERN_CHUNK_SIZE) chunkSize = PF_MULTI_PATTERN_CHUNK_SIZE;
+
+        const uint8_t *data = NULL;
+        if (section->cache) {
+            data = &section->cache[chunkAddr - section->vmaddr];
+        }
+        else {
+            // Every metric only compares bytes that are inside of the search range
+            uint64_t readSize = chunkSize - sizeof(uint32_t) + maxNBytes;
+            if (chunkAddr + readSize > endAddr) readSize = endAddr - chunkAddr;
+            if (pfsec_read_reloff(section, chunkAddr - section->vmaddr, readSize, chunk) != 0) break;
+            data = chunk;
+        }
+
+        for (uint64_t off = 0; off < chunkSize && activeCount; off += sizeof(uint32_t)) {
+            uint32_t word = 0;
+            memcpy(&word, &data[off], sizeof(word));
+
+            uint32_t bucket = word >> 24;
+            for (uint32_t e = bucketStart[bucket]; e < bucketStart[bucket + 1]; e++) {
+                if ((word & bucketEntries[e].mask) != bucketEntries[e].value) continue;
+
+                PFSweepMetric *sweepMetric = &sweepMetrics[bucketEntries[e].sweepIndex];
+
+                uint64_t addr = chunkAddr + off;
+                if (addr >= sweepMetric->endAddr) continue;
+
+                PFPatternMetric *metric = metrics[sweepMetric->index];
+                if (metric->nbytes > sizeof(uint32_t)) {
+                    uint8_t *tailMask = metric->mask ? &((uint8_t *)metric->mask)[sizeof(uint32_t)] : NULL;
+                    if (memcmp_masked(&data[off + sizeof(uint32_t)], &((uint8_t *)metric->bytes)[sizeof(uint32_t)], tailMask, metric->nbytes - sizeof(uint32_t)) != 0) continue;
+                }
+
+                bool stop = false;
+                matchBlock(sweepMetric->index, addr, &stop);
+                if (stop) {
+                    // A value with bits outside of the mask never matches
+                    for (uint32_t k = 0; k < bucketStart[256]; k++) {
+                        if (bucketEntries[k].sweepIndex == bucketEntries[e].sweepIndex) {
+                            bucketEntries[k].value = 1;
+                            bucketEntries[k].mask = 0;
+                        }
+                    }
+                    sweepMetric->stopped = true;
+                    activeCount--;
+                }
+            }
+        }
+    }
+
+    // Run the remaining metrics one by one
+    uint32_t sweepIdx = 0;
+    for (uint32_t i = 0; i < metricCount; i++) {
+        if (sweepIdx < sweepCount && sweepMetrics[sweepIdx].index == i) {
+            sweepIdx++;
+            continue;
+        }
+        _pfsec_run_pattern_metric(section, startAddr, endAddr, metrics[i], ^(uint64_t vmaddr, bool *stop) {
+            matchBlock(i, vmaddr, stop);
+        });
+    }
+
+out:
+    if (chunk) free(chunk);
+    if (bucketEntries) free(bucketEntries);
+    free(sweepMetrics);
+}
+
+void pfmetric_run_patterns(PFSection *section, PFPatternMetric **metrics, uint32_t metricCount, void (^matchBlock)(uint32_t metricIndex, uint64_t vmaddr, bool *stop))
+{
+    return pfmetric_run_patterns_in_range(section, -1, -1, metrics, metricCount, matchBlock);
+}
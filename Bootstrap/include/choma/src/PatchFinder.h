@@ -17,6 +17,9 @@ typedef struct s_PFSection {
 	uint64_t size;
 	uint8_t *cache;
 	bool ownsCache;
+	struct s_PFXrefIndex *xrefIndex;
+	struct s_PFStringIndex *stringIndex;
+	bool parallel;
 } PFSection;
 
 PFSection *pfsec_init_from_macho(MachO *macho, const char *filesetEntryId, const char *segName, const char *sectName);
@@ -32,6 +35,34 @@ uint64_t pfsec_find_next_inst(PFSection *section, uint64_t startAddr, uint32_t s
 uint64_t pfsec_find_function_start(PFSection *section, uint64_t midAddr);
 void pfsec_free(PFSection *section);
 
+// When enabled, pattern metrics and xref enumeration split the section into chunks and scan them on all cores
+// Matches are still reported in address order and one at a time, but not necessarily on the calling thread
+void pfsec_set_parallel(PFSection *section, bool parallel);
+
+typedef struct s_PFParallelMatch {
+	uint64_t vmaddr;
+	uint64_t target;
+	uint32_t type;
+} PFParallelMatch;
+
+typedef struct s_PFParallelChunk {
+	uint64_t startAddr;
+	uint64_t endAddr;
+	PFParallelMatch *matches;
+	uint64_t matchCount;
+	uint64_t matchCapacity;
+	bool done;
+	bool failed;
+	// Set once the scan has been stopped, scanners should poll this and bail out
+	const bool *stopped;
+} PFParallelChunk;
+
+int pfparallel_chunk_add_match(PFParallelChunk *chunk, uint64_t vmaddr, uint64_t target, uint32_t type);
+
+// Split [startAddr, endAddr) into chunks that are a multiple of alignment and run scanBlock on all of them concurrently
+// The matches of every chunk are passed to deliverBlock in chunk order, once deliverBlock sets *stop no further chunks are scanned
+void pfsec_scan_parallel(PFSection *section, uint64_t startAddr, uint64_t endAddr, uint16_t alignment, void (^scanBlock)(PFParallelChunk *chunk), void (^deliverBlock)(PFParallelMatch *match, bool *stop));
+
 
 typedef struct s_MetricShared {
 	uint32_t type;
@@ -46,10 +77,17 @@ typedef struct s_PFPatternMetric {
 	uint16_t alignment;
 } PFPatternMetric;
 
+typedef enum {
+	PF_STRING_MATCH_EXACT,
+	PF_STRING_MATCH_PREFIX,
+	PF_STRING_MATCH_SUBSTRING,
+} PFStringMatchType;
+
 typedef struct s_PFStringMetric {
 	MetricShared shared;
 
 	char *string;
+	PFStringMatchType matchType;
 } PFStringMetric;
 
 typedef enum {
@@ -67,9 +105,44 @@ typedef struct s_PFXrefMetric {
 
 PFPatternMetric *pfmetric_pattern_init(void *bytes, void *mask, size_t nbytes, uint16_t alignment);
 PFStringMetric *pfmetric_string_init(const char *string);
+PFStringMetric *pfmetric_string_init_with_match_type(const char *string, PFStringMatchType matchType);
 PFXrefMetric *pfmetric_xref_init(uint64_t address, PFXrefTypeMask types);
 void pfmetric_free(void *metric);
 
+// Index over every string in a section, string metrics use it instead of reading the strings one by one
+typedef struct s_PFStringIndex {
+	uint64_t vmaddr;
+	uint8_t *data;
+	uint64_t size;
+
+	// Start offset and length of every string, in section order
+	uint64_t count;
+	uint64_t *offsets;
+	uint32_t *lengths;
+
+	// Entry indexes sorted by string contents, for prefix lookups
+	uint64_t *sorted;
+
+	// Hash table for exact lookups, chains hold entry index + 1 (0 terminates) in section order
+	uint64_t bucketCount;
+	uint64_t *buckets;
+	uint64_t *next;
+} PFStringIndex;
+
+PFStringIndex *pfstring_index_build(PFSection *section);
+// Matches are reported in section order
+void pfstring_index_enumerate(PFStringIndex *index, const char *string, PFStringMatchType matchType, void (^matchBlock)(uint64_t vmaddr, bool *stop));
+void pfstring_index_free(PFStringIndex *index);
+
+// Build the string index of a section, this also happens automatically when the first string metric is run on it
+int pfsec_index_strings(PFSection *section);
+
 void pfmetric_run_in_range(PFSection *section, uint64_t startAddr, uint64_t endAddr, void *metric, void (^matchBlock)(uint64_t vmaddr, bool *stop));
 void pfmetric_run(PFSection *section, void *metric, void (^matchBlock)(uint64_t vmaddr, bool *stop));
+
+// Run several pattern metrics in a single pass over the section, each word is only checked against the metrics whose fixed opcode bits it matches
+// metricIndex is the index into metrics of the metric that matched, matches of one metric are reported in ascending order
+// Setting *stop only stops the metric that matched, the pass ends early once every metric has been stopped
+void pfmetric_run_patterns_in_range(PFSection *section, uint64_t startAddr, uint64_t endAddr, PFPatternMetric **metrics, uint32_t metricCount, void (^matchBlock)(uint32_t metricIndex, uint64_t vmaddr, bool *stop));
+void pfmetric_run_patterns(PFSection *section, PFPatternMetric **metrics, uint32_t metricCount, void (^matchBlock)(uint32_t metricIndex, uint64_t vmaddr, bool *stop));
 #endif
\ No newline at end of file
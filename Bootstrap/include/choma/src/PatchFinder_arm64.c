@@ -73,11 +73,43 @@ uint64_t pfsec_arm64_resolve_stub(PFSection *section, uint64_t stubAddr)
 	return stubAddr;
 }
 
-void pfsec_arm64_enumerate_xrefs(PFSection *section, Arm64XrefTypeMask types, void (^xrefBlock)(Arm64XrefType type, uint64_t source, uint64_t target, bool *stop))
+#define ADRP_SEEK_BACK 8
+
+// An ADD/LDR/STR pairs with the closest preceding ADRP to its source register
+// Keeping only the most recent ADRP per register gives the same result as searching backwards from every instruction
+// The window matches what pfsec_find_prev_inst(section, addr, ADRP_SEEK_BACK, ...) used to check
+static bool _pfsec_arm64_find_paired_adrp(PFSection *section, uint64_t *lastAdrpAddr, uint64_t *lastAdrpTarget, uint64_t addr, arm64_register sourceReg, uint64_t *adrpTargetOut)
 {
+	if (arm64_gen_adr_p(OPT_BOOL(true), OPT_UINT64_NONE, OPT_UINT64_NONE, sourceReg, NULL, NULL) != 0) return false;
+	if (addr - section->vmaddr < (ADRP_SEEK_BACK * 4)) return false;
+
+	uint64_t adrpAddr = lastAdrpAddr[ARM64_REG_GET_NUM(sourceReg)];
+	if (adrpAddr == 0 || (addr - adrpAddr) > ((ADRP_SEEK_BACK - 2) * 4)) return false;
+
+	*adrpTargetOut = lastAdrpTarget[ARM64_REG_GET_NUM(sourceReg)];
+	return true;
+}
+
+// Instructions between warmupAddr and startAddr are only used to find ADRPs that pair with instructions at the start of the range
+static void _pfsec_arm64_enumerate_xrefs_in_range(PFSection *section, Arm64XrefTypeMask types, uint64_t warmupAddr, uint64_t startAddr, uint64_t endAddr, void (^xrefBlock)(Arm64XrefType type, uint64_t source, uint64_t target, bool *stop))
+{
+	uint64_t lastAdrpAddr[32] = { 0 };
+	uint64_t lastAdrpTarget[32] = { 0 };
+	bool trackAdrp = (types & (ARM64_XREF_TYPE_MASK_ADRP_ADD | ARM64_XREF_TYPE_MASK_ADRP_LDR | ARM64_XREF_TYPE_MASK_ADRP_STR));
+
 	bool stop = false;
-	for (uint64_t addr = section->vmaddr; addr < (section->vmaddr + section->size) && !stop; addr += 4) {
+	for (uint64_t addr = warmupAddr; addr < endAddr && !stop; addr += 4) {
 		uint32_t inst = pfsec_read32(section, addr);
+		if (addr < startAddr) {
+			uint64_t target = 0;
+			bool isAdrp = false;
+			arm64_register reg;
+			if (trackAdrp && arm64_dec_adr_p(inst, addr, &target, &reg, &isAdrp) == 0 && isAdrp) {
+				lastAdrpAddr[ARM64_REG_GET_NUM(reg)] = addr;
+				lastAdrpTarget[ARM64_REG_GET_NUM(reg)] = target;
+			}
+			continue;
+		}
 		if ((types & ARM64_XREF_TYPE_MASK_B) || (types & ARM64_XREF_TYPE_MASK_BL)) {
 			uint64_t target = 0;
 			bool isBl = 0;
@@ -91,32 +123,29 @@ void pfsec_arm64_enumerate_xrefs(PFSection *section, Arm64XrefTypeMask types, vo
 				continue;
 			}
 		}
-		if (types & ARM64_XREF_TYPE_MASK_ADR) {
+		if ((types & ARM64_XREF_TYPE_MASK_ADR) || trackAdrp) {
 			uint64_t target = 0;
 			bool isAdrp = false;
 			arm64_register reg;
 			if (arm64_dec_adr_p(inst, addr, &target, &reg, &isAdrp) == 0) {
-				if (!isAdrp) {
+				if (isAdrp) {
+					lastAdrpAddr[ARM64_REG_GET_NUM(reg)] = addr;
+					lastAdrpTarget[ARM64_REG_GET_NUM(reg)] = target;
+				}
+				else if (types & ARM64_XREF_TYPE_MASK_ADR) {
 					xrefBlock(ARM64_XREF_TYPE_ADR, addr, target, &stop);
 				}
 				continue;
 			}
 		}
-		#define ADRP_SEEK_BACK 8
 		if (types & ARM64_XREF_TYPE_MASK_ADRP_ADD) {
 			uint16_t addImm = 0;
 			arm64_register addDestinationReg;
 			arm64_register addSourceReg;
 			if (arm64_dec_add_imm(inst, &addDestinationReg, &addSourceReg, &addImm) == 0) {
-				uint32_t adrpInst = 0;
-				uint32_t adrpMask = 0;
-				if (arm64_gen_adr_p(OPT_BOOL(true), OPT_UINT64_NONE, OPT_UINT64_NONE, addSourceReg, &adrpInst, &adrpMask) == 0) {
-					uint64_t adrpAddr = pfsec_find_prev_inst(section, addr, ADRP_SEEK_BACK, adrpInst, adrpMask);
-					if (adrpAddr != 0) {
-						uint64_t adrpTarget = 0;
-						arm64_dec_adr_p(pfsec_read32(section, adrpAddr), adrpAddr, &adrpTarget, NULL, NULL);
-						xrefBlock(ARM64_XREF_TYPE_ADRP_ADD, addr, adrpTarget + addImm, &stop);
-					}
+				uint64_t adrpTarget = 0;
+				if (_pfsec_arm64_find_paired_adrp(section, lastAdrpAddr, lastAdrpTarget, addr, addSourceReg, &adrpTarget)) {
+					xrefBlock(ARM64_XREF_TYPE_ADRP_ADD, addr, adrpTarget + addImm, &stop);
 				}
 			}
 		}
@@ -127,18 +156,12 @@ void pfsec_arm64_enumerate_xrefs(PFSection *section, Arm64XrefTypeMask types, vo
 			char ldrType = -1;
 			arm64_ldr_str_type instType = 0;
 			if (arm64_dec_ldr_imm(inst, &ldrDestinationReg, &ldrSourceReg, &ldrImm, &ldrType, &instType) == 0) {
-				uint32_t adrpInst = 0;
-				uint32_t adrpMask = 0;
-				if (arm64_gen_adr_p(OPT_BOOL(true), OPT_UINT64_NONE, OPT_UINT64_NONE, ldrSourceReg, &adrpInst, &adrpMask) == 0) {
-					uint64_t adrpAddr = pfsec_find_prev_inst(section, addr, ADRP_SEEK_BACK, adrpInst, adrpMask);
-					if (adrpAddr != 0) {
-						// TODO: Check if between adrp and ldr is either an instruction indicating a function start or something overwriting the source register of ldr
-						// Due to this inaccuracy, there are some false positives atm
-						// Probably applies to the ADRP+ADD and ADRP+STR cases as well
-						uint64_t adrpTarget = 0;
-						arm64_dec_adr_p(pfsec_read32(section, adrpAddr), adrpAddr, &adrpTarget, NULL, NULL);
-						xrefBlock(ARM64_XREF_TYPE_ADRP_LDR, addr, adrpTarget + ldrImm, &stop);
-					}
+				uint64_t adrpTarget = 0;
+				if (_pfsec_arm64_find_paired_adrp(section, lastAdrpAddr, lastAdrpTarget, addr, ldrSourceReg, &adrpTarget)) {
+					// TODO: Check if between adrp and ldr is either an instruction indicating a function start or something overwriting the source register of ldr
+					// Due to this inaccuracy, there are some false positives atm
+					// Probably applies to the ADRP+ADD and ADRP+STR cases as well
+					xrefBlock(ARM64_XREF_TYPE_ADRP_LDR, addr, adrpTarget + ldrImm, &stop);
 				}
 			}
 		}
@@ -149,17 +172,245 @@ void pfsec_arm64_enumerate_xrefs(PFSection *section, Arm64XrefTypeMask types, vo
 			char strType = -1;
 			arm64_ldr_str_type instType = 0;
 			if (arm64_dec_str_imm(inst, &strDestinationReg, &strSourceReg, &strImm, &strType, &instType) == 0) {
-				uint32_t adrpInst = 0;
-				uint32_t adrpMask = 0;
-				if (arm64_gen_adr_p(OPT_BOOL(true), OPT_UINT64_NONE, OPT_UINT64_NONE, strSourceReg, &adrpInst, &adrpMask) == 0) {
-					uint64_t adrpAddr = pfsec_find_prev_inst(section, addr, ADRP_SEEK_BACK, adrpInst, adrpMask);
-					if (adrpAddr != 0) {
-						uint64_t adrpTarget = 0;
-						arm64_dec_adr_p(pfsec_read32(section, adrpAddr), adrpAddr, &adrpTarget, NULL, NULL);
-						xrefBlock(ARM64_XREF_TYPE_ADRP_STR, addr, adrpTarget + strImm, &stop);
-					}
+				uint64_t adrpTarget = 0;
+				if (_pfsec_arm64_find_paired_adrp(section, lastAdrpAddr, lastAdrpTarget, addr, strSourceReg, &adrpTarget)) {
+					xrefBlock(ARM64_XREF_TYPE_ADRP_STR, addr, adrpTarget + strImm, &stop);
 				}
 			}
 		}
 	}
-}
\ No newline at end of file
+}
+
+void pfsec_arm64_enumerate_xrefs(PFSection *section, Arm64XrefTypeMask types, void (^xrefBlock)(Arm64XrefType type, uint64_t source, uint64_t target, bool *stop))
+{
+	uint64_t sectionEnd = section->vmaddr + section->size;
+	if (section->parallel) {
+		pfsec_scan_parallel(section, section->vmaddr, sectionEnd, 4, ^(PFParallelChunk *chunk) {
+			uint64_t warmupAddr = section->vmaddr;
+			if (chunk->startAddr - section->vmaddr > (ADRP_SEEK_BACK * 4)) {
+				warmupAddr = chunk->startAddr - (ADRP_SEEK_BACK * 4);
+			}
+			_pfsec_arm64_enumerate_xrefs_in_range(section, types, warmupAddr, chunk->startAddr, chunk->endAddr, ^(Arm64XrefType type, uint64_t source, uint64_t target, bool *stop) {
+				if (pfparallel_chunk_add_match(chunk, source, target, type) != 0 || __atomic_load_n(chunk->stopped, __ATOMIC_ACQUIRE)) {
+					*stop = true;
+				}
+			});
+		}, ^(PFParallelMatch *match, bool *stop) {
+			xrefBlock(match->type, match->vmaddr, match->target, stop);
+		});
+	}
+	else {
+		_pfsec_arm64_enumerate_xrefs_in_range(section, types, section->vmaddr, section->vmaddr, sectionEnd, xrefBlock);
+	}
+}
+
+#define PF_XREF_INDEX_MAGIC 0x49585650 // 'PFXI'
+#define PF_XREF_INDEX_VERSION 1
+
+typedef struct s_PFXrefIndexHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint8_t uuid[16];
+	uint64_t vmaddr;
+	uint64_t size;
+	uint64_t count;
+} PFXrefIndexHeader;
+
+typedef struct s_PFXrefIndexEntry {
+	uint64_t target;
+	uint64_t source;
+	uint8_t type;
+} PFXrefIndexEntry;
+
+static int _pfxref_index_entry_compare(const void *a, const void *b)
+{
+	const PFXrefIndexEntry *entryA = a;
+	const PFXrefIndexEntry *entryB = b;
+	if (entryA->target != entryB->target) return entryA->target < entryB->target ? -1 : 1;
+	if (entryA->source != entryB->source) return entryA->source < entryB->source ? -1 : 1;
+	return 0;
+}
+
+static PFXrefIndex *_pfxref_index_alloc(uint64_t count)
+{
+	PFXrefIndex *index = calloc(1, sizeof(PFXrefIndex));
+	if (!index) return NULL;
+	index->count = count;
+	if (count) {
+		index->targets = malloc(count * sizeof(uint64_t));
+		index->sources = malloc(count * sizeof(uint64_t));
+		index->types = malloc(count * sizeof(uint8_t));
+		if (!index->targets || !index->sources || !index->types) {
+			pfxref_index_free(index);
+			return NULL;
+		}
+	}
+	return index;
+}
+
+PFXrefIndex *pfxref_index_build(PFSection *section)
+{
+	__block uint64_t count = 0;
+	__block uint64_t capacity = 0x10000;
+	__block PFXrefIndexEntry *entries = malloc(capacity * sizeof(PFXrefIndexEntry));
+	__block bool failed = false;
+	if (!entries) return NULL;
+
+	pfsec_arm64_enumerate_xrefs(section, ARM64_XREF_TYPE_ALL, ^(Arm64XrefType type, uint64_t source, uint64_t target, bool *stop) {
+		if (count == capacity) {
+			PFXrefIndexEntry *newEntries = realloc(entries, capacity * 2 * sizeof(PFXrefIndexEntry));
+			if (!newEntries) {
+				failed = true;
+				*stop = true;
+				return;
+			}
+			entries = newEntries;
+			capacity *= 2;
+		}
+		entries[count++] = (PFXrefIndexEntry){ .target = target, .source = source, .type = type };
+	});
+
+	PFXrefIndex *index = NULL;
+	if (failed) {
+		printf("Error: failed to allocate memory for xref index\n");
+		goto out;
+	}
+
+	qsort(entries, count, sizeof(PFXrefIndexEntry), _pfxref_index_entry_compare);
+
+	index = _pfxref_index_alloc(count);
+	if (!index) goto out;
+	for (uint64_t i = 0; i < count; i++) {
+		index->targets[i] = entries[i].target;
+		index->sources[i] = entries[i].source;
+		index->types[i] = entries[i].type;
+	}
+	index->vmaddr = section->vmaddr;
+	index->size = section->size;
+	if (macho_get_uuid(section->macho, index->uuid) != 0) {
+		memset(index->uuid, 0, sizeof(index->uuid));
+	}
+
+out:
+	free(entries);
+	return index;
+}
+
+PFXrefIndex *pfxref_index_load(PFSection *section, const char *path)
+{
+	uint8_t uuid[16];
+	if (macho_get_uuid(section->macho, uuid) != 0) return NULL;
+
+	FILE *f = fopen(path, "rb");
+	if (!f) return NULL;
+
+	PFXrefIndex *index = NULL;
+	PFXrefIndexHeader header;
+	if (fread(&header, sizeof(header), 1, f) != 1) goto fail;
+	if (header.magic != PF_XREF_INDEX_MAGIC || header.version != PF_XREF_INDEX_VERSION) goto fail;
+	if (memcmp(header.uuid, uuid, sizeof(uuid)) != 0) goto fail;
+	if (header.vmaddr != section->vmaddr || header.size != section->size) goto fail;
+	// Every instruction produces at most one xref
+	if (header.count > (section->size / 4)) goto fail;
+
+	index = _pfxref_index_alloc(header.count);
+	if (!index) goto fail;
+	memcpy(index->uuid, header.uuid, sizeof(index->uuid));
+	index->vmaddr = header.vmaddr;
+	index->size = header.size;
+
+	if (index->count) {
+		if (fread(index->targets, sizeof(uint64_t), index->count, f) != index->count) goto fail;
+		if (fread(index->sources, sizeof(uint64_t), index->count, f) != index->count) goto fail;
+		if (fread(index->types, sizeof(uint8_t), index->count, f) != index->count) goto fail;
+	}
+
+	fclose(f);
+	return index;
+
+fail:
+	if (index) pfxref_index_free(index);
+	fclose(f);
+	return NULL;
+}
+
+int pfxref_index_save(PFXrefIndex *index, const char *path)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		printf("Error: failed to open %s for writing\n", path);
+		return -1;
+	}
+
+	PFXrefIndexHeader header = {
+		.magic = PF_XREF_INDEX_MAGIC,
+		.version = PF_XREF_INDEX_VERSION,
+		.vmaddr = index->vmaddr,
+		.size = index->size,
+		.count = index->count,
+	};
+	memcpy(header.uuid, index->uuid, sizeof(header.uuid));
+
+	int r = 0;
+	if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+		(index->count && fwrite(index->targets, sizeof(uint64_t), index->count, f) != index->count) ||
+		(index->count && fwrite(index->sources, sizeof(uint64_t), index->count, f) != index->count) ||
+		(index->count && fwrite(index->types, sizeof(uint8_t), index->count, f) != index->count)) {
+		printf("Error: failed to write xref index to %s\n", path);
+		r = -1;
+	}
+
+	if (fclose(f) != 0) r = -1;
+	return r;
+}
+
+void pfxref_index_enumerate_target(PFXrefIndex *index, uint64_t target, Arm64XrefTypeMask types, void (^xrefBlock)(Arm64XrefType type, uint64_t source, uint64_t target, bool *stop))
+{
+	// Find the first entry for this target
+	uint64_t low = 0, high = index->count;
+	while (low < high) {
+		uint64_t mid = low + ((high - low) / 2);
+		if (index->targets[mid] < target) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+
+	bool stop = false;
+	for (uint64_t i = low; i < index->count && index->targets[i] == target && !stop; i++) {
+		if (types & (1 << index->types[i])) {
+			xrefBlock(index->types[i], index->sources[i], target, &stop);
+		}
+	}
+}
+
+void pfxref_index_free(PFXrefIndex *index)
+{
+	if (index->targets) free(index->targets);
+	if (index->sources) free(index->sources);
+	if (index->types) free(index->types);
+	free(index);
+}
+
+int pfsec_arm64_index_xrefs(PFSection *section, const char *cachePath)
+{
+	if (section->xrefIndex) return 0;
+
+	PFXrefIndex *index = NULL;
+	if (cachePath) {
+		index = pfxref_index_load(section, cachePath);
+	}
+	if (!index) {
+		index = pfxref_index_build(section);
+		if (!index) return -1;
+		if (cachePath) {
+			// Not being able to cache the index isn't fatal
+			pfxref_index_save(index, cachePath);
+		}
+	}
+
+	section->xrefIndex = index;
+	return 0;
+}
@@ -0,0 +1,415 @@
+#include "PieceTableStream.h"
+
+#define PIECE_TABLE_ZERO_BUFFER_SIZE 0x4000
+
+static uint32_t _piece_table_stream_find_piece(PieceTableStreamContext *context, uint64_t offset, uint64_t *pieceStartOut)
+{
+    uint32_t i = 0;
+    uint64_t pieceStart = 0;
+    if (context->cursorPiece < context->pieceCount && offset >= context->cursorOffset) {
+        i = context->cursorPiece;
+        pieceStart = context->cursorOffset;
+    }
+
+    while (i < context->pieceCount && (pieceStart + context->pieces[i].size) <= offset) {
+        pieceStart += context->pieces[i].size;
+        i++;
+    }
+
+    if (i < context->pieceCount) {
+        context->cursorPiece = i;
+        context->cursorOffset = pieceStart;
+    }
+    *pieceStartOut = pieceStart;
+    return i;
+}
+
+static int _piece_table_stream_reserve_pieces(PieceTableStreamContext *context, uint32_t pieceCount)
+{
+    if (pieceCount <= context->pieceCapacity) return 0;
+
+    uint32_t newCapacity = context->pieceCapacity ? context->pieceCapacity : 8;
+    while (newCapacity < pieceCount) newCapacity *= 2;
+    PieceTablePiece *newPieces = realloc(context->pieces, sizeof(PieceTablePiece) * newCapacity);
+    if (!newPieces) return -1;
+    context->pieces = newPieces;
+    context->pieceCapacity = newCapacity;
+    return 0;
+}
+
+static int _piece_table_stream_append_data(PieceTableStreamContext *context, const void *data, size_t size, uint64_t *startOut)
+{
+    if (context->addedDataSize + size > context->addedDataCapacity) {
+        size_t newCapacity = context->addedDataCapacity ? context->addedDataCapacity : 0x1000;
+        while (newCapacity < context->addedDataSize + size) newCapacity *= 2;
+        uint8_t *newData = realloc(context->addedData, newCapacity);
+        if (!newData) return -1;
+        context->addedData = newData;
+        context->addedDataCapacity = newCapacity;
+    }
+
+    memcpy(&context->addedData[context->addedDataSize], data, size);
+    *startOut = context->addedDataSize;
+    context->addedDataSize += size;
+    return 0;
+}
+
+// Make sure a piece starts at offset and return its index (pieceCount if offset is the end of the stream)
+static int _piece_table_stream_split(PieceTableStreamContext *context, uint64_t offset, uint32_t *indexOut)
+{
+    uint64_t pieceStart = 0;
+    uint32_t i = _piece_table_stream_find_piece(context, offset, &pieceStart);
+    if (i == context->pieceCount || pieceStart == offset) {
+        *indexOut = i;
+        return 0;
+    }
+
+    if (_piece_table_stream_reserve_pieces(context, context->pieceCount + 1) != 0) return -1;
+    memmove(&context->pieces[i + 2], &context->pieces[i + 1], sizeof(PieceTablePiece) * (context->pieceCount - (i + 1)));
+
+    PieceTablePiece *piece = &context->pieces[i];
+    uint64_t headSize = offset - pieceStart;
+    context->pieces[i + 1] = (PieceTablePiece){
+        .source = piece->source,
+        .start = piece->source == PIECE_SOURCE_ZERO ? 0 : piece->start + headSize,
+        .size = piece->size - headSize,
+    };
+    piece->size = headSize;
+    context->pieceCount++;
+
+    *indexOut = i + 1;
+    return 0;
+}
+
+// Replace removeSize bytes at offset with newPiece (or nothing, if newPiece is NULL)
+static int _piece_table_stream_replace(PieceTableStreamContext *context, uint64_t offset, size_t removeSize, PieceTablePiece *newPiece)
+{
+    if (offset + removeSize > context->size) return -1;
+    if (newPiece && newPiece->size == 0) newPiece = NULL;
+    if (removeSize == 0 && !newPiece) return 0;
+
+    uint32_t first = 0, last = 0;
+    if (_piece_table_stream_split(context, offset, &first) != 0) return -1;
+    if (_piece_table_stream_split(context, offset + removeSize, &last) != 0) return -1;
+
+    uint32_t insertCount = newPiece ? 1 : 0;
+    if (newPiece && first > 0) {
+        // Consecutive writes usually continue where the previous one stopped, just grow that piece
+        PieceTablePiece *previousPiece = &context->pieces[first - 1];
+        if (previousPiece->source == newPiece->source && (newPiece->source == PIECE_SOURCE_ZERO || (previousPiece->start + previousPiece->size) == newPiece->start)) {
+            previousPiece->size += newPiece->size;
+            insertCount = 0;
+        }
+    }
+
+    uint32_t removeCount = last - first;
+    if (_piece_table_stream_reserve_pieces(context, context->pieceCount - removeCount + insertCount) != 0) return -1;
+    memmove(&context->pieces[first + insertCount], &context->pieces[last], sizeof(PieceTablePiece) * (context->pieceCount - last));
+    if (insertCount) {
+        context->pieces[first] = *newPiece;
+    }
+    context->pieceCount = context->pieceCount - removeCount + insertCount;
+    context->size = context->size - removeSize + (newPiece ? newPiece->size : 0);
+
+    context->cursorPiece = 0;
+    context->cursorOffset = 0;
+    return 0;
+}
+
+static int piece_table_stream_read(MemoryStream *stream, uint64_t offset, size_t size, void *outBuf)
+{
+    PieceTableStreamContext *context = stream->context;
+    if ((offset + size) > context->size) {
+        printf("Error: cannot read %zx bytes at %llx, maximum is %zx.\n", size, offset, context->size);
+        return -1;
+    }
+
+    uint64_t pieceStart = 0;
+    uint32_t i = _piece_table_stream_find_piece(context, offset, &pieceStart);
+
+    size_t readSize = 0;
+    while (readSize < size && i < context->pieceCount) {
+        PieceTablePiece *piece = &context->pieces[i];
+        uint64_t offsetInPiece = (offset + readSize) - pieceStart;
+        size_t sizeToRead = piece->size - offsetInPiece;
+        if (sizeToRead > (size - readSize)) {
+            sizeToRead = size - readSize;
+        }
+
+        uint8_t *out = (uint8_t *)outBuf + readSize;
+        switch (piece->source) {
+            case PIECE_SOURCE_BASE:
+            if (memory_stream_read(context->baseStream, piece->start + offsetInPiece, sizeToRead, out) != 0) return -1;
+            break;
+            case PIECE_SOURCE_ADDED:
+            memcpy(out, &context->addedData[piece->start + offsetInPiece], sizeToRead);
+            break;
+            case PIECE_SOURCE_ZERO:
+            memset(out, 0, sizeToRead);
+            break;
+        }
+
+        readSize += sizeToRead;
+        pieceStart += piece->size;
+        i++;
+    }
+
+    return readSize;
+}
+
+static int piece_table_stream_write(MemoryStream *stream, uint64_t offset, size_t size, const void *inBuf)
+{
+    PieceTableStreamContext *context = stream->context;
+    if (size == 0) return 0;
+
+    bool expandAllowed = (stream->flags & MEMORY_STREAM_FLAG_AUTO_EXPAND);
+    if ((offset + size) > context->size && !expandAllowed) {
+        printf("Error: cannot write %zx bytes at %llx, maximum is %zx.\n", size, offset, context->size);
+        return -1;
+    }
+
+    // Writing past the end leaves a gap that reads as zeroes
+    if (offset > context->size) {
+        PieceTablePiece gapPiece = { .source = PIECE_SOURCE_ZERO, .start = 0, .size = offset - context->size };
+        if (_piece_table_stream_replace(context, context->size, 0, &gapPiece) != 0) return -1;
+    }
+
+    PieceTablePiece newPiece = { .source = PIECE_SOURCE_ADDED, .size = size };
+    if (_piece_table_stream_append_data(context, inBuf, size, &newPiece.start) != 0) return -1;
+
+    size_t overwrittenSize = context->size - offset;
+    if (overwrittenSize > size) {
+        overwrittenSize = size;
+    }
+    if (_piece_table_stream_replace(context, offset, overwrittenSize, &newPiece) != 0) return -1;
+    return size;
+}
+
+static int piece_table_stream_insert(MemoryStream *stream, uint64_t offset, size_t size, const void *inBuf)
+{
+    PieceTableStreamContext *context = stream->context;
+    if (offset > context->size) return -1;
+    if (size == 0) return 0;
+
+    PieceTablePiece newPiece = { .source = PIECE_SOURCE_ADDED, .size = size };
+    if (_piece_table_stream_append_data(context, inBuf, size, &newPiece.start) != 0) return -1;
+    return _piece_table_stream_replace(context, offset, 0, &newPiece);
+}
+
+static int piece_table_stream_remove(MemoryStream *stream, uint64_t offset, size_t size)
+{
+    PieceTableStreamContext *context = stream->context;
+    return _piece_table_stream_replace(context, offset, size, NULL);
+}
+
+static int piece_table_stream_get_size(MemoryStream *stream, size_t *sizeOut)
+{
+    PieceTableStreamContext *context = stream->context;
+    *sizeOut = context->size;
+    return 0;
+}
+
+static int piece_table_stream_trim(MemoryStream *stream, size_t trimAtStart, size_t trimAtEnd)
+{
+    PieceTableStreamContext *context = stream->context;
+    if ((trimAtStart + trimAtEnd) > context->size) return -1;
+
+    if (_piece_table_stream_replace(context, context->size - trimAtEnd, trimAtEnd, NULL) != 0) return -1;
+    return _piece_table_stream_replace(context, 0, trimAtStart, NULL);
+}
+
+static int piece_table_stream_expand(MemoryStream *stream, size_t expandAtStart, size_t expandAtEnd)
+{
+    PieceTableStreamContext *context = stream->context;
+
+    PieceTablePiece endPiece = { .source = PIECE_SOURCE_ZERO, .start = 0, .size = expandAtEnd };
+    if (_piece_table_stream_replace(context, context->size, 0, &endPiece) != 0) return -1;
+    PieceTablePiece startPiece = { .source = PIECE_SOURCE_ZERO, .start = 0, .size = expandAtStart };
+    return _piece_table_stream_replace(context, 0, 0, &startPiece);
+}
+
+static MemoryStream *piece_table_stream_softclone(MemoryStream *stream)
+{
+    PieceTableStreamContext *context = stream->context;
+
+    MemoryStream *clone = malloc(sizeof(MemoryStream));
+    if (!clone) return NULL;
+    memset(clone, 0, sizeof(MemoryStream));
+
+    PieceTableStreamContext *contextCopy = malloc(sizeof(PieceTableStreamContext));
+    if (!contextCopy) goto fail;
+    memset(contextCopy, 0, sizeof(PieceTableStreamContext));
+    clone->context = contextCopy;
+
+    // The base stream is never written to, so sharing it is fine for both kinds of clones
+    contextCopy->baseStream = memory_stream_softclone(context->baseStream);
+    if (!contextCopy->baseStream) goto fail;
+
+    if (_piece_table_stream_reserve_pieces(contextCopy, context->pieceCount) != 0) goto fail;
+    memcpy(contextCopy->pieces, context->pieces, sizeof(PieceTablePiece) * context->pieceCount);
+    contextCopy->pieceCount = context->pieceCount;
+
+    if (context->addedDataSize) {
+        contextCopy->addedData = malloc(context->addedDataSize);
+        if (!contextCopy->addedData) goto fail;
+        memcpy(contextCopy->addedData, context->addedData, context->addedDataSize);
+        contextCopy->addedDataSize = contextCopy->addedDataCapacity = context->addedDataSize;
+    }
+
+    contextCopy->size = context->size;
+    clone->flags = stream->flags;
+    return clone;
+
+fail:
+    if (contextCopy) {
+        if (contextCopy->baseStream) memory_stream_free(contextCopy->baseStream);
+        if (contextCopy->pieces) free(contextCopy->pieces);
+        free(contextCopy);
+    }
+    free(clone);
+    return NULL;
+}
+
+static void piece_table_stream_free(MemoryStream *stream)
+{
+    PieceTableStreamContext *context = stream->context;
+    memory_stream_free(context->baseStream);
+    if (context->pieces) free(context->pieces);
+    if (context->addedData) free(context->addedData);
+    free(context);
+}
+
+MemoryStream *piece_table_stream_init(MemoryStream *baseStream, uint32_t flags)
+{
+    if (!baseStream) return NULL;
+    size_t baseSize = memory_stream_get_size(baseStream);
+    if (baseSize == MEMORY_STREAM_SIZE_INVALID) return NULL;
+
+    MemoryStream *stream = malloc(sizeof(MemoryStream));
+    if (!stream) return NULL;
+    memset(stream, 0, sizeof(MemoryStream));
+
+    PieceTableStreamContext *context = malloc(sizeof(PieceTableStreamContext));
+    if (!context) {
+        free(stream);
+        return NULL;
+    }
+    memset(context, 0, sizeof(PieceTableStreamContext));
+
+    if (baseSize) {
+        if (_piece_table_stream_reserve_pieces(context, 1) != 0) {
+            free(context);
+            free(stream);
+            return NULL;
+        }
+        context->pieces[0] = (PieceTablePiece){ .source = PIECE_SOURCE_BASE, .start = 0, .size = baseSize };
+        context->pieceCount = 1;
+    }
+    context->size = baseSize;
+    context->baseStream = baseStream;
+
+    stream->context = context;
+    stream->flags = MEMORY_STREAM_FLAG_MUTABLE;
+    if (flags & PIECE_TABLE_STREAM_FLAG_AUTO_EXPAND) {
+        stream->flags |= MEMORY_STREAM_FLAG_AUTO_EXPAND;
+    }
+
+    stream->read = piece_table_stream_read;
+    stream->write = piece_table_stream_write;
+    stream->getSize = piece_table_stream_get_size;
+
+    stream->trim = piece_table_stream_trim;
+    stream->expand = piece_table_stream_expand;
+    stream->insert = piece_table_stream_insert;
+    stream->remove = piece_table_stream_remove;
+
+    stream->softclone = piece_table_stream_softclone;
+    stream->hardclone = piece_table_stream_softclone;
+    stream->free = piece_table_stream_free;
+
+    return stream;
+}
+
+static int _piece_table_stream_write_piece(PieceTableStreamContext *context, PieceTablePiece *piece, MemoryStream *targetStream, uint64_t targetOffset)
+{
+    static const uint8_t zeroBuffer[PIECE_TABLE_ZERO_BUFFER_SIZE] = { 0 };
+
+    int r = 0;
+    switch (piece->source) {
+        case PIECE_SOURCE_BASE:
+        r = memory_stream_copy_data(context->baseStream, piece->start, targetStream, targetOffset, piece->size);
+        break;
+        case PIECE_SOURCE_ADDED:
+        r = memory_stream_write(targetStream, targetOffset, piece->size, &context->addedData[piece->start]);
+        break;
+        case PIECE_SOURCE_ZERO:
+        for (size_t zeroedSize = 0; zeroedSize < piece->size && r == 0; zeroedSize += PIECE_TABLE_ZERO_BUFFER_SIZE) {
+            size_t sizeToWrite = piece->size - zeroedSize;
+            if (sizeToWrite > PIECE_TABLE_ZERO_BUFFER_SIZE) {
+                sizeToWrite = PIECE_TABLE_ZERO_BUFFER_SIZE;
+            }
+            r = memory_stream_write(targetStream, targetOffset + zeroedSize, sizeToWrite, zeroBuffer);
+        }
+        break;
+    }
+    return r;
+}
+
+static int _piece_table_stream_trim_target(MemoryStream *targetStream, uint64_t size)
+{
+    size_t targetSize = memory_stream_get_size(targetStream);
+    if (targetSize == MEMORY_STREAM_SIZE_INVALID) return -1;
+    if (targetSize > size) {
+        return memory_stream_trim(targetStream, 0, targetSize - size);
+    }
+    return 0;
+}
+
+int piece_table_stream_serialize(MemoryStream *stream, MemoryStream *targetStream)
+{
+    if (stream->read != piece_table_stream_read) return -1;
+    PieceTableStreamContext *context = stream->context;
+
+    uint64_t targetOffset = 0;
+    for (uint32_t i = 0; i < context->pieceCount; i++) {
+        PieceTablePiece *piece = &context->pieces[i];
+        if (_piece_table_stream_write_piece(context, piece, targetStream, targetOffset) != 0) {
+            printf("Error: failed to serialize piece %u of piece table stream\n", i);
+            return -1;
+        }
+        targetOffset += piece->size;
+    }
+
+    return _piece_table_stream_trim_target(targetStream, targetOffset);
+}
+
+int piece_table_stream_commit(MemoryStream *stream, MemoryStream *targetStream)
+{
+    if (stream->read != piece_table_stream_read) return -1;
+    PieceTableStreamContext *context = stream->context;
+
+    // Base data that was moved could be read after the target already overwrote it, check before writing anything
+    uint64_t targetOffset = 0;
+    for (uint32_t i = 0; i < context->pieceCount; i++) {
+        PieceTablePiece *piece = &context->pieces[i];
+        if (piece->source == PIECE_SOURCE_BASE && piece->start != targetOffset) {
+            printf("Error: cannot commit piece table stream, base data at 0x%llx was moved to 0x%llx\n", piece->start, targetOffset);
+            return -1;
+        }
+        targetOffset += piece->size;
+    }
+
+    targetOffset = 0;
+    for (uint32_t i = 0; i < context->pieceCount; i++) {
+        PieceTablePiece *piece = &context->pieces[i];
+        if (piece->source != PIECE_SOURCE_BASE) {
+            if (_piece_table_stream_write_piece(context, piece, targetStream, targetOffset) != 0) {
+                printf("Error: failed to commit piece %u of piece table stream\n", i);
+                return -1;
+            }
+        }
+        targetOffset += piece->size;
+    }
+
+    return _piece_table_stream_trim_target(targetStream, targetOffset);
+}
@@ -0,0 +1,435 @@
+#include "SignatureCache.h"
+#include "CSBlob.h"
+#include "FAT.h"
+#include "MachO.h"
+#include "MappedStream.h"
+#include "MemoryStream.h"
+
+#include <CommonCrypto/CommonDigest.h>
+#include <dispatch/dispatch.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIGNATURE_CACHE_MAGIC 0x43534843 // 'CHSC'
+#define SIGNATURE_CACHE_VERSION 1
+#define SIGNATURE_CACHE_ENTRY_SUFFIX ".sig"
+#define SIGNATURE_CACHE_TEMP_PREFIX ".tmp."
+#define SIGNATURE_CACHE_CHUNK_SIZE 0x100000
+
+// On disk format of an entry, followed by the header and load commands and then by the signature
+typedef struct s_SignatureCacheEntryHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fileSize;
+    uint32_t loadCommandsSize; // Mach header + load commands
+    uint32_t signatureOffset;
+    uint64_t signatureSize;
+} SignatureCacheEntryHeader;
+
+typedef struct s_SignatureCacheEntry {
+    uint8_t key[SIGNATURE_CACHE_KEY_SIZE];
+    uint64_t size;
+    uint64_t lastUse;
+} SignatureCacheEntry;
+
+struct s_SignatureCache {
+    char *directoryPath;
+    uint64_t maxSize;
+    uint64_t totalSize;
+    SignatureCacheEntry *entries;
+    uint32_t entryCount;
+    uint32_t entryCapacity;
+    SignatureCacheStats stats;
+    pthread_mutex_t lock;
+};
+
+static uint64_t _signature_cache_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static char *_signature_cache_copy_entry_path(SignatureCache *cache, const uint8_t key[SIGNATURE_CACHE_KEY_SIZE])
+{
+    char hex[(SIGNATURE_CACHE_KEY_SIZE * 2) + 1];
+    for (int i = 0; i < SIGNATURE_CACHE_KEY_SIZE; i++) {
+        snprintf(&hex[i * 2], 3, "%02x", key[i]);
+    }
+    char *path = NULL;
+    if (asprintf(&path, "%s/%s%s", cache->directoryPath, hex, SIGNATURE_CACHE_ENTRY_SUFFIX) == -1) return NULL;
+    return path;
+}
+
+static bool _signature_cache_parse_entry_name(const char *name, uint8_t keyOut[SIGNATURE_CACHE_KEY_SIZE])
+{
+    if (strlen(name) != (SIGNATURE_CACHE_KEY_SIZE * 2) + strlen(SIGNATURE_CACHE_ENTRY_SUFFIX)) return false;
+    if (strcmp(&name[SIGNATURE_CACHE_KEY_SIZE * 2], SIGNATURE_CACHE_ENTRY_SUFFIX) != 0) return false;
+    for (int i = 0; i < SIGNATURE_CACHE_KEY_SIZE; i++) {
+        unsigned int byte = 0;
+        if (sscanf(&name[i * 2], "%2x", &byte) != 1) return false;
+        keyOut[i] = byte;
+    }
+    return true;
+}
+
+static int _signature_cache_find_entry(SignatureCache *cache, const uint8_t key[SIGNATURE_CACHE_KEY_SIZE])
+{
+    for (uint32_t i = 0; i < cache->entryCount; i++) {
+        if (memcmp(cache->entries[i].key, key, SIGNATURE_CACHE_KEY_SIZE) == 0) return i;
+    }
+    return -1;
+}
+
+static int _signature_cache_add_entry(SignatureCache *cache, const uint8_t key[SIGNATURE_CACHE_KEY_SIZE], uint64_t size, uint64_t lastUse)
+{
+    if (cache->entryCount == cache->entryCapacity) {
+        uint32_t newCapacity = cache->entryCapacity ? cache->entryCapacity * 2 : 64;
+        SignatureCacheEntry *newEntries = realloc(cache->entries, newCapacity * sizeof(SignatureCacheEntry));
+        if (!newEntries) return -1;
+        cache->entries = newEntries;
+        cache->entryCapacity = newCapacity;
+    }
+    SignatureCacheEntry *entry = &cache->entries[cache->entryCount++];
+    memcpy(entry->key, key, SIGNATURE_CACHE_KEY_SIZE);
+    entry->size = size;
+    entry->lastUse = lastUse;
+    cache->totalSize += size;
+    return 0;
+}
+
+// Only drops the entry from the index, the caller decides what happens to the file
+static void _signature_cache_forget_entry_at_index(SignatureCache *cache, uint32_t index)
+{
+    cache->totalSize -= cache->entries[index].size;
+    cache->entries[index] = cache->entries[--cache->entryCount];
+}
+
+static void _signature_cache_remove_entry_at_index(SignatureCache *cache, uint32_t index)
+{
+    char *entryPath = _signature_cache_copy_entry_path(cache, cache->entries[index].key);
+    if (entryPath) {
+        unlink(entryPath);
+        free(entryPath);
+    }
+    _signature_cache_forget_entry_at_index(cache, index);
+}
+
+static void _signature_cache_evict(SignatureCache *cache)
+{
+    while (cache->totalSize > cache->maxSize && cache->entryCount > 0) {
+        uint32_t oldestIndex = 0;
+        for (uint32_t i = 1; i < cache->entryCount; i++) {
+            if (cache->entries[i].lastUse < cache->entries[oldestIndex].lastUse) oldestIndex = i;
+        }
+        _signature_cache_remove_entry_at_index(cache, oldestIndex);
+        cache->stats.evictions++;
+    }
+}
+
+static int _signature_cache_pwrite_all(int fd, const void *buf, size_t size, off_t offset)
+{
+    size_t written = 0;
+    while (written < size) {
+        ssize_t r = pwrite(fd, (const uint8_t *)buf + written, size - written, offset + written);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        written += r;
+    }
+    return 0;
+}
+
+static int _signature_cache_pread_all(int fd, void *buf, size_t size, off_t offset)
+{
+    size_t readSize = 0;
+    while (readSize < size) {
+        ssize_t r = pread(fd, (uint8_t *)buf + readSize, size - readSize, offset + readSize);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (r == 0) return -1;
+        readSize += r;
+    }
+    return 0;
+}
+
+SignatureCache *signature_cache_open(const char *directoryPath, uint64_t maxSize)
+{
+    if (mkdir(directoryPath, 0755) != 0 && errno != EEXIST) {
+        printf("Error: failed to create signature cache directory %s (%d)\n", directoryPath, errno);
+        return NULL;
+    }
+
+    DIR *dir = opendir(directoryPath);
+    if (!dir) {
+        printf("Error: failed to open signature cache directory %s (%d)\n", directoryPath, errno);
+        return NULL;
+    }
+
+    SignatureCache *cache = malloc(sizeof(SignatureCache));
+    if (!cache) {
+        closedir(dir);
+        return NULL;
+    }
+    memset(cache, 0, sizeof(SignatureCache));
+    cache->directoryPath = strdup(directoryPath);
+    cache->maxSize = maxSize;
+    pthread_mutex_init(&cache->lock, NULL);
+    if (!cache->directoryPath) goto fail;
+
+    // Rebuild the index from the directory, the modification date of an entry is its last use
+    struct dirent *dirEntry = NULL;
+    while ((dirEntry = readdir(dir))) {
+        char *entryPath = NULL;
+        if (asprintf(&entryPath, "%s/%s", directoryPath, dirEntry->d_name) == -1) continue;
+
+        uint8_t key[SIGNATURE_CACHE_KEY_SIZE];
+        struct stat st;
+        if (strncmp(dirEntry->d_name, SIGNATURE_CACHE_TEMP_PREFIX, strlen(SIGNATURE_CACHE_TEMP_PREFIX)) == 0) {
+            // Left behind by an interrupted store
+            unlink(entryPath);
+        }
+        else if (_signature_cache_parse_entry_name(dirEntry->d_name, key) && stat(entryPath, &st) == 0 && S_ISREG(st.st_mode)) {
+            uint64_t lastUse = ((uint64_t)st.st_mtimespec.tv_sec * 1000000000ULL) + st.st_mtimespec.tv_nsec;
+            if (_signature_cache_add_entry(cache, key, st.st_size, lastUse) != 0) {
+                free(entryPath);
+                goto fail;
+            }
+        }
+        free(entryPath);
+    }
+    closedir(dir);
+    dir = NULL;
+
+    _signature_cache_evict(cache);
+    return cache;
+
+fail:
+    if (dir) closedir(dir);
+    signature_cache_close(cache);
+    return NULL;
+}
+
+void signature_cache_close(SignatureCache *cache)
+{
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->entries);
+    free(cache->directoryPath);
+    free(cache);
+}
+
+int signature_cache_calculate_key(const char *path, const void *parameters, size_t parametersSize, uint8_t keyOut[SIGNATURE_CACHE_KEY_SIZE])
+{
+    MemoryStream *stream = mapped_stream_init_from_path(path, 0, MAPPED_STREAM_SIZE_AUTO, 0);
+    if (!stream) return -1;
+
+    uint8_t *buf = memory_stream_get_raw_pointer(stream);
+    uint64_t size = memory_stream_get_size(stream);
+    size_t chunkCount = (size + SIGNATURE_CACHE_CHUNK_SIZE - 1) / SIGNATURE_CACHE_CHUNK_SIZE;
+    uint8_t *chunkHashes = malloc((chunkCount * CC_SHA256_DIGEST_LENGTH) + 1);
+    if (!buf || !chunkHashes) {
+        free(chunkHashes);
+        memory_stream_free(stream);
+        return -1;
+    }
+
+    dispatch_apply(chunkCount, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t chunk) {
+        uint64_t chunkStart = chunk * SIGNATURE_CACHE_CHUNK_SIZE;
+        uint64_t chunkSize = size - chunkStart;
+        if (chunkSize > SIGNATURE_CACHE_CHUNK_SIZE) chunkSize = SIGNATURE_CACHE_CHUNK_SIZE;
+        CC_SHA256(&buf[chunkStart], (CC_LONG)chunkSize, &chunkHashes[chunk * CC_SHA256_DIGEST_LENGTH]);
+    });
+
+    uint8_t parametersHash[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(parameters, (CC_LONG)parametersSize, parametersHash);
+
+    CC_SHA256_CTX context;
+    CC_SHA256_Init(&context);
+    CC_SHA256_Update(&context, &size, sizeof(size));
+    CC_SHA256_Update(&context, chunkHashes, (CC_LONG)(chunkCount * CC_SHA256_DIGEST_LENGTH));
+    CC_SHA256_Update(&context, parametersHash, sizeof(parametersHash));
+    CC_SHA256_Final(keyOut, &context);
+
+    free(chunkHashes);
+    memory_stream_free(stream);
+    return 0;
+}
+
+int signature_cache_store(SignatureCache *cache, const uint8_t key[SIGNATURE_CACHE_KEY_SIZE], const char *signedPath)
+{
+    int r = -1;
+    int fd = -1;
+    char *tempPath = NULL, *entryPath = NULL;
+    uint8_t *buf = NULL;
+
+    FAT *fat = fat_init_from_path(signedPath);
+    if (!fat) return -1;
+    if (fat->slicesCount != 1 || (fat->slices[0] && fat->slices[0]->archDescriptor.offset != 0)) {
+        printf("Error: only thin MachOs can be stored in the signature cache\n");
+        goto out;
+    }
+    if (!fat->slices[0]) {
+        printf("Error: failed to parse %s\n", signedPath);
+        goto out;
+    }
+    MachO *macho = fat->slices[0];
+
+    uint32_t signatureOffset = 0;
+    if (macho_find_code_signature_bounds(macho, &signatureOffset, NULL) != 0) {
+        printf("Error: %s is not signed\n", signedPath);
+        goto out;
+    }
+
+    SignatureCacheEntryHeader header = { 0 };
+    header.magic = SIGNATURE_CACHE_MAGIC;
+    header.version = SIGNATURE_CACHE_VERSION;
+    header.fileSize = memory_stream_get_size(fat_get_stream(fat));
+    header.loadCommandsSize = sizeof(struct mach_header_64) + macho->machHeader.sizeofcmds;
+    header.signatureOffset = signatureOffset;
+    if (signatureOffset < header.loadCommandsSize || signatureOffset > header.fileSize) {
+        printf("Error: unexpected code signature location in %s\n", signedPath);
+        goto out;
+    }
+    header.signatureSize = header.fileSize - signatureOffset;
+
+    uint64_t entrySize = sizeof(header) + header.loadCommandsSize + header.signatureSize;
+    if (entrySize > cache->maxSize) goto out;
+
+    buf = malloc(header.loadCommandsSize + header.signatureSize);
+    if (!buf) goto out;
+    if (macho_read_at_offset(macho, 0, header.loadCommandsSize, buf) != 0) goto out;
+    if (macho_read_at_offset(macho, signatureOffset, header.signatureSize, &buf[header.loadCommandsSize]) != 0) goto out;
+
+    // Write to a temporary file first, so that an entry is either complete or not there at all
+    if (asprintf(&tempPath, "%s/%sXXXXXX", cache->directoryPath, SIGNATURE_CACHE_TEMP_PREFIX) == -1) {
+        tempPath = NULL;
+        goto out;
+    }
+    entryPath = _signature_cache_copy_entry_path(cache, key);
+    if (!entryPath) goto out;
+    fd = mkstemp(tempPath);
+    if (fd < 0) {
+        printf("Error: failed to create signature cache entry (%d)\n", errno);
+        goto out;
+    }
+    if (_signature_cache_pwrite_all(fd, &header, sizeof(header), 0) != 0 ||
+        _signature_cache_pwrite_all(fd, buf, header.loadCommandsSize + header.signatureSize, sizeof(header)) != 0) {
+        printf("Error: failed to write signature cache entry (%d)\n", errno);
+        unlink(tempPath);
+        goto out;
+    }
+    fchmod(fd, 0644);
+    close(fd);
+    fd = -1;
+    if (rename(tempPath, entryPath) != 0) {
+        unlink(tempPath);
+        goto out;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    int existingIndex = _signature_cache_find_entry(cache, key);
+    if (existingIndex >= 0) {
+        // The file was already replaced by the rename
+        _signature_cache_forget_entry_at_index(cache, existingIndex);
+    }
+    r = _signature_cache_add_entry(cache, key, entrySize, _signature_cache_now());
+    if (r == 0) cache->stats.stores++;
+    _signature_cache_evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+
+out:
+    if (fd >= 0) close(fd);
+    free(tempPath);
+    free(entryPath);
+    free(buf);
+    fat_free(fat);
+    return r;
+}
+
+int signature_cache_apply(SignatureCache *cache, const uint8_t key[SIGNATURE_CACHE_KEY_SIZE], const char *path)
+{
+    pthread_mutex_lock(&cache->lock);
+    bool found = _signature_cache_find_entry(cache, key) >= 0;
+    if (!found) cache->stats.misses++;
+    pthread_mutex_unlock(&cache->lock);
+    if (!found) return -1;
+
+    int r = -1;
+    int entryFd = -1, fd = -1;
+    uint8_t *buf = NULL;
+    char *entryPath = _signature_cache_copy_entry_path(cache, key);
+    if (!entryPath) goto out;
+
+    SignatureCacheEntryHeader header;
+    entryFd = open(entryPath, O_RDONLY);
+    if (entryFd < 0 || _signature_cache_pread_all(entryFd, &header, sizeof(header), 0) != 0) goto invalid;
+    if (header.magic != SIGNATURE_CACHE_MAGIC || header.version != SIGNATURE_CACHE_VERSION ||
+        header.loadCommandsSize > header.signatureOffset || header.signatureOffset + header.signatureSize != header.fileSize) goto invalid;
+
+    buf = malloc(header.loadCommandsSize + header.signatureSize);
+    if (!buf) goto out;
+    if (_signature_cache_pread_all(entryFd, buf, header.loadCommandsSize + header.signatureSize, sizeof(header)) != 0) goto invalid;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0) {
+        printf("Error: failed to open %s (%d)\n", path, errno);
+        goto out;
+    }
+
+    // Anything between the old end of the file and the signature is zero filled by ftruncate
+    struct stat st;
+    if (fstat(fd, &st) != 0) goto out;
+    if (st.st_size < header.signatureOffset && ftruncate(fd, header.signatureOffset) != 0) goto writeFailed;
+    if (_signature_cache_pwrite_all(fd, buf, header.loadCommandsSize, 0) != 0) goto writeFailed;
+    if (_signature_cache_pwrite_all(fd, &buf[header.loadCommandsSize], header.signatureSize, header.signatureOffset) != 0) goto writeFailed;
+    if (ftruncate(fd, header.fileSize) != 0) goto writeFailed;
+
+    pthread_mutex_lock(&cache->lock);
+    int index = _signature_cache_find_entry(cache, key);
+    if (index >= 0) cache->entries[index].lastUse = _signature_cache_now();
+    cache->stats.hits++;
+    pthread_mutex_unlock(&cache->lock);
+
+    // Persist the use for the next time the cache is opened
+    utimes(entryPath, NULL);
+    r = 0;
+    goto out;
+
+writeFailed:
+    printf("Error: failed to write cached signature to %s (%d)\n", path, errno);
+    goto out;
+
+invalid:
+    // Drop entries that can't be read, this counts as a miss
+    pthread_mutex_lock(&cache->lock);
+    int invalidIndex = _signature_cache_find_entry(cache, key);
+    if (invalidIndex >= 0) _signature_cache_remove_entry_at_index(cache, invalidIndex);
+    cache->stats.misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+out:
+    if (fd >= 0) close(fd);
+    if (entryFd >= 0) close(entryFd);
+    free(buf);
+    free(entryPath);
+    return r;
+}
+
+void signature_cache_get_stats(SignatureCache *cache, SignatureCacheStats *statsOut)
+{
+    pthread_mutex_lock(&cache->lock);
+    *statsOut = cache->stats;
+    statsOut->entryCount = cache->entryCount;
+    statsOut->totalSize = cache->totalSize;
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,298 @@
+#include "TrustCache.h"
+
+#include "CSBlob.h"
+#include "CodeDirectory.h"
+#include "MachOByteOrder.h"
+
+#include <mach-o/fat.h>
+#include <mach-o/loader.h>
+#include <dispatch/dispatch.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static int _read_exact(int fd, void *buf, size_t size, uint64_t offset)
+{
+    uint8_t *cur = buf;
+    while (size) {
+        ssize_t r = pread(fd, cur, size, offset);
+        if (r <= 0) return -1;
+        cur += r;
+        offset += r;
+        size -= r;
+    }
+    return 0;
+}
+
+// Read the code signature of the slice at sliceOffset and hash its best code directory
+// Returns 1 if the slice is not signed or not 64-bit (e.g. the armv7 slice of a FAT), those are skipped like unsigned ones
+static int _cdhash_calculate_for_slice(int fd, uint64_t sliceOffset, uint64_t sliceSize, TrustCacheEntry *entryOut)
+{
+    struct mach_header_64 machHeader;
+    if (sliceSize < sizeof(machHeader) || _read_exact(fd, &machHeader, sizeof(machHeader), sliceOffset) != 0) return -1;
+    MACH_HEADER_APPLY_BYTE_ORDER(&machHeader, LITTLE_TO_HOST_APPLIER);
+    if (machHeader.magic == MH_MAGIC) return 1;
+    if (machHeader.magic != MH_MAGIC_64) return -1;
+    if (sizeof(machHeader) + (uint64_t)machHeader.sizeofcmds > sliceSize) {
+        printf("Error: load commands (size 0x%x) do not fit into slice\n", machHeader.sizeofcmds);
+        return -1;
+    }
+
+    uint8_t *loadCommands = malloc(machHeader.sizeofcmds ? machHeader.sizeofcmds : 1);
+    if (!loadCommands) return -1;
+    if (_read_exact(fd, loadCommands, machHeader.sizeofcmds, sliceOffset + sizeof(machHeader)) != 0) {
+        free(loadCommands);
+        return -1;
+    }
+
+    bool foundSignature = false;
+    struct linkedit_data_command csLoadCommand;
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < machHeader.ncmds && offset + sizeof(struct load_command) <= machHeader.sizeofcmds; i++) {
+        struct load_command loadCommand;
+        memcpy(&loadCommand, &loadCommands[offset], sizeof(loadCommand));
+        LOAD_COMMAND_APPLY_BYTE_ORDER(&loadCommand, LITTLE_TO_HOST_APPLIER);
+        if (loadCommand.cmdsize < sizeof(loadCommand) || offset + loadCommand.cmdsize > machHeader.sizeofcmds) break;
+
+        if (loadCommand.cmd == LC_CODE_SIGNATURE && loadCommand.cmdsize >= sizeof(csLoadCommand)) {
+            memcpy(&csLoadCommand, &loadCommands[offset], sizeof(csLoadCommand));
+            LINKEDIT_DATA_COMMAND_APPLY_BYTE_ORDER(&csLoadCommand, LITTLE_TO_HOST_APPLIER);
+            foundSignature = true;
+            break;
+        }
+        offset += loadCommand.cmdsize;
+    }
+    free(loadCommands);
+
+    if (!foundSignature) return 1;
+    if (csLoadCommand.datasize < sizeof(CS_SuperBlob) || (uint64_t)csLoadCommand.dataoff + csLoadCommand.datasize > sliceSize) {
+        printf("Error: code signature (0x%x-0x%x) is outside of the slice\n", csLoadCommand.dataoff, csLoadCommand.dataoff + csLoadCommand.datasize);
+        return -1;
+    }
+
+    CS_SuperBlob *superblob = malloc(csLoadCommand.datasize);
+    if (!superblob) return -1;
+    if (_read_exact(fd, superblob, csLoadCommand.datasize, sliceOffset + csLoadCommand.dataoff) != 0 ||
+        BIG_TO_HOST(superblob->magic) != CSMAGIC_EMBEDDED_SIGNATURE ||
+        BIG_TO_HOST(superblob->length) > csLoadCommand.datasize) {
+        free(superblob);
+        return -1;
+    }
+
+    // Only the code directories are read, so there is no need to copy any blob
+    CS_DecodedSuperBlob *decodedSuperblob = csd_superblob_decode_lazy(superblob);
+    if (!decodedSuperblob) {
+        free(superblob);
+        return -1;
+    }
+
+    int r = -1;
+    CS_DecodedBlob *bestCodeDirBlob = csd_superblob_find_best_code_directory(decodedSuperblob);
+    if (bestCodeDirBlob) {
+        memset(entryOut, 0, sizeof(*entryOut));
+        entryOut->hashType = csd_code_directory_get_hash_type(bestCodeDirBlob);
+        r = csd_code_directory_calculate_hash(bestCodeDirBlob, entryOut->cdhash);
+    }
+    csd_superblob_free(decodedSuperblob);
+    return r;
+}
+
+int cdhash_calculate_for_path(const char *path, TrustCacheEntry *entriesOut, uint32_t *countOut)
+{
+    *countOut = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: could not open %s\n", path);
+        return -1;
+    }
+
+    int r = -1;
+    struct stat st;
+    struct fat_header fatHeader;
+    if (fstat(fd, &st) != 0 || _read_exact(fd, &fatHeader, sizeof(fatHeader), 0) != 0) goto out;
+    FAT_HEADER_APPLY_BYTE_ORDER(&fatHeader, BIG_TO_HOST_APPLIER);
+
+    uint64_t sliceOffsets[TRUSTCACHE_MAX_SLICES_PER_FILE];
+    uint64_t sliceSizes[TRUSTCACHE_MAX_SLICES_PER_FILE];
+    uint32_t sliceCount = 0;
+    if (fatHeader.magic == FAT_MAGIC || fatHeader.magic == FAT_MAGIC_64) {
+        if (fatHeader.nfat_arch > TRUSTCACHE_MAX_SLICES_PER_FILE || fatHeader.nfat_arch < 1) {
+            printf("Error: invalid number of MachO slices (%d) in %s\n", fatHeader.nfat_arch, path);
+            goto out;
+        }
+        bool is64 = fatHeader.magic == FAT_MAGIC_64;
+        for (uint32_t i = 0; i < fatHeader.nfat_arch; i++) {
+            if (is64) {
+                struct fat_arch_64 arch64;
+                if (_read_exact(fd, &arch64, sizeof(arch64), sizeof(fatHeader) + i * sizeof(arch64)) != 0) goto out;
+                FAT_ARCH_64_APPLY_BYTE_ORDER(&arch64, BIG_TO_HOST_APPLIER);
+                sliceOffsets[sliceCount] = arch64.offset;
+                sliceSizes[sliceCount] = arch64.size;
+            }
+            else {
+                struct fat_arch arch;
+                if (_read_exact(fd, &arch, sizeof(arch), sizeof(fatHeader) + i * sizeof(arch)) != 0) goto out;
+                FAT_ARCH_APPLY_BYTE_ORDER(&arch, BIG_TO_HOST_APPLIER);
+                sliceOffsets[sliceCount] = arch.offset;
+                sliceSizes[sliceCount] = arch.size;
+            }
+            if (sliceOffsets[sliceCount] + sliceSizes[sliceCount] > (uint64_t)st.st_size) {
+                printf("Error: slice %u of %s is outside of the file\n", i, path);
+                goto out;
+            }
+            sliceCount++;
+        }
+    }
+    else {
+        sliceOffsets[0] = 0;
+        sliceSizes[0] = st.st_size;
+        sliceCount = 1;
+    }
+
+    bool anyFailed = false;
+    for (uint32_t i = 0; i < sliceCount; i++) {
+        int sliceResult = _cdhash_calculate_for_slice(fd, sliceOffsets[i], sliceSizes[i], &entriesOut[*countOut]);
+        if (sliceResult == 0) {
+            (*countOut)++;
+        }
+        else if (sliceResult < 0) {
+            anyFailed = true;
+        }
+    }
+    // A path that is reported as failed must not contribute entries
+    if (anyFailed) *countOut = 0;
+    r = (anyFailed || *countOut == 0) ? -1 : 0;
+
+out:
+    close(fd);
+    return r;
+}
+
+static int _trustcache_entry_compare(const void *a, const void *b)
+{
+    return memcmp(((const TrustCacheEntry *)a)->cdhash, ((const TrustCacheEntry *)b)->cdhash, CS_CDHASH_LEN);
+}
+
+TrustCache *trustcache_create_for_paths(char **paths, size_t pathCount, uint32_t *failedCountOut)
+{
+    // Every path gets its own slots, so the workers never need to synchronise
+    TrustCacheEntry *slots = malloc((pathCount ? pathCount : 1) * TRUSTCACHE_MAX_SLICES_PER_FILE * sizeof(TrustCacheEntry));
+    uint32_t *slotCounts = calloc(pathCount ? pathCount : 1, sizeof(uint32_t));
+    if (!slots || !slotCounts) {
+        free(slots);
+        free(slotCounts);
+        return NULL;
+    }
+
+    __block uint32_t failedCount = 0;
+    dispatch_apply(pathCount, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t i) {
+        if (cdhash_calculate_for_path(paths[i], &slots[i * TRUSTCACHE_MAX_SLICES_PER_FILE], &slotCounts[i]) != 0) {
+            __atomic_fetch_add(&failedCount, 1, __ATOMIC_RELAXED);
+        }
+    });
+
+    // Compact the slots in place
+    uint32_t entryCount = 0;
+    for (size_t i = 0; i < pathCount; i++) {
+        for (uint32_t j = 0; j < slotCounts[i]; j++) {
+            slots[entryCount++] = slots[i * TRUSTCACHE_MAX_SLICES_PER_FILE + j];
+        }
+    }
+    free(slotCounts);
+
+    qsort(slots, entryCount, sizeof(TrustCacheEntry), _trustcache_entry_compare);
+
+    TrustCache *trustCache = malloc(sizeof(TrustCache) + (entryCount * sizeof(TrustCacheEntry)));
+    if (!trustCache) {
+        free(slots);
+        return NULL;
+    }
+    memset(trustCache, 0, sizeof(TrustCache));
+    trustCache->version = TRUSTCACHE_VERSION;
+
+    // The same binary (or slice) can show up more than once, a trust cache must not contain duplicates
+    uint32_t uniqueCount = 0;
+    for (uint32_t i = 0; i < entryCount; i++) {
+        if (uniqueCount && _trustcache_entry_compare(&trustCache->entries[uniqueCount - 1], &slots[i]) == 0) continue;
+        trustCache->entries[uniqueCount++] = slots[i];
+    }
+    trustCache->count = uniqueCount;
+    free(slots);
+
+    uint8_t digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(trustCache->entries, (CC_LONG)(uniqueCount * sizeof(TrustCacheEntry)), digest);
+    memcpy(trustCache->uuid, digest, sizeof(trustCache->uuid));
+
+    if (failedCountOut) *failedCountOut = failedCount;
+    return trustCache;
+}
+
+size_t trustcache_get_size(TrustCache *trustCache)
+{
+    return sizeof(TrustCache) + ((size_t)trustCache->count * sizeof(TrustCacheEntry));
+}
+
+int trustcache_write_to_file(TrustCache *trustCache, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        printf("Error: could not open %s for writing\n", path);
+        return -1;
+    }
+    size_t size = trustcache_get_size(trustCache);
+    int r = (fwrite(trustCache, size, 1, f) == 1) ? 0 : -1;
+    if (fclose(f) != 0) r = -1;
+    return r;
+}
+
+TrustCache *trustcache_init_from_path(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        printf("Error: could not open %s\n", path);
+        return NULL;
+    }
+
+    TrustCache header;
+    TrustCache *trustCache = NULL;
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.version != TRUSTCACHE_VERSION) {
+        printf("Error: %s is not a version %d trust cache\n", path, TRUSTCACHE_VERSION);
+        goto out;
+    }
+
+    trustCache = malloc(sizeof(TrustCache) + ((size_t)header.count * sizeof(TrustCacheEntry)));
+    if (!trustCache) goto out;
+    memcpy(trustCache, &header, sizeof(header));
+    if (header.count && fread(trustCache->entries, header.count * sizeof(TrustCacheEntry), 1, f) != 1) {
+        printf("Error: %s is truncated\n", path);
+        free(trustCache);
+        trustCache = NULL;
+        goto out;
+    }
+
+    // trustcache_find_entry relies on the order
+    for (uint32_t i = 1; i < header.count; i++) {
+        if (_trustcache_entry_compare(&trustCache->entries[i - 1], &trustCache->entries[i]) >= 0) {
+            printf("Error: entries of %s are not sorted\n", path);
+            free(trustCache);
+            trustCache = NULL;
+            break;
+        }
+    }
+
+out:
+    fclose(f);
+    return trustCache;
+}
+
+TrustCacheEntry *trustcache_find_entry(TrustCache *trustCache, const uint8_t cdhash[CS_CDHASH_LEN])
+{
+    TrustCacheEntry key;
+    memcpy(key.cdhash, cdhash, CS_CDHASH_LEN);
+    return bsearch(&key, trustCache->entries, trustCache->count, sizeof(TrustCacheEntry), _trustcache_entry_compare);
+}
+
+void trustcache_free(TrustCache *trustCache)
+{
+    free(trustCache);
+}
@@ -0,0 +1,47 @@
+#ifndef TRUST_CACHE_H
+#define TRUST_CACHE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "CodeDirectory.h"
+
+#define TRUSTCACHE_VERSION 1
+// fat_parse_slices doesn't accept more slices than this either
+#define TRUSTCACHE_MAX_SLICES_PER_FILE 5
+
+// Same layout as a version 1 trust cache, entries are sorted by cdhash so they can be binary searched
+typedef struct __TrustCacheEntry {
+    uint8_t cdhash[CS_CDHASH_LEN];
+    uint8_t hashType;
+    uint8_t flags;
+} __attribute__((__packed__)) TrustCacheEntry;
+
+typedef struct __TrustCache {
+    uint32_t version;
+    uint8_t uuid[16];
+    uint32_t count;
+    TrustCacheEntry entries[];
+} __attribute__((__packed__)) TrustCache;
+
+// Calculate the cdhash of the best code directory of every signed slice of the file at path
+// Only the headers, load commands and code signature of each slice are read, the file is never parsed as a whole
+// Unsigned and 32-bit slices are skipped, entriesOut needs room for TRUSTCACHE_MAX_SLICES_PER_FILE entries
+// If any slice can't be read, -1 is returned and *countOut is 0
+int cdhash_calculate_for_path(const char *path, TrustCacheEntry *entriesOut, uint32_t *countOut);
+
+// Calculate the cdhashes of all paths on all cores and build a trust cache out of them
+// Entries are sorted and duplicates are removed, the uuid is derived from the entries so the output is reproducible
+// failedCountOut (optional) receives the number of paths that could not be read or had no signed slice
+TrustCache *trustcache_create_for_paths(char **paths, size_t pathCount, uint32_t *failedCountOut);
+
+size_t trustcache_get_size(TrustCache *trustCache);
+int trustcache_write_to_file(TrustCache *trustCache, const char *path);
+TrustCache *trustcache_init_from_path(const char *path);
+
+// Binary search for cdhash, returns NULL if it is not in the trust cache
+TrustCacheEntry *trustcache_find_entry(TrustCache *trustCache, const uint8_t cdhash[CS_CDHASH_LEN]);
+void trustcache_free(TrustCache *trustCache);
+
+#endif // TRUST_CACHE_H
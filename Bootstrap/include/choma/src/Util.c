@@ -57,6 +57,18 @@ void print_hash(uint8_t *hash, size_t size)
     }
 }
 
+// 64 bit FNV-1a, good enough for hash tables keyed by strings
+uint64_t fnv1a_hash(const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
 void enumerate_range(uint64_t start, uint64_t end, uint16_t alignment, size_t nbytes, bool (^enumerator)(uint64_t))
 {
     if (start == end) return;
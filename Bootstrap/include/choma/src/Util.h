@@ -29,6 +29,7 @@ int memcmp_masked(const void *str1, const void *str2, unsigned char* mask, size_
 uint64_t align_to_size(int size, int alignment);
 int count_digits(int64_t num);
 void print_hash(uint8_t *hash, size_t size);
+uint64_t fnv1a_hash(const void *data, size_t size);
 void enumerate_range(uint64_t start, uint64_t end, uint16_t alignment, size_t nbytes, bool (^enumerator)(uint64_t cur));
 
 #endif
\ No newline at end of file
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <mach-o/loader.h>
+#include <choma/FAT.h>
+#include <choma/MachO.h>
+#include <choma/MachOByteOrder.h>
+#include <choma/CSBlob.h>
+#include <choma/CodeDirectory.h>
+#include <choma/AdhocSign.h>
+
+#define TEST_IDENTIFIER "com.opa334.choma.adhoc-sign-test"
+
+// Ad-hoc signs a copy of a MachO with its signature stripped and a copy that is still signed
+// All code slots of every code directory have to be valid afterwards, and re-signing has to merge or replace the entitlements as requested
+
+static const char gEntitlementsA[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+    "<plist version=\"1.0\"><dict>\n"
+    "<key>com.apple.private.security.no-sandbox</key><true/>\n"
+    "<key>platform-application</key><true/>\n"
+    "</dict></plist>\n";
+
+static const char gEntitlementsB[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+    "<plist version=\"1.0\"><dict>\n"
+    "<key>get-task-allow</key><true/>\n"
+    "</dict></plist>\n";
+
+static int write_file(const char *path, const uint8_t *data, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    int r = fwrite(data, 1, size, f) == size ? 0 : -1;
+    fclose(f);
+    return r;
+}
+
+// Remove LC_CODE_SIGNATURE and the signature data at the end of __LINKEDIT, like codesign --remove-signature
+static int strip_code_signature(uint8_t *data, size_t *sizeInOut)
+{
+    struct mach_header_64 *header = (struct mach_header_64 *)data;
+    if (*sizeInOut < sizeof(*header) || header->magic != MH_MAGIC_64) {
+        printf("Error: input is not a thin 64-bit MachO\n");
+        return -1;
+    }
+
+    uint8_t *commands = data + sizeof(*header);
+    uint8_t *commandsEnd = commands + header->sizeofcmds;
+    struct linkedit_data_command *codeSignature = NULL;
+    struct segment_command_64 *linkedit = NULL;
+    for (uint8_t *cmd = commands; cmd < commandsEnd; cmd += ((struct load_command *)cmd)->cmdsize) {
+        struct load_command *lc = (struct load_command *)cmd;
+        if (lc->cmd == LC_CODE_SIGNATURE) {
+            codeSignature = (struct linkedit_data_command *)cmd;
+        }
+        else if (lc->cmd == LC_SEGMENT_64 && !strcmp(((struct segment_command_64 *)cmd)->segname, "__LINKEDIT")) {
+            linkedit = (struct segment_command_64 *)cmd;
+        }
+    }
+    if (!codeSignature || !linkedit) {
+        printf("Error: input MachO is not signed\n");
+        return -1;
+    }
+
+    uint32_t dataoff = codeSignature->dataoff;
+    linkedit->filesize = dataoff - linkedit->fileoff;
+    *sizeInOut = dataoff;
+
+    uint32_t cmdsize = codeSignature->cmdsize;
+    memmove(codeSignature, (uint8_t *)codeSignature + cmdsize, commandsEnd - ((uint8_t *)codeSignature + cmdsize));
+    memset(commandsEnd - cmdsize, 0, cmdsize);
+    header->ncmds--;
+    header->sizeofcmds -= cmdsize;
+    return 0;
+}
+
+static bool is_code_directory(CS_DecodedBlob *blob)
+{
+    uint32_t type = csd_blob_get_type(blob);
+    return type == CSSLOT_CODEDIRECTORY || (CSSLOT_ALTERNATE_CODEDIRECTORIES <= type && type < CSSLOT_ALTERNATE_CODEDIRECTORY_LIMIT);
+}
+
+// Check that every code directory is valid and the identifier matches, entitlementsOut receives the embedded XML entitlements
+static int verify_signature(const char *path, const char *expectedIdentifier, char **entitlementsOut)
+{
+    int r = -1;
+    CS_DecodedSuperBlob *decodedSuperblob = NULL;
+    FAT *fat = fat_init_from_path(path);
+    if (!fat) {
+        printf("Error: failed to parse signed output\n");
+        return -1;
+    }
+    MachO *macho = fat->slicesCount ? fat->slices[0] : NULL;
+    if (!macho) goto out;
+
+    CS_SuperBlob *superblob = macho_read_code_signature(macho);
+    if (!superblob) {
+        printf("Error: output has no code signature\n");
+        goto out;
+    }
+    decodedSuperblob = csd_superblob_decode(superblob);
+    free(superblob);
+    if (!decodedSuperblob) goto out;
+
+    int codeDirCount = 0;
+    for (CS_DecodedBlob *blob = decodedSuperblob->firstBlob; blob; blob = blob->next) {
+        if (!is_code_directory(blob)) continue;
+        codeDirCount++;
+        CS_CodeSlotVerification *verification = csd_code_directory_verify_all_code_slots(blob, macho);
+        bool valid = verification && verification->invalidCount == 0;
+        if (verification) csd_code_slot_verification_free(verification);
+        if (!valid) {
+            printf("Code directory 0x%x has invalid code slots\n", csd_blob_get_type(blob));
+            goto out;
+        }
+    }
+    if (codeDirCount == 0) {
+        printf("Error: output has no code directory\n");
+        goto out;
+    }
+
+    char *identifier = csd_code_directory_copy_identifier(csd_superblob_find_best_code_directory(decodedSuperblob), NULL);
+    bool identifierMatches = identifier && !strcmp(identifier, expectedIdentifier);
+    if (!identifierMatches) printf("Identifier mismatch: %s vs %s\n", identifier ? identifier : "(null)", expectedIdentifier);
+    free(identifier);
+    if (!identifierMatches) goto out;
+
+    if (entitlementsOut) {
+        CS_DecodedBlob *entitlementsBlob = csd_superblob_find_blob(decodedSuperblob, CSSLOT_ENTITLEMENTS, NULL);
+        if (!entitlementsBlob || csd_blob_get_size(entitlementsBlob) <= sizeof(CS_GenericBlob)) {
+            printf("Error: output has no entitlements\n");
+            goto out;
+        }
+        size_t entitlementsSize = csd_blob_get_size(entitlementsBlob) - sizeof(CS_GenericBlob);
+        char *entitlements = malloc(entitlementsSize + 1);
+        if (!entitlements) goto out;
+        csd_blob_read(entitlementsBlob, sizeof(CS_GenericBlob), entitlementsSize, entitlements);
+        entitlements[entitlementsSize] = '\0';
+        *entitlementsOut = entitlements;
+    }
+    r = 0;
+
+out:
+    if (decodedSuperblob) csd_superblob_free(decodedSuperblob);
+    fat_free(fat);
+    return r;
+}
+
+static bool has_entitlement(const char *entitlements, const char *key)
+{
+    char keyElement[256];
+    snprintf(keyElement, sizeof(keyElement), "<key>%s</key>", key);
+    return strstr(entitlements, keyElement) != NULL;
+}
+
+static int run_unsigned_test(const char *path, uint8_t *data, size_t size)
+{
+    if (strip_code_signature(data, &size) != 0 || write_file(path, data, size) != 0) return -1;
+    if (adhoc_sign_file(path, TEST_IDENTIFIER, gEntitlementsA, sizeof(gEntitlementsA) - 1, 0) != 0) {
+        printf("Error: failed to sign unsigned MachO\n");
+        return -1;
+    }
+
+    char *entitlements = NULL;
+    if (verify_signature(path, TEST_IDENTIFIER, &entitlements) != 0) return -1;
+    bool valid = has_entitlement(entitlements, "platform-application") && has_entitlement(entitlements, "com.apple.private.security.no-sandbox");
+    if (!valid) printf("Entitlements were not embedded\n");
+    free(entitlements);
+    return valid ? 0 : -1;
+}
+
+static int run_signed_test(const char *path, const uint8_t *data, size_t size)
+{
+    if (write_file(path, data, size) != 0) return -1;
+
+    // Without an identifier, the one of the existing signature is kept
+    char *existingIdentifier = NULL;
+    FAT *fat = fat_init_from_path(path);
+    if (fat && fat->slicesCount && fat->slices[0]) {
+        CS_SuperBlob *superblob = macho_read_code_signature(fat->slices[0]);
+        CS_DecodedSuperBlob *decodedSuperblob = superblob ? csd_superblob_decode(superblob) : NULL;
+        CS_DecodedBlob *codeDirBlob = decodedSuperblob ? csd_superblob_find_best_code_directory(decodedSuperblob) : NULL;
+        if (codeDirBlob) existingIdentifier = csd_code_directory_copy_identifier(codeDirBlob, NULL);
+        if (decodedSuperblob) csd_superblob_free(decodedSuperblob);
+        free(superblob);
+    }
+    if (fat) fat_free(fat);
+    if (!existingIdentifier) {
+        printf("Error: failed to read identifier of signed MachO\n");
+        return -1;
+    }
+
+    int r = adhoc_sign_file(path, NULL, NULL, 0, 0);
+    if (r != 0) printf("Error: failed to re-sign signed MachO\n");
+    if (r == 0) r = verify_signature(path, existingIdentifier, NULL);
+    free(existingIdentifier);
+    return r;
+}
+
+// path has to be the output of run_unsigned_test, so it carries gEntitlementsA
+static int run_entitlements_test(const char *path, uint32_t flags)
+{
+    if (adhoc_sign_file(path, NULL, gEntitlementsB, sizeof(gEntitlementsB) - 1, flags) != 0) {
+        printf("Error: failed to re-sign with new entitlements\n");
+        return -1;
+    }
+
+    char *entitlements = NULL;
+    if (verify_signature(path, TEST_IDENTIFIER, &entitlements) != 0) return -1;
+    bool merge = flags & ADHOC_SIGN_FLAG_MERGE_ENTITLEMENTS;
+    bool valid = has_entitlement(entitlements, "get-task-allow") &&
+                 has_entitlement(entitlements, "platform-application") == merge &&
+                 has_entitlement(entitlements, "com.apple.private.security.no-sandbox") == merge;
+    if (!valid) printf("Unexpected entitlements after %s:\n%s", merge ? "merge" : "replace", entitlements);
+    free(entitlements);
+    return valid ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: adhoc_sign <path to signed thin MachO>\n");
+        return -1;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        printf("Error: failed to open %s\n", argv[1]);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size);
+    if (!data || fread(data, 1, size, f) != size) {
+        printf("Error: failed to read %s\n", argv[1]);
+        fclose(f);
+        free(data);
+        return -1;
+    }
+    fclose(f);
+
+    char unsignedPath[] = "/tmp/adhoc_sign_unsigned_XXXXXX";
+    char signedPath[] = "/tmp/adhoc_sign_signed_XXXXXX";
+    int unsignedFd = mkstemp(unsignedPath);
+    int signedFd = mkstemp(signedPath);
+    if (unsignedFd < 0 || signedFd < 0) {
+        printf("Error: failed to create temporary files\n");
+        free(data);
+        return -1;
+    }
+    close(unsignedFd);
+    close(signedFd);
+
+    int r = run_signed_test(signedPath, data, size);
+    printf("signed: %s\n", r == 0 ? "ok" : "FAILED");
+    if (r == 0) {
+        // strip_code_signature modifies data, so this has to run last
+        r = run_unsigned_test(unsignedPath, data, size);
+        printf("unsigned: %s\n", r == 0 ? "ok" : "FAILED");
+    }
+    if (r == 0) {
+        r = run_entitlements_test(unsignedPath, ADHOC_SIGN_FLAG_MERGE_ENTITLEMENTS);
+        printf("merge entitlements: %s\n", r == 0 ? "ok" : "FAILED");
+    }
+    if (r == 0) {
+        r = run_entitlements_test(unsignedPath, 0);
+        printf("replace entitlements: %s\n", r == 0 ? "ok" : "FAILED");
+    }
+
+    unlink(unsignedPath);
+    unlink(signedPath);
+    free(data);
+    return r;
+}
@@ -3,7 +3,14 @@
 #include <choma/CodeDirectory.h>
 #include <choma/MachOLoadCommand.h>
 #include <choma/Host.h>
+#include <choma/TrustCache.h>
+#include <choma/MachOExportsTrie.h>
+#include <choma/MachOChainedFixups.h>
 #include <mach-o/nlist.h>
+#include <mach-o/fat.h>
+#include <dispatch/dispatch.h>
+#include <fts.h>
+#include <time.h>
 
 char *get_argument_value(int argc, char *argv[], const char *flag)
 {
@@ -27,22 +34,232 @@ bool argument_exists(int argc, char *argv[], const char *flag)
     return false;
 }
 
+double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+bool file_has_macho_magic(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    uint32_t magic = 0;
+    bool isMachO = false;
+    if (read(fd, &magic, sizeof(magic)) == sizeof(magic)) {
+        isMachO = (magic == FAT_MAGIC || magic == FAT_CIGAM || magic == FAT_MAGIC_64 || magic == FAT_CIGAM_64 || magic == MH_MAGIC_64 || magic == MH_CIGAM_64);
+    }
+    close(fd);
+    return isMachO;
+}
+
+// Collect every MachO below rootPath, so the files can be handed out to the workers
+int collect_macho_paths(const char *rootPath, char ***pathsOut, size_t *pathCountOut)
+{
+    char *ftsPaths[] = { (char *)rootPath, NULL };
+    FTS *fts = fts_open(ftsPaths, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+    if (!fts) {
+        printf("Error: could not open directory %s.\n", rootPath);
+        return -1;
+    }
+
+    char **paths = NULL;
+    size_t pathCount = 0, pathCapacity = 0;
+    FTSENT *entry = NULL;
+    while ((entry = fts_read(fts))) {
+        if (entry->fts_info != FTS_F || !file_has_macho_magic(entry->fts_path)) continue;
+        if (pathCount == pathCapacity) {
+            pathCapacity = pathCapacity ? (pathCapacity * 2) : 256;
+            char **newPaths = realloc(paths, pathCapacity * sizeof(char *));
+            if (!newPaths) break;
+            paths = newPaths;
+        }
+        paths[pathCount++] = strdup(entry->fts_path);
+    }
+    fts_close(fts);
+    *pathsOut = paths;
+    *pathCountOut = pathCount;
+    return 0;
+}
+
+// Read one path per line from listPath, empty lines are ignored
+int read_path_list(const char *listPath, char ***pathsOut, size_t *pathCountOut)
+{
+    FILE *f = fopen(listPath, "r");
+    if (!f) {
+        printf("Error: could not open %s.\n", listPath);
+        return -1;
+    }
+
+    char **paths = NULL;
+    size_t pathCount = 0, pathCapacity = 0;
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t lineLength = 0;
+    while ((lineLength = getline(&line, &lineCapacity, f)) > 0) {
+        while (lineLength && (line[lineLength - 1] == '\n' || line[lineLength - 1] == '\r')) line[--lineLength] = '\0';
+        if (!lineLength) continue;
+        if (pathCount == pathCapacity) {
+            pathCapacity = pathCapacity ? (pathCapacity * 2) : 256;
+            char **newPaths = realloc(paths, pathCapacity * sizeof(char *));
+            if (!newPaths) break;
+            paths = newPaths;
+        }
+        paths[pathCount++] = strdup(line);
+    }
+    free(line);
+    fclose(f);
+    *pathsOut = paths;
+    *pathCountOut = pathCount;
+    return 0;
+}
+
+void free_paths(char **paths, size_t pathCount)
+{
+    for (size_t i = 0; i < pathCount; i++) {
+        free(paths[i]);
+    }
+    if (paths) free(paths);
+}
+
+// Build a sorted trust cache out of the cdhashes of every MachO in inputPath (a MachO, a directory or a file listing one path per line)
+int create_trustcache(const char *inputPath, const char *outputPath)
+{
+    struct stat inputStat;
+    if (stat(inputPath, &inputStat) != 0) {
+        printf("Error: could not stat %s.\n", inputPath);
+        return -1;
+    }
+
+    char **paths = NULL;
+    size_t pathCount = 0;
+    if (S_ISDIR(inputStat.st_mode)) {
+        if (collect_macho_paths(inputPath, &paths, &pathCount) != 0) return -1;
+    }
+    else if (file_has_macho_magic(inputPath)) {
+        paths = malloc(sizeof(char *));
+        if (!paths) return -1;
+        paths[0] = strdup(inputPath);
+        pathCount = 1;
+    }
+    else {
+        if (read_path_list(inputPath, &paths, &pathCount) != 0) return -1;
+    }
+
+    double startTime = get_time();
+    uint32_t failedCount = 0;
+    TrustCache *trustCache = trustcache_create_for_paths(paths, pathCount, &failedCount);
+    double elapsedTime = get_time() - startTime;
+    free_paths(paths, pathCount);
+    if (!trustCache) {
+        printf("Error: failed to create trust cache.\n");
+        return -1;
+    }
+
+    printf("Calculated %u unique cdhashes of %zu files (%u without a valid signature) in %.2fs.\n", trustCache->count, pathCount, failedCount, elapsedTime);
+    int r = trustcache_write_to_file(trustCache, outputPath);
+    if (r == 0) {
+        printf("Wrote trust cache to %s.\n", outputPath);
+    }
+    trustcache_free(trustCache);
+    return r;
+}
+
+// Verify the code slots of every signed MachO below rootPath, files are spread over all cores
+int verify_directory(const char *rootPath)
+{
+    char **paths = NULL;
+    size_t pathCount = 0;
+    if (collect_macho_paths(rootPath, &paths, &pathCount) != 0) return -1;
+
+    printf("Verifying %zu MachO files in %s.\n", pathCount, rootPath);
+
+    __block uint64_t bytesHashed = 0;
+    __block uint32_t slicesVerified = 0, slicesInvalid = 0, filesFailed = 0;
+    double startTime = get_time();
+    dispatch_apply(pathCount, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t i) {
+        FAT *fat = fat_init_from_path(paths[i]);
+        if (!fat) {
+            __atomic_fetch_add(&filesFailed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        for (int j = 0; j < fat->slicesCount; j++) {
+            MachO *slice = fat->slices[j];
+            if (!slice) {
+                // The slice failed to parse
+                __atomic_fetch_add(&slicesInvalid, 1, __ATOMIC_RELAXED);
+                printf("❌ %s (slice %d): failed to parse slice\n", paths[i], j);
+                continue;
+            }
+            CS_SuperBlob *superblob = macho_read_code_signature(slice);
+            if (!superblob) continue;
+            CS_DecodedSuperBlob *decodedSuperblob = csd_superblob_decode_lazy(superblob);
+            if (!decodedSuperblob) {
+                free(superblob);
+                continue;
+            }
+
+            CS_DecodedBlob *codeDirBlob = csd_superblob_find_best_code_directory(decodedSuperblob);
+            CS_CodeSlotVerification *verification = codeDirBlob ? csd_code_directory_verify_all_code_slots(codeDirBlob, slice) : NULL;
+            if (verification) {
+                __atomic_fetch_add(&bytesHashed, verification->bytesHashed, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&slicesVerified, 1, __ATOMIC_RELAXED);
+                if (verification->invalidCount) {
+                    __atomic_fetch_add(&slicesInvalid, 1, __ATOMIC_RELAXED);
+                    printf("❌ %s (slice %d): %u of %u page hashes are invalid\n", paths[i], j, verification->invalidCount, verification->slotCount);
+                }
+                csd_code_slot_verification_free(verification);
+            }
+            csd_superblob_free(decodedSuperblob);
+        }
+        fat_free(fat);
+    });
+    double elapsedTime = get_time() - startTime;
+
+    double megabytes = (double)bytesHashed / (1024 * 1024);
+    printf("Verified %u slices (%u invalid, %u files failed to parse), hashed %.1f MB in %.2fs (%.1f MB/s)\n", slicesVerified, slicesInvalid, filesFailed, megabytes, elapsedTime, elapsedTime > 0 ? (megabytes / elapsedTime) : 0);
+
+    free_paths(paths, pathCount);
+    return slicesInvalid ? -1 : 0;
+}
+
+void print_export(const char *name, MachOExport *export)
+{
+    if (export->flags & EXPORT_SYMBOL_FLAGS_REEXPORT) {
+        printf("%s: re-exported from library %llu%s%s\n", name, export->reexportOrdinal, export->importName ? " as " : "", export->importName ? export->importName : "");
+    }
+    else if (export->flags & EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER) {
+        printf("%s: 0x%llx (resolver 0x%llx)\n", name, export->vmaddr, export->resolverVmaddr);
+    }
+    else {
+        printf("%s: 0x%llx\n", name, export->vmaddr);
+    }
+}
+
 void print_usage(char *executablePath) {
     printf("Options:\n");
     printf("\t-i: Path to input file\n");
     printf("\t-c: Parse the CMS superblob blob of a MachO\n");
     printf("\t-e: Extract the Code Signature from a MachO\n");
     printf("\t-s: Print all page hash code slots in a CodeDirectory blob\n");
-    printf("\t-v: Verify that the CodeDirectory hashes are correct\n");
+    printf("\t-v: Verify that the CodeDirectory hashes are correct (verifies every MachO below it if the input is a directory)\n");
     printf("\t-f: Parse an MH_FILESET MachO and output it's sub-files\n");
     printf("\t-y: Parse symbol table\n");
     printf("\t-L: Parse dependency dylibs\n");
+    printf("\t-x: Parse exports trie (only looks up the given name if -n is passed)\n");
+    printf("\t-n: Name of the export to look up (use with -x)\n");
+    printf("\t-u: Parse chained fixups\n");
     printf("\t-d: Parse code signature data (use with -c)\n");
+    printf("\t-t: Write a sorted trust cache with the cdhashes of the input (MachO, directory or file with one path per line) to the given path\n");
     printf("\t-h: Print this message\n");
     printf("Examples:\n");
     printf("\t%s -i <path to FAT/MachO file> -c\n", executablePath);
     printf("\t%s -i <path to FAT/MachO file> -c -s -v\n", executablePath);
     printf("\t%s -i <path to kernelcache file> -f\n", executablePath);
+    printf("\t%s -i <path to directory> -v\n", executablePath);
+    printf("\t%s -i <path to MachO file> -x -n <symbol name>\n", executablePath);
+    printf("\t%s -i <path to directory> -t <path to output trust cache>\n", executablePath);
     exit(-1);
 }
 
@@ -65,7 +282,21 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    if (!argument_exists(argc, argv, "-c") && !argument_exists(argc, argv, "-f") && !argument_exists(argc, argv, "-y") && !argument_exists(argc, argv, "-L")) {
+    if (argument_exists(argc, argv, "-t")) {
+        char *outputPath = get_argument_value(argc, argv, "-t");
+        if (!outputPath) {
+            printf("Error: no trust cache output path specified.\n");
+            return -1;
+        }
+        return create_trustcache(inputPath, outputPath);
+    }
+
+    struct stat inputStat;
+    if (argument_exists(argc, argv, "-v") && stat(inputPath, &inputStat) == 0 && S_ISDIR(inputStat.st_mode)) {
+        return verify_directory(inputPath);
+    }
+
+    if (!argument_exists(argc, argv, "-c") && !argument_exists(argc, argv, "-f") && !argument_exists(argc, argv, "-y") && !argument_exists(argc, argv, "-L") && !argument_exists(argc, argv, "-x") && !argument_exists(argc, argv, "-u")) {
         printf("Error: no action specified.\n");
         print_usage(argv[0]);
         return -1;
@@ -84,9 +315,14 @@ int main(int argc, char *argv[]) {
             return -1;
         }
         memory_stream_read(stream, 0, memory_stream_get_size(stream), superblob);
-        CS_DecodedSuperBlob *decodedSuperBlob = csd_superblob_decode(superblob);
-        csd_superblob_print_content(decodedSuperBlob, NULL, argument_exists(argc, argv, "-s"), false);
-        free(superblob);
+        CS_DecodedSuperBlob *decodedSuperBlob = csd_superblob_decode_lazy(superblob);
+        if (decodedSuperBlob) {
+            csd_superblob_print_content(decodedSuperBlob, NULL, argument_exists(argc, argv, "-s"), false);
+            csd_superblob_free(decodedSuperBlob);
+        }
+        else {
+            free(superblob);
+        }
         memory_stream_free(stream);
         return 0;
     }
@@ -101,10 +337,18 @@ int main(int argc, char *argv[]) {
         printf("Slice %d (arch %x/%x, macho %x/%x):\n", i, slice->archDescriptor.cputype, slice->archDescriptor.cpusubtype, slice->machHeader.cputype, slice->machHeader.cpusubtype);
         if (argument_exists(argc, argv, "-c")) {
             CS_SuperBlob *superblob = macho_read_code_signature(slice);
-            CS_DecodedSuperBlob *decodedSuperBlob = csd_superblob_decode(superblob);
-            csd_superblob_print_content(decodedSuperBlob, slice, argument_exists(argc, argv, "-s"), argument_exists(argc, argv, "-v"));
-            if (argument_exists(argc, argv, "-e")) {
-                macho_extract_cs_to_file(slice, superblob);
+            if (superblob) {
+                if (argument_exists(argc, argv, "-e")) {
+                    macho_extract_cs_to_file(slice, superblob);
+                }
+                CS_DecodedSuperBlob *decodedSuperBlob = csd_superblob_decode_lazy(superblob);
+                if (decodedSuperBlob) {
+                    csd_superblob_print_content(decodedSuperBlob, slice, argument_exists(argc, argv, "-s"), argument_exists(argc, argv, "-v"));
+                    csd_superblob_free(decodedSuperBlob);
+                }
+                else {
+                    free(superblob);
+                }
             }
         }
         if (argument_exists(argc, argv, "-f")) {
@@ -117,7 +361,9 @@ int main(int argc, char *argv[]) {
                 }
             }
             for (uint32_t i = 0; i < slice->filesetCount; i++) {
-                MachO *filesetMachoSlice = slice->filesetMachos[i].underlyingMachO->slices[0];
+                FAT *filesetFat = macho_fileset_entry_get_fat(slice, &slice->filesetMachos[i]);
+                if (!filesetFat || filesetFat->slicesCount == 0) continue;
+                MachO *filesetMachoSlice = filesetFat->slices[0];
                 char *entry_id = slice->filesetMachos[i].entry_id;
                 for (int j = 0; j < filesetMachoSlice->segmentCount; j++) {
                     MachOSegment *segment = filesetMachoSlice->segments[j];
@@ -164,6 +410,53 @@ int main(int argc, char *argv[]) {
                 printf("| %s\n", rpath);
             });
         }
+        if (argument_exists(argc, argv, "-x")) {
+            MachOExportsTrie *exportsTrie = macho_exports_trie_init(slice);
+            if (exportsTrie) {
+                char *exportName = get_argument_value(argc, argv, "-n");
+                if (exportName) {
+                    MachOExport export;
+                    int r = macho_exports_trie_find(exportsTrie, exportName, &export);
+                    if (r == 0) {
+                        print_export(exportName, &export);
+                        macho_export_free(&export);
+                    }
+                    else if (r == 1) {
+                        printf("%s is not exported\n", exportName);
+                    }
+                }
+                else {
+                    printf("Exports:\n");
+                    macho_exports_trie_enumerate(exportsTrie, ^(const char *name, MachOExport *export, bool *stop) {
+                        print_export(name, export);
+                    });
+                }
+                macho_exports_trie_free(exportsTrie);
+            }
+            else {
+                printf("No exports trie found.\n");
+            }
+        }
+        if (argument_exists(argc, argv, "-u")) {
+            MachOChainedFixups *fixups = macho_chained_fixups_init(slice);
+            if (fixups) {
+                printf("Chained fixups:\n");
+                macho_chained_fixups_enumerate(fixups, ^(MachOChainedFixup *fixup, bool *stop) {
+                    if (fixup->isBind) {
+                        MachOChainedImport import;
+                        if (macho_chained_fixups_get_import(fixups, fixup->importOrdinal, &import) != 0) return;
+                        printf("0x%llx / 0x%llx: bind %s (library %d%s) + 0x%llx%s\n", fixup->fileoff, fixup->vmaddr, import.name, import.libOrdinal, import.weakImport ? ", weak" : "", import.addend + fixup->addend, fixup->isAuth ? " (auth)" : "");
+                    }
+                    else {
+                        printf("0x%llx / 0x%llx: rebase -> 0x%llx%s\n", fixup->fileoff, fixup->vmaddr, fixup->targetVmaddr, fixup->isAuth ? " (auth)" : "");
+                    }
+                });
+                macho_chained_fixups_free(fixups);
+            }
+            else {
+                printf("No chained fixups found.\n");
+            }
+        }
     }
 
     fat_free(fat);
@@ -1,21 +1,54 @@
 #include <choma/CSBlob.h>
+#include <choma/CodeDirectory.h>
+#include <choma/MemoryStream.h>
 #include <choma/Host.h>
+#include <choma/MachOSymbolTable.h>
 #include <mach-o/nlist.h>
 
 char gDopamineUUID[] = (char[]){'D', 'O', 'P', 'A', 'M', 'I', 'N', 'E', 'D', 'O', 'P', 'A', 'M', 'I', 'N', 'E' };
 
+// Only rehash the pages that were patched, so the existing code directories stay valid without hashing all of dyld again
+static int update_code_directories(MachO *macho)
+{
+    CS_SuperBlob *superblob = macho_read_code_signature(macho);
+    if (!superblob) return 0;
+    CS_DecodedSuperBlob *decodedSuperblob = csd_superblob_decode(superblob);
+    free(superblob);
+    if (!decodedSuperblob) return -1;
+
+    int r = 0;
+    CS_DecodedBlob *blob = decodedSuperblob->firstBlob;
+    while (blob && r == 0) {
+        uint32_t type = csd_blob_get_type(blob);
+        if (type == CSSLOT_CODEDIRECTORY || (CSSLOT_ALTERNATE_CODEDIRECTORIES <= type && type < CSSLOT_ALTERNATE_CODEDIRECTORY_LIMIT)) {
+            r = csd_code_directory_update_incremental(blob, macho);
+        }
+        blob = blob->next;
+    }
+    // Every code directory was updated from the same dirty ranges, so they can be dropped now
+    memory_stream_clear_dirty_ranges(macho_get_stream(macho));
+
+    if (r == 0) r = macho_replace_code_signature_decoded(macho, decodedSuperblob);
+    csd_superblob_free(decodedSuperblob);
+    return r;
+}
+
 int apply_dyld_patch(const char *dyldPath)
 {
     MachO *dyldMacho = macho_init_for_writing(dyldPath);
     if (!dyldMacho) return -1;
+    memory_stream_set_dirty_tracking(macho_get_stream(dyldMacho), true);
 
     // Make AMFI flags always be `0xdf`, allows DYLD variables to always work
-    __block uint64_t getAMFIAddr = 0;
-    macho_enumerate_symbols(dyldMacho, ^(const char *name, uint8_t type, uint64_t vmaddr, bool *stop){
-        if (!strcmp(name, "__ZN5dyld413ProcessConfig8Security7getAMFIERKNS0_7ProcessERNS_15SyscallDelegateE")) {
-            getAMFIAddr = vmaddr;
-        }
-    });
+    MachOSymbolTable *symbolTable = macho_symbol_table_init(dyldMacho);
+    MachOSymbol *getAMFISymbol = symbolTable ? macho_symbol_table_find_symbol(symbolTable, "__ZN5dyld413ProcessConfig8Security7getAMFIERKNS0_7ProcessERNS_15SyscallDelegateE") : NULL;
+    uint64_t getAMFIAddr = getAMFISymbol ? getAMFISymbol->vmaddr : 0;
+    if (symbolTable) macho_symbol_table_free(symbolTable);
+    if (!getAMFIAddr) {
+        printf("Error: failed to find getAMFI in %s\n", dyldPath);
+        macho_free(dyldMacho);
+        return -1;
+    }
     uint32_t getAMFIPatch[] = {
         0xd2801be0, // mov x0, 0xdf
 		0xd65f03c0  // ret
@@ -23,17 +56,19 @@ int apply_dyld_patch(const char *dyldPath)
     macho_write_at_vmaddr(dyldMacho, getAMFIAddr, sizeof(getAMFIPatch), getAMFIPatch);
 
     // iOS 16+: Change LC_UUID to prevent the kernel from using the in-cache dyld
-    macho_enumerate_load_commands(dyldMacho, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
-        if (loadCommand.cmd == LC_UUID) {
-            struct uuid_command *uuidCommand = (struct uuid_command *)cmd;
-            memcpy(&uuidCommand->uuid, gDopamineUUID, sizeof(gDopamineUUID));
-            macho_write_at_offset(dyldMacho, offset, loadCommand.cmdsize, uuidCommand);
-            *stop = true;
-        }
+    macho_enumerate_load_commands_of_type(dyldMacho, LC_UUID, ^(struct load_command loadCommand, uint64_t offset, void *cmd, bool *stop) {
+        struct uuid_command uuidCommand;
+        memcpy(&uuidCommand, cmd, sizeof(uuidCommand));
+        memcpy(&uuidCommand.uuid, gDopamineUUID, sizeof(gDopamineUUID));
+        macho_write_at_offset(dyldMacho, offset, sizeof(uuidCommand), &uuidCommand);
+        *stop = true;
     });
 
+    int r = update_code_directories(dyldMacho);
+    if (r != 0) printf("Error: failed to update code signature of %s\n", dyldPath);
+
     macho_free(dyldMacho);
-	return 0;
+	return r;
 }
 
 void print_usage(char *executablePath) {
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <choma/FAT.h>
+#include <choma/BufferedStream.h>
+#include <choma/MemoryStream.h>
+#include <choma/MachO.h>
+#include <choma/MachOByteOrder.h>
+#include <choma/CSBlob.h>
+#include <choma/CodeDirectory.h>
+
+#define DEFAULT_ITERATIONS 20
+#define MAX_PATCHES 4
+#define MAX_PATCH_SIZE 0x2000
+
+// Patches random bytes of a signed MachO and updates its code directories once with csd_code_directory_update_incremental
+// and once with csd_code_directory_update, both have to produce the same code directories and all code slots have to be valid
+
+static MachO *first_slice(FAT *fat)
+{
+    for (uint32_t i = 0; i < fat->slicesCount; i++) {
+        if (fat->slices[i]) return fat->slices[i];
+    }
+    return NULL;
+}
+
+static CS_DecodedSuperBlob *decode_signature(MachO *macho)
+{
+    CS_SuperBlob *superblob = macho_read_code_signature(macho);
+    if (!superblob) return NULL;
+    CS_DecodedSuperBlob *decodedSuperblob = csd_superblob_decode(superblob);
+    free(superblob);
+    return decodedSuperblob;
+}
+
+static bool is_code_directory(CS_DecodedBlob *blob)
+{
+    uint32_t type = csd_blob_get_type(blob);
+    return type == CSSLOT_CODEDIRECTORY || (CSSLOT_ALTERNATE_CODEDIRECTORIES <= type && type < CSSLOT_ALTERNATE_CODEDIRECTORY_LIMIT);
+}
+
+static int run_iteration(uint8_t *data, size_t size)
+{
+    int r = -1;
+    FAT *incrementalFat = fat_init_from_memory_stream(buffered_stream_init_from_buffer(data, size, BUFFERED_STREAM_FLAG_AUTO_EXPAND));
+    FAT *fullFat = fat_init_from_memory_stream(buffered_stream_init_from_buffer(data, size, BUFFERED_STREAM_FLAG_AUTO_EXPAND));
+    CS_DecodedSuperBlob *incrementalSuperblob = NULL, *fullSuperblob = NULL;
+    CS_SuperBlob *incrementalEncoded = NULL, *fullEncoded = NULL;
+    if (!incrementalFat || !fullFat) goto out;
+
+    MachO *incrementalMacho = first_slice(incrementalFat);
+    MachO *fullMacho = first_slice(fullFat);
+    if (!incrementalMacho || !fullMacho) goto out;
+
+    uint32_t csOffset = 0;
+    if (macho_find_code_signature_bounds(incrementalMacho, &csOffset, NULL) != 0) {
+        printf("Error: MachO is not signed\n");
+        goto out;
+    }
+
+    // Stay clear of the load commands (so the MachO doesn't have to be parsed again) and of the final page,
+    // which csd_code_directory_update never rehashes
+    uint64_t patchStart = sizeof(struct mach_header_64) + incrementalMacho->machHeader.sizeofcmds;
+    uint64_t patchEnd = ((csOffset + 0xFFF) & ~0xFFFULL) - 0x1000;
+    if (patchEnd <= patchStart) {
+        printf("Error: MachO is too small to be patched\n");
+        goto out;
+    }
+
+    if (memory_stream_set_dirty_tracking(macho_get_stream(incrementalMacho), true) != 0) goto out;
+
+    int patchCount = 1 + (rand() % MAX_PATCHES);
+    for (int i = 0; i < patchCount; i++) {
+        uint8_t patch[MAX_PATCH_SIZE];
+        uint64_t offset = patchStart + (rand() % (patchEnd - patchStart));
+        size_t patchSize = 1 + (rand() % MAX_PATCH_SIZE);
+        if (offset + patchSize > patchEnd) patchSize = patchEnd - offset;
+        for (size_t j = 0; j < patchSize; j++) {
+            patch[j] = rand();
+        }
+        if (macho_write_at_offset(incrementalMacho, offset, patchSize, patch) != 0) goto out;
+        if (macho_write_at_offset(fullMacho, offset, patchSize, patch) != 0) goto out;
+    }
+
+    incrementalSuperblob = decode_signature(incrementalMacho);
+    fullSuperblob = decode_signature(fullMacho);
+    if (!incrementalSuperblob || !fullSuperblob) goto out;
+
+    for (CS_DecodedBlob *blob = incrementalSuperblob->firstBlob; blob; blob = blob->next) {
+        if (!is_code_directory(blob)) continue;
+        if (csd_code_directory_update_incremental(blob, incrementalMacho) != 0) {
+            printf("Error: incremental update failed\n");
+            goto out;
+        }
+        CS_CodeSlotVerification *verification = csd_code_directory_verify_all_code_slots(blob, incrementalMacho);
+        bool valid = verification && verification->invalidCount == 0;
+        if (verification) csd_code_slot_verification_free(verification);
+        if (!valid) {
+            printf("Code directory 0x%x has invalid code slots after the incremental update\n", csd_blob_get_type(blob));
+            goto out;
+        }
+    }
+    memory_stream_clear_dirty_ranges(macho_get_stream(incrementalMacho));
+
+    for (CS_DecodedBlob *blob = fullSuperblob->firstBlob; blob; blob = blob->next) {
+        if (is_code_directory(blob)) csd_code_directory_update(blob, fullMacho);
+    }
+
+    incrementalEncoded = csd_superblob_encode(incrementalSuperblob);
+    fullEncoded = csd_superblob_encode(fullSuperblob);
+    if (!incrementalEncoded || !fullEncoded) goto out;
+    if (incrementalEncoded->length != fullEncoded->length || memcmp(incrementalEncoded, fullEncoded, BIG_TO_HOST(fullEncoded->length)) != 0) {
+        printf("Incremental and full update produced different code signatures\n");
+        goto out;
+    }
+    r = 0;
+
+out:
+    if (fullEncoded) free(fullEncoded);
+    if (incrementalEncoded) free(incrementalEncoded);
+    if (fullSuperblob) csd_superblob_free(fullSuperblob);
+    if (incrementalSuperblob) csd_superblob_free(incrementalSuperblob);
+    if (fullFat) fat_free(fullFat);
+    if (incrementalFat) fat_free(incrementalFat);
+    return r;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: incremental_update <path to signed MachO> [iterations]\n");
+        return -1;
+    }
+
+    int iterations = DEFAULT_ITERATIONS;
+    if (argc > 2) {
+        iterations = atoi(argv[2]);
+        if (iterations < 1) iterations = 1;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        printf("Error: failed to open %s\n", argv[1]);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size);
+    if (!data || fread(data, 1, size, f) != size) {
+        printf("Error: failed to read %s\n", argv[1]);
+        fclose(f);
+        free(data);
+        return -1;
+    }
+    fclose(f);
+
+    srand(0);
+    int failures = 0;
+    for (int i = 0; i < iterations; i++) {
+        if (run_iteration(data, size) != 0) failures++;
+    }
+    printf("%d iterations finished, %d failures\n", iterations, failures);
+
+    free(data);
+    return failures ? -1 : 0;
+}
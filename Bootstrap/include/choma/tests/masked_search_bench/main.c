@@ -0,0 +1,120 @@
+#include <choma/MappedStream.h>
+#include <choma/MaskedSearch.h>
+#include <choma/Util.h>
+
+#include <time.h>
+
+#define SYNTHETIC_BUFFER_SIZE (64 * 1024 * 1024)
+#define ITERATIONS 5
+
+typedef struct s_BenchPattern {
+    const char *name;
+    uint8_t bytes[8];
+    uint8_t mask[8];
+    size_t nbytes;
+    uint16_t alignment;
+} BenchPattern;
+
+// Patterns similar to what the patchfinder looks for in a kernelcache
+static BenchPattern gPatterns[] = {
+    { "pacibsp",      { 0x7f, 0x23, 0x03, 0xd5 }, { 0xff, 0xff, 0xff, 0xff }, 4, 4 },
+    { "b/bl",         { 0x00, 0x00, 0x00, 0x14 }, { 0x00, 0x00, 0x00, 0x7c }, 4, 4 },
+    { "adrp",         { 0x00, 0x00, 0x00, 0x90 }, { 0x00, 0x00, 0x00, 0x9f }, 4, 4 },
+    { "ret+pacibsp",  { 0xc0, 0x03, 0x5f, 0xd6, 0x7f, 0x23, 0x03, 0xd5 }, { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }, 8, 4 },
+    { "bytes",        { 0xde, 0xad, 0xbe, 0xef, 0x00, 0x00 }, { 0xff, 0xff, 0xff, 0xff, 0x00, 0xff }, 6, 1 },
+};
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// The previous implementation, enumerate_range with memcmp_masked at every offset
+static uint64_t count_matches_reference(uint8_t *buf, size_t size, BenchPattern *pattern)
+{
+    __block uint64_t count = 0;
+    enumerate_range(0, size, pattern->alignment, pattern->nbytes, ^bool(uint64_t cur) {
+        if (!memcmp_masked(&buf[cur], pattern->bytes, pattern->mask, pattern->nbytes)) {
+            count++;
+        }
+        return true;
+    });
+    return count;
+}
+
+static uint64_t count_matches_masked_search(uint8_t *buf, size_t size, BenchPattern *pattern)
+{
+    MaskedSearchCandidates candidates;
+    if (masked_search_get_candidates(0, size, pattern->alignment, pattern->nbytes, &candidates) != 1) return 0;
+
+    uint64_t count = 0;
+    uint64_t found = 0;
+    while (masked_search_buffer(buf, 0, &candidates, pattern->bytes, pattern->mask, pattern->nbytes, pattern->alignment, &found) == 0) {
+        count++;
+        uint64_t consumed = ((found - candidates.first) / pattern->alignment) + 1;
+        if (consumed >= candidates.count) break;
+        candidates.first = found + pattern->alignment;
+        candidates.count -= consumed;
+    }
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    uint8_t *buf = NULL;
+    size_t size = 0;
+    MemoryStream *stream = NULL;
+
+    if (argc > 1) {
+        stream = mapped_stream_init_from_path(argv[1], 0, MAPPED_STREAM_SIZE_AUTO, 0);
+        if (!stream) return -1;
+        buf = memory_stream_get_raw_pointer(stream);
+        size = memory_stream_get_size(stream);
+    }
+    else {
+        size = SYNTHETIC_BUFFER_SIZE;
+        buf = malloc(size);
+        if (!buf) return -1;
+        srand(0);
+        for (size_t i = 0; i < size; i++) {
+            buf[i] = rand();
+        }
+    }
+
+    // Search ranges need to be a multiple of every alignment used
+    size &= ~(size_t)0xF;
+
+    printf("Buffer: %zu MiB, kernel: %s\n", size / (1024 * 1024), masked_search_get_kernel_name());
+
+    int r = 0;
+    for (int i = 0; i < sizeof(gPatterns) / sizeof(gPatterns[0]); i++) {
+        BenchPattern *pattern = &gPatterns[i];
+
+        double referenceTime = 0, searchTime = 0;
+        uint64_t referenceCount = 0, searchCount = 0;
+        for (int j = 0; j < ITERATIONS; j++) {
+            double start = get_time();
+            referenceCount = count_matches_reference(buf, size, pattern);
+            double middle = get_time();
+            searchCount = count_matches_masked_search(buf, size, pattern);
+            double end = get_time();
+            referenceTime += middle - start;
+            searchTime += end - middle;
+        }
+
+        double megabytes = ((double)size * ITERATIONS) / (1024 * 1024);
+        printf("%-12s %8llu matches  reference %8.1f MiB/s  masked search %8.1f MiB/s  (%.1fx)%s\n",
+            pattern->name, searchCount, megabytes / referenceTime, megabytes / searchTime, referenceTime / searchTime,
+            referenceCount == searchCount ? "" : "  MISMATCH");
+        if (referenceCount != searchCount) r = -1;
+    }
+
+    if (stream) {
+        memory_stream_free(stream);
+    }
+    else {
+        free(buf);
+    }
+    return r;
+}
@@ -0,0 +1,118 @@
+#include <choma/MappedStream.h>
+#include <choma/MultiBufferHash.h>
+#include <CommonCrypto/CommonDigest.h>
+
+#include <time.h>
+
+#define SYNTHETIC_BUFFER_SIZE (64 * 1024 * 1024)
+#define ITERATIONS 5
+
+typedef struct s_BenchConfig {
+    const char *name;
+    MultiBufferHashAlgorithm algorithm;
+    uint32_t pageSize;
+    size_t hashSize;
+} BenchConfig;
+
+// Page and hash sizes used by code directories
+static BenchConfig gConfigs[] = {
+    { "sha1 4k",    MULTI_BUFFER_HASH_SHA1,   0x1000, CC_SHA1_DIGEST_LENGTH },
+    { "sha256 4k",  MULTI_BUFFER_HASH_SHA256, 0x1000, CC_SHA256_DIGEST_LENGTH },
+    { "sha1 16k",   MULTI_BUFFER_HASH_SHA1,   0x4000, CC_SHA1_DIGEST_LENGTH },
+    { "sha256 16k", MULTI_BUFFER_HASH_SHA256, 0x4000, CC_SHA256_DIGEST_LENGTH },
+};
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// The previous implementation, one CommonCrypto call per page
+static void hash_pages_reference(uint8_t *buf, uint32_t pageCount, BenchConfig *config, uint8_t *hashesOut)
+{
+    for (uint32_t i = 0; i < pageCount; i++) {
+        uint8_t *page = &buf[(size_t)i * config->pageSize];
+        if (config->algorithm == MULTI_BUFFER_HASH_SHA1) {
+            CC_SHA1(page, config->pageSize, &hashesOut[i * config->hashSize]);
+        }
+        else {
+            CC_SHA256(page, config->pageSize, &hashesOut[i * config->hashSize]);
+        }
+    }
+}
+
+static void hash_pages_multi_buffer(uint8_t *buf, uint32_t pageCount, BenchConfig *config, const uint8_t **pages, uint8_t *hashesOut)
+{
+    for (uint32_t i = 0; i < pageCount; i++) {
+        pages[i] = &buf[(size_t)i * config->pageSize];
+    }
+    multi_buffer_hash(config->algorithm, pages, config->pageSize, pageCount, hashesOut, config->hashSize);
+}
+
+int main(int argc, char *argv[]) {
+    uint8_t *buf = NULL;
+    size_t size = 0;
+    MemoryStream *stream = NULL;
+
+    if (argc > 1) {
+        stream = mapped_stream_init_from_path(argv[1], 0, MAPPED_STREAM_SIZE_AUTO, 0);
+        if (!stream) return -1;
+        buf = memory_stream_get_raw_pointer(stream);
+        size = memory_stream_get_size(stream);
+    }
+    else {
+        size = SYNTHETIC_BUFFER_SIZE;
+        buf = malloc(size);
+        if (!buf) return -1;
+        srand(0);
+        for (size_t i = 0; i < size; i++) {
+            buf[i] = rand();
+        }
+    }
+
+    printf("Buffer: %zu MiB, kernel: %s\n", size / (1024 * 1024), multi_buffer_hash_get_kernel_name());
+
+    int r = 0;
+    for (int i = 0; i < sizeof(gConfigs) / sizeof(gConfigs[0]); i++) {
+        BenchConfig *config = &gConfigs[i];
+        uint32_t pageCount = (uint32_t)(size / config->pageSize);
+        if (pageCount == 0) continue;
+
+        uint8_t *referenceHashes = malloc(pageCount * config->hashSize);
+        uint8_t *multiBufferHashes = malloc(pageCount * config->hashSize);
+        const uint8_t **pages = malloc(pageCount * sizeof(*pages));
+        if (!referenceHashes || !multiBufferHashes || !pages) return -1;
+
+        double referenceTime = 0, multiBufferTime = 0;
+        for (int j = 0; j < ITERATIONS; j++) {
+            double start = get_time();
+            hash_pages_reference(buf, pageCount, config, referenceHashes);
+            double middle = get_time();
+            hash_pages_multi_buffer(buf, pageCount, config, pages, multiBufferHashes);
+            double end = get_time();
+            referenceTime += middle - start;
+            multiBufferTime += end - middle;
+        }
+
+        bool match = memcmp(referenceHashes, multiBufferHashes, pageCount * config->hashSize) == 0;
+        double megabytes = ((double)pageCount * config->pageSize * ITERATIONS) / (1024 * 1024);
+        printf("%-10s %8u pages  one call per page %8.1f MiB/s  multi buffer %8.1f MiB/s  (%.1fx)%s\n",
+            config->name, pageCount, megabytes / referenceTime, megabytes / multiBufferTime, referenceTime / multiBufferTime,
+            match ? "" : "  MISMATCH");
+        if (!match) r = -1;
+
+        free(referenceHashes);
+        free(multiBufferHashes);
+        free(pages);
+    }
+
+    if (stream) {
+        memory_stream_free(stream);
+    }
+    else {
+        free(buf);
+    }
+    return r;
+}
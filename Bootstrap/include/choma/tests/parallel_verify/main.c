@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <dispatch/dispatch.h>
+#include <choma/FAT.h>
+#include <choma/FileStream.h>
+#include <choma/MemoryStream.h>
+#include <choma/MachO.h>
+#include <choma/CSBlob.h>
+#include <choma/CodeDirectory.h>
+
+#define DEFAULT_ITERATIONS 50
+
+// Stress test for concurrent access to a single FileStream
+// All slices of the FAT share one file descriptor and are re-parsed, hashed and verified on all cores at the same time,
+// every result has to match the result of a serial verification of the same slice
+
+static bool verify_slice(MachO *macho)
+{
+    CS_SuperBlob *superblob = macho_read_code_signature(macho);
+    if (!superblob) return false;
+
+    CS_DecodedSuperBlob *decodedSuperblob = csd_superblob_decode_lazy(superblob);
+    if (!decodedSuperblob) {
+        free(superblob);
+        return false;
+    }
+
+    bool valid = false;
+    CS_DecodedBlob *codeDirBlob = csd_superblob_find_best_code_directory(decodedSuperblob);
+    if (codeDirBlob) {
+        valid = csd_code_directory_verify_code_slots(codeDirBlob, macho, 0);
+    }
+    csd_superblob_free(decodedSuperblob);
+    return valid;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: parallel_verify <path to MachO> [iterations]\n");
+        return -1;
+    }
+
+    int iterations = DEFAULT_ITERATIONS;
+    if (argc > 2) {
+        iterations = atoi(argv[2]);
+        if (iterations < 1) iterations = 1;
+    }
+
+    // Explicitly use a FileStream so every slice reads through the same file descriptor
+    MemoryStream *stream = file_stream_init_from_path(argv[1], 0, FILE_STREAM_SIZE_AUTO, 0);
+    if (!stream) return -1;
+    FAT *fat = fat_init_from_memory_stream(stream);
+    if (!fat) return -1;
+
+    size_t fileSize = memory_stream_get_size(fat->stream);
+    uint32_t slicesCount = fat->slicesCount;
+    bool *expectedResults = calloc(slicesCount, sizeof(bool));
+    for (uint32_t i = 0; i < slicesCount; i++) {
+        if (fat->slices[i]) {
+            expectedResults[i] = verify_slice(fat->slices[i]);
+            printf("Slice %u (0x%x/0x%x): %s\n", i, fat->slices[i]->machHeader.cputype, fat->slices[i]->machHeader.cpusubtype, expectedResults[i] ? "valid" : "invalid");
+        }
+    }
+
+    __block int mismatches = 0;
+    __block int failures = 0;
+    clock_t start = clock();
+    dispatch_apply(iterations * slicesCount, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t i) {
+        uint32_t sliceIndex = i % slicesCount;
+        MachO *slice = fat->slices[sliceIndex];
+        if (!slice) return;
+
+        // Parse the slice again from a fresh soft clone of the shared stream
+        MemoryStream *sliceStream = memory_stream_softclone(fat->stream);
+        if (!sliceStream) {
+            __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if (memory_stream_trim(sliceStream, slice->archDescriptor.offset, fileSize - (slice->archDescriptor.offset + slice->archDescriptor.size)) != 0) {
+            memory_stream_free(sliceStream);
+            __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        MachO *macho = macho_init(sliceStream, slice->archDescriptor);
+        if (!macho) {
+            __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        if (verify_slice(macho) != expectedResults[sliceIndex]) {
+            __atomic_fetch_add(&mismatches, 1, __ATOMIC_RELAXED);
+        }
+        macho_free(macho);
+    });
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%u verifications finished (%.2fs CPU time), %d mismatches, %d failures\n", iterations * slicesCount, elapsed, mismatches, failures);
+
+    free(expectedResults);
+    fat_free(fat);
+    return (mismatches || failures) ? -1 : 0;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <choma/MemoryStream.h>
+#include <choma/BufferedStream.h>
+#include <choma/PieceTableStream.h>
+
+#define BASE_SIZE 0x10000
+#define DEFAULT_OPERATIONS 5000
+#define MAX_EDIT_SIZE 0x800
+
+// Applies the same random sequence of writes, inserts, deletes, trims and expansions to a PieceTableStream and a BufferedStream
+// The contents of both have to match after every operation, as does the serialized (and committed) output at the end
+
+typedef enum {
+    OPERATION_WRITE,
+    OPERATION_WRITE_PAST_END,
+    OPERATION_INSERT,
+    OPERATION_DELETE,
+    OPERATION_TRIM,
+    OPERATION_EXPAND,
+    OPERATION_COUNT,
+} Operation;
+
+static void fill_random(uint8_t *buf, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = rand();
+    }
+}
+
+static bool streams_match(MemoryStream *stream, MemoryStream *referenceStream)
+{
+    size_t size = memory_stream_get_size(stream);
+    if (size != memory_stream_get_size(referenceStream)) {
+        printf("Size mismatch: 0x%zx vs 0x%zx\n", size, memory_stream_get_size(referenceStream));
+        return false;
+    }
+    if (size == 0) return true;
+
+    uint8_t *data = malloc(size);
+    bool match = memory_stream_read(stream, 0, size, data) == 0 && memcmp(data, memory_stream_get_raw_pointer(referenceStream), size) == 0;
+    free(data);
+    if (!match) printf("Content mismatch\n");
+    return match;
+}
+
+// Apply one operation to both streams, writes are limited to what BufferedStream can do without auto expansion when structural is false
+static int apply_random_operation(MemoryStream *stream, MemoryStream *referenceStream, bool structural)
+{
+    uint8_t buf[MAX_EDIT_SIZE];
+    size_t size = memory_stream_get_size(referenceStream);
+    size_t editSize = 1 + (rand() % MAX_EDIT_SIZE);
+    fill_random(buf, editSize);
+
+    Operation operation = rand() % OPERATION_COUNT;
+    if (!structural && (operation == OPERATION_INSERT || operation == OPERATION_TRIM)) {
+        operation = OPERATION_WRITE;
+    }
+
+    int r = 0, referenceR = 0;
+    switch (operation) {
+        case OPERATION_WRITE: {
+            if (size < editSize) editSize = size;
+            if (editSize == 0) return 0;
+            uint64_t offset = rand() % (size - editSize + 1);
+            r = memory_stream_write(stream, offset, editSize, buf);
+            referenceR = memory_stream_write(referenceStream, offset, editSize, buf);
+            break;
+        }
+        case OPERATION_WRITE_PAST_END: {
+            uint64_t offset = size + (rand() % 0x100);
+            r = memory_stream_write(stream, offset, editSize, buf);
+            referenceR = memory_stream_write(referenceStream, offset, editSize, buf);
+            break;
+        }
+        case OPERATION_INSERT: {
+            uint64_t offset = rand() % (size + 1);
+            r = memory_stream_insert(stream, offset, editSize, buf);
+            referenceR = memory_stream_insert(referenceStream, offset, editSize, buf);
+            break;
+        }
+        case OPERATION_DELETE: {
+            if (size < editSize) editSize = size;
+            // Without structural edits, only delete at the end so the base data stays in place
+            uint64_t offset = structural ? (rand() % (size - editSize + 1)) : (size - editSize);
+            r = memory_stream_delete(stream, offset, editSize);
+            referenceR = memory_stream_delete(referenceStream, offset, editSize);
+            break;
+        }
+        case OPERATION_TRIM: {
+            size_t trimAtStart = rand() % 0x40, trimAtEnd = rand() % 0x40;
+            if ((trimAtStart + trimAtEnd) > size) return 0;
+            r = memory_stream_trim(stream, trimAtStart, trimAtEnd);
+            referenceR = memory_stream_trim(referenceStream, trimAtStart, trimAtEnd);
+            break;
+        }
+        case OPERATION_EXPAND: {
+            size_t expandAtEnd = rand() % 0x400;
+            r = memory_stream_expand(stream, 0, expandAtEnd);
+            referenceR = memory_stream_expand(referenceStream, 0, expandAtEnd);
+            break;
+        }
+        default:
+        break;
+    }
+
+    if (r != referenceR) {
+        printf("Operation %d returned %d, reference returned %d\n", operation, r, referenceR);
+        return -1;
+    }
+    return 0;
+}
+
+static int run_serialize_test(uint8_t *baseData, int operations)
+{
+    MemoryStream *referenceStream = buffered_stream_init_from_buffer(baseData, BASE_SIZE, BUFFERED_STREAM_FLAG_AUTO_EXPAND);
+    MemoryStream *stream = piece_table_stream_init(buffered_stream_init_from_buffer(baseData, BASE_SIZE, 0), PIECE_TABLE_STREAM_FLAG_AUTO_EXPAND);
+    if (!referenceStream || !stream) return -1;
+
+    int r = 0;
+    for (int i = 0; i < operations && r == 0; i++) {
+        r = apply_random_operation(stream, referenceStream, true);
+        if (r == 0 && !streams_match(stream, referenceStream)) {
+            printf("Mismatch after operation %d\n", i);
+            r = -1;
+        }
+    }
+
+    if (r == 0) {
+        uint8_t dummy = 0;
+        MemoryStream *targetStream = buffered_stream_init_from_buffer(&dummy, sizeof(dummy), BUFFERED_STREAM_FLAG_AUTO_EXPAND);
+        if (piece_table_stream_serialize(stream, targetStream) != 0 || !streams_match(targetStream, referenceStream)) {
+            printf("Serialized output does not match\n");
+            r = -1;
+        }
+        memory_stream_free(targetStream);
+    }
+
+    memory_stream_free(stream);
+    memory_stream_free(referenceStream);
+    return r;
+}
+
+static int run_commit_test(uint8_t *baseData, int operations)
+{
+    MemoryStream *referenceStream = buffered_stream_init_from_buffer(baseData, BASE_SIZE, BUFFERED_STREAM_FLAG_AUTO_EXPAND);
+    MemoryStream *targetStream = buffered_stream_init_from_buffer(baseData, BASE_SIZE, BUFFERED_STREAM_FLAG_AUTO_EXPAND);
+    if (!referenceStream || !targetStream) return -1;
+    MemoryStream *stream = piece_table_stream_init(memory_stream_softclone(targetStream), PIECE_TABLE_STREAM_FLAG_AUTO_EXPAND);
+    if (!stream) return -1;
+
+    int r = 0;
+    for (int i = 0; i < operations && r == 0; i++) {
+        r = apply_random_operation(stream, referenceStream, false);
+    }
+
+    if (r == 0 && (piece_table_stream_commit(stream, targetStream) != 0 || !streams_match(targetStream, referenceStream))) {
+        printf("Committed output does not match\n");
+        r = -1;
+    }
+    memory_stream_free(stream);
+
+    // Moving base data has to be refused before anything is written
+    if (r == 0) {
+        stream = piece_table_stream_init(memory_stream_softclone(targetStream), 0);
+        uint8_t byte = 0xff;
+        memory_stream_insert(stream, 0, sizeof(byte), &byte);
+        if (piece_table_stream_commit(stream, targetStream) == 0 || !streams_match(targetStream, referenceStream)) {
+            printf("Commit of moved base data was not refused\n");
+            r = -1;
+        }
+        memory_stream_free(stream);
+    }
+
+    memory_stream_free(targetStream);
+    memory_stream_free(referenceStream);
+    return r;
+}
+
+int main(int argc, char *argv[]) {
+    int operations = DEFAULT_OPERATIONS;
+    if (argc > 1) {
+        operations = atoi(argv[1]);
+        if (operations < 1) operations = 1;
+    }
+
+    srand(0);
+    uint8_t *baseData = malloc(BASE_SIZE);
+    if (!baseData) return -1;
+    fill_random(baseData, BASE_SIZE);
+
+    int r = run_serialize_test(baseData, operations);
+    printf("serialize: %s\n", r == 0 ? "ok" : "FAILED");
+    if (r == 0) {
+        r = run_commit_test(baseData, operations);
+        printf("commit: %s\n", r == 0 ? "ok" : "FAILED");
+    }
+
+    free(baseData);
+    return r;
+}
@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <mach-o/loader.h>
+#include <choma/FAT.h>
+#include <choma/MachO.h>
+#include <choma/CSBlob.h>
+#include <choma/CodeDirectory.h>
+#include <choma/AdhocSign.h>
+#include <choma/SignatureCache.h>
+
+#define TEST_IDENTIFIER "com.opa334.choma.signature-cache-test"
+
+// Signs a stripped copy of a MachO, stores the signature in a SignatureCache and applies it to another stripped copy
+// The result has to be identical to the signed file, keys of other parameters have to miss and eviction has to keep the cache below maxSize
+
+static uint8_t *read_file(const char *path, size_t *sizeOut)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size);
+    if (data && fread(data, 1, size, f) != size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    if (data) *sizeOut = size;
+    return data;
+}
+
+static int write_file(const char *path, const uint8_t *data, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    int r = fwrite(data, 1, size, f) == size ? 0 : -1;
+    fclose(f);
+    return r;
+}
+
+static bool files_match(const char *path, const char *otherPath)
+{
+    size_t size = 0, otherSize = 0;
+    uint8_t *data = read_file(path, &size);
+    uint8_t *otherData = read_file(otherPath, &otherSize);
+    bool match = data && otherData && size == otherSize && memcmp(data, otherData, size) == 0;
+    free(data);
+    free(otherData);
+    return match;
+}
+
+// Remove LC_CODE_SIGNATURE and the signature data at the end of __LINKEDIT, like codesign --remove-signature
+static int strip_code_signature(uint8_t *data, size_t *sizeInOut)
+{
+    struct mach_header_64 *header = (struct mach_header_64 *)data;
+    if (*sizeInOut < sizeof(*header) || header->magic != MH_MAGIC_64) {
+        printf("Error: input is not a thin 64-bit MachO\n");
+        return -1;
+    }
+
+    uint8_t *commands = data + sizeof(*header);
+    uint8_t *commandsEnd = commands + header->sizeofcmds;
+    struct linkedit_data_command *codeSignature = NULL;
+    struct segment_command_64 *linkedit = NULL;
+    for (uint8_t *cmd = commands; cmd < commandsEnd; cmd += ((struct load_command *)cmd)->cmdsize) {
+        struct load_command *lc = (struct load_command *)cmd;
+        if (lc->cmd == LC_CODE_SIGNATURE) {
+            codeSignature = (struct linkedit_data_command *)cmd;
+        }
+        else if (lc->cmd == LC_SEGMENT_64 && !strcmp(((struct segment_command_64 *)cmd)->segname, "__LINKEDIT")) {
+            linkedit = (struct segment_command_64 *)cmd;
+        }
+    }
+    if (!codeSignature || !linkedit) {
+        printf("Error: input MachO is not signed\n");
+        return -1;
+    }
+
+    uint32_t dataoff = codeSignature->dataoff;
+    linkedit->filesize = dataoff - linkedit->fileoff;
+    *sizeInOut = dataoff;
+
+    uint32_t cmdsize = codeSignature->cmdsize;
+    memmove(codeSignature, (uint8_t *)codeSignature + cmdsize, commandsEnd - ((uint8_t *)codeSignature + cmdsize));
+    memset(commandsEnd - cmdsize, 0, cmdsize);
+    header->ncmds--;
+    header->sizeofcmds -= cmdsize;
+    return 0;
+}
+
+static bool code_slots_valid(const char *path)
+{
+    bool valid = false;
+    FAT *fat = fat_init_from_path(path);
+    if (!fat) return false;
+    MachO *macho = fat->slicesCount ? fat->slices[0] : NULL;
+    CS_SuperBlob *superblob = macho ? macho_read_code_signature(macho) : NULL;
+    CS_DecodedSuperBlob *decodedSuperblob = superblob ? csd_superblob_decode(superblob) : NULL;
+    CS_DecodedBlob *codeDirBlob = decodedSuperblob ? csd_superblob_find_best_code_directory(decodedSuperblob) : NULL;
+    if (codeDirBlob) {
+        CS_CodeSlotVerification *verification = csd_code_directory_verify_all_code_slots(codeDirBlob, macho);
+        valid = verification && verification->invalidCount == 0;
+        if (verification) csd_code_slot_verification_free(verification);
+    }
+    if (decodedSuperblob) csd_superblob_free(decodedSuperblob);
+    free(superblob);
+    fat_free(fat);
+    return valid;
+}
+
+static int calculate_key(const char *path, const char *parameters, uint8_t keyOut[SIGNATURE_CACHE_KEY_SIZE])
+{
+    return signature_cache_calculate_key(path, parameters, strlen(parameters), keyOut);
+}
+
+static void remove_directory(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir) {
+        struct dirent *entry = NULL;
+        while ((entry = readdir(dir))) {
+            if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+            char entryPath[PATH_MAX];
+            snprintf(entryPath, sizeof(entryPath), "%s/%s", path, entry->d_name);
+            unlink(entryPath);
+        }
+        closedir(dir);
+    }
+    rmdir(path);
+}
+
+// A stored signature applied to the unsigned original has to reproduce the signed file, other parameters have to miss
+static int run_apply_test(const char *cacheDir, const char *unsignedPath, const char *signedPath, const char *targetPath, uint8_t *unsignedData, size_t unsignedSize)
+{
+    int r = -1;
+    SignatureCache *cache = signature_cache_open(cacheDir, UINT64_MAX);
+    if (!cache) return -1;
+
+    uint8_t key[SIGNATURE_CACHE_KEY_SIZE], otherKey[SIGNATURE_CACHE_KEY_SIZE];
+    if (calculate_key(unsignedPath, "entitlements-a", key) != 0 || calculate_key(unsignedPath, "entitlements-b", otherKey) != 0) goto out;
+    if (memcmp(key, otherKey, SIGNATURE_CACHE_KEY_SIZE) == 0) {
+        printf("Different parameters produced the same key\n");
+        goto out;
+    }
+    if (signature_cache_store(cache, key, signedPath) != 0) {
+        printf("Error: failed to store signature\n");
+        goto out;
+    }
+
+    if (write_file(targetPath, unsignedData, unsignedSize) != 0) goto out;
+    if (signature_cache_apply(cache, otherKey, targetPath) == 0) {
+        printf("Key mismatch was not a miss\n");
+        goto out;
+    }
+    if (!files_match(targetPath, unsignedPath)) {
+        printf("Target was modified by a miss\n");
+        goto out;
+    }
+
+    if (signature_cache_apply(cache, key, targetPath) != 0) {
+        printf("Error: failed to apply cached signature\n");
+        goto out;
+    }
+    if (!files_match(targetPath, signedPath)) {
+        printf("Applied signature does not match the signed file\n");
+        goto out;
+    }
+    if (!code_slots_valid(targetPath)) {
+        printf("Applied signature has invalid code slots\n");
+        goto out;
+    }
+
+    SignatureCacheStats stats;
+    signature_cache_get_stats(cache, &stats);
+    if (stats.hits != 1 || stats.misses != 1 || stats.stores != 1 || stats.entryCount != 1) {
+        printf("Unexpected stats: %llu hits, %llu misses, %llu stores, %u entries\n", stats.hits, stats.misses, stats.stores, stats.entryCount);
+        goto out;
+    }
+    r = 0;
+
+out:
+    signature_cache_close(cache);
+    return r;
+}
+
+// With room for two entries, storing a third one has to evict the least recently used one, also after reopening the cache
+static int run_eviction_test(const char *cacheDir, const char *unsignedPath, const char *signedPath, const char *targetPath, uint8_t *unsignedData, size_t unsignedSize)
+{
+    int r = -1;
+    uint8_t keys[3][SIGNATURE_CACHE_KEY_SIZE];
+    const char *parameters[3] = { "eviction-1", "eviction-2", "eviction-3" };
+    for (int i = 0; i < 3; i++) {
+        if (calculate_key(unsignedPath, parameters[i], keys[i]) != 0) return -1;
+    }
+
+    // Measure the size of one entry first
+    SignatureCache *cache = signature_cache_open(cacheDir, UINT64_MAX);
+    if (!cache) return -1;
+    SignatureCacheStats stats;
+    bool stored = signature_cache_store(cache, keys[0], signedPath) == 0;
+    signature_cache_get_stats(cache, &stats);
+    signature_cache_close(cache);
+    if (!stored) return -1;
+    uint64_t maxSize = (stats.totalSize * 2) + (stats.totalSize / 2);
+
+    cache = signature_cache_open(cacheDir, maxSize);
+    if (!cache) return -1;
+    if (signature_cache_store(cache, keys[1], signedPath) != 0) goto out;
+
+    // Using the first entry makes the second one the least recently used
+    if (write_file(targetPath, unsignedData, unsignedSize) != 0 || signature_cache_apply(cache, keys[0], targetPath) != 0) {
+        printf("Error: failed to apply first entry\n");
+        goto out;
+    }
+    if (signature_cache_store(cache, keys[2], signedPath) != 0) goto out;
+
+    signature_cache_get_stats(cache, &stats);
+    if (stats.evictions != 1 || stats.entryCount != 2 || stats.totalSize > maxSize) {
+        printf("Unexpected stats after eviction: %llu evictions, %u entries, 0x%llx of 0x%llx bytes\n", stats.evictions, stats.entryCount, stats.totalSize, maxSize);
+        goto out;
+    }
+    for (int i = 0; i < 3; i++) {
+        bool expectHit = i != 1;
+        if (write_file(targetPath, unsignedData, unsignedSize) != 0) goto out;
+        if ((signature_cache_apply(cache, keys[i], targetPath) == 0) != expectHit) {
+            printf("Entry %d should %s\n", i + 1, expectHit ? "have been kept" : "have been evicted");
+            goto out;
+        }
+    }
+    signature_cache_close(cache);
+
+    // The index is rebuilt from the directory
+    cache = signature_cache_open(cacheDir, maxSize);
+    if (!cache) return -1;
+    signature_cache_get_stats(cache, &stats);
+    if (stats.entryCount != 2 || stats.totalSize > maxSize) {
+        printf("Unexpected stats after reopening: %u entries, 0x%llx of 0x%llx bytes\n", stats.entryCount, stats.totalSize, maxSize);
+        goto out;
+    }
+    r = 0;
+
+out:
+    signature_cache_close(cache);
+    return r;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: signature_cache <path to signed thin MachO>\n");
+        return -1;
+    }
+
+    size_t size = 0;
+    uint8_t *data = read_file(argv[1], &size);
+    if (!data) {
+        printf("Error: failed to read %s\n", argv[1]);
+        return -1;
+    }
+    if (strip_code_signature(data, &size) != 0) {
+        free(data);
+        return -1;
+    }
+
+    char workDir[] = "/tmp/signature_cache_XXXXXX";
+    if (!mkdtemp(workDir)) {
+        printf("Error: failed to create temporary directory\n");
+        free(data);
+        return -1;
+    }
+    char unsignedPath[PATH_MAX], signedPath[PATH_MAX], targetPath[PATH_MAX], applyCacheDir[PATH_MAX], evictionCacheDir[PATH_MAX];
+    snprintf(unsignedPath, sizeof(unsignedPath), "%s/unsigned", workDir);
+    snprintf(signedPath, sizeof(signedPath), "%s/signed", workDir);
+    snprintf(targetPath, sizeof(targetPath), "%s/target", workDir);
+    snprintf(applyCacheDir, sizeof(applyCacheDir), "%s/apply_cache", workDir);
+    snprintf(evictionCacheDir, sizeof(evictionCacheDir), "%s/eviction_cache", workDir);
+
+    int r = -1;
+    if (write_file(unsignedPath, data, size) == 0 && write_file(signedPath, data, size) == 0) {
+        r = adhoc_sign_file(signedPath, TEST_IDENTIFIER, NULL, 0, 0);
+        if (r != 0) printf("Error: failed to sign %s\n", signedPath);
+    }
+
+    if (r == 0) {
+        r = run_apply_test(applyCacheDir, unsignedPath, signedPath, targetPath, data, size);
+        printf("apply: %s\n", r == 0 ? "ok" : "FAILED");
+    }
+    if (r == 0) {
+        r = run_eviction_test(evictionCacheDir, unsignedPath, signedPath, targetPath, data, size);
+        printf("eviction: %s\n", r == 0 ? "ok" : "FAILED");
+    }
+
+    remove_directory(applyCacheDir);
+    remove_directory(evictionCacheDir);
+    remove_directory(workDir);
+    free(data);
+    return r;
+}